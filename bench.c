@@ -0,0 +1,2095 @@
+/*
+ * bench.c - Headless Generation Benchmarks Implementation
+ */
+
+#include "bench.h"
+#include "cave.h"
+#include "texcache.h"
+#include "world.h"
+#include "voxmesh.h"
+#include "frustum.h"
+#include "lighting.h"
+#include "svo.h"
+#include "cavefile.h"
+#include "poisson.h"
+#include "rng.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+double bench_now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Stand-in for the rest of a frame while background work runs
+static void bench_sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+// Compare the scalar and bit-sliced smoothing engines on the same input
+static int bench_smoothing(int width, int height, int depth) {
+    Cave* scalar = create_cave(width, height, depth);
+    Cave* bitsliced = create_cave(width, height, depth);
+    scalar->seed = 1234;
+    fill_cave_noise(scalar);
+    memcpy(bitsliced->voxels, scalar->voxels, scalar->voxel_count);
+    
+    double start = bench_now_ms();
+    smooth_cave_scalar(scalar, SMOOTHING_ITERATIONS);
+    double scalar_ms = bench_now_ms() - start;
+    
+    start = bench_now_ms();
+    smooth_cave_bitsliced(bitsliced, SMOOTHING_ITERATIONS);
+    double bitsliced_ms = bench_now_ms() - start;
+    
+    int identical = memcmp(scalar->voxels, bitsliced->voxels, scalar->voxel_count) == 0;
+    
+    printf("smooth %dx%dx%d (%d passes): scalar %.2f ms, bit-sliced %.2f ms (%.1fx)%s\n",
+           width, height, depth, SMOOTHING_ITERATIONS, scalar_ms, bitsliced_ms,
+           scalar_ms / bitsliced_ms, identical ? "" : "  MISMATCH");
+    
+    free_cave(scalar);
+    free_cave(bitsliced);
+    return identical;
+}
+
+// Batched vs scalar fractal noise, then the three noise textures end to end
+static int bench_noise(int size) {
+    int n = size * size;
+    float* xs = (float*)malloc(n * 3 * sizeof(float));
+    float* ys = xs + n;
+    float* zs = ys + n;
+    float* scalar = (float*)malloc(n * 2 * sizeof(float));
+    float* batch = scalar + n;
+    
+    for (int i = 0; i < n; i++) {
+        xs[i] = (i % size) * 0.01f;
+        ys[i] = (i / size) * 0.01f;
+        zs[i] = 0.0f;
+    }
+    
+    double start = bench_now_ms();
+    for (int i = 0; i < n; i++) {
+        scalar[i] = fractal_noise_3d(xs[i], ys[i], zs[i], 5, 0.5f);
+    }
+    double scalar_ms = bench_now_ms() - start;
+    
+    start = bench_now_ms();
+    fractal_noise_3d_batch(xs, ys, zs, batch, n, 5, 0.5f);
+    double batch_ms = bench_now_ms() - start;
+    
+    float max_error = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float error = fabsf(scalar[i] - batch[i]);
+        if (error > max_error) max_error = error;
+    }
+    int ok = max_error < 1e-4f;
+    
+    printf("noise %dx%d (5 octaves): scalar %.2f ms, %s %.2f ms (%.1fx), max error %.2g%s\n",
+           size, size, scalar_ms, noise_batch_isa(), batch_ms, scalar_ms / batch_ms,
+           max_error, ok ? "" : "  MISMATCH");
+    
+    free(xs);
+    free(scalar);
+    return ok;
+}
+
+// Synthesizing the cacheable textures vs reading them back from the cache
+static int bench_textures(int size) {
+    static const struct {
+        const char* name;
+        int channels;
+        void (*fill)(float* data, int width, int height);
+    } textures[] = {
+        { "bench-rock", 3, fill_rock_texture },
+        { "bench-roughness", 1, fill_roughness_texture },
+        { "bench-ao", 1, fill_ao_texture }
+    };
+    int count = (int)(sizeof(textures) / sizeof(textures[0]));
+    float* data[3];
+    float param = (float)size;
+    int ok = 1;
+    
+    double start = bench_now_ms();
+    for (int i = 0; i < count; i++) {
+        data[i] = (float*)malloc((size_t)size * size * textures[i].channels * sizeof(float));
+        textures[i].fill(data[i], size, size);
+    }
+    double synth_ms = bench_now_ms() - start;
+    
+    if (!texture_cache_enabled()) {
+        printf("textures %dx%d (rock, roughness, ao): synthesized %.2f ms, cache disabled\n",
+               size, size, synth_ms);
+    } else {
+        for (int i = 0; i < count; i++) {
+            TextureKey key = { textures[i].name, &param, 1, size, size, textures[i].channels };
+            texture_cache_store(&key, data[i]);
+        }
+        
+        // Reading every texel stands in for the upload a real launch does
+        float* upload = (float*)malloc((size_t)size * size * 3 * sizeof(float));
+        start = bench_now_ms();
+        for (int i = 0; i < count; i++) {
+            TextureKey key = { textures[i].name, &param, 1, size, size, textures[i].channels };
+            TextureCacheEntry entry;
+            size_t bytes = (size_t)size * size * textures[i].channels * sizeof(float);
+            if (!texture_cache_open(&key, &entry)) {
+                ok = 0;
+                continue;
+            }
+            memcpy(upload, entry.data, bytes);
+            ok &= memcmp(upload, data[i], bytes) == 0;
+            texture_cache_close(&entry);
+            texture_cache_remove(&key);
+        }
+        double cached_ms = bench_now_ms() - start;
+        free(upload);
+        
+        printf("textures %dx%d (rock, roughness, ao): synthesized %.2f ms, cached %.2f ms%s\n",
+               size, size, synth_ms, cached_ms, ok ? "" : "  MISMATCH");
+    }
+    
+    for (int i = 0; i < count; i++) {
+        free(data[i]);
+    }
+    return ok;
+}
+
+// Half float bits back to a float, for checking packed texels
+static float bench_half_to_float(uint16_t half) {
+    int exponent = (half >> 10) & 0x1F;
+    float mantissa = (float)(half & 0x3FF);
+    float value = exponent == 0 ? ldexpf(mantissa, -24) : ldexpf(mantissa + 1024.0f, exponent - 25);
+    return half & 0x8000 ? -value : value;
+}
+
+// Largest difference between level 0 of a chain and the floats it came from
+static float mip_level0_error(const TextureMipChain* chain, const float* data, int texels, int channels) {
+    const TextureFormat* f = chain->format;
+    float worst = 0.0f;
+    
+    for (int i = 0; i < texels; i++) {
+        const unsigned char* texel = (const unsigned char*)chain->levels[0] + (size_t)i * f->texel_bytes;
+        for (int k = 0; k < channels && k < 3; k++) {
+            float expected = data[i * channels + k], found;
+            if (f->type == GL_UNSIGNED_BYTE) {
+                found = texel[k] / 255.0f;
+                expected = fmaxf(0.0f, fminf(1.0f, expected));
+            } else if (f->type == GL_HALF_FLOAT) {
+                uint16_t half;
+                memcpy(&half, texel + 2 * k, sizeof(half));
+                found = bench_half_to_float(half);
+                expected = expected / fmaxf(1.0f, fabsf(expected));
+                found = found / fmaxf(1.0f, fabsf(data[i * channels + k]));
+            } else {
+                uint32_t packed;
+                memcpy(&packed, texel, sizeof(packed));
+                found = ((packed >> (10 * k)) & 0x3FF) / 1023.0f;
+            }
+            worst = fmaxf(worst, fabsf(found - expected));
+        }
+    }
+    return worst;
+}
+
+// Compact formats with CPU mips against the old 32-bit float textures
+static int bench_texture_formats(int size) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    float* rock = (float*)malloc((size_t)size * size * 5 * sizeof(float));
+    float* roughness = rock + (size_t)size * size * 3;
+    float* ao = roughness + (size_t)size * size;
+    fill_rock_texture(rock, size, size);
+    fill_roughness_texture(roughness, size, size);
+    fill_ao_texture(ao, size, size);
+    
+    const struct {
+        const char* name;
+        const float* data;
+        int width, height, channels;
+        TextureUsage usage;
+        float tolerance;
+    } textures[] = {
+        { "rock", rock, size, size, 3, TEXTURE_ALBEDO, 0.5f / 255.0f },
+        { "roughness", roughness, size, size, 1, TEXTURE_MASK, 0.5f / 255.0f },
+        { "ao", ao, size, size, 1, TEXTURE_MASK, 0.5f / 255.0f },
+        { "height", cave->height_map, cave->width, cave->height, 1, TEXTURE_HEIGHT, 1.0f / 2048.0f },
+        { "normal", cave->normal_map, cave->width, cave->height, 3, TEXTURE_NORMAL, 0.5f / 1023.0f }
+    };
+    int count = (int)(sizeof(textures) / sizeof(textures[0]));
+    size_t float_bytes = 0, packed_bytes = 0;
+    double build_ms = 0.0;
+    int ok = 1;
+    
+    for (int i = 0; i < count; i++) {
+        TextureMipChain chain;
+        double start = bench_now_ms();
+        build_texture_mip_chain(&chain, textures[i].data, textures[i].width, textures[i].height,
+                                textures[i].channels, textures[i].usage, NULL);
+        build_ms += bench_now_ms() - start;
+        
+        // The old path stored RGB32F or R32F and had the driver build the same chain
+        for (int level = 0; level < chain.level_count; level++) {
+            float_bytes += (size_t)chain.widths[level] * chain.heights[level] *
+                           (textures[i].channels == 1 ? 1 : 3) * sizeof(float);
+        }
+        packed_bytes += chain.total_bytes;
+        
+        int texels = textures[i].width * textures[i].height;
+        float error = mip_level0_error(&chain, textures[i].data, texels, textures[i].channels);
+        int last = chain.level_count - 1;
+        int chain_ok = error <= textures[i].tolerance + 1e-6f && chain.widths[last] == 1 && chain.heights[last] == 1;
+        if (!chain_ok) {
+            printf("  %s: level 0 error %.2e, %d levels  MISMATCH\n", textures[i].name, error, chain.level_count);
+        }
+        ok &= chain_ok;
+        free_texture_mip_chain(&chain);
+    }
+    
+    printf("texture formats (%dx%d rock, roughness, ao; %dx%d height, normal): %.2f MB as 32-bit floats, "
+           "%.2f MB packed (%.1fx smaller), mips built in %.2f ms%s\n",
+           size, size, cave->width, cave->height, float_bytes / 1048576.0, packed_bytes / 1048576.0,
+           (double)float_bytes / packed_bytes, build_ms, ok ? "" : "  MISMATCH");
+    
+    free(rock);
+    free_cave(cave);
+    return ok;
+}
+
+// Height and normal maps the way they used to be built: one thread, each
+// column walked along z, normals one texel at a time
+static void reference_surface_maps(Cave* cave, float* heights, float* normals) {
+    float* noise = (float*)malloc(cave->width * 2 * sizeof(float));
+    float* detail = noise + cave->width;
+    
+    for (int y = 0; y < cave->height; y++) {
+        fractal_noise_row(noise, cave->width, 0, cave->width, y, 0.1f, 0.0f, 4, 0.5f);
+        fractal_noise_row(detail, cave->width, 0, cave->width, y, 0.5f, 0.0f, 2, 0.3f);
+        for (int x = 0; x < cave->width; x++) {
+            float base_height = 0.0f;
+            for (int z = 0; z < cave->depth; z++) {
+                if (cave_get(cave, x, y, z) == VOXEL_AIR) {
+                    base_height += 0.02f;
+                }
+            }
+            heights[y * cave->width + x] = base_height + noise[x] * 0.3f + detail[x] * 0.1f;
+        }
+    }
+    free(noise);
+    
+    for (int y = 1; y < cave->height - 1; y++) {
+        for (int x = 1; x < cave->width - 1; x++) {
+            float dx = (heights[y * cave->width + x + 1] - heights[y * cave->width + x - 1]) * 2.0f;
+            float dy = (heights[(y + 1) * cave->width + x] - heights[(y - 1) * cave->width + x]) * 2.0f;
+            float dz = 1.0f;
+            float len = sqrt(dx * dx + dy * dy + dz * dz);
+            float* n = &normals[(y * cave->width + x) * 3];
+            n[0] = dx / len * 0.5f + 0.5f;
+            n[1] = dy / len * 0.5f + 0.5f;
+            n[2] = dz / len * 0.5f + 0.5f;
+        }
+    }
+}
+
+// Slab-wise column scan and SIMD normals against the reference, on the same voxels
+static int bench_surface_maps(int width, int height, int depth) {
+    Cave* cave = create_cave(width, height, depth);
+    cave->seed = 1234;
+    fill_cave_noise(cave);
+    
+    size_t texels = (size_t)width * height;
+    float* heights = (float*)malloc(texels * 4 * sizeof(float));
+    float* normals = heights + texels;
+    memcpy(normals, cave->normal_map, texels * 3 * sizeof(float));
+    
+    double start = bench_now_ms();
+    reference_surface_maps(cave, heights, normals);
+    double reference_ms = bench_now_ms() - start;
+    
+    start = bench_now_ms();
+    generate_height_map(cave);
+    double height_ms = bench_now_ms() - start;
+    start = bench_now_ms();
+    generate_normal_map(cave);
+    double normal_ms = bench_now_ms() - start;
+    
+    int ok = memcmp(heights, cave->height_map, texels * sizeof(float)) == 0 &&
+             memcmp(normals, cave->normal_map, texels * 3 * sizeof(float)) == 0;
+    
+    printf("surface maps %dx%d (%d deep): reference %.2f ms, height %.2f ms + normals %.2f ms (%.1fx)%s\n",
+           width, height, depth, reference_ms, height_ms, normal_ms, reference_ms / (height_ms + normal_ms),
+           ok ? "" : "  MISMATCH");
+    
+    free(heights);
+    free_cave(cave);
+    return ok;
+}
+
+// Per-voxel reference carvers, the way carving used to work
+static void reference_sphere(Cave* cave, int cx, int cy, int cz, int radius) {
+    for (int z = cz - radius; z <= cz + radius; z++) {
+        for (int y = cy - radius; y <= cy + radius; y++) {
+            for (int x = cx - radius; x <= cx + radius; x++) {
+                if (x > 0 && x < cave->width - 1 && y > 0 && y < cave->height - 1 &&
+                    z > 0 && z < cave->depth - 1 &&
+                    sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy) + (z - cz) * (z - cz)) <= radius) {
+                    cave_set(cave, x, y, z, VOXEL_AIR);
+                }
+            }
+        }
+    }
+}
+
+static void reference_capsule(Cave* cave, const float a[3], const float b[3], float radius) {
+    double d[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+    double length2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    int r = (int)ceil(radius);
+    
+    for (int z = (int)fmin(a[2], b[2]) - r; z <= (int)fmax(a[2], b[2]) + r; z++) {
+        for (int y = (int)fmin(a[1], b[1]) - r; y <= (int)fmax(a[1], b[1]) + r; y++) {
+            for (int x = (int)fmin(a[0], b[0]) - r; x <= (int)fmax(a[0], b[0]) + r; x++) {
+                if (x < 1 || x > cave->width - 2 || y < 1 || y > cave->height - 2 ||
+                    z < 1 || z > cave->depth - 2) continue;
+                double q[3] = { x - a[0], y - a[1], z - a[2] };
+                double t = length2 > 0.0 ? (q[0] * d[0] + q[1] * d[1] + q[2] * d[2]) / length2 : 0.0;
+                t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+                double e[3] = { q[0] - t * d[0], q[1] - t * d[1], q[2] - t * d[2] };
+                if (e[0] * e[0] + e[1] * e[1] + e[2] * e[2] <= (double)radius * radius) {
+                    cave_set(cave, x, y, z, VOXEL_AIR);
+                }
+            }
+        }
+    }
+}
+
+static void fill_solid(Cave* cave) {
+    for (int z = 0; z < cave->depth; z++) {
+        for (int y = 0; y < cave->height; y++) {
+            memset(&cave->voxels[cave_index(cave, 0, y, z)], VOXEL_WALL, cave->width);
+        }
+    }
+}
+
+// Span-table spheres and capsule sweeps against per-voxel references, on
+// tunnel walks like carve_cave_interior's but many more of them
+static int bench_carving(int size, int tunnels, int steps) {
+    Cave* fast = create_cave(size, size, size);
+    Cave* reference = create_cave(size, size, size);
+    const int lo[3] = { 1, 1, 1 };
+    const int hi[3] = { size - 2, size - 2, size - 2 };
+    double fast_ms = 0.0, reference_ms = 0.0;
+    int ok = 1;
+    
+    // Stamped spheres of every radius the stamp table covers
+    fill_solid(fast);
+    fill_solid(reference);
+    for (int r = 0; r <= 32; r++) {
+        int c = size / 2 + (r % 5) - 2;
+        carve_sphere(fast, c, c + r % 3, c - r % 7, r, lo, hi);
+        reference_sphere(reference, c, c + r % 3, c - r % 7, r);
+        ok &= memcmp(fast->voxels, reference->voxels, fast->voxel_count) == 0;
+    }
+    
+    fill_solid(fast);
+    fill_solid(reference);
+    for (int pass = 0; pass < 2; pass++) {
+        Cave* cave = pass == 0 ? fast : reference;
+        double start = bench_now_ms();
+        
+        for (int t = 0; t < tunnels; t++) {
+            Rng rng = rng_stream(99, RNG_STREAM_TUNNEL, t);
+            float angle_h = rng_int(&rng, 360) * (float)M_PI / 180.0f;
+            float angle_v = (rng_int(&rng, 60) - 30) * (float)M_PI / 180.0f;
+            float pos[3] = { size * 0.5f, size * 0.5f, size * 0.5f };
+            float prev[3] = { pos[0], pos[1], pos[2] };
+            
+            for (int i = 0; i < steps; i++) {
+                int radius = 3 + rng_int(&rng, 2);
+                if (pass == 0) {
+                    carve_capsule(cave, prev, pos, (float)radius, lo, hi);
+                } else {
+                    reference_capsule(cave, prev, pos, (float)radius);
+                }
+                memcpy(prev, pos, sizeof(pos));
+                pos[0] += cosf(angle_h) * cosf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.5f;
+                pos[1] += sinf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.3f;
+                pos[2] += sinf(angle_h) * cosf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.5f;
+                angle_h += (rng_int(&rng, 40) - 20) * (float)M_PI / 180.0f * 0.1f;
+                angle_v += (rng_int(&rng, 20) - 10) * (float)M_PI / 180.0f * 0.1f;
+            }
+        }
+        
+        if (pass == 0) fast_ms = bench_now_ms() - start;
+        else reference_ms = bench_now_ms() - start;
+    }
+    
+    size_t differing = 0;
+    for (size_t i = 0; i < fast->voxel_count; i++) {
+        differing += fast->voxels[i] != reference->voxels[i];
+    }
+    ok &= differing == 0;
+    
+    printf("carve %d tunnels x %d steps in %d^3: per-voxel %.2f ms, capsule spans %.2f ms (%.1fx)%s\n",
+           tunnels, steps, size, reference_ms, fast_ms, reference_ms / fast_ms,
+           ok ? "" : "  MISMATCH");
+    if (differing) printf("  %zu voxels differ\n", differing);
+    
+    free_cave(fast);
+    free_cave(reference);
+    return ok;
+}
+
+// Mark the faces a mesh covers in one byte per voxel and direction (bit
+// 2 * axis + (sign > 0)); 0 if two quads overlap
+static int rasterize_voxel_mesh(const VoxelMeshData* data, const Cave* cave, unsigned char* faces,
+                                const float origin[3], const float scale[3]) {
+    for (int q = 0; q < data->vertex_count; q += 4) {
+        const VoxelVertex* quad = &data->vertices[q];
+        int axis = quad[0].normal[0] ? 0 : quad[0].normal[1] ? 1 : 2;
+        int sign = quad[0].normal[axis] > 0 ? 1 : -1;
+        int lo[3], hi[3];
+        
+        for (int i = 0; i < 3; i++) {
+            float a = quad[0].position[i], b = quad[0].position[i];
+            for (int c = 1; c < 4; c++) {
+                if (quad[c].position[i] < a) a = quad[c].position[i];
+                if (quad[c].position[i] > b) b = quad[c].position[i];
+            }
+            if (i == axis) {
+                lo[i] = hi[i] = (int)lroundf((a - origin[i]) / scale[i] - 0.5f * sign);
+            } else {
+                lo[i] = (int)lroundf((a - origin[i]) / scale[i] + 0.5f);
+                hi[i] = (int)lroundf((b - origin[i]) / scale[i] - 0.5f);
+            }
+        }
+        
+        unsigned char bit = (unsigned char)(1 << (2 * axis + (sign > 0)));
+        for (int z = lo[2]; z <= hi[2]; z++) {
+            for (int y = lo[1]; y <= hi[1]; y++) {
+                for (int x = lo[0]; x <= hi[0]; x++) {
+                    unsigned char* f = &faces[cave_index(cave, x, y, z)];
+                    if (*f & bit) return 0;
+                    *f |= bit;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// Greedy meshing of the generated cave: the quads have to cover exactly the
+// wall faces that touch air, each once
+static int bench_meshing(void) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    const int lo[3] = { 0, 0, 0 };
+    const int hi[3] = { cave->width - 1, cave->height - 1, cave->depth - 1 };
+    const float origin[3] = { -5.0f, -5.0f, -5.0f };
+    const float scale[3] = { 10.0f / cave->width, 10.0f / cave->height, 10.0f / cave->depth };
+    VoxelMeshData data;
+    memset(&data, 0, sizeof(data));
+    
+    double start = bench_now_ms();
+    build_voxel_mesh(&data, cave, lo, hi, origin, scale);
+    double mesh_ms = bench_now_ms() - start;
+    
+    unsigned char* faces = (unsigned char*)calloc(cave->voxel_count, 1);
+    int ok = rasterize_voxel_mesh(&data, cave, faces, origin, scale);
+    
+    const ptrdiff_t steps[3] = { 1, cave->stride_y, cave->stride_z };
+    long naive = 0;
+    for (int z = 0; z < cave->depth && ok; z++) {
+        for (int y = 0; y < cave->height; y++) {
+            for (int x = 0; x < cave->width; x++) {
+                size_t i = cave_index(cave, x, y, z);
+                unsigned char expected = 0;
+                for (int d = 0; d < 6; d++) {
+                    ptrdiff_t step = (d & 1) ? steps[d >> 1] : -steps[d >> 1];
+                    if (cave->voxels[i] == VOXEL_WALL && cave->voxels[i + step] == VOXEL_AIR) {
+                        expected |= (unsigned char)(1 << d);
+                        naive++;
+                    }
+                }
+                ok &= faces[i] == expected;
+            }
+        }
+    }
+    
+    ok &= naive == data.face_count;
+    int quads = data.index_count / 6;
+    printf("mesh %dx%dx%d: %ld faces -> %d quads (%.1fx fewer), %.1f KB, %.2f ms%s\n",
+           cave->width, cave->height, cave->depth, naive, quads, (double)naive / quads,
+           data.vertex_count * sizeof(VoxelVertex) / 1024.0 + data.index_count * sizeof(unsigned int) / 1024.0,
+           mesh_ms, ok ? "" : "  MISMATCH");
+    
+    free(faces);
+    free_voxel_mesh_data(&data);
+    free_cave(cave);
+    return ok;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 1 if every directed edge of the mesh is matched by exactly one reverse
+// edge: the surface is closed and consistently wound
+static int smooth_mesh_closed(const VoxelMeshData* data) {
+    uint64_t* edges = (uint64_t*)malloc(data->index_count * sizeof(uint64_t));
+    for (int t = 0; t < data->index_count; t += 3) {
+        for (int e = 0; e < 3; e++) {
+            uint64_t a = data->indices[t + e], b = data->indices[t + (e + 1) % 3];
+            edges[t + e] = a << 32 | b;
+        }
+    }
+    qsort(edges, data->index_count, sizeof(uint64_t), compare_u64);
+    
+    int ok = 1;
+    for (int i = 0; i < data->index_count && ok; i++) {
+        uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+        ok = (i + 1 == data->index_count || edges[i + 1] != edges[i]) &&
+             bsearch(&reverse, edges, data->index_count, sizeof(uint64_t), compare_u64) != NULL;
+    }
+    free(edges);
+    return ok;
+}
+
+static int compare_positions(const void* a, const void* b) {
+    const float* p = (const float*)a;
+    const float* q = (const float*)b;
+    for (int i = 0; i < 3; i++) {
+        if (p[i] != q[i]) return p[i] < q[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// Vertices of a mesh on the plane x = plane, sorted; returns how many
+static int plane_vertices(const VoxelMeshData* data, float plane, float* out) {
+    int count = 0;
+    for (int i = 0; i < data->vertex_count; i++) {
+        if (fabsf(data->vertices[i].position[0] - plane) < 1e-4f) {
+            memcpy(&out[3 * count++], data->vertices[i].position, 3 * sizeof(float));
+        }
+    }
+    qsort(out, count, 3 * sizeof(float), compare_positions);
+    return count;
+}
+
+// Smooth walls: the case table must give closed surfaces, neighbouring
+// chunks must meet exactly, and the triangle count should beat the faces
+static int bench_smooth_meshing(int chunks) {
+    VoxelMeshData blocky, smooth, neighbour;
+    memset(&blocky, 0, sizeof(blocky));
+    memset(&smooth, 0, sizeof(smooth));
+    memset(&neighbour, 0, sizeof(neighbour));
+    int ok = 1;
+    
+    // Caverns sealed inside rock, with and without relief noise
+    Cave* cave = create_cave(64, 64, 64);
+    const int box_lo[3] = { 1, 1, 1 };
+    const int box_hi[3] = { 62, 62, 62 };
+    const float a[3] = { 12.0f, 20.0f, 15.0f }, b[3] = { 50.0f, 40.0f, 44.0f };
+    const float unit[3] = { 1.0f, 1.0f, 1.0f };
+    const float zero[3] = { 0.0f, 0.0f, 0.0f };
+    const int all_lo[3] = { 0, 0, 0 };
+    const int all_hi[3] = { 63, 63, 63 };
+    fill_solid(cave);
+    carve_sphere(cave, 20, 20, 20, 9, box_lo, box_hi);
+    carve_sphere(cave, 44, 40, 30, 13, box_lo, box_hi);
+    carve_capsule(cave, a, b, 3.5f, box_lo, box_hi);
+    for (int cell = 1; cell <= 2; cell++) {
+        for (int noisy = 0; noisy < 2; noisy++) {
+            build_smooth_mesh(&smooth, cave, all_lo, all_hi, zero, unit, cell, noisy ? SMOOTH_ROUGHNESS : 0.0f);
+            ok &= smooth.index_count > 0 && smooth_mesh_closed(&smooth);
+        }
+    }
+    free_cave(cave);
+    
+    // World chunks, and the seam between the first one and its +x neighbour
+    const uint64_t seed = 1234;
+    Cave* scratch = create_cave(CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE);
+    Cave* chunk = create_cave(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+    const int lo[3] = { 0, 0, 0 };
+    const int hi[3] = { CHUNK_SIZE - 1, CHUNK_SIZE - 1, CHUNK_SIZE - 1 };
+    const float scale[3] = { WORLD_VOXEL_SIZE, WORLD_VOXEL_SIZE, WORLD_VOXEL_SIZE };
+    double blocky_ms = 0.0, smooth_ms = 0.0;
+    long faces = 0, blocky_triangles = 0, smooth_triangles = 0;
+    
+    for (int i = 0; i < chunks; i++) {
+        const float origin[3] = { i * CHUNK_SIZE * WORLD_VOXEL_SIZE, 0.0f, 0.0f };
+        generate_world_chunk(chunk, scratch, seed, i, 0, 0);
+        
+        double start = bench_now_ms();
+        build_voxel_mesh(&blocky, chunk, lo, hi, origin, scale);
+        blocky_ms += bench_now_ms() - start;
+        
+        start = bench_now_ms();
+        build_smooth_mesh(i == 0 ? &smooth : &neighbour, chunk, lo, hi, origin, scale,
+                          SMOOTH_CELL_SIZE, SMOOTH_ROUGHNESS);
+        smooth_ms += bench_now_ms() - start;
+        
+        faces += blocky.face_count;
+        blocky_triangles += blocky.index_count / 3;
+        smooth_triangles += (i == 0 ? smooth.index_count : neighbour.index_count) / 3;
+        
+        if (i == 1) {
+            float plane = (CHUNK_SIZE - 0.5f) * WORLD_VOXEL_SIZE;
+            float* p = (float*)malloc(smooth.vertex_count * 3 * sizeof(float));
+            float* q = (float*)malloc(neighbour.vertex_count * 3 * sizeof(float));
+            int np = plane_vertices(&smooth, plane, p);
+            int nq = plane_vertices(&neighbour, plane, q);
+            int seam = np == nq;
+            for (int v = 0; v < 3 * np && seam; v++) {
+                seam = fabsf(p[v] - q[v]) < 1e-4f;
+            }
+            ok &= seam;
+            free(p);
+            free(q);
+        }
+    }
+    
+    printf("smooth walls per %d^3 chunk: %ld faces, greedy %ld tris in %.2f ms, "
+           "marching cubes %ld tris in %.2f ms (%.1fx fewer than faces)%s\n",
+           CHUNK_SIZE, faces / chunks, blocky_triangles / chunks, blocky_ms / chunks,
+           smooth_triangles / chunks, smooth_ms / chunks, 2.0 * faces / smooth_triangles,
+           ok ? "" : "  MISMATCH");
+    
+    free_voxel_mesh_data(&blocky);
+    free_voxel_mesh_data(&smooth);
+    free_voxel_mesh_data(&neighbour);
+    free_cave(chunk);
+    free_cave(scratch);
+    return ok;
+}
+
+// Runtime digs: each edit carves, refreshes the maps and their mips under it
+// and remeshes the chunks it touches. Afterwards everything must match a full
+// rebuild.
+static int bench_digging(int digs) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    int chunks[3] = {
+        (cave->width + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->height + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->depth + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE
+    };
+    int count = chunks[0] * chunks[1] * chunks[2];
+    VoxelMeshData* meshes = (VoxelMeshData*)calloc(count, sizeof(VoxelMeshData));
+    for (int i = 0; i < count; i++) {
+        mesh_interior_chunk(&meshes[i], cave, i % chunks[0], i / chunks[0] % chunks[1], i / (chunks[0] * chunks[1]));
+    }
+    
+    // Mip levels of the height and normal textures, patched the way update_cave_mesh does
+    TextureMipChain chain;
+    TextureMipFloats height_mips, normal_mips;
+    build_texture_mip_chain(&chain, cave->height_map, cave->width, cave->height, 1, TEXTURE_HEIGHT, &height_mips);
+    free_texture_mip_chain(&chain);
+    build_texture_mip_chain(&chain, cave->normal_map, cave->width, cave->height, 3, TEXTURE_NORMAL, &normal_mips);
+    free_texture_mip_chain(&chain);
+    
+    double total_ms = 0.0, worst_ms = 0.0;
+    int remeshed = 0;
+    for (int d = 0; d < digs; d++) {
+        Rng rng = rng_stream(1234, RNG_STREAM_TUNNEL, 1000 + d);
+        int x = 1 + rng_int(&rng, cave->width - 2);
+        int y = 1 + rng_int(&rng, cave->height - 2);
+        int z = 1 + rng_int(&rng, cave->depth - 2);
+        
+        double start = bench_now_ms();
+        cave_carve_sphere(cave, x, y, z, 3);
+        if (cave->dirty) {
+            // The chunks mark_interior_mesh_dirty picks
+            int lo[3], hi[3];
+            for (int i = 0; i < 3; i++) {
+                lo[i] = cave->dirty_lo[i] - 1 < 0 ? 0 : (cave->dirty_lo[i] - 1) / INTERIOR_CHUNK_SIZE;
+                hi[i] = (cave->dirty_hi[i] + 1) / INTERIOR_CHUNK_SIZE;
+                if (hi[i] >= chunks[i]) hi[i] = chunks[i] - 1;
+            }
+            for (int cz = lo[2]; cz <= hi[2]; cz++) {
+                for (int cy = lo[1]; cy <= hi[1]; cy++) {
+                    for (int cx = lo[0]; cx <= hi[0]; cx++) {
+                        mesh_interior_chunk(&meshes[(cz * chunks[1] + cy) * chunks[0] + cx], cave, cx, cy, cz);
+                        remeshed++;
+                    }
+                }
+            }
+        }
+        int patch = cave->dirty;
+        int x0 = cave->dirty_lo[0], y0 = cave->dirty_lo[1], x1 = cave->dirty_hi[0], y1 = cave->dirty_hi[1];
+        update_cave_mesh(NULL, cave);
+        if (patch) {
+            refilter_texture_mips(&height_mips, x0, y0, x1, y1);
+            refilter_texture_mips(&normal_mips, x0 - 1 < 1 ? 1 : x0 - 1, y0 - 1 < 1 ? 1 : y0 - 1,
+                                  x1 + 1 > cave->width - 2 ? cave->width - 2 : x1 + 1,
+                                  y1 + 1 > cave->height - 2 ? cave->height - 2 : y1 + 1);
+        }
+        double ms = bench_now_ms() - start;
+        
+        total_ms += ms;
+        if (ms > worst_ms) worst_ms = ms;
+    }
+    
+    // Incremental results against a rebuild of everything
+    size_t map_size = (size_t)cave->width * cave->height;
+    float* height_map = (float*)malloc(map_size * sizeof(float));
+    float* normal_map = (float*)malloc(map_size * 3 * sizeof(float));
+    memcpy(height_map, cave->height_map, map_size * sizeof(float));
+    memcpy(normal_map, cave->normal_map, map_size * 3 * sizeof(float));
+    generate_height_map(cave);
+    generate_normal_map(cave);
+    int ok = memcmp(height_map, cave->height_map, map_size * sizeof(float)) == 0 &&
+             memcmp(normal_map, cave->normal_map, map_size * 3 * sizeof(float)) == 0;
+    
+    // Patched mips against a chain filtered from the rebuilt maps
+    TextureMipFloats fresh_mips[2];
+    TextureMipFloats* patched_mips[2] = { &height_mips, &normal_mips };
+    build_texture_mip_chain(&chain, cave->height_map, cave->width, cave->height, 1, TEXTURE_HEIGHT, &fresh_mips[0]);
+    free_texture_mip_chain(&chain);
+    build_texture_mip_chain(&chain, cave->normal_map, cave->width, cave->height, 3, TEXTURE_NORMAL, &fresh_mips[1]);
+    free_texture_mip_chain(&chain);
+    for (int m = 0; m < 2; m++) {
+        ok &= fresh_mips[m].level_count == patched_mips[m]->level_count;
+        for (int level = 1; level < fresh_mips[m].level_count && ok; level++) {
+            ok = memcmp(fresh_mips[m].levels[level], patched_mips[m]->levels[level],
+                        (size_t)fresh_mips[m].widths[level] * fresh_mips[m].heights[level] *
+                        fresh_mips[m].channels * sizeof(float)) == 0;
+        }
+        free_texture_mip_floats(&fresh_mips[m]);
+        free_texture_mip_floats(patched_mips[m]);
+    }
+    
+    VoxelMeshData fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    for (int i = 0; i < count && ok; i++) {
+        mesh_interior_chunk(&fresh, cave, i % chunks[0], i / chunks[0] % chunks[1], i / (chunks[0] * chunks[1]));
+        ok = fresh.vertex_count == meshes[i].vertex_count && fresh.index_count == meshes[i].index_count &&
+             memcmp(fresh.vertices, meshes[i].vertices, fresh.vertex_count * sizeof(VoxelVertex)) == 0 &&
+             memcmp(fresh.indices, meshes[i].indices, fresh.index_count * sizeof(unsigned int)) == 0;
+    }
+    
+    printf("dig %d spheres (r = 3): %.3f ms avg, %.3f ms worst, %.1f chunks remeshed per dig%s\n",
+           digs, total_ms / digs, worst_ms, (double)remeshed / digs, ok ? "" : "  MISMATCH");
+    
+    free_voxel_mesh_data(&fresh);
+    for (int i = 0; i < count; i++) {
+        free_voxel_mesh_data(&meshes[i]);
+    }
+    free(meshes);
+    free(height_map);
+    free(normal_map);
+    free_cave(cave);
+    return ok;
+}
+
+// Uniform float in [0, 1)
+static float bench_unit(Rng* rng) {
+    return rng_int(rng, 1 << 24) / (float)(1 << 24);
+}
+
+// View matrix the way get_view_matrix builds it
+static void bench_view_matrix(float* view, const float pos[3], float yaw, float pitch) {
+    matrix_identity(view);
+    matrix_translate(view, -pos[0], -pos[1], -pos[2]);
+    matrix_rotate_y(view, -yaw);
+    matrix_rotate_x(view, -pitch);
+}
+
+// Planes pulled out of projection * view must keep exactly the points that
+// land inside the clip volume when transformed by the two matrices one after
+// the other; then count what a camera standing in the fixed cave culls while
+// turning on the spot.
+static int bench_culling(int turns) {
+    const float fovy = M_PI / 4.0f, aspect = 16.0f / 9.0f, near = 0.1f, far = 200.0f;
+    float view[16], projection[16];
+    Frustum frustum;
+    matrix_perspective(projection, fovy, aspect, near, far);
+    
+    int ok = 1, mismatches = 0, points = 0;
+    for (int t = 0; t < turns && ok; t++) {
+        Rng rng = rng_stream(99, RNG_STREAM_TUNNEL, t);
+        float pos[3];
+        for (int a = 0; a < 3; a++) {
+            pos[a] = bench_unit(&rng) * 10.0f - 5.0f;
+        }
+        float yaw = bench_unit(&rng) * 2.0f * M_PI;
+        float pitch = (bench_unit(&rng) - 0.5f) * 2.0f;
+        bench_view_matrix(view, pos, yaw, pitch);
+        frustum_from_matrices(&frustum, view, projection);
+        
+        for (int i = 0; i < 1000; i++) {
+            float p[4] = { 0.0f, 0.0f, 0.0f, 1.0f }, e[4], c[4];
+            for (int a = 0; a < 3; a++) {
+                p[a] = pos[a] + (bench_unit(&rng) - 0.5f) * 40.0f;
+            }
+            for (int r = 0; r < 4; r++) {
+                e[r] = view[r] * p[0] + view[4 + r] * p[1] + view[8 + r] * p[2] + view[12 + r] * p[3];
+            }
+            for (int r = 0; r < 4; r++) {
+                c[r] = projection[r] * e[0] + projection[4 + r] * e[1] + projection[8 + r] * e[2] + projection[12 + r] * e[3];
+            }
+            
+            // Skip points within a hair of a plane
+            float margin = INFINITY;
+            for (int a = 0; a < 3; a++) {
+                margin = fminf(margin, fabsf(fabsf(c[a]) - c[3]) / (fabsf(c[3]) + 1.0f));
+            }
+            if (margin < 1e-4f) continue;
+            
+            int expected = fabsf(c[0]) <= c[3] && fabsf(c[1]) <= c[3] && fabsf(c[2]) <= c[3];
+            if (frustum_test_sphere(&frustum, p[0], p[1], p[2], 0.0f) != expected) mismatches++;
+            points++;
+        }
+    }
+    ok = mismatches == 0;
+    
+    // Fixed cave: interior chunks, gems and crystals seen from its centre
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    int gem_count = 200, crystal_count = 50;
+    Gem* gems = generate_gems(cave, gem_count);
+    Crystal* crystals = generate_crystals(cave, crystal_count);
+    
+    int chunks[3] = {
+        (cave->width + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->height + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->depth + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE
+    };
+    int count = chunks[0] * chunks[1] * chunks[2];
+    float* bounds = (float*)malloc(count * 6 * sizeof(float));
+    int* empty = (int*)calloc(count, sizeof(int));
+    VoxelMeshData data;
+    memset(&data, 0, sizeof(data));
+    for (int i = 0; i < count; i++) {
+        mesh_interior_chunk(&data, cave, i % chunks[0], i / chunks[0] % chunks[1], i / (chunks[0] * chunks[1]));
+        voxel_mesh_bounds(&data, &bounds[i * 6], &bounds[i * 6 + 3]);
+        empty[i] = data.index_count == 0;
+    }
+    
+    CullStats stats;
+    reset_cull_stats(&stats);
+    const float centre[3] = { 0.0f, 0.0f, 0.0f };
+    double start = bench_now_ms();
+    for (int t = 0; t < turns; t++) {
+        bench_view_matrix(view, centre, t * 2.0f * M_PI / turns, 0.0f);
+        frustum_from_matrices(&frustum, view, projection);
+        
+        for (int i = 0; i < count; i++) {
+            if (!empty[i]) frustum_cull_aabb(&frustum, &bounds[i * 6], &bounds[i * 6 + 3], &stats.chunks);
+        }
+        for (int i = 0; i < gem_count; i++) {
+            frustum_cull_sphere(&frustum, gems[i].x, gems[i].y, gems[i].z, 0.5f * gems[i].size, &stats.gems);
+        }
+        for (int i = 0; i < crystal_count; i++) {
+            float size = crystals[i].size;
+            frustum_cull_sphere(&frustum, crystals[i].x, crystals[i].y + 0.4f * size, crystals[i].z, 0.82f * size,
+                                &stats.crystals);
+        }
+    }
+    double ms = (bench_now_ms() - start) / turns;
+    
+    printf("cull %d views: %d points vs clip space, chunks %.1f/%.1f, gems %.1f/%.1f, crystals %.1f/%.1f "
+           "drawn/culled per view, %.4f ms per view%s\n",
+           turns, points,
+           (double)stats.chunks.drawn / turns, (double)stats.chunks.culled / turns,
+           (double)stats.gems.drawn / turns, (double)stats.gems.culled / turns,
+           (double)stats.crystals.drawn / turns, (double)stats.crystals.culled / turns,
+           ms, ok ? "" : "  MISMATCH");
+    
+    free_voxel_mesh_data(&data);
+    free(bounds);
+    free(empty);
+    free(gems);
+    free(crystals);
+    free_cave(cave);
+    return ok;
+}
+
+// 1 if voxel (x, y, z) is air with rock somewhere in its 3x3x3 block
+static int bench_touches_rock(const Cave* cave, int x, int y, int z) {
+    if (cave_get(cave, x, y, z) != VOXEL_AIR) return 0;
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (cave_get(cave, x + dx, y + dy, z + dz) == VOXEL_WALL) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Placement from surface candidates: every entity placed against rock, and
+// the candidate lists match a plain scan before and after digging
+static int bench_placement(int count) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    double start = bench_now_ms();
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    double build_ms = bench_now_ms() - start;
+    
+    start = bench_now_ms();
+    Gem* gems = generate_gems(cave, count);
+    double gems_ms = bench_now_ms() - start;
+    start = bench_now_ms();
+    Crystal* crystals = generate_crystals(cave, count);
+    double crystals_ms = bench_now_ms() - start;
+    start = bench_now_ms();
+    for (int i = 0; i < count; i++) {
+        respawn_gem(gems, i, NULL, cave);
+    }
+    double respawn_ms = bench_now_ms() - start;
+    
+    int ok = 1, misplaced = 0;
+    for (int i = 0; i < count; i++) {
+        int x = (int)lroundf((gems[i].x + 5.0f) / 10.0f * cave->width);
+        int y = (int)lroundf((gems[i].y + 5.0f) / 10.0f * cave->height);
+        int z = (int)lroundf((gems[i].z + 5.0f) / 10.0f * cave->depth);
+        if (gems[i].collected || !bench_touches_rock(cave, x, y, z)) misplaced++;
+        if (crystals[i].size == 0.0f) misplaced++;
+    }
+    ok &= misplaced == 0;
+    
+    // Candidates against a scan, then again once a dig has made them stale
+    int listed_counts[2] = { 0, 0 };
+    int class_counts[SURFACE_CLASS_COUNT];
+    memcpy(class_counts, surface->count, sizeof(class_counts));
+    for (int round = 0; round < 2; round++) {
+        if (round == 1) {
+            // Dig into the rock beside a wall candidate
+            int x, y, z;
+            surface_voxel(cave, surface->voxels[surface->first[SURFACE_WALL]], &x, &y, &z);
+            cave_carve_sphere(cave, x, y, z, 4);
+            surface = cave_surface_candidates(cave);
+        }
+        int scanned = 0;
+        for (int z = 2; z < cave->depth - 2; z++) {
+            for (int y = 2; y < cave->height - 2; y++) {
+                for (int x = 2; x < cave->width - 2; x++) {
+                    scanned += bench_touches_rock(cave, x, y, z);
+                }
+            }
+        }
+        for (int i = 0; i < surface->total; i++) {
+            int x, y, z;
+            surface_voxel(cave, surface->voxels[i], &x, &y, &z);
+            int expected = cave_get(cave, x, y - 1, z) == VOXEL_WALL ? SURFACE_FLOOR :
+                           cave_get(cave, x, y + 1, z) == VOXEL_WALL ? SURFACE_CEILING : SURFACE_WALL;
+            int listed = i < surface->first[SURFACE_CEILING] ? SURFACE_FLOOR :
+                         i < surface->first[SURFACE_WALL] ? SURFACE_CEILING : SURFACE_WALL;
+            ok &= bench_touches_rock(cave, x, y, z) && listed == expected;
+        }
+        ok &= scanned == surface->total;
+        listed_counts[round] = surface->total;
+    }
+    
+    printf("placement %d each: %d candidates (%d floor, %d ceiling, %d wall) built in %.2f ms, "
+           "%d after a dig\n",
+           count, listed_counts[0], class_counts[SURFACE_FLOOR], class_counts[SURFACE_CEILING],
+           class_counts[SURFACE_WALL], build_ms, listed_counts[1]);
+    printf("  gems %.2f ms, crystals %.2f ms, respawns %.3f us each, %d misplaced%s\n",
+           gems_ms, crystals_ms, respawn_ms * 1000.0 / count, misplaced, ok ? "" : "  MISMATCH");
+    
+    free(gems);
+    free(crystals);
+    free_cave(cave);
+    return ok;
+}
+
+// World distance from p to the nearest rock voxel centre by brute force, with
+// voxels outside the grid counted as rock
+static float brute_clearance(const Cave* cave, const float p[3]) {
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    float best = INFINITY;
+    for (int a = 0; a < 3; a++) {
+        float step = 10.0f / dims[a], g = (p[a] + 5.0f) / step;
+        best = fminf(best, fminf(g + 1.0f, dims[a] - g) * step);
+    }
+    
+    for (int z = 0; z < cave->depth; z++) {
+        for (int y = 0; y < cave->height; y++) {
+            for (int x = 0; x < cave->width; x++) {
+                if (cave_get(cave, x, y, z) == VOXEL_AIR) continue;
+                float dx = (float)x / cave->width * 10.0f - 5.0f - p[0];
+                float dy = (float)y / cave->height * 10.0f - 5.0f - p[1];
+                float dz = (float)z / cave->depth * 10.0f - 5.0f - p[2];
+                best = fminf(best, sqrtf(dx * dx + dy * dy + dz * dz));
+            }
+        }
+    }
+    return best;
+}
+
+// Spawn points of a few seeds must hold the player's sphere clear of rock
+static int bench_spawn(int seeds, float radius) {
+    float least = 1e9f, most = 0.0f;
+    double total_ms = 0.0;
+    int ok = 1;
+    
+    for (int seed = 0; seed < seeds; seed++) {
+        Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+        cave->seed = seed;
+        generate_cave_3d(cave);
+        cave_surface_candidates(cave);
+        cave_distance_field(cave);
+        
+        float p[3];
+        double start = bench_now_ms();
+        find_spawn_point(cave, radius, &p[0], &p[1], &p[2]);
+        total_ms += bench_now_ms() - start;
+        
+        float clearance = brute_clearance(cave, p);
+        if (clearance < least) least = clearance;
+        if (clearance > most) most = clearance;
+        ok &= clearance >= radius - 1e-5f;   // Ties at the radius differ only in rounding
+        free_cave(cave);
+    }
+    
+    printf("spawn %d seeds: %.3f to %.3f clear of rock (radius %.2f), found in %.3f ms avg%s\n",
+           seeds, least, most, radius, total_ms / seeds, ok ? "" : "  MISMATCH");
+    return ok;
+}
+
+// Squared distance from world point p to the nearest of count points, skipping index skip
+static float bench_nearest_d2(const float* points, int count, const float* p, int skip) {
+    float best = INFINITY;
+    for (int i = 0; i < count; i++) {
+        if (i == skip) continue;
+        const float* q = &points[i * 3];
+        float dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < best) best = d2;
+    }
+    return best;
+}
+
+static void bench_domain_position(const PoissonDomain* domain, uint32_t packed, float* p) {
+    p[0] = (packed % (uint32_t)domain->dims[0]) * domain->scale[0];
+    packed /= (uint32_t)domain->dims[0];
+    p[1] = (packed % (uint32_t)domain->dims[1]) * domain->scale[1];
+    p[2] = (packed / (uint32_t)domain->dims[1]) * domain->scale[2];
+}
+
+// Poisson-disk sampling over the surface candidates of a size^3 cave: no two
+// samples closer than the spacing, no candidate left uncovered, and the same
+// seed giving the same set; independent picks of as many points for contrast
+static int bench_poisson(int size, int samples, int checks) {
+    Cave* cave = create_cave(size, size, size);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    PoissonDomain domain = {
+        surface->voxels, surface->total, { cave->width, cave->height, cave->depth },
+        { 10.0f / cave->width, 10.0f / cave->height, 10.0f / cave->depth }
+    };
+    float spacing = poisson_spacing_for_count(&domain, samples);
+    
+    double start = bench_now_ms();
+    uint32_t* points;
+    int n = poisson_sample(&domain, spacing, 99, &points);
+    double sample_ms = bench_now_ms() - start;
+    
+    uint32_t* again;
+    int ok = poisson_sample(&domain, spacing, 99, &again) == n && memcmp(points, again, n * sizeof(uint32_t)) == 0;
+    ok &= n >= samples;
+    
+    float* positions = (float*)malloc(n * 3 * sizeof(float));
+    float* independent = (float*)malloc(n * 3 * sizeof(float));
+    Rng rng = rng_stream(7, RNG_STREAM_SPAWN, 0);
+    for (int i = 0; i < n; i++) {
+        bench_domain_position(&domain, points[i], &positions[i * 3]);
+        bench_domain_position(&domain, surface->voxels[rng_int(&rng, surface->total)], &independent[i * 3]);
+    }
+    
+    // Spacing and coverage on a spread of samples and candidates against all samples
+    float spacing2 = spacing * spacing * 0.9999f;
+    float closest = INFINITY;
+    int too_close = 0, uncovered = 0, clumped = 0;
+    for (int c = 0; c < checks; c++) {
+        int i = (int)((int64_t)c * n / checks);
+        float d2 = bench_nearest_d2(positions, n, &positions[i * 3], i);
+        if (d2 < closest) closest = d2;
+        too_close += d2 < spacing2;
+        clumped += bench_nearest_d2(independent, n, &independent[i * 3], i) < spacing2;
+        
+        float p[3];
+        bench_domain_position(&domain, surface->voxels[rng_int(&rng, surface->total)], p);
+        uncovered += bench_nearest_d2(positions, n, p, -1) >= spacing * spacing * 1.0001f;
+    }
+    ok &= too_close == 0 && uncovered == 0;
+    
+    // The placement path end to end
+    start = bench_now_ms();
+    Gem* gems = generate_gems(cave, samples);
+    double gems_ms = bench_now_ms() - start;
+    
+    printf("poisson %d^3: %d candidates, spacing %.4f, %d samples in %.1f ms (%.2f us each), "
+           "generate_gems %d in %.1f ms\n",
+           size, surface->total, spacing, n, sample_ms, sample_ms * 1000.0 / n, samples, gems_ms);
+    printf("  %d checked: closest pair %.2f spacings, %d too close, %d candidates uncovered; "
+           "independent picks %.1f%% within a spacing%s\n",
+           checks, sqrtf(closest) / spacing, too_close, uncovered, 100.0 * clumped / checks, ok ? "" : "  MISMATCH");
+    
+    free(gems);
+    free(positions);
+    free(independent);
+    free(points);
+    free(again);
+    free_cave(cave);
+    return ok;
+}
+
+// The cube scan check_collision used before the distance field
+static int bench_cube_collides(const Cave* cave, float x, float y, float z, float radius) {
+    int cx = (int)((x + 5.0f) / 10.0f * cave->width);
+    int cy = (int)((y + 5.0f) / 10.0f * cave->height);
+    int cz = (int)((z + 5.0f) / 10.0f * cave->depth);
+    if (!cave_in_bounds(cave, cx, cy, cz)) return 1;
+    
+    int reach = (int)(radius * cave->width / 10.0f) + 1;
+    int x0 = cx - reach < 0 ? 0 : cx - reach, x1 = cx + reach >= cave->width ? cave->width - 1 : cx + reach;
+    int y0 = cy - reach < 0 ? 0 : cy - reach, y1 = cy + reach >= cave->height ? cave->height - 1 : cy + reach;
+    int z0 = cz - reach < 0 ? 0 : cz - reach, z1 = cz + reach >= cave->depth ? cave->depth - 1 : cz + reach;
+    for (int vz = z0; vz <= z1; vz++) {
+        for (int vy = y0; vy <= y1; vy++) {
+            const unsigned char* row = &cave->voxels[cave_index(cave, 0, vy, vz)];
+            for (int vx = x0; vx <= x1; vx++) {
+                if (row[vx] != VOXEL_WALL) continue;
+                float dist = sqrt(pow(x - ((float)vx / cave->width * 10.0f - 5.0f), 2) +
+                                  pow(y - ((float)vy / cave->height * 10.0f - 5.0f), 2) +
+                                  pow(z - ((float)vz / cave->depth * 10.0f - 5.0f), 2));
+                if (dist < radius) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// World distance from world point p to the nearest rock voxel of the padded
+// block within range, by scanning every voxel that could be nearer
+static float bench_rock_distance(const Cave* cave, const float* p) {
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    int lo[3], hi[3];
+    float step[3];
+    for (int a = 0; a < 3; a++) {
+        step[a] = 10.0f / dims[a];
+        int c = (int)floorf((p[a] + 5.0f) / step[a]);
+        int reach = (int)ceilf(CAVE_DISTANCE_RANGE / step[a]) + 1;
+        lo[a] = c - reach < -1 ? -1 : c - reach;
+        hi[a] = c + reach > dims[a] ? dims[a] : c + reach;
+    }
+    float best = CAVE_DISTANCE_RANGE * CAVE_DISTANCE_RANGE;
+    for (int z = lo[2]; z <= hi[2]; z++) {
+        for (int y = lo[1]; y <= hi[1]; y++) {
+            for (int x = lo[0]; x <= hi[0]; x++) {
+                if (cave_get(cave, x, y, z) != VOXEL_WALL) continue;
+                float dx = x * step[0] - 5.0f - p[0], dy = y * step[1] - 5.0f - p[1], dz = z * step[2] - 5.0f - p[2];
+                float d2 = dx * dx + dy * dy + dz * dz;
+                if (d2 < best) best = d2;
+            }
+        }
+    }
+    return sqrtf(best);
+}
+
+// Distance field: exact at voxels against a scan, patched edits equal to a
+// fresh build, and collision queries against the old cube scan
+static int bench_distance_field(int width, int height, int depth, int digs, int queries) {
+    Cave* cave = create_cave(width, height, depth);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    double start = bench_now_ms();
+    const float* field = cave_distance_field(cave);
+    double build_ms = bench_now_ms() - start;
+    
+    // Voxel centres, halo included, against the scan
+    Rng rng = rng_stream(7, RNG_STREAM_SPAWN, 1);
+    float worst = 0.0f;
+    for (int i = 0; i < 2000; i++) {
+        int v[3] = { rng_int(&rng, width + 2) - 1, rng_int(&rng, height + 2) - 1, rng_int(&rng, depth + 2) - 1 };
+        float p[3] = { v[0] * 10.0f / width - 5.0f, v[1] * 10.0f / height - 5.0f, v[2] * 10.0f / depth - 5.0f };
+        float error = fabsf(field[cave_index(cave, v[0], v[1], v[2])] - bench_rock_distance(cave, p));
+        if (error > worst) worst = error;
+    }
+    int ok = worst < 1e-4f;
+    
+    // Dig, patch, and compare with a field built from scratch
+    double patch_ms = 0.0, patch_worst_ms = 0.0;
+    for (int i = 0; i < digs; i++) {
+        cave_carve_sphere(cave, rng_int(&rng, width), rng_int(&rng, height), rng_int(&rng, depth), 3);
+        start = bench_now_ms();
+        field = cave_distance_field(cave);
+        double ms = bench_now_ms() - start;
+        patch_ms += ms;
+        if (ms > patch_worst_ms) patch_worst_ms = ms;
+    }
+    Cave* fresh = create_cave(width, height, depth);
+    memcpy(fresh->voxels, cave->voxels, cave->voxel_count);
+    const float* rebuilt = cave_distance_field(fresh);
+    float drift = 0.0f;
+    for (size_t i = 0; i < cave->voxel_count; i++) {
+        float error = fabsf(field[i] - rebuilt[i]);
+        if (error > drift) drift = error;
+    }
+    ok &= drift < 1e-4f;
+    free_cave(fresh);
+    
+    if (queries > 0) {
+        // Collision queries at random points, both ways; the answers may only
+        // differ where the exact distance is within a voxel diagonal of the radius
+        const float radius = 0.3f;
+        float* points = (float*)malloc(queries * 3 * sizeof(float));
+        for (int i = 0; i < queries * 3; i++) {
+            points[i] = bench_unit(&rng) * 10.0f - 5.0f;
+        }
+        unsigned char* scanned = (unsigned char*)malloc(queries);
+        unsigned char* looked_up = (unsigned char*)malloc(queries);
+        
+        start = bench_now_ms();
+        for (int i = 0; i < queries; i++) {
+            scanned[i] = (unsigned char)bench_cube_collides(cave, points[i * 3], points[i * 3 + 1], points[i * 3 + 2], radius);
+        }
+        double scan_ms = bench_now_ms() - start;
+        start = bench_now_ms();
+        for (int i = 0; i < queries; i++) {
+            looked_up[i] = cave_distance(cave, points[i * 3], points[i * 3 + 1], points[i * 3 + 2], NULL) < radius;
+        }
+        double lookup_ms = bench_now_ms() - start;
+        
+        float diagonal = sqrtf(3.0f) * 10.0f / (width < height ? (width < depth ? width : depth) : (height < depth ? height : depth));
+        int differ = 0, far_off = 0;
+        for (int i = 0; i < queries; i++) {
+            if (scanned[i] == looked_up[i]) continue;
+            differ++;
+            far_off += fabsf(bench_rock_distance(cave, &points[i * 3]) - radius) >= diagonal;
+        }
+        ok &= far_off == 0;
+        
+        printf("distance field %dx%dx%d: built in %.2f ms, exact to %.1e at voxels, %d digs patched in "
+               "%.3f ms avg (%.3f ms worst), %.1e from a fresh build\n",
+               width, height, depth, build_ms, worst, digs, patch_ms / digs, patch_worst_ms, drift);
+        printf("  %d collision queries: cube scan %.1f ns, field lookup %.1f ns (%.1fx), "
+               "%.2f%% answers differ, %d beyond a voxel diagonal of the radius%s\n",
+               queries, scan_ms * 1e6 / queries, lookup_ms * 1e6 / queries, scan_ms / lookup_ms,
+               100.0 * differ / queries, far_off, ok ? "" : "  MISMATCH");
+        free(points);
+        free(scanned);
+        free(looked_up);
+    } else {
+        printf("distance field %dx%dx%d: built in %.2f ms, exact to %.1e at voxels, %d digs patched in "
+               "%.3f ms avg (%.3f ms worst), %.1e from a fresh build%s\n",
+               width, height, depth, build_ms, worst, digs, patch_ms / digs, patch_worst_ms, drift, ok ? "" : "  MISMATCH");
+    }
+    
+    free_cave(cave);
+    return ok;
+}
+
+// Swept spheres from clear points: long moves against a fine walk along each
+// (no blocked move may pass, and contacts sit on the radius), and per-frame
+// moves timed against the three cube scans update_camera used to make
+static int bench_sweep(int moves) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    cave_distance_field(cave);
+    
+    const float radius = 0.3f;
+    const float frame_move = 5.0f / 60.0f;      // Camera speed over one 60 Hz frame
+    Rng rng = rng_stream(7, RNG_STREAM_SPAWN, 2);
+    float* from = (float*)malloc(moves * 3 * sizeof(float));
+    float* dir = (float*)malloc(moves * 3 * sizeof(float));
+    float* length = (float*)malloc(moves * sizeof(float));
+    for (int i = 0; i < moves; i++) {
+        float* p = &from[i * 3];
+        do {
+            for (int a = 0; a < 3; a++) p[a] = bench_unit(&rng) * 10.0f - 5.0f;
+        } while (cave_distance(cave, p[0], p[1], p[2], NULL) < radius);
+        
+        float* d = &dir[i * 3];
+        float n;
+        do {
+            for (int a = 0; a < 3; a++) d[a] = bench_unit(&rng) * 2.0f - 1.0f;
+            n = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        } while (n < 0.1f || n > 1.0f);
+        for (int a = 0; a < 3; a++) d[a] /= n;
+        length[i] = 0.1f + bench_unit(&rng) * 1.9f;
+    }
+    
+    // Long moves
+    SweepHit* hits = (SweepHit*)malloc(moves * sizeof(SweepHit));
+    unsigned char* hit = (unsigned char*)malloc(moves);
+    double start = bench_now_ms();
+    for (int i = 0; i < moves; i++) {
+        const float* p = &from[i * 3];
+        float to[3] = { p[0] + dir[i * 3] * length[i], p[1] + dir[i * 3 + 1] * length[i], p[2] + dir[i * 3 + 2] * length[i] };
+        hit[i] = (unsigned char)cave_sweep_sphere(cave, p, to, radius, &hits[i]);
+    }
+    double long_ms = bench_now_ms() - start;
+    
+    int blocked = 0, tunnelled = 0, missed = 0, off_radius = 0, bad_normals = 0;
+    for (int i = 0; i < moves; i++) {
+        const float* p = &from[i * 3];
+        const float* d = &dir[i * 3];
+        
+        // Blocked if a fine walk comes clearly closer than the radius; grazes are left out
+        float closest = INFINITY;
+        for (float s = 0.0f; s <= length[i]; s += 0.002f) {
+            float dist = cave_distance(cave, p[0] + d[0] * s, p[1] + d[1] * s, p[2] + d[2] * s, NULL);
+            if (dist < closest) closest = dist;
+        }
+        int is_blocked = closest < radius - 0.005f;
+        blocked += is_blocked;
+        float e = length[i];
+        tunnelled += is_blocked && cave_distance(cave, p[0] + d[0] * e, p[1] + d[1] * e, p[2] + d[2] * e, NULL) >= radius;
+        missed += is_blocked && !hit[i];
+        if (!hit[i]) continue;
+        
+        float s = hits[i].time * length[i];
+        float at = cave_distance(cave, p[0] + d[0] * s, p[1] + d[1] * s, p[2] + d[2] * s, NULL);
+        off_radius += at < radius - 1e-4f || at > radius + 0.01f;
+        bad_normals += hits[i].normal[0] * d[0] + hits[i].normal[1] * d[1] + hits[i].normal[2] * d[2] >= 0.0f;
+    }
+    
+    // Moves from starts inside the radius: coming closer than the start is a
+    // contact anywhere along the path, not only at its end
+    int near_moves = moves / 10, near_blocked = 0, near_missed = 0, near_off = 0;
+    for (int i = 0; i < near_moves; i++) {
+        float p[3], d[3], begin, n;
+        do {
+            for (int a = 0; a < 3; a++) p[a] = bench_unit(&rng) * 10.0f - 5.0f;
+            begin = cave_distance(cave, p[0], p[1], p[2], NULL);
+        } while (begin < 0.05f || begin >= radius);
+        do {
+            for (int a = 0; a < 3; a++) d[a] = bench_unit(&rng) * 2.0f - 1.0f;
+            n = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        } while (n < 0.1f || n > 1.0f);
+        for (int a = 0; a < 3; a++) d[a] /= n;
+        float e = 0.1f + bench_unit(&rng) * 1.9f;
+        
+        float to[3] = { p[0] + d[0] * e, p[1] + d[1] * e, p[2] + d[2] * e };
+        SweepHit h;
+        int got = cave_sweep_sphere(cave, p, to, radius, &h);
+        
+        float closest = INFINITY;
+        for (float s = 0.0f; s <= e; s += 0.002f) {
+            float dist = cave_distance(cave, p[0] + d[0] * s, p[1] + d[1] * s, p[2] + d[2] * s, NULL);
+            if (dist < closest) closest = dist;
+        }
+        int is_blocked = closest < begin - 0.005f;
+        near_blocked += is_blocked;
+        near_missed += is_blocked && !got;
+        if (got) {
+            float s = h.time * e;
+            float at = cave_distance(cave, p[0] + d[0] * s, p[1] + d[1] * s, p[2] + d[2] * s, NULL);
+            near_off += at < begin - 1e-4f || at > begin + 0.01f;
+        }
+    }
+    int ok = missed == 0 && off_radius == 0 && bad_normals == 0 && near_missed == 0 && near_off == 0;
+    
+    // One frame of movement: a sweep against a cube scan per axis
+    start = bench_now_ms();
+    int swept_hits = 0;
+    for (int i = 0; i < moves; i++) {
+        const float* p = &from[i * 3];
+        float to[3] = { p[0] + dir[i * 3] * frame_move, p[1] + dir[i * 3 + 1] * frame_move, p[2] + dir[i * 3 + 2] * frame_move };
+        SweepHit h;
+        swept_hits += cave_sweep_sphere(cave, p, to, radius, &h);
+    }
+    double sweep_ms = bench_now_ms() - start;
+    start = bench_now_ms();
+    int scan_hits = 0;
+    for (int i = 0; i < moves; i++) {
+        const float* p = &from[i * 3];
+        const float* d = &dir[i * 3];
+        scan_hits += bench_cube_collides(cave, p[0] + d[0] * frame_move, p[1], p[2], radius);
+        scan_hits += bench_cube_collides(cave, p[0], p[1] + d[1] * frame_move, p[2], radius);
+        scan_hits += bench_cube_collides(cave, p[0], p[1], p[2] + d[2] * frame_move, radius);
+    }
+    double scan_ms = bench_now_ms() - start;
+    
+    printf("sweep %d moves of 0.1-2.0 units: %.2f us each, %d blocked, %d of them tunnelled by an end check, "
+           "%d missed; %d contacts off the radius, %d normals along the move\n",
+           moves, long_ms * 1000.0 / moves, blocked, tunnelled, missed, off_radius, bad_normals);
+    printf("  %d moves from inside the radius: %d blocked, %d missed, %d contacts off the start distance\n",
+           near_moves, near_blocked, near_missed, near_off);
+    printf("  per frame (%.3f units): sweep %.1f ns vs 3 cube scans %.1f ns (%.1fx), "
+           "%d sweeps hit, %d axis checks collided%s\n",
+           frame_move, sweep_ms * 1e6 / moves, scan_ms * 1e6 / moves, scan_ms / sweep_ms, swept_hits, scan_hits,
+           ok ? "" : "  MISMATCH");
+    
+    free(from);
+    free(dir);
+    free(length);
+    free(hits);
+    free(hit);
+    free_cave(cave);
+    return ok;
+}
+
+// Nearest uncollected gem within radius (or anywhere when radius is INFINITY) by scanning them all
+static int linear_nearest_gem(const Gem* gems, int count, const float* p, float radius) {
+    int best = -1;
+    float best_d2 = radius * radius;
+    for (int i = 0; i < count; i++) {
+        if (gems[i].collected) continue;
+        float dx = gems[i].x - p[0], dy = gems[i].y - p[1], dz = gems[i].z - p[2];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < best_d2) {
+            best_d2 = d2;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Spatial hash against linear scans: collection and compass queries, with
+// collections and respawns keeping it current
+static int bench_gem_grid(int count, int queries) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    Gem* gems = generate_gems(cave, count);
+    
+    double start = bench_now_ms();
+    GemGrid* grid = create_gem_grid(gems, count, GEM_GRID_CELL);
+    double build_ms = bench_now_ms() - start;
+    
+    float* points = (float*)malloc(queries * 3 * sizeof(float));
+    Rng rng = rng_stream(99, RNG_STREAM_SPAWN, 0);
+    for (int i = 0; i < queries * 3; i++) {
+        points[i] = bench_unit(&rng) * 10.0f - 5.0f;
+    }
+    
+    // Collect around every query point, respawning every other gem taken;
+    // the linear scan on a copy must take the same gems
+    Gem* copy = (Gem*)malloc(count * sizeof(Gem));
+    memcpy(copy, gems, count * sizeof(Gem));
+    int ok = 1, collected = 0;
+    double grid_ms = 0.0, linear_ms = 0.0;
+    for (int q = 0; q < queries && ok; q++) {
+        const float* p = &points[q * 3];
+        start = bench_now_ms();
+        int taken = collect_gem(gems, grid, p[0], p[1], p[2], 0.5f);
+        grid_ms += bench_now_ms() - start;
+        
+        start = bench_now_ms();
+        int expected = linear_nearest_gem(copy, count, p, 0.5f);
+        linear_ms += bench_now_ms() - start;
+        if (expected >= 0) copy[expected].collected = 1;
+        ok &= taken == expected;
+        
+        if (taken >= 0) {
+            collected++;
+            if (collected % 2 == 0) {
+                respawn_gem(gems, taken, grid, cave);
+                copy[taken] = gems[taken];
+            }
+        }
+    }
+    
+    double near_ms = 0.0, near_linear_ms = 0.0;
+    for (int q = 0; q < queries && ok; q++) {
+        const float* p = &points[q * 3];
+        start = bench_now_ms();
+        int nearest = find_nearest_gem(grid, gems, p[0], p[1], p[2]);
+        near_ms += bench_now_ms() - start;
+        
+        start = bench_now_ms();
+        int expected = linear_nearest_gem(gems, count, p, INFINITY);
+        near_linear_ms += bench_now_ms() - start;
+        ok &= nearest == expected;
+    }
+    
+    printf("gem grid %d gems: built in %.2f ms; collect %.2f us vs %.1f us linear, "
+           "nearest %.2f us vs %.1f us linear (%d collected)%s\n",
+           count, build_ms, grid_ms * 1000.0 / queries, linear_ms * 1000.0 / queries,
+           near_ms * 1000.0 / queries, near_linear_ms * 1000.0 / queries, collected, ok ? "" : "  MISMATCH");
+    
+    free(points);
+    free(copy);
+    free_gem_grid(grid);
+    free(gems);
+    free_cave(cave);
+    return ok;
+}
+
+// Crystal cluster library: shape soundness, and packing many crystals into per-shape batches
+static int bench_crystal_instances(int count) {
+    double start = bench_now_ms();
+    CrystalMeshLibrary library;
+    build_crystal_meshes(&library);
+    double build_ms = bench_now_ms() - start;
+    
+    // Each spire is convex, so every face must have its whole spire behind it
+    int ok = library.vertex_count % CRYSTAL_SPIRE_VERTICES == 0 && library.reach <= 1.0f;
+    int bad_faces = 0;
+    for (int spire = 0; spire < library.vertex_count; spire += CRYSTAL_SPIRE_VERTICES) {
+        const CrystalVertex* v = &library.vertices[spire];
+        for (int t = 0; t < CRYSTAL_SPIRE_VERTICES; t += 3) {
+            const float* n = v[t].normal;
+            if (fabsf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2] - 1.0f) > 1e-4f) bad_faces++;
+            for (int i = 0; i < CRYSTAL_SPIRE_VERTICES; i++) {
+                float d[3];
+                for (int a = 0; a < 3; a++) d[a] = v[i].position[a] - v[t].position[a];
+                if (n[0] * d[0] + n[1] * d[1] + n[2] * d[2] > 1e-4f) {
+                    bad_faces++;
+                    break;
+                }
+            }
+        }
+    }
+    ok &= bad_faces == 0;
+    
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    Crystal* crystals = generate_crystals(cave, count);
+    CrystalInstance* instances = (CrystalInstance*)malloc(count * sizeof(CrystalInstance));
+    int first[CRYSTAL_MESH_VARIANTS], counts[CRYSTAL_MESH_VARIANTS];
+    
+    const int repeats = 10;
+    start = bench_now_ms();
+    for (int r = 0; r < repeats; r++) {
+        pack_crystal_instances(crystals, count, instances, first, counts);
+    }
+    double pack_ms = (bench_now_ms() - start) / repeats;
+    
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS && ok; variant++) {
+        for (int i = 0; i < counts[variant]; i++) {
+            const Crystal* crystal = &crystals[variant + i * CRYSTAL_MESH_VARIANTS];
+            const CrystalInstance* instance = &instances[first[variant] + i];
+            ok &= instance->position[0] == crystal->x && instance->position[1] == crystal->y &&
+                  instance->position[2] == crystal->z && instance->size == crystal->size &&
+                  instance->rotation == crystal->rotation && instance->glow_intensity == crystal->glow_intensity;
+        }
+    }
+    ok &= first[CRYSTAL_MESH_VARIANTS - 1] + counts[CRYSTAL_MESH_VARIANTS - 1] == count;
+    
+    int fewest = library.count[0], most = library.count[0];
+    for (int variant = 1; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        fewest = library.count[variant] < fewest ? library.count[variant] : fewest;
+        most = library.count[variant] > most ? library.count[variant] : most;
+    }
+    
+    // Immediate mode issued push, translate, rotate, scale, colour, begin, 12 vertices, end, pop per crystal
+    printf("crystal clusters: %d shapes of %d-%d tris (built in %.2f ms), %d faces facing inwards\n",
+           CRYSTAL_MESH_VARIANTS, fewest / 3, most / 3, build_ms, bad_faces);
+    printf("  %d crystals packed in %.2f ms, %d draw calls per frame vs %d immediate-mode calls%s\n",
+           count, pack_ms, CRYSTAL_MESH_VARIANTS, count * 20, ok ? "" : "  MISMATCH");
+    
+    free(instances);
+    free(crystals);
+    free_cave(cave);
+    free_crystal_meshes(&library);
+    return ok;
+}
+
+// Instance data of many gems: packing cost, buffer size and what one draw replaces
+static int bench_gem_instances(int count) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    Gem* gems = generate_gems(cave, count);
+    for (int i = 0; i < count; i += 7) {
+        gems[i].collected = 1;
+    }
+    GemInstance* instances = (GemInstance*)malloc(count * sizeof(GemInstance));
+    
+    const int repeats = 10;
+    double start = bench_now_ms();
+    for (int r = 0; r < repeats; r++) {
+        pack_gem_instances(gems, count, instances);
+    }
+    double pack_ms = (bench_now_ms() - start) / repeats;
+    
+    int ok = sizeof(GemInstance) == 28;
+    for (int i = 0; i < count && ok; i++) {
+        const Gem* gem = &gems[i];
+        const GemInstance* instance = &instances[i];
+        ok &= instance->position[0] == gem->x && instance->position[1] == gem->y && instance->position[2] == gem->z;
+        ok &= instance->size == gem->size && instance->rotation == gem->rotation &&
+              instance->bob_offset == gem->bob_offset;
+        ok &= (instance->collected != 0) == (gem->collected != 0);
+        for (int c = 0; c < 3; c++) {
+            ok &= fabsf(instance->color[c] / 255.0f - gem->color[c]) <= 0.501f / 255.0f;
+        }
+    }
+    
+    // Immediate mode issued push, translate, rotate, scale, colour, begin, 24 vertices, end, pop per gem
+    printf("gem instances %d: %.2f MB buffer (%d bytes each), packed in %.2f ms once, "
+           "1 draw call per frame vs %d immediate-mode calls%s\n",
+           count, count * sizeof(GemInstance) / 1048576.0, (int)sizeof(GemInstance), pack_ms,
+           count * 32, ok ? "" : "  MISMATCH");
+    
+    free(instances);
+    free(gems);
+    free_cave(cave);
+    return ok;
+}
+
+typedef struct {
+    int count;
+    uint64_t checksum;
+} SurfaceTally;
+
+static void tally_surface(SurfaceTally* tally, int x, int y, int z, int faces) {
+    tally->count++;
+    tally->checksum += ((uint64_t)x * 73856093u) ^ ((uint64_t)y * 19349663u) ^ ((uint64_t)z * 83492791u) ^
+                       ((uint64_t)faces << 40);
+}
+
+static void tally_tree_surface(void* ctx, int x, int y, int z, int faces) {
+    tally_surface((SurfaceTally*)ctx, x, y, z, faces);
+}
+
+// Surface voxels of cave in [lo, hi] by brute force, reported at offset + (x, y, z)
+static SurfaceTally dense_surface(const Cave* cave, const int lo[3], const int hi[3], const int offset[3]) {
+    static const int steps[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    SurfaceTally tally = { 0, 0 };
+    
+    for (int z = lo[2]; z <= hi[2]; z++) {
+        for (int y = lo[1]; y <= hi[1]; y++) {
+            for (int x = lo[0]; x <= hi[0]; x++) {
+                if (cave_get(cave, x, y, z) != VOXEL_WALL) continue;
+                int faces = 0;
+                for (int d = 0; d < 6; d++) {
+                    if (cave_get(cave, x + steps[d][0], y + steps[d][1], z + steps[d][2]) == VOXEL_AIR) {
+                        faces |= 1 << d;
+                    }
+                }
+                if (faces) tally_surface(&tally, offset[0] + x, offset[1] + y, offset[2] + z, faces);
+            }
+        }
+    }
+    return tally;
+}
+
+// Tree storage against the dense grid on the fixed cave, then a 2048^3 cave
+// of tunnels that would take 8 GB dense
+static int bench_svo(int size, int tunnels, int steps) {
+    Cave* cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    cave->seed = 1234;
+    generate_cave_3d(cave);
+    
+    double start = bench_now_ms();
+    VoxelTree* tree = voxel_tree_from_cave(cave);
+    double build_ms = bench_now_ms() - start;
+    Cave* copy = voxel_tree_to_cave(tree);
+    int ok = memcmp(copy->voxels, cave->voxels, cave->voxel_count) == 0;
+    
+    for (int z = -1; z <= cave->depth; z++) {
+        for (int y = -1; y <= cave->height; y++) {
+            for (int x = -1; x <= cave->width; x++) {
+                ok &= voxel_tree_get(tree, x, y, z) == cave_get(cave, x, y, z);
+            }
+        }
+    }
+    
+    // Digging the tree and the grid alike, and single voxel edits
+    Rng rng = rng_stream(7, RNG_STREAM_CARVE, 0);
+    for (int i = 0; i < 64; i++) {
+        int x = rng_int(&rng, cave->width), y = rng_int(&rng, cave->height), z = rng_int(&rng, cave->depth);
+        int r = rng_int(&rng, 9);
+        cave_carve_sphere(cave, x, y, z, r);
+        voxel_tree_carve_sphere(tree, x, y, z, r);
+        
+        x = rng_int(&rng, cave->width);
+        y = rng_int(&rng, cave->height);
+        z = rng_int(&rng, cave->depth);
+        int value = rng_int(&rng, 2) ? VOXEL_WALL : VOXEL_AIR;
+        cave_set(cave, x, y, z, value);
+        voxel_tree_set(tree, x, y, z, value);
+    }
+    voxel_tree_extract(tree, copy, 0, 0, 0);
+    ok &= memcmp(copy->voxels, cave->voxels, cave->voxel_count) == 0;
+    
+    const int lo[3] = { 0, 0, 0 };
+    const int hi[3] = { cave->width - 1, cave->height - 1, cave->depth - 1 };
+    SurfaceTally expected = dense_surface(cave, lo, hi, lo);
+    SurfaceTally found = { 0, 0 };
+    voxel_tree_for_each_surface(tree, lo, hi, tally_tree_surface, &found);
+    ok &= found.count == expected.count && found.checksum == expected.checksum;
+    
+    printf("svo %dx%dx%d: built in %.2f ms, %.2f MB vs %.2f MB dense, %d surface voxels%s\n",
+           cave->width, cave->height, cave->depth, build_ms, voxel_tree_memory(tree) / 1048576.0,
+           cave->voxel_count / 1048576.0, found.count, ok ? "" : "  MISMATCH");
+    
+    // Interior chunks meshed through tree windows, as --sparse-cave does,
+    // against the same chunks meshed from the grid
+    const int chunks[3] = {
+        (cave->width + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->height + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE,
+        (cave->depth + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE
+    };
+    int chunk_count = chunks[0] * chunks[1] * chunks[2];
+    Cave* tree_window = create_cave(INTERIOR_CHUNK_SIZE, INTERIOR_CHUNK_SIZE, INTERIOR_CHUNK_SIZE);
+    VoxelMeshData grid_mesh, tree_mesh;
+    memset(&grid_mesh, 0, sizeof(grid_mesh));
+    memset(&tree_mesh, 0, sizeof(tree_mesh));
+    VoxelSurface surface = get_voxel_surface();
+    for (int style = 0; style < 2; style++) {
+        set_voxel_surface(style == 0 ? VOXEL_SURFACE_BLOCKY : VOXEL_SURFACE_SMOOTH);
+        double grid_ms = 0.0, tree_ms = 0.0;
+        float drift = 0.0f;
+        int same = 1;
+        for (int i = 0; i < chunk_count; i++) {
+            int cx = i % chunks[0], cy = i / chunks[0] % chunks[1], cz = i / (chunks[0] * chunks[1]);
+            start = bench_now_ms();
+            mesh_interior_chunk(&grid_mesh, cave, cx, cy, cz);
+            grid_ms += bench_now_ms() - start;
+            start = bench_now_ms();
+            mesh_sparse_interior_chunk(&tree_mesh, tree, tree_window, cx, cy, cz);
+            tree_ms += bench_now_ms() - start;
+            
+            same &= grid_mesh.vertex_count == tree_mesh.vertex_count &&
+                    grid_mesh.index_count == tree_mesh.index_count &&
+                    memcmp(grid_mesh.indices, tree_mesh.indices, grid_mesh.index_count * sizeof(unsigned int)) == 0;
+            for (int v = 0; same && v < grid_mesh.vertex_count; v++) {
+                const VoxelVertex* a = &grid_mesh.vertices[v];
+                const VoxelVertex* b = &tree_mesh.vertices[v];
+                same &= memcmp(a->normal, b->normal, sizeof(a->normal)) == 0;
+                for (int k = 0; k < 3; k++) {
+                    drift = fmaxf(drift, fabsf(a->position[k] - b->position[k]));
+                }
+            }
+        }
+        same &= drift < 1e-5f;
+        ok &= same;
+        printf("  %s interior, %d chunks through tree windows: %.2f ms vs %.2f ms from the grid, "
+               "vertices within %.1e%s\n", style == 0 ? "blocky" : "smooth", chunk_count, tree_ms, grid_ms,
+               drift, same ? "" : "  MISMATCH");
+    }
+    set_voxel_surface(surface);
+    free_voxel_mesh_data(&grid_mesh);
+    free_voxel_mesh_data(&tree_mesh);
+    free_cave(tree_window);
+    
+    free_voxel_tree(tree);
+    free_cave(copy);
+    free_cave(cave);
+    
+    // Random walks from random starts, as carve_cave_interior digs
+    tree = create_voxel_tree(size, size, size);
+    start = bench_now_ms();
+    int spheres = 0;
+    for (int t = 0; t < tunnels; t++) {
+        rng = rng_stream(99, RNG_STREAM_TUNNEL, t);
+        float angle_h = rng_int(&rng, 360) * (float)M_PI / 180.0f;
+        float angle_v = (rng_int(&rng, 60) - 30) * (float)M_PI / 180.0f;
+        float pos[3] = { (float)rng_int(&rng, size), (float)rng_int(&rng, size), (float)rng_int(&rng, size) };
+        
+        for (int i = 0; i < steps; i++) {
+            voxel_tree_carve_sphere(tree, (int)pos[0], (int)pos[1], (int)pos[2], 3 + rng_int(&rng, 2));
+            spheres++;
+            pos[0] += cosf(angle_h) * cosf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.5f;
+            pos[1] += sinf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.3f;
+            pos[2] += sinf(angle_h) * cosf(angle_v) * 2.0f + (rng_int(&rng, 3) - 1) * 0.5f;
+            angle_h += (rng_int(&rng, 40) - 20) * (float)M_PI / 180.0f * 0.1f;
+            angle_v += (rng_int(&rng, 20) - 10) * (float)M_PI / 180.0f * 0.1f;
+        }
+    }
+    double carve_ms = bench_now_ms() - start;
+    
+    const int queries = 1 << 22;
+    int walls = 0;
+    rng = rng_stream(7, RNG_STREAM_CARVE, 1);
+    start = bench_now_ms();
+    for (int i = 0; i < queries; i++) {
+        walls += voxel_tree_get(tree, rng_int(&rng, size), rng_int(&rng, size), rng_int(&rng, size));
+    }
+    double query_ns = (bench_now_ms() - start) * 1e6 / queries;
+    
+    // A chunk-sized window around the first tunnel, walked in the tree and
+    // extracted for the dense brute force
+    rng = rng_stream(99, RNG_STREAM_TUNNEL, 0);
+    rng_int(&rng, 360);
+    rng_int(&rng, 60);
+    int corner[3];
+    for (int a = 0; a < 3; a++) {
+        corner[a] = rng_int(&rng, size) - 32;
+        corner[a] = corner[a] < 0 ? 0 : (corner[a] > size - 64 ? size - 64 : corner[a]);
+    }
+    Cave* window = create_cave(64, 64, 64);
+    const int window_lo[3] = { 0, 0, 0 };
+    const int window_hi[3] = { 63, 63, 63 };
+    const int tree_hi[3] = { corner[0] + 63, corner[1] + 63, corner[2] + 63 };
+    voxel_tree_extract(tree, window, corner[0], corner[1], corner[2]);
+    expected = dense_surface(window, window_lo, window_hi, corner);
+    
+    found.count = 0;
+    found.checksum = 0;
+    start = bench_now_ms();
+    voxel_tree_for_each_surface(tree, corner, tree_hi, tally_tree_surface, &found);
+    double walk_ms = bench_now_ms() - start;
+    int window_ok = found.count == expected.count && found.checksum == expected.checksum;
+    ok &= window_ok;
+    
+    size_t dense = (size_t)(size + 2) * (size + 2) * (size + 2);
+    printf("svo %d^3, %d tunnels x %d steps: carved in %.0f ms (%.2f us/sphere), %.1f MB vs %.1f MB dense\n",
+           size, tunnels, steps, carve_ms, carve_ms * 1000.0 / spheres, voxel_tree_memory(tree) / 1048576.0,
+           dense / 1048576.0);
+    printf("svo %d^3: get %.1f ns (%.1f%% wall), 64^3 surface walk %.2f ms (%d voxels)%s\n",
+           size, query_ns, 100.0 * walls / queries, walk_ms, found.count, window_ok ? "" : "  MISMATCH");
+    
+    free_cave(window);
+    free_voxel_tree(tree);
+    return ok;
+}
+
+// Saving a generated cave, then opening it lazily and loading it whole
+static int bench_cave_file(int size) {
+    const char* path = "bench_cave.cdcv";
+    Cave* cave = create_cave(size, size, size);
+    cave->seed = 1234;
+    
+    double start = bench_now_ms();
+    generate_cave_3d(cave);
+    Crystal* crystals = generate_crystals(cave, 1000);
+    Gem* gems = generate_gems(cave, 2000);
+    double generate_ms = bench_now_ms() - start;
+    
+    start = bench_now_ms();
+    int ok = save_cave_file(path, cave, crystals, 1000, gems, 2000);
+    double save_ms = bench_now_ms() - start;
+    
+    struct stat st;
+    double file_mb = stat(path, &st) == 0 ? st.st_size / 1048576.0 : 0.0;
+    
+    // Opening only maps the file; one query decodes one chunk, and scattered
+    // queries after it read back through the per-chunk blocks
+    start = bench_now_ms();
+    CaveFile* file = open_cave_file(path);
+    double open_ms = bench_now_ms() - start;
+    double touch_ms = 0.0;
+    if (file) {
+        start = bench_now_ms();
+        ok &= cave_file_get(file, size / 2, size / 2, size / 2) == cave_get(cave, size / 2, size / 2, size / 2);
+        touch_ms = bench_now_ms() - start;
+        ok &= file->decoded_count == 1;
+        
+        Rng rng = rng_stream(cave->seed, RNG_STREAM_FILL, 0);
+        for (int i = 0; i < 100000; i++) {
+            int x = rng_int(&rng, size + 2) - 1;
+            int y = rng_int(&rng, size + 2) - 1;
+            int z = rng_int(&rng, size + 2) - 1;
+            ok &= cave_file_get(file, x, y, z) == cave_get(cave, x, y, z);
+        }
+        close_cave_file(file);
+    } else {
+        ok = 0;
+    }
+    
+    Crystal* loaded_crystals = NULL;
+    Gem* loaded_gems = NULL;
+    int loaded_crystal_count = 0, loaded_gem_count = 0;
+    start = bench_now_ms();
+    Cave* loaded = load_cave_file(path, &loaded_crystals, &loaded_crystal_count, &loaded_gems, &loaded_gem_count);
+    double load_ms = bench_now_ms() - start;
+    
+    if (loaded) {
+        size_t map = (size_t)size * size * sizeof(float);
+        ok &= memcmp(loaded->voxels, cave->voxels, cave->voxel_count) == 0;
+        ok &= memcmp(loaded->height_map, cave->height_map, map) == 0;
+        ok &= memcmp(loaded->normal_map, cave->normal_map, map * 3) == 0;
+        ok &= loaded->seed == cave->seed;
+        ok &= loaded_crystal_count == 1000 && memcmp(loaded_crystals, crystals, 1000 * sizeof(Crystal)) == 0;
+        ok &= loaded_gem_count == 2000 && memcmp(loaded_gems, gems, 2000 * sizeof(Gem)) == 0;
+    } else {
+        ok = 0;
+    }
+    remove(path);
+    
+    printf("cave file %d^3: generated in %.0f ms, saved in %.0f ms, %.2f MB vs %.1f MB dense\n",
+           size, generate_ms, save_ms, file_mb, cave->voxel_count / 1048576.0);
+    printf("  open %.2f ms + first touch %.3f ms, full load %.1f ms (%.0fx faster than generating)%s\n",
+           open_ms, touch_ms, load_ms, generate_ms / load_ms, ok ? "" : "  MISMATCH");
+    
+    free_cave(loaded);
+    free(loaded_crystals);
+    free(loaded_gems);
+    free(crystals);
+    free(gems);
+    free_cave(cave);
+    return ok;
+}
+
+// 1 if the halo of chunk a on its +axis side matches the first layer of b, and
+// the halo of b on its -axis side matches the last layer of a
+static int chunk_seam_matches(const Cave* a, const Cave* b, int axis) {
+    for (int v = -1; v <= CHUNK_SIZE; v++) {
+        for (int u = -1; u <= CHUNK_SIZE; u++) {
+            int p[3], q[3], r[3], s[3];
+            p[axis] = CHUNK_SIZE;       q[axis] = 0;        // a's halo vs b's first layer
+            r[axis] = -1;               s[axis] = CHUNK_SIZE - 1;  // b's halo vs a's last layer
+            p[(axis + 1) % 3] = q[(axis + 1) % 3] = r[(axis + 1) % 3] = s[(axis + 1) % 3] = u;
+            p[(axis + 2) % 3] = q[(axis + 2) % 3] = r[(axis + 2) % 3] = s[(axis + 2) % 3] = v;
+            
+            // The far halo corners belong to chunks neither grid owns
+            if (u == -1 || u == CHUNK_SIZE || v == -1 || v == CHUNK_SIZE) continue;
+            if (cave_get(a, p[0], p[1], p[2]) != cave_get(b, q[0], q[1], q[2])) return 0;
+            if (cave_get(b, r[0], r[1], r[2]) != cave_get(a, s[0], s[1], s[2])) return 0;
+        }
+    }
+    return 1;
+}
+
+// Chunk generation cost, seams between neighbours and streaming around a moving camera
+static int bench_world(void) {
+    const uint64_t seed = 1234;
+    Cave* scratch = create_cave(CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE);
+    Cave* chunks[4];
+    const int offsets[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    
+    double start = bench_now_ms();
+    for (int i = 0; i < 4; i++) {
+        chunks[i] = create_cave(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+        generate_world_chunk(chunks[i], scratch, seed, offsets[i][0], offsets[i][1], offsets[i][2]);
+    }
+    double chunk_ms = (bench_now_ms() - start) / 4;
+    
+    int ok = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        ok &= chunk_seam_matches(chunks[0], chunks[axis + 1], axis);
+    }
+    
+    size_t air = 0;
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                air += cave_get(chunks[0], x, y, z) == VOXEL_AIR;
+            }
+        }
+    }
+    
+    printf("world chunk %d^3: %.2f ms/chunk, %.0f%% air, seams %s\n", CHUNK_SIZE, chunk_ms,
+           100.0 * air / ((double)CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE), ok ? "match" : "MISMATCH");
+    
+    for (int i = 0; i < 4; i++) {
+        free_cave(chunks[i]);
+    }
+    free_cave(scratch);
+    
+    // Stream a full ring, then walk three chunks east; update_world is the
+    // only per-frame cost the main thread pays
+    World* world = create_world(seed, 2);
+    int ring = world->span * world->span * world->span;
+    for (int leg = 0; leg < 2; leg++) {
+        float x = leg * 3 * CHUNK_SIZE * WORLD_VOXEL_SIZE;
+        double worst_ms = 0.0;
+        int frames = 0;
+        
+        start = bench_now_ms();
+        do {
+            double frame_start = bench_now_ms();
+            update_world(world, x, 0.0f, 0.0f);
+            double frame_ms = bench_now_ms() - frame_start;
+            if (frame_ms > worst_ms) worst_ms = frame_ms;
+            frames++;
+            
+            bench_sleep_ms(1);
+        } while (world->live_count < ring);
+        
+        printf("world stream %s: %d chunks in %.0f ms, worst update_world %.3f ms over %d polls\n",
+               leg == 0 ? "fill" : "move", ring, bench_now_ms() - start, worst_ms, frames);
+    }
+    printf("world stream: %llu generated, %llu evicted, %d resident\n",
+           (unsigned long long)world->generated_count, (unsigned long long)world->evicted_count,
+           world->live_count);
+    free_world(world);
+    
+    return ok;
+}
+
+// Every pair of face neighbours in a span^3 block of chunks, the first at chunk
+// (first, first, first), must agree voxel for voxel where they meet
+static int bench_world_seams(int span, int first) {
+    const uint64_t seed = 1234;
+    Cave* scratch = create_cave(CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE);
+    int count = span * span * span;
+    Cave** chunks = (Cave**)malloc(count * sizeof(Cave*));
+    
+    for (int i = 0; i < count; i++) {
+        chunks[i] = create_cave(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+        generate_world_chunk(chunks[i], scratch, seed, first + i % span, first + i / span % span, first + i / (span * span));
+    }
+    
+    int faces = 0, differ = 0;
+    for (int i = 0; i < count; i++) {
+        const int c[3] = { i % span, i / span % span, i / (span * span) };
+        const int step[3] = { 1, span, span * span };
+        for (int axis = 0; axis < 3; axis++) {
+            if (c[axis] + 1 == span) continue;
+            faces++;
+            differ += !chunk_seam_matches(chunks[i], chunks[i + step[axis]], axis);
+        }
+    }
+    
+    int ok = differ == 0;
+    printf("world seams %d^3 chunks from %d: %d of %d shared faces differ%s\n", span, first, differ, faces,
+           ok ? "" : "  MISMATCH");
+    
+    for (int i = 0; i < count; i++) {
+        free_cave(chunks[i]);
+    }
+    free(chunks);
+    free_cave(scratch);
+    return ok;
+}
+
+int run_benchmarks(void) {
+    int ok = 1;
+    
+    printf("Cave Dweller benchmarks\n");
+    ok &= bench_smoothing(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    ok &= bench_smoothing(512, 512, 512);
+    ok &= bench_noise(512);
+    ok &= bench_textures(512);
+    ok &= bench_texture_formats(512);
+    ok &= bench_surface_maps(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+    ok &= bench_surface_maps(4096, 4096, CAVE_DEPTH);
+    ok &= bench_carving(256, 64, 200);
+    ok &= bench_meshing();
+    ok &= bench_smooth_meshing(8);
+    ok &= bench_digging(200);
+    ok &= bench_culling(16);
+    ok &= bench_gem_instances(100000);
+    ok &= bench_gem_grid(100000, 2000);
+    ok &= bench_placement(100000);
+    ok &= bench_spawn(8, 0.3f);
+    ok &= bench_poisson(384, 100000, 1000);
+    ok &= bench_distance_field(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH, 200, 1000000);
+    ok &= bench_distance_field(256, 256, 256, 50, 0);
+    ok &= bench_sweep(100000);
+    ok &= bench_crystal_instances(10000);
+    ok &= bench_svo(2048, 1000, 200);
+    ok &= bench_cave_file(512);
+    ok &= bench_world();
+    ok &= bench_world_seams(12, -6);
+    ok &= bench_world_seams(12, 1000000);
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+/*
+ * bench.h - Headless Generation Benchmarks
+ * Run with: ./cave_dweller --bench
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Runs every benchmark and prints timings; returns a process exit code
+int run_benchmarks(void);
+
+// Wall-clock time in milliseconds
+double bench_now_ms(void);
+
+#endif // BENCH_H
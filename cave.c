@@ -5,9 +5,15 @@
 #include "cave.h"
 #include "shaders.h"
 #include "lighting.h"
+#include "parallel.h"
+#include "rng.h"
+#include "texcache.h"
+#include "poisson.h"
+#include <limits.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
-#include <time.h>
+#include <pthread.h>
 
 #ifdef __APPLE__
 #include <OpenGL/glu.h>
@@ -15,6 +21,11 @@
 #include <GL/glu.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define CAVE_SSE2 1
+#endif
+
 // Matrix helper functions (only the ones not in lighting.h)
 void matrix_scale(float* m, float sx, float sy, float sz) {
     float s[16];
@@ -32,101 +43,76 @@ GLuint generate_roughness_texture(int width, int height);
 GLuint generate_ao_texture(int width, int height);
 GLuint generate_crystal_emissive_texture(int width, int height);
 
-// Perlin noise implementation
-static int p[512];
-static int permutation[] = { 151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-    190,6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,68,175,
-    74,165,71,134,139,48,27,166,77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,102,143,54,65,25,63,
-    161,1,216,80,73,209,76,132,187,208,89,18,169,200,196,135,130,116,188,159,86,164,100,109,198,173,186,3,64,52,217,226,250,124,
-    123,5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,223,183,170,213,119,248,152,2,44,154,163,70,
-    221,153,101,155,167,43,172,9,129,22,39,253,19,98,108,110,79,113,224,232,178,185,112,104,218,246,97,228,251,34,242,193,238,
-    210,144,12,191,179,162,241,81,51,145,235,249,14,239,107,49,192,214,31,181,199,106,157,184,84,204,176,115,121,50,45,127,4,
-    150,254,138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
-
-static void init_perlin() {
-    static int initialized = 0;
-    if (!initialized) {
-        for (int i = 0; i < 256; i++) {
-            p[256 + i] = p[i] = permutation[i];
-        }
-        initialized = 1;
-    }
-}
-
-static double fade(double t) {
-    return t * t * t * (t * (t * 6 - 15) + 10);
-}
-
-static double lerp(double t, double a, double b) {
-    return a + t * (b - a);
-}
-
-static double grad(int hash, double x, double y, double z) {
-    int h = hash & 15;
-    double u = h < 8 ? x : y;
-    double v = h < 4 ? y : h == 12 || h == 14 ? x : z;
-    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+// Aligned allocation for the voxel block
+static void* cave_aligned_alloc(size_t size) {
+    size = (size + CAVE_VOXEL_ALIGNMENT - 1) & ~(size_t)(CAVE_VOXEL_ALIGNMENT - 1);
+#ifdef _WIN32
+    return _aligned_malloc(size, CAVE_VOXEL_ALIGNMENT);
+#else
+    return aligned_alloc(CAVE_VOXEL_ALIGNMENT, size);
+#endif
 }
 
-float perlin_noise_3d(float x, float y, float z) {
-    init_perlin();
-    
-    int X = (int)floor(x) & 255;
-    int Y = (int)floor(y) & 255;
-    int Z = (int)floor(z) & 255;
-    
-    x -= floor(x);
-    y -= floor(y);
-    z -= floor(z);
-    
-    double u = fade(x);
-    double v = fade(y);
-    double w = fade(z);
-    
-    int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
-    int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
-    
-    return lerp(w, lerp(v, lerp(u, grad(p[AA], x, y, z),
-                                   grad(p[BA], x - 1, y, z)),
-                           lerp(u, grad(p[AB], x, y - 1, z),
-                                   grad(p[BB], x - 1, y - 1, z))),
-                   lerp(v, lerp(u, grad(p[AA + 1], x, y, z - 1),
-                                   grad(p[BA + 1], x - 1, y, z - 1)),
-                           lerp(u, grad(p[AB + 1], x, y - 1, z - 1),
-                                   grad(p[BB + 1], x - 1, y - 1, z - 1))));
+static void cave_aligned_free(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
 }
 
-float fractal_noise_3d(float x, float y, float z, int octaves, float persistence) {
-    float total = 0;
-    float frequency = 1;
-    float amplitude = 1;
-    float maxValue = 0;
-    
-    for (int i = 0; i < octaves; i++) {
-        total += perlin_noise_3d(x * frequency, y * frequency, z * frequency) * amplitude;
-        maxValue += amplitude;
-        amplitude *= persistence;
-        frequency *= 2;
+// Halo around interior slices [z0, z1), plus the halo slice below or above
+// when the range reaches it; air fills the interior too in the same pass
+static void fill_cave_slices(Cave* cave, int z0, int z1, int air) {
+    const int width = cave->width;
+    const int height = cave->height;
+    
+    if (z0 == 0) {
+        memset(cave->voxels, VOXEL_WALL, cave->stride_z);
+    }
+    if (z1 == cave->depth) {
+        memset(&cave->voxels[cave->voxel_count - cave->stride_z], VOXEL_WALL, cave->stride_z);
+    }
+    for (int z = z0; z < z1; z++) {
+        unsigned char* slice = &cave->voxels[(size_t)(z + 1) * cave->stride_z];
+        memset(slice, VOXEL_WALL, cave->stride_y);
+        for (int y = 0; y < height; y++) {
+            unsigned char* row = &slice[(size_t)(y + 1) * cave->stride_y];
+            row[0] = VOXEL_WALL;
+            if (air) memset(row + 1, VOXEL_AIR, width);
+            row[width + 1] = VOXEL_WALL;
+        }
+        memset(&slice[(size_t)(height + 1) * cave->stride_y], VOXEL_WALL, cave->stride_y);
     }
-    
-    return total / maxValue;
 }
 
 // Cave generation
-Cave* create_cave(int width, int height, int depth) {
+Cave* create_cave_unfilled(int width, int height, int depth) {
     Cave* cave = (Cave*)malloc(sizeof(Cave));
     cave->width = width;
     cave->height = height;
     cave->depth = depth;
-    
-    // Allocate 3D map
-    cave->map = (int***)malloc(depth * sizeof(int**));
-    for (int z = 0; z < depth; z++) {
-        cave->map[z] = (int**)malloc(height * sizeof(int*));
-        for (int y = 0; y < height; y++) {
-            cave->map[z][y] = (int*)calloc(width, sizeof(int));
-        }
-    }
+    cave->seed = 0;
+    cave->respawn_count = 0;
+    cave->dirty = 0;
+    cave->surface = NULL;
+    cave->surface_stale = 0;
+    cave->distance = NULL;
+    cave->distance_stale = 0;
+    
+    // Allocate padded 3D map; the halo stays solid wall forever
+    cave->stride_y = width + 2;
+    cave->stride_z = cave->stride_y * (height + 2);
+    cave->voxel_count = (size_t)cave->stride_z * (depth + 2);
+    cave->voxels = (unsigned char*)cave_aligned_alloc(cave->voxel_count);
+    
+    // Smoothing buffers: a second voxel block to swap with (made by the first
+    // smoothing pass, so caves that are never smoothed don't pay for it), plus
+    // four slices of partial sums per worker (one x-sum slice and a ring of
+    // three xy-sum slices)
+    cave->back_buffer = NULL;
+    cave->sum_slice_sets = parallel_thread_count();
+    cave->sum_slices = (unsigned char*)cave_aligned_alloc((size_t)cave->stride_z * 4 * cave->sum_slice_sets);
     
     // Allocate height map and normal map
     cave->height_map = (float*)calloc(width * height, sizeof(float));
@@ -135,37 +121,72 @@ Cave* create_cave(int width, int height, int depth) {
     return cave;
 }
 
+Cave* create_cave(int width, int height, int depth) {
+    Cave* cave = create_cave_unfilled(width, height, depth);
+    
+    // One pass over the block: halo slices whole, then row by row the halo
+    // voxel ends around a run of air
+    fill_cave_slices(cave, 0, depth, 1);
+    return cave;
+}
+
+void cave_seal_slices(Cave* cave, int z0, int z1) {
+    fill_cave_slices(cave, z0, z1, 0);
+}
+
 void free_cave(Cave* cave) {
     if (cave) {
-        for (int z = 0; z < cave->depth; z++) {
-            for (int y = 0; y < cave->height; y++) {
-                free(cave->map[z][y]);
-            }
-            free(cave->map[z]);
-        }
-        free(cave->map);
+        cave_aligned_free(cave->voxels);
+        cave_aligned_free(cave->back_buffer);
+        cave_aligned_free(cave->sum_slices);
         free(cave->height_map);
         free(cave->normal_map);
+        if (cave->surface) free(cave->surface->voxels);
+        free(cave->surface);
+        free(cave->distance);
         free(cave);
     }
 }
 
-void generate_cave_3d(Cave* cave) {
-    srand(time(NULL));
+// Random fill of slices [begin, end); voxel n of the grid always draws value n of the fill stream
+static void fill_noise_slab(void* ctx, int begin, int end, int chunk) {
+    Cave* cave = (Cave*)ctx;
+    uint64_t key = rng_key(cave->seed, RNG_STREAM_FILL, 0);
+    (void)chunk;
     
-    // Initialize with random noise
-    for (int z = 0; z < cave->depth; z++) {
+    for (int z = begin; z < end; z++) {
         for (int y = 0; y < cave->height; y++) {
+            unsigned char* row = &cave->voxels[cave_index(cave, 0, y, z)];
+            uint64_t n = ((uint64_t)z * cave->height + y) * cave->width;
             for (int x = 0; x < cave->width; x++) {
-                cave->map[z][y][x] = (rand() % 100 < WALL_THRESHOLD_PERCENTAGE) ? 1 : 0;
+                row[x] = (rng_range(rng_at(key, n + x), 100) < WALL_THRESHOLD_PERCENTAGE) ? VOXEL_WALL : VOXEL_AIR;
             }
         }
     }
+}
+
+void fill_cave_noise(Cave* cave) {
+    parallel_for(cave->depth, fill_noise_slab, cave);
+}
+
+// Grow the box the distance field has to patch; padded coordinates, so the
+// whole block is [-1, dim]
+static void mark_distance_stale(Cave* cave, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const int lo[3] = { x0, y0, z0 };
+    const int hi[3] = { x1, y1, z1 };
+    for (int i = 0; i < 3; i++) {
+        if (!cave->distance_stale || lo[i] < cave->distance_lo[i]) cave->distance_lo[i] = lo[i];
+        if (!cave->distance_stale || hi[i] > cave->distance_hi[i]) cave->distance_hi[i] = hi[i];
+    }
+    cave->distance_stale = 1;
+}
+
+void generate_cave_3d(Cave* cave) {
+    // Initialize with random noise
+    fill_cave_noise(cave);
     
     // Apply cellular automata rules
-    for (int i = 0; i < SMOOTHING_ITERATIONS; i++) {
-        smooth_cave(cave);
-    }
+    smooth_cave_iterations(cave, SMOOTHING_ITERATIONS);
     
     // Carve out interior space
     carve_cave_interior(cave);
@@ -173,106 +194,699 @@ void generate_cave_3d(Cave* cave) {
     // Generate terrain features
     generate_height_map(cave);
     generate_normal_map(cave);
+    
+    // Placement candidates and distances of any earlier voxels no longer apply
+    cave->surface_stale = 1;
+    mark_distance_stale(cave, -1, -1, -1, cave->width, cave->height, cave->depth);
 }
 
-void smooth_cave(Cave* cave) {
-    int*** new_map = (int***)malloc(cave->depth * sizeof(int**));
-    for (int z = 0; z < cave->depth; z++) {
-        new_map[z] = (int**)malloc(cave->height * sizeof(int*));
-        for (int y = 0; y < cave->height; y++) {
-            new_map[z][y] = (int*)malloc(cave->width * sizeof(int));
+// Sum each voxel of slice z with its x and y neighbours (3x3 box) into out
+static void sum_slice_xy(const Cave* cave, int z, unsigned char* restrict xsum,
+                         unsigned char* restrict out) {
+    const int w = cave->width;
+    const ptrdiff_t sy = cave->stride_y;
+    
+    // Pass 1: running sum along x
+    for (int y = 0; y < cave->height; y++) {
+        const unsigned char* restrict in = &cave->voxels[cave_index(cave, 0, y, z)];
+        unsigned char* restrict xs = &xsum[(size_t)(y + 1) * sy + 1];
+        for (int x = 1; x < w - 1; x++) {
+            xs[x] = in[x - 1] + in[x] + in[x + 1];
         }
     }
     
-    for (int z = 1; z < cave->depth - 1; z++) {
+    // Pass 2: running sum along y
+    for (int y = 1; y < cave->height - 1; y++) {
+        size_t row = (size_t)(y + 1) * sy + 1;
+        const unsigned char* restrict above = &xsum[row - sy];
+        const unsigned char* restrict mid = &xsum[row];
+        const unsigned char* restrict below = &xsum[row + sy];
+        unsigned char* restrict ys = &out[row];
+        for (int x = 1; x < w - 1; x++) {
+            ys[x] = above[x] + mid[x] + below[x];
+        }
+    }
+}
+
+// Smooth slices [begin + 1, end + 1) using this chunk's scratch slices
+static void smooth_scalar_slab(void* ctx, int begin, int end, int chunk) {
+    Cave* cave = (Cave*)ctx;
+    const int w = cave->width;
+    const size_t slice = (size_t)cave->stride_z;
+    const unsigned char* src = cave->voxels;
+    unsigned char* dst = cave->back_buffer;
+    unsigned char* scratch = cave->sum_slices + slice * 4 * chunk;
+    unsigned char* xsum = scratch;
+    unsigned char* ring[3] = { scratch + slice, scratch + slice * 2, scratch + slice * 3 };
+    int z0 = begin + 1;
+    int z1 = end + 1;
+    
+    // Third pass runs along z over a ring of three xy-sum slices
+    sum_slice_xy(cave, z0 - 1, xsum, ring[(z0 - 1) % 3]);
+    sum_slice_xy(cave, z0, xsum, ring[z0 % 3]);
+    
+    for (int z = z0; z < z1; z++) {
+        sum_slice_xy(cave, z + 1, xsum, ring[(z + 1) % 3]);
+        const unsigned char* restrict s0 = ring[(z - 1) % 3];
+        const unsigned char* restrict s1 = ring[z % 3];
+        const unsigned char* restrict s2 = ring[(z + 1) % 3];
+        
         for (int y = 1; y < cave->height - 1; y++) {
-            for (int x = 1; x < cave->width - 1; x++) {
-                int wall_count = 0;
-                
-                // Count surrounding walls in 3x3x3 cube
-                for (int nz = z - 1; nz <= z + 1; nz++) {
-                    for (int ny = y - 1; ny <= y + 1; ny++) {
-                        for (int nx = x - 1; nx <= x + 1; nx++) {
-                            if (nz != z || ny != y || nx != x) {
-                                wall_count += cave->map[nz][ny][nx];
-                            }
-                        }
-                    }
-                }
+            size_t local = (size_t)(y + 1) * cave->stride_y + 1;
+            size_t row = cave_index(cave, 0, y, z);
+            const unsigned char* restrict in = &src[row];
+            unsigned char* restrict out = &dst[row];
+            for (int x = 1; x < w - 1; x++) {
+                // Box sum includes the centre voxel, so remove it to get the 26 neighbours
+                unsigned char wall_count = s0[local + x] + s1[local + x] + s2[local + x] - in[x];
                 
                 // Apply cellular automata rules
-                new_map[z][y][x] = (wall_count > 13) ? 1 : 0;
+                out[x] = (wall_count > 13) ? VOXEL_WALL : VOXEL_AIR;
             }
         }
     }
+}
+
+static void smooth_cave_scalar_pass(Cave* cave) {
+    const int w = cave->width;
     
-    // Copy back
-    for (int z = 1; z < cave->depth - 1; z++) {
-        for (int y = 1; y < cave->height - 1; y++) {
-            memcpy(cave->map[z][y], new_map[z][y], cave->width * sizeof(int));
-        }
+    // The back buffer starts as a copy so its halo is wall like the front's
+    if (!cave->back_buffer) {
+        cave->back_buffer = (unsigned char*)cave_aligned_alloc(cave->voxel_count);
+        memcpy(cave->back_buffer, cave->voxels, cave->voxel_count);
+    }
+    
+    const unsigned char* src = cave->voxels;
+    unsigned char* dst = cave->back_buffer;
+    
+    // One set of scratch slices per worker
+    int sets = parallel_thread_count();
+    if (sets > cave->sum_slice_sets) {
+        cave_aligned_free(cave->sum_slices);
+        cave->sum_slices = (unsigned char*)cave_aligned_alloc((size_t)cave->stride_z * 4 * sets);
+        cave->sum_slice_sets = sets;
     }
     
-    // Free temporary map
+    // The outer shell of the grid is never smoothed; carry it over unchanged
     for (int z = 0; z < cave->depth; z++) {
         for (int y = 0; y < cave->height; y++) {
-            free(new_map[z][y]);
+            size_t row = cave_index(cave, 0, y, z);
+            if (z == 0 || z == cave->depth - 1 || y == 0 || y == cave->height - 1) {
+                memcpy(&dst[row], &src[row], w);
+            } else {
+                dst[row] = src[row];
+                dst[row + w - 1] = src[row + w - 1];
+            }
         }
-        free(new_map[z]);
     }
-    free(new_map);
+    
+    // Interior slices are split into z-slabs across the workers
+    parallel_for(cave->depth - 2, smooth_scalar_slab, cave);
+    
+    // Swap front and back buffers
+    cave->back_buffer = cave->voxels;
+    cave->voxels = dst;
 }
 
-void generate_height_map(Cave* cave) {
-    for (int y = 0; y < cave->height; y++) {
-        for (int x = 0; x < cave->width; x++) {
-            float base_height = 0.0f;
-            
-            // Sample multiple layers of the cave to determine height
-            for (int z = 0; z < cave->depth; z++) {
-                if (cave->map[z][y][x] == 0) {  // Empty space
-                    base_height += 0.02f;
-                }
-            }
+void smooth_cave_scalar(Cave* cave, int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        smooth_cave_scalar_pass(cave);
+    }
+}
+
+// Bit-sliced engine: each x-row is packed into 64-bit words, one voxel per bit,
+// and neighbour counts are kept as bit planes added with full-adder logic.
+// Planes for a slice are stored plane-major: plane p of row y at (p * height + y) * words.
+
+// Majority of three bit vectors (carry out of a full adder)
+static inline uint64_t bit_majority(uint64_t a, uint64_t b, uint64_t c) {
+    return (a & b) | (c & (a ^ b));
+}
+
+// Sum of each voxel with its x neighbours (0..3) as two bit planes
+static void bitsliced_sum_x(const uint64_t* restrict row, int words,
+                            uint64_t* restrict h0, uint64_t* restrict h1) {
+    for (int k = 0; k < words; k++) {
+        uint64_t c = row[k];
+        uint64_t west = (c << 1) | (k > 0 ? row[k - 1] >> 63 : 0);
+        uint64_t east = (c >> 1) | (k + 1 < words ? row[k + 1] << 63 : 0);
+        h0[k] = west ^ c ^ east;
+        h1[k] = bit_majority(west, c, east);
+    }
+}
+
+// 3x3 box sum of every row of a packed slice (0..9) as four bit planes
+static void bitsliced_sum_xy(const uint64_t* restrict slice, int height, int words,
+                             uint64_t* restrict hsum, uint64_t* restrict out) {
+    const size_t plane = (size_t)height * words;
+    
+    for (int y = 0; y < height; y++) {
+        bitsliced_sum_x(&slice[(size_t)y * words], words,
+                        &hsum[(size_t)y * words], &hsum[plane + (size_t)y * words]);
+    }
+    
+    for (int y = 1; y < height - 1; y++) {
+        const uint64_t* a0 = &hsum[(size_t)(y - 1) * words];
+        const uint64_t* b0 = &hsum[(size_t)y * words];
+        const uint64_t* c0 = &hsum[(size_t)(y + 1) * words];
+        const uint64_t* a1 = a0 + plane;
+        const uint64_t* b1 = b0 + plane;
+        const uint64_t* c1 = c0 + plane;
+        uint64_t* s0 = &out[(size_t)y * words];
+        uint64_t* s1 = s0 + plane;
+        uint64_t* s2 = s1 + plane;
+        uint64_t* s3 = s2 + plane;
+        
+        for (int k = 0; k < words; k++) {
+            // a + b -> three bits
+            uint64_t r0 = a0[k] ^ b0[k];
+            uint64_t carry = a0[k] & b0[k];
+            uint64_t r1 = a1[k] ^ b1[k] ^ carry;
+            uint64_t r2 = bit_majority(a1[k], b1[k], carry);
             
-            // Add procedural detail
-            float noise = fractal_noise_3d(x * 0.1f, y * 0.1f, 0.0f, 4, 0.5f);
-            float detail = fractal_noise_3d(x * 0.5f, y * 0.5f, 0.0f, 2, 0.3f);
+            // + c -> four bits
+            s0[k] = r0 ^ c0[k];
+            carry = r0 & c0[k];
+            s1[k] = r1 ^ c1[k] ^ carry;
+            carry = bit_majority(r1, c1[k], carry);
+            s2[k] = r2 ^ carry;
+            s3[k] = r2 & carry;
+        }
+    }
+}
+
+// Shared state of one bit-sliced smoothing pass
+typedef struct {
+    const uint64_t* src;
+    uint64_t* dst;
+    const uint64_t* interior;  // Mask of the x positions that get updated
+    uint64_t* scratch;         // Per-chunk hsum planes and xy-sum ring
+    const Cave* cave;
+    int words;
+} BitslicedJob;
+
+// Scratch words one chunk needs: two hsum planes and a ring of three four-plane slices
+static size_t bitsliced_scratch_words(int height, int words) {
+    return (size_t)height * words * (2 + 4 * 3);
+}
+
+// Smooth packed slices [begin + 1, end + 1)
+static void bitsliced_slab(void* ctx, int begin, int end, int chunk) {
+    const BitslicedJob* job = (const BitslicedJob*)ctx;
+    const int h = job->cave->height;
+    const int words = job->words;
+    const size_t row_stride = words;
+    const size_t slice_stride = (size_t)h * words;
+    const size_t plane = slice_stride;
+    const uint64_t* src = job->src;
+    uint64_t* dst = job->dst;
+    uint64_t* hsum = job->scratch + bitsliced_scratch_words(h, words) * chunk;
+    uint64_t* ring[3] = { hsum + slice_stride * 2, hsum + slice_stride * 6, hsum + slice_stride * 10 };
+    int z0 = begin + 1;
+    int z1 = end + 1;
+    
+    bitsliced_sum_xy(&src[(z0 - 1) * slice_stride], h, words, hsum, ring[(z0 - 1) % 3]);
+    bitsliced_sum_xy(&src[z0 * slice_stride], h, words, hsum, ring[z0 % 3]);
+    
+    for (int z = z0; z < z1; z++) {
+        bitsliced_sum_xy(&src[(z + 1) * slice_stride], h, words, hsum, ring[(z + 1) % 3]);
+        const uint64_t* restrict va = ring[(z - 1) % 3];
+        const uint64_t* restrict vb = ring[z % 3];
+        const uint64_t* restrict vc = ring[(z + 1) % 3];
+        
+        for (int y = 1; y < h - 1; y++) {
+            size_t local = (size_t)y * row_stride;
+            const uint64_t* restrict centre = &src[z * slice_stride + local];
+            uint64_t* restrict out = &dst[z * slice_stride + local];
             
-            cave->height_map[y * cave->width + x] = base_height + noise * 0.3f + detail * 0.1f;
+            for (int k = 0; k < words; k++) {
+                size_t i = local + k;
+                
+                // a + b -> five bits
+                uint64_t t0 = va[i] ^ vb[i];
+                uint64_t carry = va[i] & vb[i];
+                uint64_t t1 = va[i + plane] ^ vb[i + plane] ^ carry;
+                carry = bit_majority(va[i + plane], vb[i + plane], carry);
+                uint64_t t2 = va[i + 2 * plane] ^ vb[i + 2 * plane] ^ carry;
+                carry = bit_majority(va[i + 2 * plane], vb[i + 2 * plane], carry);
+                uint64_t t3 = va[i + 3 * plane] ^ vb[i + 3 * plane] ^ carry;
+                uint64_t t4 = bit_majority(va[i + 3 * plane], vb[i + 3 * plane], carry);
+                
+                // + c -> five bits (box sum is at most 27)
+                uint64_t u0 = t0 ^ vc[i];
+                carry = t0 & vc[i];
+                uint64_t u1 = t1 ^ vc[i + plane] ^ carry;
+                carry = bit_majority(t1, vc[i + plane], carry);
+                uint64_t u2 = t2 ^ vc[i + 2 * plane] ^ carry;
+                carry = bit_majority(t2, vc[i + 2 * plane], carry);
+                uint64_t u3 = t3 ^ vc[i + 3 * plane] ^ carry;
+                carry = bit_majority(t3, vc[i + 3 * plane], carry);
+                uint64_t u4 = t4 ^ carry;
+                
+                // 26-neighbour count > 13  <=>  box sum >= 14 + centre
+                uint64_t wall = u4 | (u3 & u2 & u1 & (u0 | ~centre[k]));
+                out[k] = (wall & job->interior[k]) | (centre[k] & ~job->interior[k]);
+            }
+        }
+    }
+}
+
+static void bitsliced_pass(BitslicedJob* job) {
+    const int h = job->cave->height;
+    const int d = job->cave->depth;
+    const size_t row_stride = job->words;
+    const size_t slice_stride = (size_t)h * job->words;
+    const uint64_t* src = job->src;
+    uint64_t* dst = job->dst;
+    
+    // The outer shell of the grid is never smoothed; carry it over unchanged
+    memcpy(dst, src, slice_stride * sizeof(uint64_t));
+    memcpy(&dst[(d - 1) * slice_stride], &src[(d - 1) * slice_stride],
+           slice_stride * sizeof(uint64_t));
+    for (int z = 1; z < d - 1; z++) {
+        memcpy(&dst[z * slice_stride], &src[z * slice_stride], row_stride * sizeof(uint64_t));
+        memcpy(&dst[z * slice_stride + (h - 1) * row_stride],
+               &src[z * slice_stride + (h - 1) * row_stride], row_stride * sizeof(uint64_t));
+    }
+    
+    parallel_for(d - 2, bitsliced_slab, job);
+}
+
+// Gather eight 0/1 voxel bytes into eight bits with one multiply (little-endian)
+static inline uint64_t bitsliced_pack8(const unsigned char* in) {
+    uint64_t v;
+    memcpy(&v, in, sizeof(v));
+    return ((v & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+}
+
+// Spread eight bits back out to eight 0/1 voxel bytes
+static inline void bitsliced_unpack8(uint64_t bits, unsigned char* out) {
+    uint64_t v = (bits * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+    v = ((v + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+    memcpy(out, &v, sizeof(v));
+}
+
+// Pack the voxel bytes of slices [begin, end) into bits
+static void bitsliced_pack_slab(void* ctx, int begin, int end, int chunk) {
+    BitslicedJob* job = (BitslicedJob*)ctx;
+    const Cave* cave = job->cave;
+    const int w = cave->width;
+    const size_t slice_words = (size_t)cave->height * job->words;
+    (void)chunk;
+    
+    for (int z = begin; z < end; z++) {
+        for (int y = 0; y < cave->height; y++) {
+            const unsigned char* in = &cave->voxels[cave_index(cave, 0, y, z)];
+            uint64_t* out = &job->dst[z * slice_words + (size_t)y * job->words];
+            int x = 0;
+            for (; x + 8 <= w; x += 8) {
+                out[x >> 6] |= bitsliced_pack8(&in[x]) << (x & 63);
+            }
+            for (; x < w; x++) {
+                out[x >> 6] |= (uint64_t)(in[x] & 1) << (x & 63);
+            }
         }
     }
 }
 
+// Unpack the bits of slices [begin, end) back into voxel bytes
+static void bitsliced_unpack_slab(void* ctx, int begin, int end, int chunk) {
+    BitslicedJob* job = (BitslicedJob*)ctx;
+    const Cave* cave = job->cave;
+    const int w = cave->width;
+    const size_t slice_words = (size_t)cave->height * job->words;
+    (void)chunk;
+    
+    for (int z = begin; z < end; z++) {
+        for (int y = 0; y < cave->height; y++) {
+            const uint64_t* in = &job->src[z * slice_words + (size_t)y * job->words];
+            unsigned char* out = &cave->voxels[cave_index(cave, 0, y, z)];
+            int x = 0;
+            for (; x + 8 <= w; x += 8) {
+                bitsliced_unpack8((in[x >> 6] >> (x & 63)) & 0xFF, &out[x]);
+            }
+            for (; x < w; x++) {
+                out[x] = (unsigned char)((in[x >> 6] >> (x & 63)) & 1);
+            }
+        }
+    }
+}
+
+void smooth_cave_bitsliced(Cave* cave, int iterations) {
+    const int w = cave->width;
+    const int h = cave->height;
+    const int d = cave->depth;
+    if (iterations <= 0 || w < 3 || h < 3 || d < 3) return;
+    
+    const int words = (w + 63) / 64;
+    const size_t total_words = (size_t)h * words * d;
+    
+    uint64_t* grids[2];
+    grids[0] = (uint64_t*)calloc(total_words, sizeof(uint64_t));
+    grids[1] = (uint64_t*)calloc(total_words, sizeof(uint64_t));
+    uint64_t* interior = (uint64_t*)calloc(words, sizeof(uint64_t));
+    
+    // Only voxels 1..w-2 of a row are updated
+    for (int x = 1; x < w - 1; x++) {
+        interior[x >> 6] |= 1ULL << (x & 63);
+    }
+    
+    BitslicedJob job = {
+        .interior = interior,
+        .scratch = (uint64_t*)calloc(bitsliced_scratch_words(h, words) * parallel_thread_count(),
+                                     sizeof(uint64_t)),
+        .cave = cave,
+        .words = words
+    };
+    
+    // Pack bytes into bits
+    job.dst = grids[0];
+    parallel_for(d, bitsliced_pack_slab, &job);
+    
+    int current = 0;
+    for (int i = 0; i < iterations; i++) {
+        job.src = grids[current];
+        job.dst = grids[current ^ 1];
+        bitsliced_pass(&job);
+        current ^= 1;
+    }
+    
+    // Unpack bits back into bytes
+    job.src = grids[current];
+    parallel_for(d, bitsliced_unpack_slab, &job);
+    
+    free(grids[0]);
+    free(grids[1]);
+    free(interior);
+    free(job.scratch);
+}
+
+static SmoothEngine smooth_engine = SMOOTH_ENGINE_SCALAR;
+
+void set_smooth_engine(SmoothEngine engine) {
+    smooth_engine = engine;
+}
+
+SmoothEngine get_smooth_engine(void) {
+    return smooth_engine;
+}
+
+void smooth_cave_iterations(Cave* cave, int iterations) {
+    if (smooth_engine == SMOOTH_ENGINE_BITSLICED) {
+        smooth_cave_bitsliced(cave, iterations);
+    } else {
+        smooth_cave_scalar(cave, iterations);
+    }
+}
+
+void smooth_cave(Cave* cave) {
+    smooth_cave_iterations(cave, 1);
+}
+
+// Height map texels [x0, x1] of row y; noise and detail hold the row's noise.
+// The column scan runs slice by slice over contiguous rows, adding each
+// layer's air into the height row, so every z step is a straight streaming
+// pass that vectorises; the sums happen in the same order as a per-column walk.
+static void height_map_span(Cave* cave, int y, int x0, int x1, const float* noise, const float* detail) {
+    float* restrict heights = &cave->height_map[y * cave->width];
+    for (int x = x0; x <= x1; x++) {
+        heights[x] = 0.0f;
+    }
+    
+    // Sample multiple layers of the cave to determine height
+    const unsigned char* layer = &cave->voxels[cave_index(cave, 0, y, 0)];
+    for (int z = 0; z < cave->depth; z++, layer += cave->stride_z) {
+        const unsigned char* restrict row = layer;
+        for (int x = x0; x <= x1; x++) {
+            heights[x] += row[x] == VOXEL_AIR ? 0.02f : 0.0f;
+        }
+    }
+    
+    for (int x = x0; x <= x1; x++) {
+        heights[x] = heights[x] + noise[x] * 0.3f + detail[x] * 0.1f;
+    }
+}
+
+// Procedural detail for columns [x0, x1] of row y, indexed by x
+static void height_map_noise(const Cave* cave, int y, int x0, int x1, float* noise, float* detail) {
+    fractal_noise_row(noise, cave->width, x0, x1 + 1, y, 0.1f, 0.0f, 4, 0.5f);
+    fractal_noise_row(detail, cave->width, x0, x1 + 1, y, 0.5f, 0.0f, 2, 0.3f);
+}
+
+// Height map rows [begin, end)
+static void height_map_rows(void* ctx, int begin, int end, int chunk) {
+    Cave* cave = (Cave*)ctx;
+    (void)chunk;
+    
+    float* noise = (float*)malloc(cave->width * 2 * sizeof(float));
+    float* detail = noise + cave->width;
+    
+    for (int y = begin; y < end; y++) {
+        height_map_noise(cave, y, 0, cave->width - 1, noise, detail);
+        height_map_span(cave, y, 0, cave->width - 1, noise, detail);
+    }
+    
+    free(noise);
+}
+
+void generate_height_map(Cave* cave) {
+    parallel_for(cave->height, height_map_rows, cave);
+}
+
+// Normal of one texel from the Sobel differences, stored biased into [0, 1]
+static inline void normal_map_texel(float* out, float h_l, float h_r, float h_d, float h_u) {
+    float dx = (h_r - h_l) * 2.0f;
+    float dy = (h_u - h_d) * 2.0f;
+    float dz = 1.0f;
+    
+    // Normalize
+    float len = sqrtf(dx * dx + dy * dy + dz * dz);
+    dx /= len;
+    dy /= len;
+    dz /= len;
+    
+    out[0] = dx * 0.5f + 0.5f;
+    out[1] = dy * 0.5f + 0.5f;
+    out[2] = dz * 0.5f + 0.5f;
+}
+
+#ifdef CAVE_SSE2
+// Four texels per step; IEEE sqrt and division, so every texel matches normal_map_texel
+static int normal_map_span_sse2(Cave* cave, int y, int x0, int x1) {
+    const float* row = &cave->height_map[y * cave->width];
+    const float* below = row - cave->width;
+    const float* above = row + cave->width;
+    float* out = &cave->normal_map[(y * cave->width) * 3];
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    
+    int x = x0;
+    for (; x + 3 <= x1; x += 4) {
+        __m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&row[x + 1]), _mm_loadu_ps(&row[x - 1])), two);
+        __m128 dy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&above[x]), _mm_loadu_ps(&below[x])), two);
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                            _mm_mul_ps(one, one)));
+        __m128 nx = _mm_add_ps(_mm_mul_ps(_mm_div_ps(dx, len), half), half);
+        __m128 ny = _mm_add_ps(_mm_mul_ps(_mm_div_ps(dy, len), half), half);
+        __m128 nz = _mm_add_ps(_mm_mul_ps(_mm_div_ps(one, len), half), half);
+        
+        // Interleave four (x, y, z) triples into three vectors
+        __m128 xy_lo = _mm_unpacklo_ps(nx, ny);     // x0 y0 x1 y1
+        __m128 zx_lo = _mm_unpacklo_ps(nz, nx);     // z0 x0 z1 x1
+        __m128 yz_lo = _mm_unpacklo_ps(ny, nz);     // y0 z0 y1 z1
+        __m128 xy_hi = _mm_unpackhi_ps(nx, ny);     // x2 y2 x3 y3
+        __m128 zx_hi = _mm_unpackhi_ps(nz, nx);     // z2 x2 z3 x3
+        __m128 yz_hi = _mm_unpackhi_ps(ny, nz);     // y2 z2 y3 z3
+        float* texel = &out[x * 3];
+        _mm_storeu_ps(texel, _mm_shuffle_ps(xy_lo, zx_lo, _MM_SHUFFLE(3, 0, 1, 0)));
+        _mm_storeu_ps(texel + 4, _mm_shuffle_ps(yz_lo, xy_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm_storeu_ps(texel + 8, _mm_shuffle_ps(zx_hi, yz_hi, _MM_SHUFFLE(3, 2, 3, 0)));
+    }
+    return x;
+}
+#endif
+
+// Normal map texels [x0, x1] of row y, all inside the one-texel border
+static void normal_map_span(Cave* cave, int y, int x0, int x1) {
+    const float* row = &cave->height_map[y * cave->width];
+    int x = x0;
+#ifdef CAVE_SSE2
+    x = normal_map_span_sse2(cave, y, x0, x1);
+#endif
+    
+    // Calculate normal using Sobel operator
+    for (; x <= x1; x++) {
+        normal_map_texel(&cave->normal_map[(y * cave->width + x) * 3], row[x - 1], row[x + 1],
+                         row[x - cave->width], row[x + cave->width]);
+    }
+}
+
+// Normal map rows [begin + 1, end + 1)
+static void normal_map_rows(void* ctx, int begin, int end, int chunk) {
+    Cave* cave = (Cave*)ctx;
+    (void)chunk;
+    
+    for (int y = begin + 1; y < end + 1; y++) {
+        normal_map_span(cave, y, 1, cave->width - 2);
+    }
+}
+
 void generate_normal_map(Cave* cave) {
-    for (int y = 1; y < cave->height - 1; y++) {
-        for (int x = 1; x < cave->width - 1; x++) {
-            // Calculate normal using Sobel operator
-            float h_l = cave->height_map[y * cave->width + (x - 1)];
-            float h_r = cave->height_map[y * cave->width + (x + 1)];
-            float h_d = cave->height_map[(y - 1) * cave->width + x];
-            float h_u = cave->height_map[(y + 1) * cave->width + x];
+    parallel_for(cave->height - 2, normal_map_rows, cave);
+}
+
+// Carve interior cave system
+// Sphere stamps: for each radius up to CARVE_STAMP_MAX_RADIUS, the x half-width
+// of the ball on every (dy, dz) row, or -1 where the row misses it
+#define CARVE_STAMP_MAX_RADIUS 32
+
+static short* sphere_stamps[CARVE_STAMP_MAX_RADIUS + 1];
+static pthread_once_t sphere_stamps_once = PTHREAD_ONCE_INIT;
+
+// Largest h with h * h <= n, or -1 for negative n
+static int isqrt_floor(int n) {
+    if (n < 0) return -1;
+    int h = (int)sqrt((double)n);
+    while (h * h > n) h--;
+    while ((h + 1) * (h + 1) <= n) h++;
+    return h;
+}
+
+static void init_sphere_stamps(void) {
+    size_t total = 0;
+    for (int r = 0; r <= CARVE_STAMP_MAX_RADIUS; r++) {
+        total += (size_t)(2 * r + 1) * (2 * r + 1);
+    }
+    
+    short* spans = (short*)malloc(total * sizeof(short));
+    for (int r = 0; r <= CARVE_STAMP_MAX_RADIUS; r++) {
+        sphere_stamps[r] = spans;
+        for (int dz = -r; dz <= r; dz++) {
+            for (int dy = -r; dy <= r; dy++) {
+                *spans++ = (short)isqrt_floor(r * r - dy * dy - dz * dz);
+            }
+        }
+    }
+}
+
+void carve_sphere(Cave* cave, int cx, int cy, int cz, int radius, const int lo[3], const int hi[3]) {
+    const short* stamp = NULL;
+    if (radius <= CARVE_STAMP_MAX_RADIUS) {
+        pthread_once(&sphere_stamps_once, init_sphere_stamps);
+        stamp = sphere_stamps[radius];
+    }
+    
+    int y0 = cy - radius < lo[1] ? lo[1] : cy - radius;
+    int z0 = cz - radius < lo[2] ? lo[2] : cz - radius;
+    int y1 = cy + radius > hi[1] ? hi[1] : cy + radius;
+    int z1 = cz + radius > hi[2] ? hi[2] : cz + radius;
+    
+    for (int z = z0; z <= z1; z++) {
+        int dz = z - cz;
+        for (int y = y0; y <= y1; y++) {
+            int dy = y - cy;
+            int half = stamp ? stamp[(dz + radius) * (2 * radius + 1) + dy + radius]
+                             : isqrt_floor(radius * radius - dy * dy - dz * dz);
+            if (half < 0) continue;
             
-            float dx = (h_r - h_l) * 2.0f;
-            float dy = (h_u - h_d) * 2.0f;
-            float dz = 1.0f;
+            // One run per row
+            int x0 = cx - half < lo[0] ? lo[0] : cx - half;
+            int x1 = cx + half > hi[0] ? hi[0] : cx + half;
+            if (x0 <= x1) {
+                memset(&cave->voxels[cave_index(cave, x0, y, z)], VOXEL_AIR, x1 - x0 + 1);
+            }
+        }
+    }
+}
+
+// Widen [*x0, *x1] by the part of row (y, z) inside the ball around c
+static void sphere_row_extent(const float c[3], int y, int z, double r2, double* x0, double* x1) {
+    double rest = r2 - (y - c[1]) * (double)(y - c[1]) - (z - c[2]) * (double)(z - c[2]);
+    if (rest >= 0.0) {
+        double half = sqrt(rest);
+        if (c[0] - half < *x0) *x0 = c[0] - half;
+        if (c[0] + half > *x1) *x1 = c[0] + half;
+    }
+}
+
+void carve_capsule(Cave* cave, const float a[3], const float b[3], float radius,
+                   const int lo[3], const int hi[3]) {
+    double d[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+    double length2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    double r2 = (double)radius * radius;
+    
+    int y0 = (int)ceil(fmin(a[1], b[1]) - radius);
+    int z0 = (int)ceil(fmin(a[2], b[2]) - radius);
+    int y1 = (int)floor(fmax(a[1], b[1]) + radius);
+    int z1 = (int)floor(fmax(a[2], b[2]) + radius);
+    if (y0 < lo[1]) y0 = lo[1];
+    if (z0 < lo[2]) z0 = lo[2];
+    if (y1 > hi[1]) y1 = hi[1];
+    if (z1 > hi[2]) z1 = hi[2];
+    
+    for (int z = z0; z <= z1; z++) {
+        for (int y = y0; y <= y1; y++) {
+            // The capsule is convex, so each row crosses it in one run: the
+            // union of the runs through the two end balls and the cylinder
+            double x0 = INFINITY, x1 = -INFINITY;
+            sphere_row_extent(a, y, z, r2, &x0, &x1);
+            sphere_row_extent(b, y, z, r2, &x0, &x1);
             
-            // Normalize
-            float len = sqrt(dx * dx + dy * dy + dz * dz);
-            dx /= len;
-            dy /= len;
-            dz /= len;
+            if (length2 > 0.0) {
+                // With q = p - a and u = q.x: q.d = u * d.x + c
+                double qy = y - a[1], qz = z - a[2];
+                double c = qy * d[1] + qz * d[2];
+                
+                // Between the end caps: 0 <= q.d <= length2
+                double s0 = -INFINITY, s1 = INFINITY;
+                int inside = 1;
+                if (d[0] != 0.0) {
+                    s0 = fmin(-c / d[0], (length2 - c) / d[0]);
+                    s1 = fmax(-c / d[0], (length2 - c) / d[0]);
+                } else {
+                    inside = c >= 0.0 && c <= length2;
+                }
+                
+                // Distance to the axis: |q|^2 - (q.d)^2 / length2 <= r2, a quadratic in u
+                double qa = 1.0 - d[0] * d[0] / length2;
+                double qb = -2.0 * d[0] * c / length2;
+                double qc = qy * qy + qz * qz - c * c / length2 - r2;
+                if (inside && qa > 1e-12) {
+                    double disc = qb * qb - 4.0 * qa * qc;
+                    if (disc >= 0.0) {
+                        double root = sqrt(disc);
+                        s0 = fmax(s0, (-qb - root) / (2.0 * qa));
+                        s1 = fmin(s1, (-qb + root) / (2.0 * qa));
+                    } else {
+                        inside = 0;
+                    }
+                } else if (inside) {
+                    // Segment along x: the whole slab is in or out
+                    inside = qc <= 0.0;
+                }
+                
+                if (inside && s0 <= s1) {
+                    if (a[0] + s0 < x0) x0 = a[0] + s0;
+                    if (a[0] + s1 > x1) x1 = a[0] + s1;
+                }
+            }
             
-            int idx = (y * cave->width + x) * 3;
-            cave->normal_map[idx + 0] = dx * 0.5f + 0.5f;
-            cave->normal_map[idx + 1] = dy * 0.5f + 0.5f;
-            cave->normal_map[idx + 2] = dz * 0.5f + 0.5f;
+            if (x0 > x1) continue;
+            int first = (int)ceil(x0) < lo[0] ? lo[0] : (int)ceil(x0);
+            int last = (int)floor(x1) > hi[0] ? hi[0] : (int)floor(x1);
+            if (first <= last) {
+                memset(&cave->voxels[cave_index(cave, first, y, z)], VOXEL_AIR, last - first + 1);
+            }
         }
     }
 }
 
-// Carve interior cave system
 void carve_cave_interior(Cave* cave) {
+    // Carving never touches the outermost layer of the grid
+    const int lo[3] = { 1, 1, 1 };
+    const int hi[3] = { cave->width - 2, cave->height - 2, cave->depth - 2 };
+    
     // Create main chamber in center
     int center_x = cave->width / 2;
     int center_y = cave->height / 2;
@@ -280,71 +894,41 @@ void carve_cave_interior(Cave* cave) {
     int chamber_radius = 15;
     
     // Carve main chamber
-    for (int z = center_z - chamber_radius; z < center_z + chamber_radius; z++) {
-        for (int y = center_y - chamber_radius; y < center_y + chamber_radius; y++) {
-            for (int x = center_x - chamber_radius; x < center_x + chamber_radius; x++) {
-                if (x > 0 && x < cave->width - 1 &&
-                    y > 0 && y < cave->height - 1 &&
-                    z > 0 && z < cave->depth - 1) {
-                    float dist = sqrt(pow(x - center_x, 2) + pow(y - center_y, 2) + pow(z - center_z, 2));
-                    if (dist < chamber_radius) {
-                        cave->map[z][y][x] = 0;  // Empty space
-                    }
-                }
-            }
-        }
-    }
+    carve_sphere(cave, center_x, center_y, center_z, chamber_radius, lo, hi);
     
-    // Carve tunnels
-    int num_tunnels = 6 + rand() % 4;
+    // Carve tunnels; each tunnel walks its own random stream
+    Rng rng = rng_stream(cave->seed, RNG_STREAM_CARVE, 0);
+    int num_tunnels = 6 + rng_int(&rng, 4);
     for (int t = 0; t < num_tunnels; t++) {
-        int start_x = center_x;
-        int start_y = center_y;
-        int start_z = center_z;
+        Rng tunnel = rng_stream(cave->seed, RNG_STREAM_TUNNEL, t);
         
         // Random direction
-        float angle_h = (rand() % 360) * M_PI / 180.0f;
-        float angle_v = ((rand() % 60) - 30) * M_PI / 180.0f;
+        float angle_h = rng_int(&tunnel, 360) * M_PI / 180.0f;
+        float angle_v = (rng_int(&tunnel, 60) - 30) * M_PI / 180.0f;
         float dx = cos(angle_h) * cos(angle_v);
         float dy = sin(angle_v);
         float dz = sin(angle_h) * cos(angle_v);
         
-        // Carve tunnel
-        float x = start_x, y = start_y, z = start_z;
-        int tunnel_length = 20 + rand() % 30;
+        // Sweep a capsule along each step of the walk
+        float pos[3] = { (float)center_x, (float)center_y, (float)center_z };
+        float prev[3] = { pos[0], pos[1], pos[2] };
+        int tunnel_length = 20 + rng_int(&tunnel, 30);
         
         for (int i = 0; i < tunnel_length; i++) {
-            int ix = (int)x, iy = (int)y, iz = (int)z;
-            
-            // Carve a sphere at current position
-            int radius = 3 + (rand() % 2);
-            for (int sz = -radius; sz <= radius; sz++) {
-                for (int sy = -radius; sy <= radius; sy++) {
-                    for (int sx = -radius; sx <= radius; sx++) {
-                        int px = ix + sx;
-                        int py = iy + sy;
-                        int pz = iz + sz;
-                        
-                        if (px > 0 && px < cave->width - 1 &&
-                            py > 0 && py < cave->height - 1 &&
-                            pz > 0 && pz < cave->depth - 1) {
-                            float dist = sqrt(sx*sx + sy*sy + sz*sz);
-                            if (dist <= radius) {
-                                cave->map[pz][py][px] = 0;
-                            }
-                        }
-                    }
-                }
-            }
+            int radius = 3 + rng_int(&tunnel, 2);
+            carve_capsule(cave, prev, pos, (float)radius, lo, hi);
+            prev[0] = pos[0];
+            prev[1] = pos[1];
+            prev[2] = pos[2];
             
             // Move along tunnel direction with some randomness
-            x += dx * 2.0f + (rand() % 3 - 1) * 0.5f;
-            y += dy * 2.0f + (rand() % 3 - 1) * 0.3f;
-            z += dz * 2.0f + (rand() % 3 - 1) * 0.5f;
+            pos[0] += dx * 2.0f + (rng_int(&tunnel, 3) - 1) * 0.5f;
+            pos[1] += dy * 2.0f + (rng_int(&tunnel, 3) - 1) * 0.3f;
+            pos[2] += dz * 2.0f + (rng_int(&tunnel, 3) - 1) * 0.5f;
             
             // Slightly adjust direction
-            angle_h += (rand() % 40 - 20) * M_PI / 180.0f * 0.1f;
-            angle_v += (rand() % 20 - 10) * M_PI / 180.0f * 0.1f;
+            angle_h += (rng_int(&tunnel, 40) - 20) * M_PI / 180.0f * 0.1f;
+            angle_v += (rng_int(&tunnel, 20) - 10) * M_PI / 180.0f * 0.1f;
             dx = cos(angle_h) * cos(angle_v);
             dy = sin(angle_v);
             dz = sin(angle_h) * cos(angle_v);
@@ -352,329 +936,1379 @@ void carve_cave_interior(Cave* cave) {
     }
 }
 
-// Find a good spawn point inside the cave
-void find_spawn_point(Cave* cave, float* x, float* y, float* z) {
-    // Start from center and find an empty space
-    int center_x = cave->width / 2;
-    int center_y = cave->height / 2;
-    int center_z = cave->depth / 2;
+// Voxel (x, y, z) in world units
+static void voxel_world(const Cave* cave, int x, int y, int z, float* p) {
+    p[0] = (float)x / cave->width * 10.0f - 5.0f;
+    p[1] = (float)y / cave->height * 10.0f - 5.0f;
+    p[2] = (float)z / cave->depth * 10.0f - 5.0f;
+}
+
+// Find a good spawn point inside the cave
+void find_spawn_point(Cave* cave, float radius, float* x, float* y, float* z) {
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    
+    // Stand on a floor if there is one, else anywhere against rock
+    int first = surface->first[SURFACE_FLOOR], count = surface->count[SURFACE_FLOOR];
+    if (count == 0) {
+        first = 0;
+        count = surface->total;
+    }
+    if (count == 0) {
+        // Fallback to center
+        *x = 0.0f;
+        *y = 0.0f;
+        *z = 0.0f;
+        return;
+    }
+    
+    // Of a few random picks with room for the player, the one nearest the
+    // centre. A floor voxel has rock right below it, so each pick climbs its
+    // column until the sphere clears the rock; a pick that meets the ceiling
+    // first only counts if nothing better turns up.
+    Rng rng = rng_stream(cave->seed, RNG_STREAM_SPAWN, 0);
+    float best[3] = { 0.0f, 0.0f, 0.0f }, best_clearance = -1.0f;
+    long best_d2 = -1;
+    int cleared = 0;
+    for (int pick = 0; pick < 256 && cleared < 16; pick++) {
+        int v[3];
+        surface_voxel(cave, surface->voxels[first + rng_int(&rng, count)], &v[0], &v[1], &v[2]);
+        
+        float p[3] = { 0.0f, 0.0f, 0.0f }, clearance = -1.0f;
+        for (int climb = v[1]; climb < cave->height && cave_get(cave, v[0], climb, v[2]) == VOXEL_AIR; climb++) {
+            voxel_world(cave, v[0], climb, v[2], p);
+            clearance = cave_distance(cave, p[0], p[1], p[2], NULL);
+            if (clearance >= radius) break;
+        }
+        if (clearance < 0.0f) continue;
+        
+        long dx = v[0] - cave->width / 2, dy = v[1] - cave->height / 2, dz = v[2] - cave->depth / 2;
+        long d2 = dx * dx + dy * dy + dz * dz;
+        int clear = clearance >= radius;
+        cleared += clear;
+        if (clear ? best_clearance < radius || d2 < best_d2 : clearance > best_clearance) {
+            best_clearance = clearance;
+            best_d2 = d2;
+            memcpy(best, p, sizeof(best));
+        }
+    }
+    *x = best[0];
+    *y = best[1];
+    *z = best[2];
+}
+
+// Runtime edits
+
+void cave_mark_dirty(Cave* cave, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const int lo[3] = { x0, y0, z0 };
+    const int hi[3] = { x1, y1, z1 };
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    int clipped_lo[3], clipped_hi[3];
+    
+    for (int i = 0; i < 3; i++) {
+        clipped_lo[i] = lo[i] < 0 ? 0 : lo[i];
+        clipped_hi[i] = hi[i] >= dims[i] ? dims[i] - 1 : hi[i];
+        if (clipped_lo[i] > clipped_hi[i]) return;
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        if (!cave->dirty || clipped_lo[i] < cave->dirty_lo[i]) cave->dirty_lo[i] = clipped_lo[i];
+        if (!cave->dirty || clipped_hi[i] > cave->dirty_hi[i]) cave->dirty_hi[i] = clipped_hi[i];
+    }
+    cave->dirty = 1;
+    cave->surface_stale = 1;
+    mark_distance_stale(cave, clipped_lo[0], clipped_lo[1], clipped_lo[2],
+                        clipped_hi[0], clipped_hi[1], clipped_hi[2]);
+}
+
+void cave_set_voxel(Cave* cave, int x, int y, int z, int value) {
+    if (!cave_in_bounds(cave, x, y, z) || cave_get(cave, x, y, z) == value) return;
+    
+    cave_set(cave, x, y, z, value);
+    cave_mark_dirty(cave, x, y, z, x, y, z);
+}
+
+// Dig a ball of air; the outer layer of the grid stays rock, as in carve_cave_interior
+void cave_carve_sphere(Cave* cave, int cx, int cy, int cz, int radius) {
+    const int lo[3] = { 1, 1, 1 };
+    const int hi[3] = { cave->width - 2, cave->height - 2, cave->depth - 2 };
+    
+    carve_sphere(cave, cx, cy, cz, radius, lo, hi);
+    cave_mark_dirty(cave, cx - radius < lo[0] ? lo[0] : cx - radius,
+                    cy - radius < lo[1] ? lo[1] : cy - radius,
+                    cz - radius < lo[2] ? lo[2] : cz - radius,
+                    cx + radius > hi[0] ? hi[0] : cx + radius,
+                    cy + radius > hi[1] ? hi[1] : cy + radius,
+                    cz + radius > hi[2] ? hi[2] : cz + radius);
+}
+
+// Surface candidates. Entities keep two voxels from the grid's faces, as the
+// old rejection sampling did.
+#define SURFACE_MARGIN 2
+
+typedef struct {
+    Cave* cave;
+    int* counts;        // SURFACE_CLASS_COUNT per slice; write cursors on the filling sweep
+    uint32_t* out;      // NULL on the counting sweep
+} SurfaceJob;
+
+// Class of the voxel at index i, or -1 if it is rock or touches none
+static int surface_class(const Cave* cave, size_t i) {
+    const unsigned char* v = cave->voxels;
+    if (v[i] != VOXEL_AIR) return -1;
+    if (v[i - cave->stride_y] == VOXEL_WALL) return SURFACE_FLOOR;
+    if (v[i + cave->stride_y] == VOXEL_WALL) return SURFACE_CEILING;
+    
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (v[i + cave_offset(cave, dx, dy, dz)] == VOXEL_WALL) return SURFACE_WALL;
+            }
+        }
+    }
+    return -1;
+}
+
+// Count, or write out, the candidates of slices [begin, end) past the margin
+static void surface_slab(void* ctx, int begin, int end, int chunk) {
+    SurfaceJob* job = (SurfaceJob*)ctx;
+    const Cave* cave = job->cave;
+    (void)chunk;
+    
+    for (int s = begin; s < end; s++) {
+        int z = s + SURFACE_MARGIN;
+        int* counts = &job->counts[s * SURFACE_CLASS_COUNT];
+        for (int y = SURFACE_MARGIN; y < cave->height - SURFACE_MARGIN; y++) {
+            size_t row = cave_index(cave, 0, y, z);
+            for (int x = SURFACE_MARGIN; x < cave->width - SURFACE_MARGIN; x++) {
+                int c = surface_class(cave, row + x);
+                if (c < 0) continue;
+                
+                if (job->out) {
+                    job->out[counts[c]] = (uint32_t)x + (uint32_t)cave->width * ((uint32_t)y + (uint32_t)cave->height * z);
+                }
+                counts[c]++;
+            }
+        }
+    }
+}
+
+static void free_surface_candidates(SurfaceCandidates* surface) {
+    if (surface) {
+        free(surface->voxels);
+        free(surface);
+    }
+}
+
+const SurfaceCandidates* cave_surface_candidates(Cave* cave) {
+    if (cave->surface && !cave->surface_stale) return cave->surface;
+    
+    free_surface_candidates(cave->surface);
+    SurfaceCandidates* surface = (SurfaceCandidates*)calloc(1, sizeof(SurfaceCandidates));
+    int slices = cave->depth - 2 * SURFACE_MARGIN;
+    if (slices < 0) slices = 0;
+    
+    // Count per slice and class, then turn the counts into write cursors so
+    // each class lists its voxels in scan order whatever the thread count
+    SurfaceJob job = { cave, (int*)calloc(slices > 0 ? slices * SURFACE_CLASS_COUNT : 1, sizeof(int)), NULL };
+    parallel_for(slices, surface_slab, &job);
+    for (int c = 0; c < SURFACE_CLASS_COUNT; c++) {
+        surface->first[c] = surface->total;
+        for (int s = 0; s < slices; s++) {
+            int n = job.counts[s * SURFACE_CLASS_COUNT + c];
+            job.counts[s * SURFACE_CLASS_COUNT + c] = surface->total;
+            surface->total += n;
+        }
+        surface->count[c] = surface->total - surface->first[c];
+    }
+    
+    surface->voxels = (uint32_t*)malloc((surface->total > 0 ? surface->total : 1) * sizeof(uint32_t));
+    job.out = surface->voxels;
+    parallel_for(slices, surface_slab, &job);
+    free(job.counts);
+    
+    cave->surface = surface;
+    cave->surface_stale = 0;
+    return surface;
+}
+
+// Distance field. The squared Euclidean distance transform is separable
+// (Felzenszwalb and Huttenlocher): the distance to rock along every row of x,
+// then one lower envelope of parabolas along every line of y and of z.
+// Distances saturate at CAVE_DISTANCE_RANGE, so saturated voxels add no
+// parabola, and an edit only reaches that far: a patch recomputes the edited
+// box grown by twice the range (every rock voxel a written voxel can see) and
+// writes back the box grown by the range.
+
+typedef struct {
+    Cave* cave;
+    float* d2;          // Squared distances over the box
+    int lo[3];          // Box origin, padded coordinates
+    int size[3];
+    int out_lo[3];      // Part of the box written back to the field
+    int out_hi[3];
+    float* scratch;     // Per worker: line in and out, envelope bounds and sites
+    int line;           // Longest line of the box
+} DistanceJob;
+
+// d[p] = min over q of f[q] + w2 (p - q)^2, capped at cap, for one line of n
+// voxels, through the lower envelope of the parabolas rooted at each q below cap
+static void distance_line(const float* f, float* d, int n, float w2, float cap, int* v, float* z) {
+    int k = -1;
+    for (int q = 0; q < n; q++) {
+        if (f[q] >= cap) continue;
+        
+        // Drop the parabolas the new one hides, then append it
+        float s = -INFINITY;
+        while (k >= 0) {
+            int r = v[k];
+            s = ((f[q] + w2 * q * q) - (f[r] + w2 * r * r)) / (2.0f * w2 * (q - r));
+            if (s > z[k]) break;
+            s = -INFINITY;
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+    }
+    if (k < 0) {
+        for (int q = 0; q < n; q++) d[q] = cap;
+        return;
+    }
+    z[k + 1] = INFINITY;
+    
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) k++;
+        float t = (float)(q - v[k]);
+        float value = w2 * t * t + f[v[k]];
+        d[q] = value < cap ? value : cap;
+    }
+}
+
+static float distance_step(const Cave* cave, int axis) {
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    return 10.0f / dims[axis];
+}
+
+// Rows of slices [begin, end) of the box, the pass along x: the nearest rock
+// in the row is found by a sweep each way
+static void distance_pass_x(void* ctx, int begin, int end, int chunk) {
+    DistanceJob* job = (DistanceJob*)ctx;
+    const Cave* cave = job->cave;
+    const int sx = job->size[0], sy = job->size[1];
+    const float step = distance_step(cave, 0);
+    const float cap = CAVE_DISTANCE_RANGE * CAVE_DISTANCE_RANGE;
+    const int reach = (int)(CAVE_DISTANCE_RANGE / step) + 1;
+    (void)chunk;
+    
+    for (int bz = begin; bz < end; bz++) {
+        for (int by = 0; by < sy; by++) {
+            const unsigned char* row = &cave->voxels[cave_index(cave, job->lo[0], job->lo[1] + by, job->lo[2] + bz)];
+            float* d = &job->d2[((size_t)bz * sy + by) * sx];
+            int gap = reach;
+            for (int x = 0; x < sx; x++) {
+                gap = row[x] == VOXEL_WALL ? 0 : (gap < reach ? gap + 1 : reach);
+                d[x] = (float)gap;
+            }
+            gap = reach;
+            for (int x = sx - 1; x >= 0; x--) {
+                gap = row[x] == VOXEL_WALL ? 0 : (gap < reach ? gap + 1 : reach);
+                float t = (gap < d[x] ? gap : d[x]) * step;
+                d[x] = t * t < cap ? t * t : cap;
+            }
+        }
+    }
+}
+
+// Columns of slices [begin, end) of the box, the pass along y
+static void distance_pass_y(void* ctx, int begin, int end, int chunk) {
+    DistanceJob* job = (DistanceJob*)ctx;
+    const int sx = job->size[0], sy = job->size[1];
+    float* f = &job->scratch[(size_t)chunk * (job->line * 4 + 1)];
+    float* d = &f[job->line];
+    int* v = (int*)&f[job->line * 2];
+    float* z = &f[job->line * 3];
+    float w2 = distance_step(job->cave, 1) * distance_step(job->cave, 1);
+    
+    for (int bz = begin; bz < end; bz++) {
+        float* slice = &job->d2[(size_t)bz * sy * sx];
+        for (int x = 0; x < sx; x++) {
+            for (int y = 0; y < sy; y++) f[y] = slice[(size_t)y * sx + x];
+            distance_line(f, d, sy, w2, CAVE_DISTANCE_RANGE * CAVE_DISTANCE_RANGE, v, z);
+            for (int y = 0; y < sy; y++) slice[(size_t)y * sx + x] = d[y];
+        }
+    }
+}
+
+// Lines along z of rows [begin, end) of the box; the last pass, so the
+// written part goes straight to the field
+static void distance_pass_z(void* ctx, int begin, int end, int chunk) {
+    DistanceJob* job = (DistanceJob*)ctx;
+    Cave* cave = job->cave;
+    const int sx = job->size[0], sy = job->size[1], sz = job->size[2];
+    const size_t slice = (size_t)sx * sy;
+    float* f = &job->scratch[(size_t)chunk * (job->line * 4 + 1)];
+    float* d = &f[job->line];
+    int* v = (int*)&f[job->line * 2];
+    float* z = &f[job->line * 3];
+    float w2 = distance_step(cave, 2) * distance_step(cave, 2);
+    float range2 = CAVE_DISTANCE_RANGE * CAVE_DISTANCE_RANGE;
+    
+    for (int by = begin; by < end; by++) {
+        int y = job->lo[1] + by;
+        if (y < job->out_lo[1] || y > job->out_hi[1]) continue;
+        for (int x = job->out_lo[0]; x <= job->out_hi[0]; x++) {
+            const float* column = &job->d2[(size_t)by * sx + (x - job->lo[0])];
+            for (int bz = 0; bz < sz; bz++) f[bz] = column[bz * slice];
+            distance_line(f, d, sz, w2, range2, v, z);
+            for (int cz = job->out_lo[2]; cz <= job->out_hi[2]; cz++) {
+                cave->distance[cave_index(cave, x, y, cz)] = sqrtf(d[cz - job->lo[2]]);
+            }
+        }
+    }
+}
+
+const float* cave_distance_field(Cave* cave) {
+    if (cave->distance && !cave->distance_stale) return cave->distance;
+    
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    DistanceJob job;
+    job.cave = cave;
+    job.line = 0;
+    if (!cave->distance) {
+        // Nothing to patch: the whole block, halo included
+        cave->distance = (float*)malloc(cave->voxel_count * sizeof(float));
+        mark_distance_stale(cave, -1, -1, -1, dims[0], dims[1], dims[2]);
+    }
+    for (int a = 0; a < 3; a++) {
+        int reach = (int)ceilf(CAVE_DISTANCE_RANGE / distance_step(cave, a));
+        int lo = cave->distance_lo[a] - 2 * reach, hi = cave->distance_hi[a] + 2 * reach;
+        job.lo[a] = lo < -1 ? -1 : lo;
+        job.size[a] = (hi > dims[a] ? dims[a] : hi) - job.lo[a] + 1;
+        job.out_lo[a] = cave->distance_lo[a] - reach < -1 ? -1 : cave->distance_lo[a] - reach;
+        job.out_hi[a] = cave->distance_hi[a] + reach > dims[a] ? dims[a] : cave->distance_hi[a] + reach;
+        if (job.size[a] > job.line) job.line = job.size[a];
+    }
+    
+    job.d2 = (float*)malloc((size_t)job.size[0] * job.size[1] * job.size[2] * sizeof(float));
+    job.scratch = (float*)malloc((size_t)parallel_thread_count() * (job.line * 4 + 1) * sizeof(float));
+    parallel_for(job.size[2], distance_pass_x, &job);
+    parallel_for(job.size[2], distance_pass_y, &job);
+    parallel_for(job.size[1], distance_pass_z, &job);
+    free(job.d2);
+    free(job.scratch);
+    
+    cave->distance_stale = 0;
+    return cave->distance;
+}
+
+float cave_distance(Cave* cave, float x, float y, float z, float* gradient) {
+    const float* field = cave_distance_field(cave);
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    const float p[3] = { x, y, z };
+    int i[3];
+    float t[3];
+    
+    // Voxel coordinates; the eight voxels around the point have to lie in the block
+    for (int a = 0; a < 3; a++) {
+        float g = (p[a] + 5.0f) / 10.0f * dims[a];
+        if (!(g >= -1.0f && g < dims[a])) {
+            if (gradient) gradient[0] = gradient[1] = gradient[2] = 0.0f;
+            return 0.0f;
+        }
+        i[a] = (int)floorf(g);
+        t[a] = g - i[a];
+    }
+    
+    const float* c = &field[cave_index(cave, i[0], i[1], i[2])];
+    const ptrdiff_t sy = cave->stride_y, sz = cave->stride_z;
+    float c00 = c[0] + (c[1] - c[0]) * t[0];
+    float c10 = c[sy] + (c[sy + 1] - c[sy]) * t[0];
+    float c01 = c[sz] + (c[sz + 1] - c[sz]) * t[0];
+    float c11 = c[sy + sz] + (c[sy + sz + 1] - c[sy + sz]) * t[0];
+    float c0 = c00 + (c10 - c00) * t[1];
+    float c1 = c01 + (c11 - c01) * t[1];
+    
+    if (gradient) {
+        float dx0 = (c[1] - c[0]) + ((c[sy + 1] - c[sy]) - (c[1] - c[0])) * t[1];
+        float dx1 = (c[sz + 1] - c[sz]) + ((c[sy + sz + 1] - c[sy + sz]) - (c[sz + 1] - c[sz])) * t[1];
+        gradient[0] = (dx0 + (dx1 - dx0) * t[2]) / distance_step(cave, 0);
+        gradient[1] = ((c10 - c00) + ((c11 - c01) - (c10 - c00)) * t[2]) / distance_step(cave, 1);
+        gradient[2] = (c1 - c0) / distance_step(cave, 2);
+    }
+    return c0 + (c1 - c0) * t[2];
+}
+
+// Distance samples taken through a cell that may hold a contact, and the
+// bisection steps that refine the first one found
+#define SWEEP_CELL_SAMPLES 4
+#define SWEEP_REFINE_STEPS 10
+
+static float sweep_distance(Cave* cave, const float* from, const float* to, float t, float* gradient) {
+    return cave_distance(cave, from[0] + (to[0] - from[0]) * t, from[1] + (to[1] - from[1]) * t,
+                         from[2] + (to[2] - from[2]) * t, gradient);
+}
+
+// Contact at time t: the normal is the distance gradient there, or against
+// the motion where the field is flat
+static int sweep_contact(Cave* cave, const float* from, const float* to, float t, SweepHit* hit) {
+    float gradient[3];
+    sweep_distance(cave, from, to, t, gradient);
+    float length = sqrtf(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+    if (length < 1e-6f) {
+        for (int a = 0; a < 3; a++) gradient[a] = from[a] - to[a];
+        length = sqrtf(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+    }
+    hit->time = t;
+    for (int a = 0; a < 3; a++) {
+        hit->normal[a] = length > 0.0f ? gradient[a] / length : 0.0f;
+    }
+    return 1;
+}
+
+int cave_sweep_sphere(Cave* cave, const float* from, const float* to, float radius, SweepHit* hit) {
+    const float* field = cave_distance_field(cave);
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    
+    // Starting too close, only coming closer still than the start counts, so
+    // the walk runs against the start distance instead of the radius
+    float threshold = fminf(sweep_distance(cave, from, to, 0.0f, NULL), radius);
+    
+    // DDA over the cells between voxel centres, the cells cave_distance interpolates in
+    int cell[3], step[3];
+    float t_max[3], t_delta[3];
+    for (int a = 0; a < 3; a++) {
+        float g = (from[a] + 5.0f) / 10.0f * dims[a];
+        float delta = (to[a] - from[a]) / 10.0f * dims[a];
+        cell[a] = (int)floorf(g);
+        if (delta > 0.0f) {
+            step[a] = 1;
+            t_max[a] = (cell[a] + 1 - g) / delta;
+            t_delta[a] = 1.0f / delta;
+        } else if (delta < 0.0f) {
+            step[a] = -1;
+            t_max[a] = (g - cell[a]) / -delta;
+            t_delta[a] = -1.0f / delta;
+        } else {
+            step[a] = 0;
+            t_max[a] = INFINITY;
+            t_delta[a] = INFINITY;
+        }
+    }
+    
+    float t_enter = 0.0f;
+    for (;;) {
+        float t_exit = t_max[0] < t_max[1] ? t_max[0] : t_max[1];
+        if (t_max[2] < t_exit) t_exit = t_max[2];
+        if (t_exit > 1.0f) t_exit = 1.0f;
+        
+        // Past the halo everything is rock
+        if (cell[0] < -1 || cell[0] >= dims[0] || cell[1] < -1 || cell[1] >= dims[1] ||
+            cell[2] < -1 || cell[2] >= dims[2]) {
+            return sweep_contact(cave, from, to, t_enter, hit);
+        }
+        
+        // Inside a cell the distance is a blend of its corners, so it can only
+        // dip below the threshold if a corner does
+        const float* c = &field[cave_index(cave, cell[0], cell[1], cell[2])];
+        const ptrdiff_t sy = cave->stride_y, sz = cave->stride_z;
+        float low = fminf(fminf(fminf(c[0], c[1]), fminf(c[sy], c[sy + 1])),
+                          fminf(fminf(c[sz], c[sz + 1]), fminf(c[sy + sz], c[sy + sz + 1])));
+        if (low < threshold) {
+            float clear = t_enter;
+            for (int s = 1; s <= SWEEP_CELL_SAMPLES; s++) {
+                float t = t_enter + (t_exit - t_enter) * s / SWEEP_CELL_SAMPLES;
+                if (sweep_distance(cave, from, to, t, NULL) >= threshold) {
+                    clear = t;
+                    continue;
+                }
+                
+                // Narrow [clear, t] down to the crossing, keeping the clear side
+                for (int i = 0; i < SWEEP_REFINE_STEPS; i++) {
+                    float mid = 0.5f * (clear + t);
+                    if (sweep_distance(cave, from, to, mid, NULL) >= threshold) {
+                        clear = mid;
+                    } else {
+                        t = mid;
+                    }
+                }
+                return sweep_contact(cave, from, to, clear, hit);
+            }
+        }
+        if (t_exit >= 1.0f) return 0;
+        
+        // Into the next cell along the axis whose boundary comes first
+        int a = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+        cell[a] += step[a];
+        t_enter = t_max[a];
+        t_max[a] += t_delta[a];
+    }
+}
+
+static float placement_spacing[PLACEMENT_KIND_COUNT];
+
+void set_placement_spacing(PlacementKind kind, float spacing) {
+    placement_spacing[kind] = spacing;
+}
+
+float get_placement_spacing(PlacementKind kind) {
+    return placement_spacing[kind];
+}
+
+// Spread count entities of a kind over domain: a Poisson-disk set, cut down
+// to count at random when it holds more. Returns the picked points (NULL
+// when placement is independent) and their number in *picked; entities
+// past it fall back to independent picks.
+static uint32_t* spread_entities(const Cave* cave, const PoissonDomain* domain, PlacementKind kind, int count,
+                                 int* picked) {
+    *picked = 0;
+    float spacing = placement_spacing[kind];
+    if (spacing < 0.0f || count <= 0) return NULL;
+    if (spacing == 0.0f) spacing = poisson_spacing_for_count(domain, count);
+    
+    uint32_t* samples;
+    int n = poisson_sample(domain, spacing, rng_key(cave->seed, RNG_STREAM_POISSON, kind), &samples);
+    if (n > count) {
+        // Partial shuffle: the first count samples become a uniform subset
+        Rng rng = rng_stream(cave->seed, RNG_STREAM_POISSON, PLACEMENT_KIND_COUNT + kind);
+        for (int i = 0; i < count; i++) {
+            int j = i + rng_int(&rng, n - i);
+            uint32_t t = samples[i];
+            samples[i] = samples[j];
+            samples[j] = t;
+        }
+        n = count;
+    }
+    *picked = n;
+    return samples;
+}
+
+// Entity placement job shared by crystals and gems
+typedef struct {
+    Cave* cave;
+    const SurfaceCandidates* surface;
+    const uint32_t* picks;  // Spread points for the first pick_count entities
+    int pick_count;
+    void* entities;
+} PlacementJob;
+
+// Place crystals [begin, end); crystal i only draws from its own stream
+static void place_crystals(void* ctx, int begin, int end, int chunk) {
+    PlacementJob* job = (PlacementJob*)ctx;
+    Cave* cave = job->cave;
+    const SurfaceCandidates* surface = job->surface;
+    Crystal* crystals = (Crystal*)job->entities;
+    (void)chunk;
+    if (surface->total == 0) return;
+    
+    for (int i = begin; i < end; i++) {
+        Rng rng = rng_stream(cave->seed, RNG_STREAM_CRYSTAL, i);
+        
+        // A spread column, else any voxel against rock; crystals stand on
+        // the exterior height map over its column
+        int x, y, z;
+        surface_voxel(cave, surface->voxels[rng_int(&rng, surface->total)], &x, &y, &z);
+        if (i < job->pick_count) {
+            x = (int)(job->picks[i] % (uint32_t)cave->width);
+            y = (int)(job->picks[i] / (uint32_t)cave->width);
+        }
+        crystals[i].x = (float)x / cave->width * 10.0f - 5.0f;
+        crystals[i].y = cave->height_map[y * cave->width + x] + 0.2f;
+        crystals[i].z = (float)y / cave->height * 10.0f - 5.0f;
+        crystals[i].size = 0.1f + rng_int(&rng, 100) / 200.0f;
+        crystals[i].rotation = rng_int(&rng, 360) * M_PI / 180.0f;
+        
+        // Random crystal colors
+        int color_type = rng_int(&rng, 4);
+        switch (color_type) {
+            case 0:  // Blue
+                crystals[i].color[0] = 0.2f;
+                crystals[i].color[1] = 0.4f;
+                crystals[i].color[2] = 1.0f;
+                break;
+            case 1:  // Green
+                crystals[i].color[0] = 0.2f;
+                crystals[i].color[1] = 1.0f;
+                crystals[i].color[2] = 0.4f;
+                break;
+            case 2:  // Purple
+                crystals[i].color[0] = 0.8f;
+                crystals[i].color[1] = 0.2f;
+                crystals[i].color[2] = 1.0f;
+                break;
+            case 3:  // Orange
+                crystals[i].color[0] = 1.0f;
+                crystals[i].color[1] = 0.6f;
+                crystals[i].color[2] = 0.2f;
+                break;
+        }
+        
+        crystals[i].glow_intensity = 0.5f + rng_int(&rng, 50) / 100.0f;
+    }
+}
+
+// Crystal generation
+Crystal* generate_crystals(Cave* cave, int count) {
+    Crystal* crystals = (Crystal*)calloc(count, sizeof(Crystal));
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    
+    // Crystals are spaced over the columns that hold any surface voxel
+    unsigned char* column_used = (unsigned char*)calloc((size_t)cave->width * cave->height, 1);
+    uint32_t* columns = (uint32_t*)malloc((surface->total > 0 ? surface->total : 1) * sizeof(uint32_t));
+    int column_count = 0;
+    for (int i = 0; i < surface->total; i++) {
+        int x, y, z;
+        surface_voxel(cave, surface->voxels[i], &x, &y, &z);
+        uint32_t column = (uint32_t)x + (uint32_t)cave->width * y;
+        if (!column_used[column]) {
+            column_used[column] = 1;
+            columns[column_count++] = column;
+        }
+    }
+    PoissonDomain domain = {
+        columns, column_count, { cave->width, cave->height, 1 },
+        { 10.0f / cave->width, 10.0f / cave->height, 0.0f }
+    };
+    
+    PlacementJob job = { cave, surface, NULL, 0, crystals };
+    uint32_t* picks = spread_entities(cave, &domain, PLACEMENT_CRYSTALS, count, &job.pick_count);
+    job.picks = picks;
+    parallel_for(count, place_crystals, &job);
+    
+    free(picks);
+    free(columns);
+    free(column_used);
+    return crystals;
+}
+
+#define CRYSTAL_MAX_SPIRES 7
+
+static float crystal_rng_unit(Rng* rng) {
+    return rng_int(rng, 1 << 16) / 65536.0f;
+}
+
+static void crystal_vertex(CrystalVertex* vertex, const float* p) {
+    vertex->position[0] = p[0];
+    vertex->position[1] = p[1];
+    vertex->position[2] = p[2];
+}
+
+// Emit triangle (a, b, c), counter-clockwise seen from outside, with its face normal
+static void crystal_triangle(CrystalVertex* out, const float* a, const float* b, const float* c) {
+    float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    float n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0]
+    };
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    crystal_vertex(&out[0], a);
+    crystal_vertex(&out[1], b);
+    crystal_vertex(&out[2], c);
+    for (int v = 0; v < 3; v++) {
+        for (int axis = 0; axis < 3; axis++) {
+            out[v].normal[axis] = length > 0.0f ? n[axis] / length : 0.0f;
+        }
+    }
+}
+
+// Hexagonal spire from base centre along unit axis: a prism up to its
+// shoulder, then a point. The base sinks below y = 0 so it meets the ground.
+static CrystalVertex* crystal_spire(CrystalVertex* out, const float* base, const float* axis, float height,
+                                    float radius) {
+    // Frame (u, v, axis) with u x v = axis
+    float ref[3] = { 0.0f, 0.0f, 1.0f };
+    float u[3] = {
+        ref[1] * axis[2] - ref[2] * axis[1],
+        ref[2] * axis[0] - ref[0] * axis[2],
+        ref[0] * axis[1] - ref[1] * axis[0]
+    };
+    float length = sqrtf(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+    for (int a = 0; a < 3; a++) u[a] /= length;
+    float v[3] = {
+        axis[1] * u[2] - axis[2] * u[1],
+        axis[2] * u[0] - axis[0] * u[2],
+        axis[0] * u[1] - axis[1] * u[0]
+    };
+    
+    float shoulder = 0.75f * height;
+    float tip[3], ring[2][CRYSTAL_SPIRE_SIDES][3];
+    for (int a = 0; a < 3; a++) {
+        tip[a] = base[a] + axis[a] * height;
+    }
+    for (int k = 0; k < CRYSTAL_SPIRE_SIDES; k++) {
+        float angle = 2.0f * M_PI * k / CRYSTAL_SPIRE_SIDES;
+        float c = cosf(angle) * radius, s = sinf(angle) * radius;
+        for (int a = 0; a < 3; a++) {
+            ring[0][k][a] = base[a] + u[a] * c + v[a] * s;
+            ring[1][k][a] = ring[0][k][a] + axis[a] * shoulder;
+        }
+    }
+    
+    for (int k = 0; k < CRYSTAL_SPIRE_SIDES; k++) {
+        int next = (k + 1) % CRYSTAL_SPIRE_SIDES;
+        crystal_triangle(out, ring[0][k], ring[0][next], ring[1][next]);
+        crystal_triangle(out + 3, ring[0][k], ring[1][next], ring[1][k]);
+        crystal_triangle(out + 6, ring[1][k], ring[1][next], tip);
+        out += 9;
+    }
+    return out;
+}
+
+// A tall central spire ringed by shorter ones leaning outwards; the same
+// shapes on every run
+void build_crystal_meshes(CrystalMeshLibrary* library) {
+    memset(library, 0, sizeof(*library));
+    library->vertices = (CrystalVertex*)malloc(CRYSTAL_MESH_VARIANTS * CRYSTAL_MAX_SPIRES * CRYSTAL_SPIRE_VERTICES *
+                                               sizeof(CrystalVertex));
+    CrystalVertex* out = library->vertices;
+    
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        Rng rng = rng_stream(0, RNG_STREAM_CRYSTAL_MESH, variant);
+        int spires = 3 + rng_int(&rng, CRYSTAL_MAX_SPIRES - 2);
+        float phase = crystal_rng_unit(&rng) * 2.0f * M_PI;
+        library->first[variant] = (int)(out - library->vertices);
+        
+        for (int i = 0; i < spires; i++) {
+            float base[3] = { 0.0f, -0.1f, 0.0f };
+            float axis[3] = { 0.0f, 1.0f, 0.0f };
+            float height = 0.8f, radius = 0.12f;
+            if (i > 0) {
+                // Around the centre, leaning away from it by 15 to 40 degrees
+                float around = phase + 2.0f * M_PI * (i - 1 + 0.3f * crystal_rng_unit(&rng)) / (spires - 1);
+                float lean = (15.0f + 25.0f * crystal_rng_unit(&rng)) * M_PI / 180.0f;
+                float offset = 0.08f + 0.1f * crystal_rng_unit(&rng);
+                base[0] = cosf(around) * offset;
+                base[2] = sinf(around) * offset;
+                axis[0] = sinf(lean) * cosf(around);
+                axis[1] = cosf(lean);
+                axis[2] = sinf(lean) * sinf(around);
+                height = 0.3f + 0.35f * crystal_rng_unit(&rng);
+                radius = 0.05f + 0.05f * crystal_rng_unit(&rng);
+            }
+            out = crystal_spire(out, base, axis, height, radius);
+        }
+        library->count[variant] = (int)(out - library->vertices) - library->first[variant];
+    }
+    library->vertex_count = (int)(out - library->vertices);
+    
+    for (int i = 0; i < library->vertex_count; i++) {
+        const float* p = library->vertices[i].position;
+        library->reach = fmaxf(library->reach, sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+    }
+}
+
+void free_crystal_meshes(CrystalMeshLibrary* library) {
+    free(library->vertices);
+    memset(library, 0, sizeof(*library));
+}
+
+void pack_crystal_instances(const Crystal* crystals, int count, CrystalInstance* instances,
+                            int first[CRYSTAL_MESH_VARIANTS], int counts[CRYSTAL_MESH_VARIANTS]) {
+    int next = 0;
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        first[variant] = next;
+        for (int i = variant; i < count; i += CRYSTAL_MESH_VARIANTS) {
+            const Crystal* crystal = &crystals[i];
+            CrystalInstance* instance = &instances[next++];
+            instance->position[0] = crystal->x;
+            instance->position[1] = crystal->y;
+            instance->position[2] = crystal->z;
+            instance->size = crystal->size;
+            instance->rotation = crystal->rotation;
+            instance->glow_intensity = crystal->glow_intensity;
+            for (int c = 0; c < 3; c++) {
+                float value = fminf(fmaxf(crystal->color[c], 0.0f), 1.0f);
+                instance->color[c] = (unsigned char)(value * 255.0f + 0.5f);
+            }
+            instance->reserved = 0;
+        }
+        counts[variant] = next - first[variant];
+    }
+}
+
+CrystalRenderer* create_crystal_renderer(void) {
+    CrystalRenderer* renderer = (CrystalRenderer*)calloc(1, sizeof(CrystalRenderer));
+    CrystalMeshLibrary library;
+    build_crystal_meshes(&library);
+    renderer->reach = library.reach;
+    
+    glGenVertexArrays(CRYSTAL_MESH_VARIANTS, renderer->vao);
+    glGenBuffers(1, &renderer->vbo_mesh);
+    glGenBuffers(1, &renderer->vbo_instances);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_mesh);
+    glBufferData(GL_ARRAY_BUFFER, library.vertex_count * sizeof(CrystalVertex), library.vertices, GL_STATIC_DRAW);
+    
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        renderer->first_vertex[variant] = library.first[variant];
+        renderer->vertex_count[variant] = library.count[variant];
+        
+        // Shared mesh: position and normal
+        glBindVertexArray(renderer->vao[variant]);
+        glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_mesh);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CrystalVertex),
+                              (void*)offsetof(CrystalVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CrystalVertex), (void*)offsetof(CrystalVertex, normal));
+        glEnableVertexAttribArray(1);
+        
+        // Instances: base and size, spin and glow, colour; pointed at the
+        // variant's range by upload_crystal_instances
+        for (int attribute = 2; attribute <= 4; attribute++) {
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribDivisor(attribute, 1);
+        }
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    free_crystal_meshes(&library);
+    return renderer;
+}
+
+void free_crystal_renderer(CrystalRenderer* renderer) {
+    if (!renderer) return;
+    
+    glDeleteVertexArrays(CRYSTAL_MESH_VARIANTS, renderer->vao);
+    glDeleteBuffers(1, &renderer->vbo_mesh);
+    glDeleteBuffers(1, &renderer->vbo_instances);
+    free(renderer);
+}
+
+void upload_crystal_instances(CrystalRenderer* renderer, const Crystal* crystals, int count) {
+    size_t size = (size_t)count * sizeof(CrystalInstance);
+    CrystalInstance* instances = (CrystalInstance*)malloc(size > 0 ? size : 1);
+    pack_crystal_instances(crystals, count, instances, renderer->first_instance, renderer->instance_count);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_instances);
+    if (size > renderer->instance_bytes) {
+        renderer->instance_bytes = size;
+        glBufferData(GL_ARRAY_BUFFER, size, instances, GL_STATIC_DRAW);
+    } else if (size > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances);
+    }
+    
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        // Without base instances (GL 4.2), each variant's pointers start at its range
+        size_t first = (size_t)renderer->first_instance[variant] * sizeof(CrystalInstance);
+        glBindVertexArray(renderer->vao[variant]);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(CrystalInstance),
+                              (void*)(first + offsetof(CrystalInstance, position)));
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(CrystalInstance),
+                              (void*)(first + offsetof(CrystalInstance, rotation)));
+        glVertexAttribPointer(4, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CrystalInstance),
+                              (void*)(first + offsetof(CrystalInstance, color)));
+        
+        float* min = renderer->bounds_min[variant];
+        float* max = renderer->bounds_max[variant];
+        for (int a = 0; a < 3; a++) {
+            min[a] = INFINITY;
+            max[a] = -INFINITY;
+        }
+        for (int i = 0; i < renderer->instance_count[variant]; i++) {
+            const CrystalInstance* instance = &instances[renderer->first_instance[variant] + i];
+            float pad = renderer->reach * instance->size;
+            for (int a = 0; a < 3; a++) {
+                min[a] = fminf(min[a], instance->position[a] - pad);
+                max[a] = fmaxf(max[a], instance->position[a] + pad);
+            }
+        }
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(instances);
+}
+
+void render_crystals(const CrystalRenderer* renderer, const Frustum* frustum, CullCounter* counter) {
+    if (!renderer) return;
+    
+    for (int variant = 0; variant < CRYSTAL_MESH_VARIANTS; variant++) {
+        if (renderer->instance_count[variant] == 0) continue;
+        if (!frustum_cull_aabb(frustum, renderer->bounds_min[variant], renderer->bounds_max[variant], counter)) {
+            continue;
+        }
+        
+        glBindVertexArray(renderer->vao[variant]);
+        glDrawArraysInstanced(GL_TRIANGLES, renderer->first_vertex[variant], renderer->vertex_count[variant],
+                              renderer->instance_count[variant]);
+    }
+    glBindVertexArray(0);
+}
+
+// Place gems [begin, end); gem i only draws from its own stream
+static void place_gems(void* ctx, int begin, int end, int chunk) {
+    PlacementJob* job = (PlacementJob*)ctx;
+    Cave* cave = job->cave;
+    const SurfaceCandidates* surface = job->surface;
+    Gem* gems = (Gem*)job->entities;
+    (void)chunk;
+    
+    for (int i = begin; i < end; i++) {
+        Rng rng = rng_stream(cave->seed, RNG_STREAM_GEM, i);
+        
+        // Solid rock has nowhere to put a gem; hide it
+        if (surface->total == 0) {
+            gems[i].collected = 1;
+            continue;
+        }
+        
+        // A spread voxel, else any empty voxel against rock
+        uint32_t packed = surface->voxels[rng_int(&rng, surface->total)];
+        int x, y, z;
+        surface_voxel(cave, i < job->pick_count ? job->picks[i] : packed, &x, &y, &z);
+        gems[i].x = (float)x / cave->width * 10.0f - 5.0f;
+        gems[i].y = (float)y / cave->height * 10.0f - 5.0f;
+        gems[i].z = (float)z / cave->depth * 10.0f - 5.0f;
+        gems[i].rotation = rng_int(&rng, 360) * M_PI / 180.0f;
+        gems[i].bob_offset = rng_int(&rng, 100) / 100.0f * 2.0f * M_PI;
+        gems[i].type = rng_int(&rng, 10);
+        gems[i].collected = 0;
+        gems[i].size = 0.1f + rng_int(&rng, 50) / 500.0f;
+        
+        // Set color based on type
+        switch (gems[i].type) {
+            case 0: // Ruby
+                gems[i].color[0] = 1.0f; gems[i].color[1] = 0.2f; gems[i].color[2] = 0.2f;
+                break;
+            case 1: // Emerald
+                gems[i].color[0] = 0.2f; gems[i].color[1] = 1.0f; gems[i].color[2] = 0.2f;
+                break;
+            case 2: // Sapphire
+                gems[i].color[0] = 0.2f; gems[i].color[1] = 0.2f; gems[i].color[2] = 1.0f;
+                break;
+            case 3: // Amethyst
+                gems[i].color[0] = 0.8f; gems[i].color[1] = 0.2f; gems[i].color[2] = 1.0f;
+                break;
+            case 4: // Topaz
+                gems[i].color[0] = 1.0f; gems[i].color[1] = 0.8f; gems[i].color[2] = 0.2f;
+                break;
+            case 5: // Diamond
+                gems[i].color[0] = 0.9f; gems[i].color[1] = 0.9f; gems[i].color[2] = 1.0f;
+                break;
+            case 6: // Onyx
+                gems[i].color[0] = 0.1f; gems[i].color[1] = 0.1f; gems[i].color[2] = 0.1f;
+                break;
+            case 7: // Aquamarine
+                gems[i].color[0] = 0.2f; gems[i].color[1] = 0.8f; gems[i].color[2] = 1.0f;
+                break;
+            case 8: // Citrine
+                gems[i].color[0] = 1.0f; gems[i].color[1] = 0.6f; gems[i].color[2] = 0.0f;
+                break;
+            case 9: // Rose Quartz
+                gems[i].color[0] = 1.0f; gems[i].color[1] = 0.6f; gems[i].color[2] = 0.8f;
+                break;
+        }
+    }
+}
+
+// Generate collectible gems
+Gem* generate_gems(Cave* cave, int count) {
+    Gem* gems = (Gem*)calloc(count, sizeof(Gem));
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    PoissonDomain domain = {
+        surface->voxels, surface->total, { cave->width, cave->height, cave->depth },
+        { 10.0f / cave->width, 10.0f / cave->height, 10.0f / cave->depth }
+    };
+    
+    PlacementJob job = { cave, surface, NULL, 0, gems };
+    uint32_t* picks = spread_entities(cave, &domain, PLACEMENT_GEMS, count, &job.pick_count);
+    job.picks = picks;
+    parallel_for(count, place_gems, &job);
+    
+    free(picks);
+    return gems;
+}
+
+#define GEM_MESH_VERTICES 24
+
+// Octahedron reaching 0.5 from its centre: 8 faces, 3 vertices each, with
+// flat normals so the facets catch the light
+static void build_gem_mesh(float* vertices) {
+    int v = 0;
+    for (int face = 0; face < 8; face++) {
+        float sx = (face & 1) ? -1.0f : 1.0f;
+        float sy = (face & 2) ? -1.0f : 1.0f;
+        float sz = (face & 4) ? -1.0f : 1.0f;
+        float corners[3][3] = {
+            { 0.0f, 0.5f * sy, 0.0f },
+            { 0.5f * sx, 0.0f, 0.0f },
+            { 0.0f, 0.0f, 0.5f * sz }
+        };
+        // Counter-clockwise seen from outside
+        int flip = (sx * sy * sz) > 0.0f;
+        float n = 1.0f / sqrtf(3.0f);
+        for (int c = 0; c < 3; c++) {
+            const float* corner = corners[flip && c > 0 ? 3 - c : c];
+            vertices[v++] = corner[0];
+            vertices[v++] = corner[1];
+            vertices[v++] = corner[2];
+            vertices[v++] = sx * n;
+            vertices[v++] = sy * n;
+            vertices[v++] = sz * n;
+        }
+    }
+}
+
+static void pack_gem_instance(const Gem* gem, GemInstance* instance) {
+    instance->position[0] = gem->x;
+    instance->position[1] = gem->y;
+    instance->position[2] = gem->z;
+    instance->size = gem->size;
+    instance->rotation = gem->rotation;
+    instance->bob_offset = gem->bob_offset;
+    for (int c = 0; c < 3; c++) {
+        float value = fminf(fmaxf(gem->color[c], 0.0f), 1.0f);
+        instance->color[c] = (unsigned char)(value * 255.0f + 0.5f);
+    }
+    instance->collected = gem->collected ? 1 : 0;
+}
+
+void pack_gem_instances(const Gem* gems, int count, GemInstance* instances) {
+    for (int i = 0; i < count; i++) {
+        pack_gem_instance(&gems[i], &instances[i]);
+    }
+}
+
+// Grow the renderer's box over gem's whole bob range
+static void extend_gem_bounds(GemRenderer* renderer, const Gem* gem) {
+    float reach = 0.5f * gem->size;
+    float centre[3] = { gem->x, gem->y, gem->z };
+    for (int a = 0; a < 3; a++) {
+        float pad = reach + (a == 1 ? 0.05f : 0.0f);
+        renderer->bounds_min[a] = fminf(renderer->bounds_min[a], centre[a] - pad);
+        renderer->bounds_max[a] = fmaxf(renderer->bounds_max[a], centre[a] + pad);
+    }
+}
+
+GemRenderer* create_gem_renderer(void) {
+    GemRenderer* renderer = (GemRenderer*)calloc(1, sizeof(GemRenderer));
+    float vertices[GEM_MESH_VERTICES * 6];
+    build_gem_mesh(vertices);
+    
+    glGenVertexArrays(1, &renderer->vao);
+    glGenBuffers(1, &renderer->vbo_mesh);
+    glGenBuffers(1, &renderer->vbo_instances);
+    glBindVertexArray(renderer->vao);
+    
+    // Shared mesh: position and normal
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_mesh);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    
+    // Instances: centre and size, spin and bob phase, colour, collected flag
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_instances);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GemInstance), (void*)offsetof(GemInstance, position));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(GemInstance), (void*)offsetof(GemInstance, rotation));
+    glVertexAttribPointer(4, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GemInstance), (void*)offsetof(GemInstance, color));
+    glVertexAttribPointer(5, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(GemInstance),
+                          (void*)offsetof(GemInstance, collected));
+    for (int attribute = 2; attribute <= 5; attribute++) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    
+    glBindVertexArray(0);
+    return renderer;
+}
+
+void free_gem_renderer(GemRenderer* renderer) {
+    if (!renderer) return;
+    
+    glDeleteVertexArrays(1, &renderer->vao);
+    glDeleteBuffers(1, &renderer->vbo_mesh);
+    glDeleteBuffers(1, &renderer->vbo_instances);
+    free(renderer);
+}
+
+void upload_gem_instances(GemRenderer* renderer, const Gem* gems, int count) {
+    size_t size = (size_t)count * sizeof(GemInstance);
+    GemInstance* instances = (GemInstance*)malloc(size > 0 ? size : 1);
+    pack_gem_instances(gems, count, instances);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_instances);
+    if (size > renderer->instance_bytes) {
+        renderer->instance_bytes = size;
+        glBufferData(GL_ARRAY_BUFFER, size, instances, GL_DYNAMIC_DRAW);
+    } else if (size > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(instances);
+    
+    renderer->instance_count = count;
+    for (int a = 0; a < 3; a++) {
+        renderer->bounds_min[a] = INFINITY;
+        renderer->bounds_max[a] = -INFINITY;
+    }
+    for (int i = 0; i < count; i++) {
+        extend_gem_bounds(renderer, &gems[i]);
+    }
+}
+
+void update_gem_instance(GemRenderer* renderer, const Gem* gems, int index) {
+    if (index < 0 || index >= renderer->instance_count) return;
     
-    // Search for empty space near center
-    for (int r = 0; r < 20; r++) {
-        for (int attempts = 0; attempts < 100; attempts++) {
-            int tx = center_x + (rand() % (r * 2 + 1)) - r;
-            int ty = center_y + (rand() % (r * 2 + 1)) - r;
-            int tz = center_z + (rand() % (r * 2 + 1)) - r;
-            
-            if (tx > 0 && tx < cave->width - 1 &&
-                ty > 0 && ty < cave->height - 1 &&
-                tz > 0 && tz < cave->depth - 1) {
-                if (cave->map[tz][ty][tx] == 0) {
-                    *x = (float)tx / cave->width * 10.0f - 5.0f;
-                    *y = (float)ty / cave->height * 10.0f - 5.0f;
-                    *z = (float)tz / cave->depth * 10.0f - 5.0f;
-                    return;
-                }
-            }
-        }
-    }
+    GemInstance instance;
+    pack_gem_instance(&gems[index], &instance);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo_instances);
+    glBufferSubData(GL_ARRAY_BUFFER, (size_t)index * sizeof(GemInstance), sizeof(GemInstance), &instance);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     
-    // Fallback to center
-    *x = 0.0f;
-    *y = 0.0f;
-    *z = 0.0f;
+    // A respawned gem may have moved outside the box
+    extend_gem_bounds(renderer, &gems[index]);
 }
 
-// Crystal generation
-Crystal* generate_crystals(Cave* cave, int count) {
-    Crystal* crystals = (Crystal*)malloc(count * sizeof(Crystal));
+void render_gems(const GemRenderer* renderer, const Frustum* frustum, CullCounter* counter) {
+    if (!renderer || renderer->instance_count == 0) return;
+    
+    // Per-gem culling would mean repacking the buffer every frame; the GPU
+    // clips the rest, and collected gems collapse to a point
+    if (!frustum_cull_aabb(frustum, renderer->bounds_min, renderer->bounds_max, counter)) return;
+    
+    glBindVertexArray(renderer->vao);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, GEM_MESH_VERTICES, renderer->instance_count);
+    glBindVertexArray(0);
+}
+
+static int gem_cell(const GemGrid* grid, float v) {
+    return (int)floorf(v / grid->cell_size);
+}
+
+static int gem_grid_bucket(const GemGrid* grid, int cx, int cy, int cz) {
+    uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u ^ (uint32_t)cz * 83492791u;
+    return (int)(h & (uint32_t)grid->bucket_mask);
+}
+
+GemGrid* create_gem_grid(const Gem* gems, int count, float cell_size) {
+    GemGrid* grid = (GemGrid*)calloc(1, sizeof(GemGrid));
+    grid->cell_size = cell_size;
+    grid->count = count;
+    
+    // About two buckets per gem keeps chains short even when all are live
+    int buckets = 64;
+    while (buckets < 2 * count) buckets *= 2;
+    grid->bucket_mask = buckets - 1;
+    grid->heads = (int*)malloc(buckets * sizeof(int));
+    memset(grid->heads, 0xff, buckets * sizeof(int));
+    
+    int slots = count > 0 ? count : 1;
+    grid->next = (int*)malloc(slots * sizeof(int));
+    grid->prev = (int*)malloc(slots * sizeof(int));
+    grid->bucket = (int*)malloc(slots * sizeof(int));
+    grid->cells = (int*)malloc(slots * 3 * sizeof(int));
+    memset(grid->bucket, 0xff, slots * sizeof(int));
+    for (int a = 0; a < 3; a++) {
+        grid->cell_min[a] = INT_MAX;
+        grid->cell_max[a] = INT_MIN;
+    }
     
     for (int i = 0; i < count; i++) {
-        // Find a suitable location
-        int attempts = 0;
-        while (attempts < 100) {
-            int x = rand() % cave->width;
-            int y = rand() % cave->height;
-            int z = cave->depth / 2 + (rand() % 10 - 5);
-            
-            // Check if location is near a wall
-            if (x > 0 && x < cave->width - 1 && y > 0 && y < cave->height - 1 && z > 0 && z < cave->depth - 1) {
-                int wall_nearby = 0;
-                for (int dz = -1; dz <= 1; dz++) {
-                    for (int dy = -1; dy <= 1; dy++) {
-                        for (int dx = -1; dx <= 1; dx++) {
-                            if (cave->map[z + dz][y + dy][x + dx] == 1) {
-                                wall_nearby = 1;
-                                break;
-                            }
-                        }
-                    }
-                }
-                
-                if (wall_nearby) {
-                    crystals[i].x = (float)x / cave->width * 10.0f - 5.0f;
-                    crystals[i].y = cave->height_map[y * cave->width + x] + 0.2f;
-                    crystals[i].z = (float)y / cave->height * 10.0f - 5.0f;
-                    crystals[i].size = 0.1f + (rand() % 100) / 200.0f;
-                    crystals[i].rotation = (rand() % 360) * M_PI / 180.0f;
-                    
-                    // Random crystal colors
-                    int color_type = rand() % 4;
-                    switch (color_type) {
-                        case 0:  // Blue
-                            crystals[i].color[0] = 0.2f;
-                            crystals[i].color[1] = 0.4f;
-                            crystals[i].color[2] = 1.0f;
-                            break;
-                        case 1:  // Green
-                            crystals[i].color[0] = 0.2f;
-                            crystals[i].color[1] = 1.0f;
-                            crystals[i].color[2] = 0.4f;
-                            break;
-                        case 2:  // Purple
-                            crystals[i].color[0] = 0.8f;
-                            crystals[i].color[1] = 0.2f;
-                            crystals[i].color[2] = 1.0f;
-                            break;
-                        case 3:  // Orange
-                            crystals[i].color[0] = 1.0f;
-                            crystals[i].color[1] = 0.6f;
-                            crystals[i].color[2] = 0.2f;
-                            break;
+        if (!gems[i].collected) gem_grid_insert(grid, gems, i);
+    }
+    return grid;
+}
+
+void free_gem_grid(GemGrid* grid) {
+    if (!grid) return;
+    
+    free(grid->heads);
+    free(grid->next);
+    free(grid->prev);
+    free(grid->bucket);
+    free(grid->cells);
+    free(grid);
+}
+
+void gem_grid_insert(GemGrid* grid, const Gem* gems, int index) {
+    if (grid->bucket[index] >= 0) gem_grid_remove(grid, index);
+    
+    int cell[3] = { gem_cell(grid, gems[index].x), gem_cell(grid, gems[index].y), gem_cell(grid, gems[index].z) };
+    int b = gem_grid_bucket(grid, cell[0], cell[1], cell[2]);
+    grid->bucket[index] = b;
+    memcpy(&grid->cells[index * 3], cell, sizeof(cell));
+    grid->prev[index] = -1;
+    grid->next[index] = grid->heads[b];
+    if (grid->heads[b] >= 0) grid->prev[grid->heads[b]] = index;
+    grid->heads[b] = index;
+    grid->live_count++;
+    
+    for (int a = 0; a < 3; a++) {
+        grid->cell_min[a] = cell[a] < grid->cell_min[a] ? cell[a] : grid->cell_min[a];
+        grid->cell_max[a] = cell[a] > grid->cell_max[a] ? cell[a] : grid->cell_max[a];
+    }
+}
+
+void gem_grid_remove(GemGrid* grid, int index) {
+    int b = grid->bucket[index];
+    if (b < 0) return;
+    
+    if (grid->prev[index] >= 0) {
+        grid->next[grid->prev[index]] = grid->next[index];
+    } else {
+        grid->heads[b] = grid->next[index];
+    }
+    if (grid->next[index] >= 0) grid->prev[grid->next[index]] = grid->prev[index];
+    grid->bucket[index] = -1;
+    grid->live_count--;
+}
+
+// Visit the gems filed under cell (cx, cy, cz); other cells sharing its
+// bucket are skipped so no gem is seen twice
+#define GEM_CELL_FOREACH(grid, cx, cy, cz, i)                                                    \
+    for (int i = (grid)->heads[gem_grid_bucket(grid, cx, cy, cz)]; i >= 0; i = (grid)->next[i])   \
+        if ((grid)->cells[i * 3] == (cx) && (grid)->cells[i * 3 + 1] == (cy) && (grid)->cells[i * 3 + 2] == (cz))
+
+int gem_grid_query(const GemGrid* grid, const Gem* gems, float x, float y, float z, float radius,
+                   int* results, int max_results) {
+    float r2 = radius * radius;
+    int found = 0;
+    for (int cz = gem_cell(grid, z - radius); cz <= gem_cell(grid, z + radius); cz++) {
+        for (int cy = gem_cell(grid, y - radius); cy <= gem_cell(grid, y + radius); cy++) {
+            for (int cx = gem_cell(grid, x - radius); cx <= gem_cell(grid, x + radius); cx++) {
+                GEM_CELL_FOREACH(grid, cx, cy, cz, i) {
+                    float dx = gems[i].x - x, dy = gems[i].y - y, dz = gems[i].z - z;
+                    if (dx * dx + dy * dy + dz * dz < r2 && found < max_results) {
+                        results[found++] = i;
                     }
-                    
-                    crystals[i].glow_intensity = 0.5f + (rand() % 50) / 100.0f;
-                    break;
                 }
             }
-            attempts++;
         }
     }
-    
-    return crystals;
+    return found;
 }
 
-// Render crystals with basic shapes
-void render_crystals(Crystal* crystals, int count) {
-    for (int i = 0; i < count; i++) {
-        glPushMatrix();
-        
-        glTranslatef(crystals[i].x, crystals[i].y, crystals[i].z);
-        glRotatef(crystals[i].rotation * 180.0f / M_PI, 0, 1, 0);
-        glScalef(crystals[i].size, crystals[i].size, crystals[i].size);
-        
-        // Set crystal color
-        glColor3f(crystals[i].color[0], crystals[i].color[1], crystals[i].color[2]);
-        
-        // Draw simple pyramid crystal
-        glBegin(GL_TRIANGLES);
-        // Top pyramid
-        glVertex3f( 0.0f,  0.8f,  0.0f);
-        glVertex3f( 0.5f,  0.0f,  0.5f);
-        glVertex3f(-0.5f,  0.0f,  0.5f);
-        
-        glVertex3f( 0.0f,  0.8f,  0.0f);
-        glVertex3f(-0.5f,  0.0f,  0.5f);
-        glVertex3f(-0.5f,  0.0f, -0.5f);
-        
-        glVertex3f( 0.0f,  0.8f,  0.0f);
-        glVertex3f(-0.5f,  0.0f, -0.5f);
-        glVertex3f( 0.5f,  0.0f, -0.5f);
-        
-        glVertex3f( 0.0f,  0.8f,  0.0f);
-        glVertex3f( 0.5f,  0.0f, -0.5f);
-        glVertex3f( 0.5f,  0.0f,  0.5f);
-        glEnd();
-        
-        glPopMatrix();
+// Closest gem filed under cell (cx, cy, cz) if nearer than *best_d2; ties
+// go to the lowest index, as a scan in array order would pick
+static void nearest_in_cell(const GemGrid* grid, const Gem* gems, int cx, int cy, int cz, float x, float y, float z,
+                            int* best, float* best_d2) {
+    // Skip the cell when even its nearest point is no closer than the best
+    float p[3] = { x, y, z };
+    int c[3] = { cx, cy, cz };
+    float gap2 = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        float lo = c[a] * grid->cell_size, hi = lo + grid->cell_size;
+        float gap = p[a] < lo ? lo - p[a] : (p[a] > hi ? p[a] - hi : 0.0f);
+        gap2 += gap * gap;
+    }
+    if (gap2 > *best_d2) return;
+    
+    GEM_CELL_FOREACH(grid, cx, cy, cz, i) {
+        float dx = gems[i].x - x, dy = gems[i].y - y, dz = gems[i].z - z;
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 < *best_d2 || (d2 == *best_d2 && i < *best)) {
+            *best_d2 = d2;
+            *best = i;
+        }
     }
 }
 
-// Generate collectible gems
-Gem* generate_gems(Cave* cave, int count) {
-    Gem* gems = (Gem*)malloc(count * sizeof(Gem));
+int find_nearest_gem(const GemGrid* grid, const Gem* gems, float x, float y, float z) {
+    if (!grid || grid->live_count == 0) return -1;
+    
+    int c[3] = { gem_cell(grid, x), gem_cell(grid, y), gem_cell(grid, z) };
+    int rings = 0;
+    for (int a = 0; a < 3; a++) {
+        int reach = c[a] - grid->cell_min[a] > grid->cell_max[a] - c[a] ? c[a] - grid->cell_min[a]
+                                                                          : grid->cell_max[a] - c[a];
+        rings = reach > rings ? reach : rings;
+    }
     
-    for (int i = 0; i < count; i++) {
-        // Find a spot near walls in empty space
-        int attempts = 0;
-        while (attempts < 100) {
-            int x = rand() % cave->width;
-            int y = rand() % cave->height;
-            int z = rand() % cave->depth;
-            
-            // Check if this is empty space near a wall
-            if (x > 1 && x < cave->width - 2 &&
-                y > 1 && y < cave->height - 2 &&
-                z > 1 && z < cave->depth - 2 &&
-                cave->map[z][y][x] == 0) {
-                
-                // Check if there's a wall nearby
-                int wall_nearby = 0;
-                for (int dz = -1; dz <= 1 && !wall_nearby; dz++) {
-                    for (int dy = -1; dy <= 1 && !wall_nearby; dy++) {
-                        for (int dx = -1; dx <= 1 && !wall_nearby; dx++) {
-                            if (cave->map[z + dz][y + dy][x + dx] == 1) {
-                                wall_nearby = 1;
-                            }
-                        }
-                    }
-                }
-                
-                if (wall_nearby) {
-                    gems[i].x = (float)x / cave->width * 10.0f - 5.0f;
-                    gems[i].y = (float)y / cave->height * 10.0f - 5.0f;
-                    gems[i].z = (float)z / cave->depth * 10.0f - 5.0f;
-                    gems[i].rotation = (rand() % 360) * M_PI / 180.0f;
-                    gems[i].bob_offset = (rand() % 100) / 100.0f * 2.0f * M_PI;
-                    gems[i].type = rand() % 10;
-                    gems[i].collected = 0;
-                    gems[i].size = 0.1f + (rand() % 50) / 500.0f;
-                    
-                    // Set color based on type
-                    switch (gems[i].type) {
-                        case 0: // Ruby
-                            gems[i].color[0] = 1.0f; gems[i].color[1] = 0.2f; gems[i].color[2] = 0.2f;
-                            break;
-                        case 1: // Emerald
-                            gems[i].color[0] = 0.2f; gems[i].color[1] = 1.0f; gems[i].color[2] = 0.2f;
-                            break;
-                        case 2: // Sapphire
-                            gems[i].color[0] = 0.2f; gems[i].color[1] = 0.2f; gems[i].color[2] = 1.0f;
-                            break;
-                        case 3: // Amethyst
-                            gems[i].color[0] = 0.8f; gems[i].color[1] = 0.2f; gems[i].color[2] = 1.0f;
-                            break;
-                        case 4: // Topaz
-                            gems[i].color[0] = 1.0f; gems[i].color[1] = 0.8f; gems[i].color[2] = 0.2f;
-                            break;
-                        case 5: // Diamond
-                            gems[i].color[0] = 0.9f; gems[i].color[1] = 0.9f; gems[i].color[2] = 1.0f;
-                            break;
-                        case 6: // Onyx
-                            gems[i].color[0] = 0.1f; gems[i].color[1] = 0.1f; gems[i].color[2] = 0.1f;
-                            break;
-                        case 7: // Aquamarine
-                            gems[i].color[0] = 0.2f; gems[i].color[1] = 0.8f; gems[i].color[2] = 1.0f;
-                            break;
-                        case 8: // Citrine
-                            gems[i].color[0] = 1.0f; gems[i].color[1] = 0.6f; gems[i].color[2] = 0.0f;
-                            break;
-                        case 9: // Rose Quartz
-                            gems[i].color[0] = 1.0f; gems[i].color[1] = 0.6f; gems[i].color[2] = 0.8f;
-                            break;
-                    }
-                    break;
+    // Grow a shell of cells around the query's; once the best gem is within
+    // r cells no cell further out can hold a closer one
+    int best = -1;
+    float best_d2 = INFINITY;
+    for (int r = 0; r <= rings; r++) {
+        for (int dz = -r; dz <= r; dz++) {
+            for (int dy = -r; dy <= r; dy++) {
+                int face = dz == -r || dz == r || dy == -r || dy == r;
+                for (int dx = -r; dx <= r; dx += face || r == 0 ? 1 : 2 * r) {
+                    nearest_in_cell(grid, gems, c[0] + dx, c[1] + dy, c[2] + dz, x, y, z, &best, &best_d2);
                 }
             }
-            attempts++;
         }
+        float reached = r * grid->cell_size;
+        if (best >= 0 && best_d2 <= reached * reached) break;
     }
-    
-    return gems;
-}
-
-// Render gems with rotation and bobbing animation
-void render_gems(Gem* gems, int count, float time) {
-    for (int i = 0; i < count; i++) {
-        if (gems[i].collected) continue;
-        
-        float bob = sin(time * 2.0f + gems[i].bob_offset) * 0.05f;
-        float rotation = time + gems[i].rotation;
-        
-        glPushMatrix();
-        
-        glTranslatef(gems[i].x, gems[i].y + bob, gems[i].z);
-        glRotatef(rotation * 180.0f / M_PI, 0, 1, 0);
-        glScalef(gems[i].size, gems[i].size, gems[i].size);
-        
-        // Set gem color
-        glColor3f(gems[i].color[0], gems[i].color[1], gems[i].color[2]);
-        
-        // Draw octahedron gem
-        glBegin(GL_TRIANGLES);
-        // Top pyramid
-        glVertex3f( 0.0f,  0.5f,  0.0f);
-        glVertex3f( 0.5f,  0.0f,  0.0f);
-        glVertex3f( 0.0f,  0.0f,  0.5f);
-        
-        glVertex3f( 0.0f,  0.5f,  0.0f);
-        glVertex3f( 0.0f,  0.0f,  0.5f);
-        glVertex3f(-0.5f,  0.0f,  0.0f);
-        
-        glVertex3f( 0.0f,  0.5f,  0.0f);
-        glVertex3f(-0.5f,  0.0f,  0.0f);
-        glVertex3f( 0.0f,  0.0f, -0.5f);
-        
-        glVertex3f( 0.0f,  0.5f,  0.0f);
-        glVertex3f( 0.0f,  0.0f, -0.5f);
-        glVertex3f( 0.5f,  0.0f,  0.0f);
-        
-        // Bottom pyramid
-        glVertex3f( 0.0f, -0.5f,  0.0f);
-        glVertex3f( 0.0f,  0.0f,  0.5f);
-        glVertex3f( 0.5f,  0.0f,  0.0f);
-        
-        glVertex3f( 0.0f, -0.5f,  0.0f);
-        glVertex3f(-0.5f,  0.0f,  0.0f);
-        glVertex3f( 0.0f,  0.0f,  0.5f);
-        
-        glVertex3f( 0.0f, -0.5f,  0.0f);
-        glVertex3f( 0.0f,  0.0f, -0.5f);
-        glVertex3f(-0.5f,  0.0f,  0.0f);
-        
-        glVertex3f( 0.0f, -0.5f,  0.0f);
-        glVertex3f( 0.5f,  0.0f,  0.0f);
-        glVertex3f( 0.0f,  0.0f, -0.5f);
-        glEnd();
-        
-        glPopMatrix();
-    }
+    return best;
 }
 
 // Check for gem collection
-int collect_gem(Gem* gems, int count, float player_x, float player_y, float player_z, float collect_radius) {
-    for (int i = 0; i < count; i++) {
-        if (!gems[i].collected) {
-            float dx = gems[i].x - player_x;
-            float dy = gems[i].y - player_y;
-            float dz = gems[i].z - player_z;
-            float dist = sqrt(dx*dx + dy*dy + dz*dz);
-            
-            if (dist < collect_radius) {
-                gems[i].collected = 1;
-                return gems[i].type;
+int collect_gem(Gem* gems, GemGrid* grid, float player_x, float player_y, float player_z, float collect_radius) {
+    int best = -1;
+    float best_d2 = collect_radius * collect_radius;
+    for (int cz = gem_cell(grid, player_z - collect_radius); cz <= gem_cell(grid, player_z + collect_radius); cz++) {
+        for (int cy = gem_cell(grid, player_y - collect_radius); cy <= gem_cell(grid, player_y + collect_radius); cy++) {
+            for (int cx = gem_cell(grid, player_x - collect_radius); cx <= gem_cell(grid, player_x + collect_radius);
+                 cx++) {
+                nearest_in_cell(grid, gems, cx, cy, cz, player_x, player_y, player_z, &best, &best_d2);
             }
         }
     }
-    return -1;
+    if (best < 0) return -1;
+    
+    gems[best].collected = 1;
+    gem_grid_remove(grid, best);
+    return best;
 }
 
 // Respawn a collected gem at a new location
-void respawn_gem(Gem* gem, Cave* cave) {
-    // Find new location
-    int attempts = 0;
-    while (attempts < 100) {
-        int x = rand() % cave->width;
-        int y = rand() % cave->height;
-        int z = rand() % cave->depth;
-        
-        if (x > 1 && x < cave->width - 2 &&
-            y > 1 && y < cave->height - 2 &&
-            z > 1 && z < cave->depth - 2 &&
-            cave->map[z][y][x] == 0) {
-            
-            gem->x = (float)x / cave->width * 10.0f - 5.0f;
-            gem->y = (float)y / cave->height * 10.0f - 5.0f;
-            gem->z = (float)z / cave->depth * 10.0f - 5.0f;
-            gem->collected = 0;
-            gem->bob_offset = (rand() % 100) / 100.0f * 2.0f * M_PI;
-            break;
+void respawn_gem(Gem* gems, int index, GemGrid* grid, Cave* cave) {
+    Gem* gem = &gems[index];
+    const SurfaceCandidates* surface = cave_surface_candidates(cave);
+    if (surface->total == 0) return;
+    
+    // Every respawn gets a fresh stream
+    Rng rng = rng_stream(cave->seed, RNG_STREAM_RESPAWN, cave->respawn_count++);
+    int x, y, z;
+    surface_voxel(cave, surface->voxels[rng_int(&rng, surface->total)], &x, &y, &z);
+    gem->x = (float)x / cave->width * 10.0f - 5.0f;
+    gem->y = (float)y / cave->height * 10.0f - 5.0f;
+    gem->z = (float)z / cave->depth * 10.0f - 5.0f;
+    gem->collected = 0;
+    gem->bob_offset = rng_int(&rng, 100) / 100.0f * 2.0f * M_PI;
+    
+    if (grid) gem_grid_insert(grid, gems, index);
+}
+
+// Cave mesh creation and rendering
+// Exterior mesh vertex over height map texel (x, z)
+static void terrain_vertex(const Cave* cave, int x, int z, float* out) {
+    out[0] = (float)x / cave->width * 10.0f - 5.0f;
+    out[1] = cave->height_map[z * cave->width + x];
+    out[2] = (float)z / cave->height * 10.0f - 5.0f;
+}
+
+// Box around the vertices of patch (px, pz), which include the far edge
+static void cave_patch_bounds(CaveMesh* mesh, const Cave* cave, int px, int pz) {
+    CavePatch* patch = &mesh->patches[pz * mesh->patch_count_x + px];
+    int x0 = px * CAVE_PATCH_SIZE, z0 = pz * CAVE_PATCH_SIZE;
+    int x1 = x0 + CAVE_PATCH_SIZE < cave->width - 1 ? x0 + CAVE_PATCH_SIZE : cave->width - 1;
+    int z1 = z0 + CAVE_PATCH_SIZE < cave->height - 1 ? z0 + CAVE_PATCH_SIZE : cave->height - 1;
+    
+    float lo[3], hi[3];
+    terrain_vertex(cave, x0, z0, lo);
+    terrain_vertex(cave, x1, z1, hi);
+    float min_y = INFINITY, max_y = -INFINITY;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            float h = cave->height_map[z * cave->width + x];
+            if (h < min_y) min_y = h;
+            if (h > max_y) max_y = h;
         }
-        attempts++;
     }
+    
+    patch->bounds_min[0] = lo[0];
+    patch->bounds_min[1] = min_y;
+    patch->bounds_min[2] = lo[2];
+    patch->bounds_max[0] = hi[0];
+    patch->bounds_max[1] = max_y;
+    patch->bounds_max[2] = hi[2];
 }
 
-// Cave mesh creation and rendering
 CaveMesh* create_cave_mesh(Cave* cave) {
     CaveMesh* mesh = (CaveMesh*)calloc(1, sizeof(CaveMesh));
     
@@ -696,9 +2330,7 @@ CaveMesh* create_cave_mesh(Cave* cave) {
     for (int z = 0; z < cave->height; z++) {
         for (int x = 0; x < cave->width; x++) {
             // Position
-            vertices[v_idx * 3 + 0] = (float)x / cave->width * 10.0f - 5.0f;
-            vertices[v_idx * 3 + 1] = cave->height_map[z * cave->width + x];
-            vertices[v_idx * 3 + 2] = (float)z / cave->height * 10.0f - 5.0f;
+            terrain_vertex(cave, x, z, &vertices[v_idx * 3]);
             
             // Normal
             normals[v_idx * 3 + 0] = 0.0f;
@@ -713,24 +2345,40 @@ CaveMesh* create_cave_mesh(Cave* cave) {
         }
     }
     
-    // Generate indices
+    // Generate indices patch by patch, so each patch is one contiguous range
     mesh->index_count = (cave->width - 1) * (cave->height - 1) * 6;
     unsigned int* indices = (unsigned int*)malloc(mesh->index_count * sizeof(unsigned int));
     
+    mesh->patch_count_x = (cave->width - 1 + CAVE_PATCH_SIZE - 1) / CAVE_PATCH_SIZE;
+    mesh->patch_count_z = (cave->height - 1 + CAVE_PATCH_SIZE - 1) / CAVE_PATCH_SIZE;
+    mesh->patches = (CavePatch*)calloc(mesh->patch_count_x * mesh->patch_count_z, sizeof(CavePatch));
+    
     int idx = 0;
-    for (int z = 0; z < cave->height - 1; z++) {
-        for (int x = 0; x < cave->width - 1; x++) {
-            int base = z * cave->width + x;
+    for (int pz = 0; pz < mesh->patch_count_z; pz++) {
+        for (int px = 0; px < mesh->patch_count_x; px++) {
+            CavePatch* patch = &mesh->patches[pz * mesh->patch_count_x + px];
+            patch->first_index = idx;
             
-            // First triangle
-            indices[idx++] = base;
-            indices[idx++] = base + 1;
-            indices[idx++] = base + cave->width;
+            int x_end = (px + 1) * CAVE_PATCH_SIZE < cave->width - 1 ? (px + 1) * CAVE_PATCH_SIZE : cave->width - 1;
+            int z_end = (pz + 1) * CAVE_PATCH_SIZE < cave->height - 1 ? (pz + 1) * CAVE_PATCH_SIZE : cave->height - 1;
+            for (int z = pz * CAVE_PATCH_SIZE; z < z_end; z++) {
+                for (int x = px * CAVE_PATCH_SIZE; x < x_end; x++) {
+                    int base = z * cave->width + x;
+                    
+                    // First triangle
+                    indices[idx++] = base;
+                    indices[idx++] = base + 1;
+                    indices[idx++] = base + cave->width;
+                    
+                    // Second triangle
+                    indices[idx++] = base + 1;
+                    indices[idx++] = base + cave->width + 1;
+                    indices[idx++] = base + cave->width;
+                }
+            }
             
-            // Second triangle
-            indices[idx++] = base + 1;
-            indices[idx++] = base + cave->width + 1;
-            indices[idx++] = base + cave->width;
+            patch->index_count = idx - patch->first_index;
+            cave_patch_bounds(mesh, cave, px, pz);
         }
     }
     
@@ -758,8 +2406,10 @@ CaveMesh* create_cave_mesh(Cave* cave) {
     glBindVertexArray(0);
     
     // Create textures from cave data
-    mesh->height_texture = create_texture_from_data(cave->height_map, cave->width, cave->height, 1);
-    mesh->normal_texture = create_texture_from_data(cave->normal_map, cave->width, cave->height, 3);
+    mesh->height_texture = create_texture_keeping_mips(cave->height_map, cave->width, cave->height, 1,
+                                                        TEXTURE_HEIGHT, &mesh->height_mips);
+    mesh->normal_texture = create_texture_keeping_mips(cave->normal_map, cave->width, cave->height, 3,
+                                                        TEXTURE_NORMAL, &mesh->normal_mips);
     
     // Generate procedural textures
     mesh->diffuse_texture = generate_rock_texture(512, 512);
@@ -789,11 +2439,73 @@ void free_cave_mesh(CaveMesh* mesh) {
         glDeleteTextures(1, &mesh->roughness_texture);
         glDeleteTextures(1, &mesh->ao_texture);
         glDeleteTextures(1, &mesh->emissive_texture);
+        free_texture_mip_floats(&mesh->height_mips);
+        free_texture_mip_floats(&mesh->normal_mips);
+        free(mesh->patches);
         free(mesh);
     }
 }
 
-void render_cave_with_tessellation(CaveMesh* mesh) {
+void update_cave_mesh(CaveMesh* mesh, Cave* cave) {
+    if (!cave->dirty) return;
+    cave->dirty = 0;
+    
+    // Height columns over the changed voxels
+    int x0 = cave->dirty_lo[0], x1 = cave->dirty_hi[0];
+    int y0 = cave->dirty_lo[1], y1 = cave->dirty_hi[1];
+    float* noise = (float*)malloc(cave->width * 2 * sizeof(float));
+    float* detail = noise + cave->width;
+    for (int y = y0; y <= y1; y++) {
+        height_map_noise(cave, y, x0, x1, noise, detail);
+        height_map_span(cave, y, x0, x1, noise, detail);
+    }
+    free(noise);
+    
+    // Normals read the heights one texel around them
+    int nx0 = x0 - 1 < 1 ? 1 : x0 - 1;
+    int ny0 = y0 - 1 < 1 ? 1 : y0 - 1;
+    int nx1 = x1 + 1 > cave->width - 2 ? cave->width - 2 : x1 + 1;
+    int ny1 = y1 + 1 > cave->height - 2 ? cave->height - 2 : y1 + 1;
+    for (int y = ny0; y <= ny1; y++) {
+        normal_map_span(cave, y, nx0, nx1);
+    }
+    
+    if (!mesh) return;
+    
+    // Each height map row is a contiguous run of the vertex buffer
+    int span = x1 - x0 + 1;
+    float* row = (float*)malloc(span * 3 * sizeof(float));
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            terrain_vertex(cave, x, y, &row[(x - x0) * 3]);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)((size_t)(y * cave->width + x0) * 3 * sizeof(float)),
+                        span * 3 * sizeof(float), row);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(row);
+    
+    // Patches sharing a vertex with the changed rows; quads x - 1 and x both use vertex x
+    int px0 = x0 - 1 < 0 ? 0 : (x0 - 1) / CAVE_PATCH_SIZE;
+    int pz0 = y0 - 1 < 0 ? 0 : (y0 - 1) / CAVE_PATCH_SIZE;
+    int px1 = x1 / CAVE_PATCH_SIZE < mesh->patch_count_x - 1 ? x1 / CAVE_PATCH_SIZE : mesh->patch_count_x - 1;
+    int pz1 = y1 / CAVE_PATCH_SIZE < mesh->patch_count_z - 1 ? y1 / CAVE_PATCH_SIZE : mesh->patch_count_z - 1;
+    for (int pz = pz0; pz <= pz1; pz++) {
+        for (int px = px0; px <= px1; px++) {
+            cave_patch_bounds(mesh, cave, px, pz);
+        }
+    }
+    
+    // Texture sub-rectangles and the mip texels under them, filtered and packed
+    // the way the whole chain was at load time
+    patch_texture_mips(mesh->height_texture, &mesh->height_mips, x0, y0, x1, y1);
+    if (nx0 <= nx1 && ny0 <= ny1) {
+        patch_texture_mips(mesh->normal_texture, &mesh->normal_mips, nx0, ny0, nx1, ny1);
+    }
+}
+
+void render_cave_with_tessellation(CaveMesh* mesh, const Frustum* frustum, CullCounter* counter) {
     // Simple fallback rendering without tessellation
     glBindVertexArray(mesh->vao);
     
@@ -807,177 +2519,181 @@ void render_cave_with_tessellation(CaveMesh* mesh) {
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, mesh->diffuse_texture);
     
-    // Render as triangles for compatibility
-    glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+    // Render as triangles for compatibility; runs of visible patches are
+    // adjacent in the index buffer and go out as one draw
+    int patch_count = mesh->patch_count_x * mesh->patch_count_z;
+    int run_first = 0, run_count = 0;
+    for (int i = 0; i < patch_count; i++) {
+        const CavePatch* patch = &mesh->patches[i];
+        if (frustum_cull_aabb(frustum, patch->bounds_min, patch->bounds_max, counter)) {
+            if (run_count == 0) run_first = patch->first_index;
+            run_count += patch->index_count;
+            continue;
+        }
+        if (run_count > 0) {
+            glDrawElements(GL_TRIANGLES, run_count, GL_UNSIGNED_INT,
+                           (void*)((size_t)run_first * sizeof(unsigned int)));
+            run_count = 0;
+        }
+    }
+    if (run_count > 0) {
+        glDrawElements(GL_TRIANGLES, run_count, GL_UNSIGNED_INT,
+                       (void*)((size_t)run_first * sizeof(unsigned int)));
+    }
     
     glBindVertexArray(0);
 }
 
-// Render cave interior walls
-void render_cave_interior(Cave* cave, float cam_x, float cam_y, float cam_z) {
-    // Convert camera position to cave coordinates
-    int cx = (int)((cam_x + 5.0f) / 10.0f * cave->width);
-    int cy = (int)((cam_y + 5.0f) / 10.0f * cave->height);
-    int cz = (int)((cam_z + 5.0f) / 10.0f * cave->depth);
-    
-    // Render nearby cave blocks
-    int render_dist = 25;  // Increased render distance
-    
-    glUseProgram(0);  // Use fixed function for now
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    
-    // Set up better lighting for cave interior
-    float light_pos[] = {cam_x, cam_y + 1.0f, cam_z, 1.0f};
-    float light_ambient[] = {0.4f, 0.4f, 0.5f, 1.0f};   // Increased ambient
-    float light_diffuse[] = {0.8f, 0.8f, 0.9f, 1.0f};   // Brighter diffuse
-    float light_specular[] = {0.3f, 0.3f, 0.4f, 1.0f};  // Some specular
-    
-    glLightfv(GL_LIGHT0, GL_POSITION, light_pos);
-    glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
-    
-    glBegin(GL_QUADS);
-    
-    for (int z = cz - render_dist; z <= cz + render_dist; z++) {
-        for (int y = cy - render_dist; y <= cy + render_dist; y++) {
-            for (int x = cx - render_dist; x <= cx + render_dist; x++) {
-                if (x >= 0 && x < cave->width &&
-                    y >= 0 && y < cave->height &&
-                    z >= 0 && z < cave->depth) {
-                    
-                    if (cave->map[z][y][x] == 1) {
-                        // This is a wall block - check if we need to render any faces
-                        float bx = (float)x / cave->width * 10.0f - 5.0f;
-                        float by = (float)y / cave->height * 10.0f - 5.0f;
-                        float bz = (float)z / cave->depth * 10.0f - 5.0f;
-                        float s = 0.05f;  // Block size
-                        
-                        // Only render faces adjacent to empty space
-                        if (x > 0 && cave->map[z][y][x-1] == 0) {
-                            // Left face - brighter colors
-                            glNormal3f(-1, 0, 0);
-                            glColor3f(0.6f, 0.5f, 0.4f);  // Increased brightness
-                            glVertex3f(bx-s, by-s, bz-s);
-                            glVertex3f(bx-s, by-s, bz+s);
-                            glVertex3f(bx-s, by+s, bz+s);
-                            glVertex3f(bx-s, by+s, bz-s);
-                        }
-                        
-                        if (x < cave->width-1 && cave->map[z][y][x+1] == 0) {
-                            // Right face
-                            glNormal3f(1, 0, 0);
-                            glColor3f(0.6f, 0.5f, 0.4f);
-                            glVertex3f(bx+s, by-s, bz+s);
-                            glVertex3f(bx+s, by-s, bz-s);
-                            glVertex3f(bx+s, by+s, bz-s);
-                            glVertex3f(bx+s, by+s, bz+s);
-                        }
-                        
-                        if (y > 0 && cave->map[z][y-1][x] == 0) {
-                            // Bottom face - darker for ground
-                            glNormal3f(0, -1, 0);
-                            glColor3f(0.5f, 0.4f, 0.3f);
-                            glVertex3f(bx-s, by-s, bz+s);
-                            glVertex3f(bx-s, by-s, bz-s);
-                            glVertex3f(bx+s, by-s, bz-s);
-                            glVertex3f(bx+s, by-s, bz+s);
-                        }
-                        
-                        if (y < cave->height-1 && cave->map[z][y+1][x] == 0) {
-                            // Top face - brightest for ceiling
-                            glNormal3f(0, 1, 0);
-                            glColor3f(0.7f, 0.6f, 0.5f);
-                            glVertex3f(bx-s, by+s, bz-s);
-                            glVertex3f(bx-s, by+s, bz+s);
-                            glVertex3f(bx+s, by+s, bz+s);
-                            glVertex3f(bx+s, by+s, bz-s);
-                        }
-                        
-                        if (z > 0 && cave->map[z-1][y][x] == 0) {
-                            // Front face
-                            glNormal3f(0, 0, -1);
-                            glColor3f(0.55f, 0.45f, 0.35f);
-                            glVertex3f(bx-s, by-s, bz-s);
-                            glVertex3f(bx+s, by-s, bz-s);
-                            glVertex3f(bx+s, by+s, bz-s);
-                            glVertex3f(bx-s, by+s, bz-s);
-                        }
-                        
-                        if (z < cave->depth-1 && cave->map[z+1][y][x] == 0) {
-                            // Back face
-                            glNormal3f(0, 0, 1);
-                            glColor3f(0.55f, 0.45f, 0.35f);
-                            glVertex3f(bx+s, by-s, bz+s);
-                            glVertex3f(bx-s, by-s, bz+s);
-                            glVertex3f(bx-s, by+s, bz+s);
-                            glVertex3f(bx+s, by+s, bz+s);
-                        }
-                    }
+// Texture generation functions
+
+// One fractal noise layer; everything is a float so a texture's parameters
+// can be hashed as a flat array for the texture cache
+typedef struct {
+    float scale;
+    float z;
+    float octaves;
+    float persistence;
+    float weight;       // 0 disables the layer
+} TextureNoiseLayer;
+
+typedef struct {
+    float base;
+    float clamp;        // Nonzero clamps the value to [0, 1]
+    float tint[3];      // Per-channel multiplier for RGB textures
+    TextureNoiseLayer layers[2];
+} NoiseTextureParams;
+
+typedef struct {
+    const char* name;
+    int channels;
+    TextureUsage usage;
+    NoiseTextureParams params;
+} NoiseTexture;
+
+static const NoiseTexture rock_texture = {
+    "rock", 3, TEXTURE_ALBEDO,
+    { 0.3f, 1.0f, { 0.4f, 0.35f, 0.3f },
+      { { 0.01f, 0.0f, 5, 0.5f, 0.2f }, { 0.05f, 10.0f, 3, 0.3f, 0.1f } } }
+};
+
+static const NoiseTexture roughness_texture = {
+    "roughness", 1, TEXTURE_MASK,
+    { 0.7f, 0.0f, { 1.0f, 1.0f, 1.0f }, { { 0.02f, 0.0f, 4, 0.6f, 0.3f } } }
+};
+
+static const NoiseTexture ao_texture = {
+    "ao", 1, TEXTURE_MASK,
+    { 0.8f, 0.0f, { 1.0f, 1.0f, 1.0f }, { { 0.01f, 0.0f, 3, 0.5f, 0.2f } } }
+};
+
+#define TEXTURE_NOISE_LAYERS (int)(sizeof(((NoiseTextureParams*)0)->layers) / sizeof(TextureNoiseLayer))
+
+typedef struct {
+    const NoiseTexture* texture;
+    float* data;
+    int width;
+    int height;
+} TextureJob;
+
+// Texture rows [begin, end)
+static void noise_texture_rows(void* ctx, int begin, int end, int chunk) {
+    TextureJob* job = (TextureJob*)ctx;
+    const NoiseTextureParams* p = &job->texture->params;
+    int width = job->width;
+    int channels = job->texture->channels;
+    (void)chunk;
+    
+    float* noise = (float*)malloc(width * TEXTURE_NOISE_LAYERS * sizeof(float));
+    
+    for (int y = begin; y < end; y++) {
+        for (int l = 0; l < TEXTURE_NOISE_LAYERS; l++) {
+            const TextureNoiseLayer* layer = &p->layers[l];
+            if (layer->weight != 0.0f) {
+                fractal_noise_row(noise + l * width, width, 0, width, y, layer->scale, layer->z,
+                                  (int)layer->octaves, layer->persistence);
+            }
+        }
+        
+        float* row = job->data + (size_t)y * width * channels;
+        for (int x = 0; x < width; x++) {
+            float value = p->base;
+            for (int l = 0; l < TEXTURE_NOISE_LAYERS; l++) {
+                if (p->layers[l].weight != 0.0f) {
+                    value += noise[l * width + x] * p->layers[l].weight;
+                }
+            }
+            if (p->clamp != 0.0f) {
+                value = fmax(0.0f, fmin(1.0f, value));
+            }
+            
+            if (channels == 1) {
+                row[x] = value;
+            } else {
+                for (int c = 0; c < channels; c++) {
+                    row[x * channels + c] = value * p->tint[c];
                 }
             }
         }
     }
     
-    glEnd();
-    glDisable(GL_LIGHTING);
+    free(noise);
 }
 
-// Texture generation functions
-GLuint generate_rock_texture(int width, int height) {
-    float* data = (float*)malloc(width * height * 3 * sizeof(float));
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            float noise1 = fractal_noise_3d(x * 0.01f, y * 0.01f, 0.0f, 5, 0.5f);
-            float noise2 = fractal_noise_3d(x * 0.05f, y * 0.05f, 10.0f, 3, 0.3f);
-            
-            float value = 0.3f + noise1 * 0.2f + noise2 * 0.1f;
-            value = fmax(0.0f, fmin(1.0f, value));
-            
-            int idx = (y * width + x) * 3;
-            data[idx + 0] = value * 0.4f;
-            data[idx + 1] = value * 0.35f;
-            data[idx + 2] = value * 0.3f;
-        }
+static void fill_noise_texture(const NoiseTexture* texture, float* data, int width, int height) {
+    TextureJob job = { texture, data, width, height };
+    parallel_for(height, noise_texture_rows, &job);
+}
+
+void fill_rock_texture(float* data, int width, int height) {
+    fill_noise_texture(&rock_texture, data, width, height);
+}
+
+void fill_roughness_texture(float* data, int width, int height) {
+    fill_noise_texture(&roughness_texture, data, width, height);
+}
+
+void fill_ao_texture(float* data, int width, int height) {
+    fill_noise_texture(&ao_texture, data, width, height);
+}
+
+// Upload a noise texture, from the on-disk cache when it has one
+static GLuint generate_noise_texture(const NoiseTexture* texture, int width, int height) {
+    TextureKey key = {
+        texture->name, (const float*)&texture->params,
+        (int)(sizeof(NoiseTextureParams) / sizeof(float)),
+        width, height, texture->channels
+    };
+    
+    TextureCacheEntry entry;
+    if (texture_cache_open(&key, &entry)) {
+        GLuint cached = create_texture_from_data(entry.data, width, height, texture->channels,
+                                                  texture->usage);
+        texture_cache_close(&entry);
+        return cached;
     }
     
-    GLuint texture = create_texture_from_data(data, width, height, 3);
+    float* data = (float*)malloc((size_t)width * height * texture->channels * sizeof(float));
+    fill_noise_texture(texture, data, width, height);
+    texture_cache_store(&key, data);
+    
+    GLuint result = create_texture_from_data(data, width, height, texture->channels, texture->usage);
     free(data);
-    return texture;
+    return result;
+}
+
+GLuint generate_rock_texture(int width, int height) {
+    return generate_noise_texture(&rock_texture, width, height);
 }
 
 GLuint generate_roughness_texture(int width, int height) {
-    float* data = (float*)malloc(width * height * sizeof(float));
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            float noise = fractal_noise_3d(x * 0.02f, y * 0.02f, 0.0f, 4, 0.6f);
-            data[y * width + x] = 0.7f + noise * 0.3f;
-        }
-    }
-    
-    GLuint texture = create_texture_from_data(data, width, height, 1);
-    free(data);
-    return texture;
+    return generate_noise_texture(&roughness_texture, width, height);
 }
 
 GLuint generate_ao_texture(int width, int height) {
-    float* data = (float*)malloc(width * height * sizeof(float));
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            float noise = fractal_noise_3d(x * 0.01f, y * 0.01f, 0.0f, 3, 0.5f);
-            data[y * width + x] = 0.8f + noise * 0.2f;
-        }
-    }
-    
-    GLuint texture = create_texture_from_data(data, width, height, 1);
-    free(data);
-    return texture;
+    return generate_noise_texture(&ao_texture, width, height);
 }
 
+// Not cached: the spots are placed randomly on every launch
 GLuint generate_crystal_emissive_texture(int width, int height) {
     float* data = (float*)calloc(width * height * 3, sizeof(float));
     
@@ -1003,29 +2719,370 @@ GLuint generate_crystal_emissive_texture(int width, int height) {
         }
     }
     
-    GLuint texture = create_texture_from_data(data, width, height, 3);
+    GLuint texture = create_texture_from_data(data, width, height, 3, TEXTURE_EMISSIVE);
     free(data);
     return texture;
 }
 
-GLuint create_texture_from_data(const float* data, int width, int height, int channels) {
+// GPU storage for each usage, by channel count; three-channel data is padded
+// to four wherever the packed texel needs it
+static const TextureFormat texture_formats[TEXTURE_USAGE_COUNT][4] = {
+    [TEXTURE_ALBEDO] = {
+        { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 },
+        { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2, 2 },
+        { GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4 },
+        { GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4 }
+    },
+    [TEXTURE_MASK] = {
+        { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 },
+        { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2, 2 },
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4 },
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4 }
+    },
+    [TEXTURE_NORMAL] = {
+        { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 },
+        { GL_RG16F, GL_RG, GL_HALF_FLOAT, 4, 2 },
+        { GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4, 1 },
+        { GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4, 1 }
+    },
+    [TEXTURE_HEIGHT] = {
+        { GL_R16F, GL_RED, GL_HALF_FLOAT, 2, 1 },
+        { GL_RG16F, GL_RG, GL_HALF_FLOAT, 4, 2 },
+        { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8, 4 },
+        { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8, 4 }
+    },
+    [TEXTURE_EMISSIVE] = {
+        { GL_R16F, GL_RED, GL_HALF_FLOAT, 2, 1 },
+        { GL_RG16F, GL_RG, GL_HALF_FLOAT, 4, 2 },
+        { GL_R11F_G11F_B10F, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4, 1 },
+        { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8, 4 }
+    }
+};
+
+const TextureFormat* texture_format(TextureUsage usage, int channels) {
+    return &texture_formats[usage][channels - 1];
+}
+
+// Round to nearest even half float; overflow saturates to infinity
+static uint16_t float_to_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    
+    if (magnitude >= 0x7F800000) {
+        return (uint16_t)(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+    }
+    if (magnitude >= 0x477FF000) {
+        return (uint16_t)(sign | 0x7C00);
+    }
+    if (magnitude < 0x38800000) {
+        // Subnormal half: scale the value up and round as an integer
+        float scaled = fabsf(value) * 16777216.0f;
+        return (uint16_t)(sign | (uint32_t)lrintf(scaled));
+    }
+    
+    uint32_t rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1);
+    return (uint16_t)(sign | ((rounded - 0x38000000) >> 13));
+}
+
+// Positive half float bits with the low mantissa bits dropped, for the
+// unsigned 11 and 10 bit floats of R11F_G11F_B10F
+static uint32_t half_to_small_float(uint16_t half, int drop) {
+    if (half & 0x8000) return 0;
+    return (uint32_t)(half + (1u << (drop - 1))) >> drop;
+}
+
+static float srgb_to_linear(float value) {
+    return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value) {
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static inline uint32_t unorm(float value, float scale) {
+    return (uint32_t)(fmaxf(0.0f, fminf(1.0f, value)) * scale + 0.5f);
+}
+
+// Shared state of one mip level being filtered and packed
+typedef struct {
+    const TextureFormat* format;
+    TextureUsage usage;
+    int channels;
+    const float* src;       // Previous level (NULL for level 0)
+    int src_width;
+    int src_height;
+    float* dst;             // This level as floats
+    int width;
+    int height;
+    int x0;                 // Columns [x0, x1) of rows from y0 on are filtered and packed
+    int x1;
+    int y0;
+    unsigned char* packed;  // Those texels in the GPU format, x1 - x0 per row
+} MipJob;
+
+// Box filter rows [begin, end) of the next level from the previous one
+static void mip_filter_rows(void* ctx, int begin, int end, int chunk) {
+    MipJob* job = (MipJob*)ctx;
+    const int c = job->channels;
+    (void)chunk;
+    
+    for (int y = job->y0 + begin; y < job->y0 + end; y++) {
+        int y0 = 2 * y, y1 = 2 * y + 1 < job->src_height ? 2 * y + 1 : 2 * y;
+        for (int x = job->x0; x < job->x1; x++) {
+            int x0 = 2 * x, x1 = 2 * x + 1 < job->src_width ? 2 * x + 1 : 2 * x;
+            const float* taps[4] = {
+                &job->src[((size_t)y0 * job->src_width + x0) * c], &job->src[((size_t)y0 * job->src_width + x1) * c],
+                &job->src[((size_t)y1 * job->src_width + x0) * c], &job->src[((size_t)y1 * job->src_width + x1) * c]
+            };
+            float* out = &job->dst[((size_t)y * job->width + x) * c];
+            
+            for (int k = 0; k < c; k++) {
+                float sum = 0.0f;
+                for (int t = 0; t < 4; t++) {
+                    float v = taps[t][k];
+                    if (job->usage == TEXTURE_ALBEDO && k < 3) v = srgb_to_linear(v);
+                    else if (job->usage == TEXTURE_NORMAL && k < 3) v = v * 2.0f - 1.0f;
+                    sum += v;
+                }
+                out[k] = sum * 0.25f;
+                if (job->usage == TEXTURE_ALBEDO && k < 3) out[k] = linear_to_srgb(out[k]);
+            }
+            
+            // Averaged normals are shorter than unit; renormalise before re-biasing
+            if (job->usage == TEXTURE_NORMAL && c >= 3) {
+                float len = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+                for (int k = 0; k < 3; k++) {
+                    out[k] = (len > 0.0f ? out[k] / len : 0.0f) * 0.5f + 0.5f;
+                }
+            } else if (job->usage == TEXTURE_NORMAL) {
+                for (int k = 0; k < c; k++) {
+                    out[k] = out[k] * 0.5f + 0.5f;
+                }
+            }
+        }
+    }
+}
+
+// Pack rows [begin, end) of the level into the GPU format
+static void mip_pack_rows(void* ctx, int begin, int end, int chunk) {
+    MipJob* job = (MipJob*)ctx;
+    const TextureFormat* f = job->format;
+    const int c = job->channels;
+    (void)chunk;
+    
+    for (int y = begin; y < end; y++) {
+        const float* in = &job->dst[((size_t)(job->y0 + y) * job->width + job->x0) * c];
+        unsigned char* out = job->packed + (size_t)y * (job->x1 - job->x0) * f->texel_bytes;
+        
+        for (int x = job->x0; x < job->x1; x++, in += c, out += f->texel_bytes) {
+            if (f->type == GL_UNSIGNED_BYTE) {
+                for (int k = 0; k < f->components; k++) {
+                    out[k] = (unsigned char)(k < c ? unorm(in[k], 255.0f) : 255);
+                }
+            } else if (f->type == GL_HALF_FLOAT) {
+                uint16_t* half = (uint16_t*)out;
+                for (int k = 0; k < f->components; k++) {
+                    half[k] = k < c ? float_to_half(in[k]) : 0x3C00;
+                }
+            } else if (f->type == GL_UNSIGNED_INT_2_10_10_10_REV) {
+                uint32_t texel = unorm(in[0], 1023.0f) | unorm(in[1], 1023.0f) << 10 |
+                                 unorm(in[2], 1023.0f) << 20 | 3u << 30;
+                memcpy(out, &texel, sizeof(texel));
+            } else {
+                // GL_UNSIGNED_INT_10F_11F_11F_REV
+                uint32_t texel = half_to_small_float(float_to_half(in[0]), 4) |
+                                 half_to_small_float(float_to_half(in[1]), 4) << 11 |
+                                 half_to_small_float(float_to_half(in[2]), 5) << 22;
+                memcpy(out, &texel, sizeof(texel));
+            }
+        }
+    }
+}
+
+void build_texture_mip_chain(TextureMipChain* chain, const float* data, int width, int height,
+                             int channels, TextureUsage usage, TextureMipFloats* keep) {
+    memset(chain, 0, sizeof(*chain));
+    chain->format = texture_format(usage, channels);
+    
+    MipJob job = { chain->format, usage, channels, NULL, 0, 0, (float*)data, width, height, 0, width, 0, NULL };
+    float* levels[2] = { NULL, NULL };
+    if (keep) {
+        memset(keep, 0, sizeof(*keep));
+        keep->usage = usage;
+        keep->channels = channels;
+        keep->levels[0] = (float*)data;
+    } else {
+        levels[0] = (float*)malloc((size_t)(width / 2 > 0 ? width / 2 : 1) * (height / 2 > 0 ? height / 2 : 1) *
+                                   channels * sizeof(float));
+        levels[1] = (float*)malloc((size_t)(width / 4 > 0 ? width / 4 : 1) * (height / 4 > 0 ? height / 4 : 1) *
+                                   channels * sizeof(float));
+    }
+    
+    for (int level = 0; level < TEXTURE_MAX_LEVELS; level++) {
+        if (level > 0) {
+            // Filter from the previous level into alternating scratch buffers, or
+            // into buffers of their own when the levels are kept
+            job.src = job.dst;
+            job.src_width = job.width;
+            job.src_height = job.height;
+            job.width = job.width / 2 > 0 ? job.width / 2 : 1;
+            job.height = job.height / 2 > 0 ? job.height / 2 : 1;
+            job.x1 = job.width;
+            job.dst = keep ? (float*)malloc((size_t)job.width * job.height * channels * sizeof(float))
+                           : levels[(level - 1) & 1];
+            parallel_for(job.height, mip_filter_rows, &job);
+        }
+        
+        size_t size = (size_t)job.width * job.height * chain->format->texel_bytes;
+        job.packed = (unsigned char*)malloc(size);
+        parallel_for(job.height, mip_pack_rows, &job);
+        
+        chain->levels[level] = job.packed;
+        chain->widths[level] = job.width;
+        chain->heights[level] = job.height;
+        chain->total_bytes += size;
+        chain->level_count = level + 1;
+        if (keep) {
+            keep->levels[level] = job.dst;
+            keep->widths[level] = job.width;
+            keep->heights[level] = job.height;
+            keep->level_count = level + 1;
+        }
+        if (job.width == 1 && job.height == 1) break;
+    }
+    
+    free(levels[0]);
+    free(levels[1]);
+}
+
+void free_texture_mip_chain(TextureMipChain* chain) {
+    for (int level = 0; level < chain->level_count; level++) {
+        free(chain->levels[level]);
+    }
+    memset(chain, 0, sizeof(*chain));
+}
+
+// Texels of each level whose footprint meets [x0, x1] x [y0, y1] of level 0;
+// returns how many levels have any. A texel reads texels 2x and 2x + 1 of the
+// level above, so the odd last column or row of a level feeds nothing.
+static int mip_dirty_rects(const TextureMipFloats* mips, int x0, int y0, int x1, int y1, int rects[][4]) {
+    int level = 0;
+    for (; level < mips->level_count; level++) {
+        if (level > 0) {
+            x0 /= 2;
+            y0 /= 2;
+            x1 /= 2;
+            y1 /= 2;
+        }
+        if (x1 > mips->widths[level] - 1) x1 = mips->widths[level] - 1;
+        if (y1 > mips->heights[level] - 1) y1 = mips->heights[level] - 1;
+        if (x0 > x1 || y0 > y1) break;
+        rects[level][0] = x0;
+        rects[level][1] = y0;
+        rects[level][2] = x1;
+        rects[level][3] = y1;
+    }
+    return level;
+}
+
+// Filter a rectangle of a level from the level above it; a dig touches a few
+// texels, too few to be worth waking the workers
+static void mip_refilter_rect(MipJob* job, const TextureMipFloats* mips, int level, const int rect[4]) {
+    job->src = mips->levels[level - 1];
+    job->src_width = mips->widths[level - 1];
+    job->src_height = mips->heights[level - 1];
+    job->dst = mips->levels[level];
+    job->width = mips->widths[level];
+    job->height = mips->heights[level];
+    job->x0 = rect[0];
+    job->x1 = rect[2] + 1;
+    job->y0 = rect[1];
+    mip_filter_rows(job, 0, rect[3] - rect[1] + 1, 0);
+}
+
+void refilter_texture_mips(TextureMipFloats* mips, int x0, int y0, int x1, int y1) {
+    int rects[TEXTURE_MAX_LEVELS][4];
+    int levels = mip_dirty_rects(mips, x0, y0, x1, y1, rects);
+    MipJob job = { texture_format(mips->usage, mips->channels), mips->usage, mips->channels };
+    
+    for (int level = 1; level < levels; level++) {
+        mip_refilter_rect(&job, mips, level, rects[level]);
+    }
+}
+
+void patch_texture_mips(GLuint texture, TextureMipFloats* mips, int x0, int y0, int x1, int y1) {
+    int rects[TEXTURE_MAX_LEVELS][4];
+    int levels = mip_dirty_rects(mips, x0, y0, x1, y1, rects);
+    const TextureFormat* format = texture_format(mips->usage, mips->channels);
+    MipJob job = { format, mips->usage, mips->channels };
+    
+    // The rectangle is largest at level 0
+    int span = x1 - x0 + 1, rows = y1 - y0 + 1;
+    unsigned char* packed = (unsigned char*)malloc((size_t)span * rows * format->texel_bytes);
+    
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < levels; level++) {
+        const int* rect = rects[level];
+        if (level > 0) {
+            mip_refilter_rect(&job, mips, level, rect);
+        } else {
+            job.dst = mips->levels[0];
+            job.width = mips->widths[0];
+            job.height = mips->heights[0];
+            job.x0 = rect[0];
+            job.x1 = rect[2] + 1;
+            job.y0 = rect[1];
+        }
+        
+        job.packed = packed;
+        mip_pack_rows(&job, 0, rect[3] - rect[1] + 1, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, level, rect[0], rect[1], rect[2] - rect[0] + 1, rect[3] - rect[1] + 1,
+                        format->format, format->type, packed);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    free(packed);
+}
+
+void free_texture_mip_floats(TextureMipFloats* mips) {
+    // Level 0 belongs to the caller
+    for (int level = 1; level < mips->level_count; level++) {
+        free(mips->levels[level]);
+    }
+    memset(mips, 0, sizeof(*mips));
+}
+
+GLuint create_texture_from_data(const float* data, int width, int height, int channels, TextureUsage usage) {
+    return create_texture_keeping_mips(data, width, height, channels, usage, NULL);
+}
+
+GLuint create_texture_keeping_mips(const float* data, int width, int height, int channels, TextureUsage usage,
+                                   TextureMipFloats* keep) {
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
     
-    GLenum format = GL_RED;
-    if (channels == 3) format = GL_RGB;
-    else if (channels == 4) format = GL_RGBA;
+    // Every level is filtered and packed on the workers, so the driver only copies
+    TextureMipChain chain;
+    build_texture_mip_chain(&chain, data, width, height, channels, usage, keep);
     
-    glTexImage2D(GL_TEXTURE_2D, 0, format == GL_RED ? GL_R32F : GL_RGB32F,
-                 width, height, 0, format, GL_FLOAT, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < chain.level_count; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, chain.format->internal_format, chain.widths[level],
+                     chain.heights[level], 0, chain.format->format, chain.format->type, chain.levels[level]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.level_count - 1);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     
-    glGenerateMipmap(GL_TEXTURE_2D);
-    
+    free_texture_mip_chain(&chain);
     return texture;
 }
@@ -16,25 +16,131 @@
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <math.h>
 
+#include "noise.h"
+#include "frustum.h"
+
 #define CAVE_WIDTH 100
 #define CAVE_HEIGHT 100
 #define CAVE_DEPTH 50
 #define WALL_THRESHOLD_PERCENTAGE 45
 #define SMOOTHING_ITERATIONS 5
 #define MIN_CAVE_SIZE 40
+#define CAVE_PATCH_SIZE 16  // Height map quads per exterior patch edge; patches are culled as a whole
+
+// Voxel values stored in the cave map
+#define VOXEL_AIR 0
+#define VOXEL_WALL 1
+
+// Alignment of the voxel block (one cache line)
+#define CAVE_VOXEL_ALIGNMENT 64
+
+// World units; the distance field saturates here, which bounds the box an edit has to patch
+#define CAVE_DISTANCE_RANGE 1.0f
+
+// Where an air voxel touches rock; each surface voxel has exactly one class
+typedef enum {
+    SURFACE_FLOOR,      // Rock directly below
+    SURFACE_CEILING,    // Rock directly above
+    SURFACE_WALL,       // Rock only beside or diagonal
+    SURFACE_CLASS_COUNT
+} SurfaceClass;
+
+// Air voxels next to rock, where entities can be placed by picking an index
+typedef struct {
+    uint32_t* voxels;   // Packed x + width * (y + height * z), grouped by class in scan order
+    int first[SURFACE_CLASS_COUNT];
+    int count[SURFACE_CLASS_COUNT];
+    int total;
+} SurfaceCandidates;
+
+// First contact of a sphere swept along a segment
+typedef struct {
+    float time;         // Fraction of the segment covered before contact
+    float normal[3];    // Unit contact normal, pointing away from rock
+} SweepHit;
 
 // Cave map structure
+// Voxels live in one contiguous block, one byte each, with a one-voxel halo of
+// wall around the grid so 3x3x3 neighbourhoods never need bounds checks.
 typedef struct {
-    int*** map;  // 3D cave map
+    unsigned char* voxels;  // Padded voxel block, index with cave_index()
     int width;
     int height;
     int depth;
+    int stride_y;       // Distance between rows (padded width)
+    int stride_z;       // Distance between slices (padded width * padded height)
+    size_t voxel_count; // Total size of the padded block in bytes
+    unsigned char* back_buffer; // Ping-pong target for smooth_cave, same layout as voxels; NULL until first used
+    unsigned char* sum_slices;  // Scratch slices for the separable neighbour count
+    int sum_slice_sets;         // Number of workers sum_slices has room for
     float* height_map;  // 2D height map for terrain
     float* normal_map;  // Normal map data
+    uint64_t seed;            // Seed for every random choice made during generation
+    uint64_t respawn_count;   // Stream index for the next respawn_gem
+    int dirty;                // Voxels in [dirty_lo, dirty_hi] changed since update_cave_mesh
+    int dirty_lo[3];
+    int dirty_hi[3];
+    SurfaceCandidates* surface;   // Placement candidates; NULL until first needed
+    int surface_stale;            // Voxels were edited since surface was built
+    float* distance;              // Distance field, same layout as voxels; NULL until first needed
+    int distance_stale;           // Voxels in [distance_lo, distance_hi] changed since it was patched
+    int distance_lo[3];
+    int distance_hi[3];
 } Cave;
 
+// What a texture holds, which decides how it is stored on the GPU
+typedef enum {
+    TEXTURE_ALBEDO,     // sRGB-encoded colour; filtered and sampled in linear space
+    TEXTURE_MASK,       // Values in [0, 1] such as roughness and AO, 8 bits each
+    TEXTURE_NORMAL,     // Unit vectors biased into [0, 1]
+    TEXTURE_HEIGHT,     // Unbounded scalars, half floats
+    TEXTURE_EMISSIVE,   // Unbounded colour
+    TEXTURE_USAGE_COUNT
+} TextureUsage;
+
+#define TEXTURE_MAX_LEVELS 16
+
+typedef struct {
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+    int texel_bytes;
+    int components;     // Values per texel in the upload (1 for packed types)
+} TextureFormat;
+
+// Every mip level of a texture, packed for upload
+typedef struct {
+    const TextureFormat* format;
+    int level_count;
+    int widths[TEXTURE_MAX_LEVELS];
+    int heights[TEXTURE_MAX_LEVELS];
+    void* levels[TEXTURE_MAX_LEVELS];
+    size_t total_bytes;
+} TextureMipChain;
+
+// Mip levels of a texture as floats, kept so a changed rectangle of level 0 can
+// be filtered down again without rebuilding the chain
+typedef struct {
+    TextureUsage usage;
+    int channels;
+    int level_count;
+    int widths[TEXTURE_MAX_LEVELS];
+    int heights[TEXTURE_MAX_LEVELS];
+    float* levels[TEXTURE_MAX_LEVELS];  // Level 0 is the caller's data
+} TextureMipFloats;
+
+// A square of exterior quads whose indices are contiguous in the index buffer
+typedef struct {
+    int first_index;
+    int index_count;
+    float bounds_min[3];
+    float bounds_max[3];
+} CavePatch;
+
 // Cave mesh structure for rendering
 typedef struct {
     GLuint vao;
@@ -51,6 +157,9 @@ typedef struct {
     int index_count;
     int patch_count_x;
     int patch_count_z;
+    CavePatch* patches;       // Row-major, patch_count_x * patch_count_z
+    TextureMipFloats height_mips;   // Patched by update_cave_mesh after digs
+    TextureMipFloats normal_mips;
 } CaveMesh;
 
 // Crystal structure
@@ -62,6 +171,51 @@ typedef struct {
     float glow_intensity;
 } Crystal;
 
+#define CRYSTAL_MESH_VARIANTS 4     // Cluster shapes; crystal i uses variant i % CRYSTAL_MESH_VARIANTS
+#define CRYSTAL_SPIRE_SIDES 6
+#define CRYSTAL_SPIRE_VERTICES (CRYSTAL_SPIRE_SIDES * 9)   // Two body triangles and one tip triangle per side
+
+// Vertex of a crystal cluster mesh, with its flat face normal
+typedef struct {
+    float position[3];
+    float normal[3];
+} CrystalVertex;
+
+// Every cluster shape as one range of a shared vertex array; a cluster rises
+// from y = 0 and fits in a unit crystal's size
+typedef struct {
+    CrystalVertex* vertices;
+    int vertex_count;
+    int first[CRYSTAL_MESH_VARIANTS];
+    int count[CRYSTAL_MESH_VARIANTS];
+    float reach;                // Farthest vertex from the origin
+} CrystalMeshLibrary;
+
+// Per-instance attributes of one crystal, 28 bytes
+typedef struct {
+    float position[3];
+    float size;
+    float rotation;             // Radians about +y
+    float glow_intensity;
+    unsigned char color[3];
+    unsigned char reserved;
+} CrystalInstance;
+
+// All crystals of a cave as one instanced draw per cluster shape, main thread only
+typedef struct {
+    GLuint vao[CRYSTAL_MESH_VARIANTS];  // Shared buffers; instance pointers start at the variant's range
+    GLuint vbo_mesh;
+    GLuint vbo_instances;       // CrystalInstances grouped by variant
+    int first_vertex[CRYSTAL_MESH_VARIANTS];
+    int vertex_count[CRYSTAL_MESH_VARIANTS];
+    int first_instance[CRYSTAL_MESH_VARIANTS];
+    int instance_count[CRYSTAL_MESH_VARIANTS];
+    size_t instance_bytes;      // Size of the instance store, which only grows
+    float reach;
+    float bounds_min[CRYSTAL_MESH_VARIANTS][3]; // Box around each variant's crystals, for culling
+    float bounds_max[CRYSTAL_MESH_VARIANTS][3];
+} CrystalRenderer;
+
 // Gem structure (collectible)
 typedef struct {
     float x, y, z;
@@ -73,6 +227,59 @@ typedef struct {
     float size;
 } Gem;
 
+// Per-instance attributes of one gem, 28 bytes; the vertex shader bobs and
+// spins it from the time uniform
+typedef struct {
+    float position[3];
+    float size;
+    float rotation;             // Spin at time 0, radians
+    float bob_offset;           // Bob phase, radians
+    unsigned char color[3];
+    unsigned char collected;    // Nonzero collapses the gem to a point
+} GemInstance;
+
+#define GEM_GRID_CELL 0.5f   // World units; a collection radius rarely spans more than one cell
+
+// Uniform spatial hash over the uncollected gems. Each bucket is a doubly
+// linked list threaded through per-gem arrays, so moving one gem is O(1).
+typedef struct {
+    float cell_size;
+    int bucket_mask;            // Bucket count - 1, a power of two
+    int* heads;                 // First gem of each bucket, -1 when empty
+    int* next;                  // Per gem, -1 at the end of a list
+    int* prev;                  // Per gem, -1 at the head of a list
+    int* bucket;                // Per gem, -1 while it is not in the grid
+    int* cells;                 // Per gem, the cell it was filed under (x, y, z)
+    int count;                  // Gems indexed by the arrays
+    int live_count;             // Gems in the grid
+    int cell_min[3];            // Cells ever occupied, bounding nearest-gem searches
+    int cell_max[3];
+} GemGrid;
+
+// All gems of a cave as one instanced draw, main thread only
+typedef struct {
+    GLuint vao;
+    GLuint vbo_mesh;            // Shared octahedron, position and normal per vertex
+    GLuint vbo_instances;       // One GemInstance per gem
+    int instance_count;
+    size_t instance_bytes;      // Size of the instance store, which only grows
+    float bounds_min[3];        // Box around every gem's bob range, for culling
+    float bounds_max[3];
+} GemRenderer;
+
+// Cellular automaton engine used by smooth_cave
+typedef enum {
+    SMOOTH_ENGINE_SCALAR,     // Byte-per-voxel separable box sums
+    SMOOTH_ENGINE_BITSLICED   // 64 voxels per word, bitwise adder networks
+} SmoothEngine;
+
+// Entity kinds spread over the surface by Poisson-disk sampling
+typedef enum {
+    PLACEMENT_GEMS,
+    PLACEMENT_CRYSTALS,
+    PLACEMENT_KIND_COUNT
+} PlacementKind;
+
 // Cave interior mode
 typedef enum {
     CAVE_EXTERIOR,
@@ -94,30 +301,139 @@ typedef struct {
     float water_level;
 } WaterPlane;
 
+// Index of voxel (x, y, z) in the padded block; -1 and width are valid halo coordinates
+static inline size_t cave_index(const Cave* cave, int x, int y, int z) {
+    return (size_t)(z + 1) * cave->stride_z + (size_t)(y + 1) * cave->stride_y + (size_t)(x + 1);
+}
+
+// Offset to add to an index to reach the neighbour at (dx, dy, dz)
+static inline ptrdiff_t cave_offset(const Cave* cave, int dx, int dy, int dz) {
+    return (ptrdiff_t)dz * cave->stride_z + (ptrdiff_t)dy * cave->stride_y + dx;
+}
+
+static inline int cave_get(const Cave* cave, int x, int y, int z) {
+    return cave->voxels[cave_index(cave, x, y, z)];
+}
+
+static inline void cave_set(Cave* cave, int x, int y, int z, int value) {
+    cave->voxels[cave_index(cave, x, y, z)] = (unsigned char)value;
+}
+
+static inline int cave_in_bounds(const Cave* cave, int x, int y, int z) {
+    return x >= 0 && x < cave->width &&
+           y >= 0 && y < cave->height &&
+           z >= 0 && z < cave->depth;
+}
+
 // Function prototypes
 Cave* create_cave(int width, int height, int depth);
+// A cave whose voxels are left unset, for callers that write every interior
+// voxel themselves; cave_seal_slices then writes the halo around slices [z0, z1)
+Cave* create_cave_unfilled(int width, int height, int depth);
+void cave_seal_slices(Cave* cave, int z0, int z1);
 void free_cave(Cave* cave);
+void fill_cave_noise(Cave* cave);
 void generate_cave_3d(Cave* cave);
 void smooth_cave(Cave* cave);
+void smooth_cave_iterations(Cave* cave, int iterations);
+void smooth_cave_scalar(Cave* cave, int iterations);
+void smooth_cave_bitsliced(Cave* cave, int iterations);
+void set_smooth_engine(SmoothEngine engine);
+SmoothEngine get_smooth_engine(void);
+// Least distance between entities of a kind, in world units. 0 (the default)
+// derives it from the entity count; negative places them independently.
+void set_placement_spacing(PlacementKind kind, float spacing);
+float get_placement_spacing(PlacementKind kind);
 void generate_height_map(Cave* cave);
 void generate_normal_map(Cave* cave);
 void carve_cave_interior(Cave* cave);
-void find_spawn_point(Cave* cave, float* x, float* y, float* z);
+
+// Clear voxels to air inside the box [lo, hi] (inclusive, halo coordinates allowed):
+// a ball of integer radius, or every voxel within radius of segment a-b
+void carve_sphere(Cave* cave, int cx, int cy, int cz, int radius, const int lo[3], const int hi[3]);
+void carve_capsule(Cave* cave, const float a[3], const float b[3], float radius,
+                   const int lo[3], const int hi[3]);
+// A floor point with radius of clearance from the rock, near the cave centre
+void find_spawn_point(Cave* cave, float radius, float* x, float* y, float* z);
+
+// Placement candidates of the current voxels, rebuilt in one parallel pass
+// when missing or stale. Main thread only.
+const SurfaceCandidates* cave_surface_candidates(Cave* cave);
+// Voxel coordinates of a packed candidate
+static inline void surface_voxel(const Cave* cave, uint32_t packed, int* x, int* y, int* z) {
+    *x = (int)(packed % (uint32_t)cave->width);
+    packed /= (uint32_t)cave->width;
+    *y = (int)(packed % (uint32_t)cave->height);
+    *z = (int)(packed / (uint32_t)cave->height);
+}
+
+// Distance field of the current voxels: the world distance from each voxel to
+// the nearest rock voxel (0 in rock), saturating at CAVE_DISTANCE_RANGE. Built
+// in parallel separable passes when missing and patched around edits since.
+// Main thread only.
+const float* cave_distance_field(Cave* cave);
+// Trilinear distance field at a world point, 0 outside the grid. gradient,
+// when not NULL, gets its gradient, which points away from rock.
+float cave_distance(Cave* cave, float x, float y, float z, float* gradient);
+// Sweep a sphere from one world point to another through the distance field,
+// walking the cells the segment crosses with a 3D DDA. Returns 1 and fills hit
+// where the sphere would first come closer to rock than radius, or than its
+// start when it starts closer; 0 when the whole segment is clear.
+int cave_sweep_sphere(Cave* cave, const float* from, const float* to, float radius, SweepHit* hit);
+
+// Runtime edits; they grow the dirty box that update_cave_mesh consumes
+void cave_mark_dirty(Cave* cave, int x0, int y0, int z0, int x1, int y1, int z1);
+void cave_set_voxel(Cave* cave, int x, int y, int z, int value);
+void cave_carve_sphere(Cave* cave, int cx, int cy, int cz, int radius);
 
 CaveMesh* create_cave_mesh(Cave* cave);
 void free_cave_mesh(CaveMesh* mesh);
+// Recompute the height and normal maps under the dirty box and upload just
+// those vertices and texels; mesh may be NULL to only update the maps
 void update_cave_mesh(CaveMesh* mesh, Cave* cave);
 void render_cave_mesh(CaveMesh* mesh);
-void render_cave_with_tessellation(CaveMesh* mesh);
-void render_cave_interior(Cave* cave, float cam_x, float cam_y, float cam_z);
+// Draws the patches inside the frustum (NULL draws everything)
+void render_cave_with_tessellation(CaveMesh* mesh, const Frustum* frustum, CullCounter* counter);
 
 Crystal* generate_crystals(Cave* cave, int count);
-void render_crystals(Crystal* crystals, int count);
+void build_crystal_meshes(CrystalMeshLibrary* library);
+void free_crystal_meshes(CrystalMeshLibrary* library);
+// Pack crystals grouped by variant; first and count receive each variant's range
+void pack_crystal_instances(const Crystal* crystals, int count, CrystalInstance* instances,
+                            int first[CRYSTAL_MESH_VARIANTS], int counts[CRYSTAL_MESH_VARIANTS]);
+CrystalRenderer* create_crystal_renderer(void);
+void free_crystal_renderer(CrystalRenderer* renderer);
+// Replace every instance, after generating or loading crystals
+void upload_crystal_instances(CrystalRenderer* renderer, const Crystal* crystals, int count);
+// One instanced draw per cluster shape with SHADER_CRYSTAL bound; each batch is culled as a whole
+void render_crystals(const CrystalRenderer* renderer, const Frustum* frustum, CullCounter* counter);
 
 Gem* generate_gems(Cave* cave, int count);
-void render_gems(Gem* gems, int count, float time);
-int collect_gem(Gem* gems, int count, float player_x, float player_y, float player_z, float collect_radius);
-void respawn_gem(Gem* gem, Cave* cave);
+void pack_gem_instances(const Gem* gems, int count, GemInstance* instances);
+GemRenderer* create_gem_renderer(void);
+void free_gem_renderer(GemRenderer* renderer);
+// Replace every instance, after generating or loading gems
+void upload_gem_instances(GemRenderer* renderer, const Gem* gems, int count);
+// Rewrite just gem index, after it was collected or respawned
+void update_gem_instance(GemRenderer* renderer, const Gem* gems, int index);
+// One instanced draw of every gem with SHADER_GEM bound; the batch is culled as a whole
+void render_gems(const GemRenderer* renderer, const Frustum* frustum, CullCounter* counter);
+// Index every uncollected gem
+GemGrid* create_gem_grid(const Gem* gems, int count, float cell_size);
+void free_gem_grid(GemGrid* grid);
+void gem_grid_insert(GemGrid* grid, const Gem* gems, int index);
+void gem_grid_remove(GemGrid* grid, int index);
+// Uncollected gems within radius of (x, y, z), at most max_results of them
+// written to results; returns how many were found
+int gem_grid_query(const GemGrid* grid, const Gem* gems, float x, float y, float z, float radius,
+                   int* results, int max_results);
+// Closest uncollected gem to (x, y, z), or -1 if none is left
+int find_nearest_gem(const GemGrid* grid, const Gem* gems, float x, float y, float z);
+// Marks the nearest uncollected gem within collect_radius collected, drops it
+// from the grid and returns its index, or -1
+int collect_gem(Gem* gems, GemGrid* grid, float player_x, float player_y, float player_z, float collect_radius);
+// Moves gem index to a new spot and puts it back in the grid
+void respawn_gem(Gem* gems, int index, GemGrid* grid, Cave* cave);
 
 WaterPlane* create_water_plane(float size, float level);
 void free_water_plane(WaterPlane* water);
@@ -128,11 +444,33 @@ void render_water(WaterPlane* water);
 
 // Texture loading
 GLuint load_texture(const char* filename);
-GLuint create_texture_from_data(const float* data, int width, int height, int channels);
+// Uploads data in the compact format for its usage, with every mip level
+// filtered on the CPU
+GLuint create_texture_from_data(const float* data, int width, int height, int channels, TextureUsage usage);
+
+// Format of a usage and channel count: texels go up as components values of
+// type, texel_bytes each
+const TextureFormat* texture_format(TextureUsage usage, int channels);
+// CPU side of create_texture_from_data; free with free_texture_mip_chain.
+// With keep, the float levels are handed over for refilter_texture_mips.
+void build_texture_mip_chain(TextureMipChain* chain, const float* data, int width, int height,
+                             int channels, TextureUsage usage, TextureMipFloats* keep);
+void free_texture_mip_chain(TextureMipChain* chain);
+// create_texture_from_data that keeps the float levels; data must outlive them
+GLuint create_texture_keeping_mips(const float* data, int width, int height, int channels, TextureUsage usage,
+                                   TextureMipFloats* keep);
+// Filter texels [x0, x1] x [y0, y1] of level 0 down through the kept levels
+void refilter_texture_mips(TextureMipFloats* mips, int x0, int y0, int x1, int y1);
+// refilter_texture_mips, then pack and upload the changed texels of every level
+void patch_texture_mips(GLuint texture, TextureMipFloats* mips, int x0, int y0, int x1, int y1);
+void free_texture_mip_floats(TextureMipFloats* mips);
+
+// CPU side of the procedural textures (RGB for rock, single channel otherwise)
+void fill_rock_texture(float* data, int width, int height);
+void fill_roughness_texture(float* data, int width, int height);
+void fill_ao_texture(float* data, int width, int height);
 
 // Utility functions
-float perlin_noise_3d(float x, float y, float z);
-float fractal_noise_3d(float x, float y, float z, int octaves, float persistence);
 void calculate_tangent_space(const float* v0, const float* v1, const float* v2,
                             const float* uv0, const float* uv1, const float* uv2,
                             float* tangent, float* bitangent);
@@ -0,0 +1,489 @@
+/*
+ * cavefile.c - Compressed Binary Cave Files Implementation
+ */
+
+#include "cavefile.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define CAVE_FILE_PATH_MAX 1024
+#define CAVE_FILE_ALIGNMENT 16      // Sections start on this boundary so they can be read in place
+
+// File header; every section is found through it
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t chunk_size;
+    uint64_t seed;
+    uint64_t respawn_count;
+    uint32_t crystal_count;
+    uint32_t crystal_size;      // sizeof(Crystal) when written
+    uint32_t gem_count;
+    uint32_t gem_size;
+    uint64_t index_offset;
+    uint64_t height_map_offset;
+    uint64_t normal_map_offset;
+    uint64_t crystal_offset;
+    uint64_t gem_offset;
+} CaveFileHeader;
+
+static int chunk_grid(int voxels) {
+    return (voxels + CAVE_FILE_CHUNK_SIZE - 1) / CAVE_FILE_CHUNK_SIZE;
+}
+
+// Voxel box [lo, hi) of chunk index i, clipped to the grid
+static void chunk_box(const int dims[3], const int chunks[3], int i, int lo[3], int hi[3]) {
+    const int coords[3] = { i % chunks[0], (i / chunks[0]) % chunks[1], i / (chunks[0] * chunks[1]) };
+    for (int a = 0; a < 3; a++) {
+        lo[a] = coords[a] * CAVE_FILE_CHUNK_SIZE;
+        hi[a] = lo[a] + CAVE_FILE_CHUNK_SIZE < dims[a] ? lo[a] + CAVE_FILE_CHUNK_SIZE : dims[a];
+    }
+}
+
+static unsigned char* put_varint(unsigned char* out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+// Encode one chunk into out (room for 3 bytes per voxel); returns the payload size
+static uint32_t encode_chunk(const Cave* cave, const int lo[3], const int hi[3],
+                             unsigned char* out, CaveChunkEntry* entry) {
+    unsigned char* p = out;
+    int value = cave_get(cave, lo[0], lo[1], lo[2]);
+    int current = value;
+    uint32_t run = 0;
+    
+    for (int z = lo[2]; z < hi[2]; z++) {
+        for (int y = lo[1]; y < hi[1]; y++) {
+            const unsigned char* row = &cave->voxels[cave_index(cave, 0, y, z)];
+            for (int x = lo[0]; x < hi[0]; x++) {
+                if (row[x] != current) {
+                    p = put_varint(p, run);
+                    current = row[x];
+                    run = 0;
+                }
+                run++;
+            }
+        }
+    }
+    
+    entry->value = (uint8_t)value;
+    if (p == out) {
+        // A single run: the palette value is all there is
+        entry->encoding = CAVE_CHUNK_UNIFORM;
+        return 0;
+    }
+    p = put_varint(p, run);
+    entry->encoding = CAVE_CHUNK_RUNS;
+    return (uint32_t)(p - out);
+}
+
+// Pad the stream to the section alignment
+static int write_padding(FILE* file, uint64_t* offset) {
+    static const unsigned char zeros[CAVE_FILE_ALIGNMENT] = { 0 };
+    size_t pad = (size_t)(-*offset & (CAVE_FILE_ALIGNMENT - 1));
+    *offset += pad;
+    return pad == 0 || fwrite(zeros, 1, pad, file) == pad;
+}
+
+static int write_section(FILE* file, uint64_t* offset, uint64_t* section, const void* data, size_t size) {
+    if (!write_padding(file, offset)) return 0;
+    *section = *offset;
+    *offset += size;
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+int save_cave_file(const char* path, const Cave* cave, const Crystal* crystals, int crystal_count,
+                   const Gem* gems, int gem_count) {
+    char temp_path[CAVE_FILE_PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) return 0;
+    
+    const int chunks[3] = { chunk_grid(cave->width), chunk_grid(cave->height), chunk_grid(cave->depth) };
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    const int chunk_count = chunks[0] * chunks[1] * chunks[2];
+    const int chunk_voxels = CAVE_FILE_CHUNK_SIZE * CAVE_FILE_CHUNK_SIZE * CAVE_FILE_CHUNK_SIZE;
+    CaveChunkEntry* index = (CaveChunkEntry*)calloc(chunk_count, sizeof(CaveChunkEntry));
+    unsigned char* payload = (unsigned char*)malloc((size_t)chunk_voxels * 3);
+    
+    CaveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CDCV", 4);
+    header.version = CAVE_FILE_VERSION;
+    header.width = cave->width;
+    header.height = cave->height;
+    header.depth = cave->depth;
+    header.chunk_size = CAVE_FILE_CHUNK_SIZE;
+    header.seed = cave->seed;
+    header.respawn_count = cave->respawn_count;
+    header.crystal_count = crystals ? crystal_count : 0;
+    header.crystal_size = sizeof(Crystal);
+    header.gem_count = gems ? gem_count : 0;
+    header.gem_size = sizeof(Gem);
+    
+    // The header is written again with the section offsets once they are known
+    uint64_t offset = sizeof(header);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    
+    // Chunks go out one at a time through a single chunk's worth of scratch
+    for (int i = 0; i < chunk_count && ok; i++) {
+        int lo[3], hi[3];
+        chunk_box(dims, chunks, i, lo, hi);
+        uint32_t size = encode_chunk(cave, lo, hi, payload, &index[i]);
+        index[i].offset = offset;
+        index[i].size = size;
+        offset += size;
+        ok = size == 0 || fwrite(payload, 1, size, file) == size;
+    }
+    
+    size_t map_size = (size_t)cave->width * cave->height * sizeof(float);
+    ok = ok && write_section(file, &offset, &header.height_map_offset, cave->height_map, map_size);
+    ok = ok && write_section(file, &offset, &header.normal_map_offset, cave->normal_map, map_size * 3);
+    ok = ok && write_section(file, &offset, &header.crystal_offset, crystals,
+                             (size_t)header.crystal_count * sizeof(Crystal));
+    ok = ok && write_section(file, &offset, &header.gem_offset, gems, (size_t)header.gem_count * sizeof(Gem));
+    ok = ok && write_section(file, &offset, &header.index_offset, index,
+                             (size_t)chunk_count * sizeof(CaveChunkEntry));
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok &= fclose(file) == 0;
+    
+    free(index);
+    free(payload);
+    
+    // Publish with a rename so readers never see a partial file
+    if (ok) {
+#ifdef _WIN32
+        remove(path);
+#endif
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+        fprintf(stderr, "Warning: could not write cave file %s\n", path);
+    }
+    return ok;
+}
+
+// 1 if [offset, offset + size) lies inside the file
+static int section_fits(const CaveFile* file, uint64_t offset, uint64_t size) {
+    return offset <= file->size && size <= file->size - offset;
+}
+
+static int header_valid(const CaveFile* file, const CaveFileHeader* header) {
+    if (file->size < sizeof(CaveFileHeader) ||
+        memcmp(header->magic, "CDCV", 4) != 0 ||
+        header->version != CAVE_FILE_VERSION ||
+        header->chunk_size != CAVE_FILE_CHUNK_SIZE ||
+        header->crystal_size != sizeof(Crystal) ||
+        header->gem_size != sizeof(Gem) ||
+        header->width == 0 || header->height == 0 || header->depth == 0 ||
+        header->width > 65536 || header->height > 65536 || header->depth > 65536) {
+        return 0;
+    }
+    
+    uint64_t chunk_count = (uint64_t)chunk_grid(header->width) * chunk_grid(header->height) *
+                           chunk_grid(header->depth);
+    uint64_t map_size = (uint64_t)header->width * header->height * sizeof(float);
+    return section_fits(file, header->index_offset, chunk_count * sizeof(CaveChunkEntry)) &&
+           section_fits(file, header->height_map_offset, map_size) &&
+           section_fits(file, header->normal_map_offset, map_size * 3) &&
+           section_fits(file, header->crystal_offset, (uint64_t)header->crystal_count * sizeof(Crystal)) &&
+           section_fits(file, header->gem_offset, (uint64_t)header->gem_count * sizeof(Gem));
+}
+
+// Map (or on Windows read) the whole file into file->base
+static int map_file(CaveFile* file, const char* path) {
+#ifdef _WIN32
+    FILE* in = fopen(path, "rb");
+    if (!in) return 0;
+    
+    int ok = fseek(in, 0, SEEK_END) == 0;
+    long size = ok ? ftell(in) : -1;
+    ok = size > 0 && fseek(in, 0, SEEK_SET) == 0;
+    unsigned char* base = ok ? (unsigned char*)malloc((size_t)size) : NULL;
+    ok = base && fread(base, 1, (size_t)size, in) == (size_t)size;
+    fclose(in);
+    if (!ok) {
+        free(base);
+        return 0;
+    }
+    file->base = base;
+    file->size = (size_t)size;
+    file->mapped = 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return 0;
+    
+    file->base = (const unsigned char*)base;
+    file->size = (size_t)st.st_size;
+    file->mapped = 1;
+#endif
+    return 1;
+}
+
+static void unmap_file(CaveFile* file) {
+    if (!file->base) return;
+#ifdef _WIN32
+    free((void*)file->base);
+#else
+    munmap((void*)file->base, file->size);
+#endif
+    file->base = NULL;
+}
+
+CaveFile* open_cave_file(const char* path) {
+    CaveFile* file = (CaveFile*)calloc(1, sizeof(CaveFile));
+    if (!map_file(file, path)) {
+        free(file);
+        return NULL;
+    }
+    
+    CaveFileHeader header;
+    if (file->size >= sizeof(header)) {
+        memcpy(&header, file->base, sizeof(header));
+    }
+    if (!header_valid(file, &header)) {
+        unmap_file(file);
+        free(file);
+        return NULL;
+    }
+    
+    file->chunks[0] = chunk_grid(header.width);
+    file->chunks[1] = chunk_grid(header.height);
+    file->chunks[2] = chunk_grid(header.depth);
+    file->chunk_count = file->chunks[0] * file->chunks[1] * file->chunks[2];
+    file->index = (const CaveChunkEntry*)(file->base + header.index_offset);
+    
+    // Every payload has to lie inside the file before any is decoded
+    for (int i = 0; i < file->chunk_count; i++) {
+        if (!section_fits(file, file->index[i].offset, file->index[i].size) ||
+            file->index[i].encoding > CAVE_CHUNK_RUNS) {
+            unmap_file(file);
+            free(file);
+            return NULL;
+        }
+    }
+    
+    file->decoded = (unsigned char*)calloc(file->chunk_count, 1);
+    file->chunk_voxels = (unsigned char**)calloc(file->chunk_count, sizeof(unsigned char*));
+    file->width = (int)header.width;
+    file->height = (int)header.height;
+    file->depth = (int)header.depth;
+    file->seed = header.seed;
+    file->respawn_count = header.respawn_count;
+    
+    file->height_map = (const float*)(file->base + header.height_map_offset);
+    file->normal_map = (const float*)(file->base + header.normal_map_offset);
+    file->crystals = (const Crystal*)(file->base + header.crystal_offset);
+    file->crystal_count = (int)header.crystal_count;
+    file->gems = (const Gem*)(file->base + header.gem_offset);
+    file->gem_count = (int)header.gem_count;
+    return file;
+}
+
+void close_cave_file(CaveFile* file) {
+    if (file) {
+        for (int i = 0; i < file->chunk_count; i++) {
+            free(file->chunk_voxels[i]);
+        }
+        unmap_file(file);
+        free(file->chunk_voxels);
+        free(file->decoded);
+        free(file);
+    }
+}
+
+// Write chunk i's voxels to out, which holds voxel lo of the chunk; rows step
+// by stride_y and slices by stride_z. Corrupt run lengths are clamped to the
+// chunk, so a damaged file can only produce wrong voxels.
+static void decode_chunk(const CaveFile* file, int i, unsigned char* out, size_t stride_y, size_t stride_z) {
+    const int dims[3] = { file->width, file->height, file->depth };
+    const CaveChunkEntry* entry = &file->index[i];
+    int lo[3], hi[3];
+    chunk_box(dims, file->chunks, i, lo, hi);
+    const int w = hi[0] - lo[0];
+    
+    const unsigned char* p = file->base + entry->offset;
+    const unsigned char* end = p + entry->size;
+    unsigned char value = entry->value ? VOXEL_WALL : VOXEL_AIR;
+    uint32_t run = entry->encoding == CAVE_CHUNK_UNIFORM ? UINT32_MAX : 0;
+    int first = 1;
+    
+    for (int z = 0; z < hi[2] - lo[2]; z++) {
+        for (int y = 0; y < hi[1] - lo[1]; y++) {
+            unsigned char* row = &out[z * stride_z + y * stride_y];
+            int x = 0;
+            while (x < w) {
+                if (run == 0) {
+                    // Next run, alternating value; a truncated stream ends in one long run
+                    uint32_t length = 0;
+                    for (int shift = 0; p < end && shift < 32; shift += 7) {
+                        length |= (uint32_t)(*p & 0x7F) << shift;
+                        if (!(*p++ & 0x80)) break;
+                    }
+                    run = length ? length : UINT32_MAX;
+                    if (!first) value ^= 1;
+                    first = 0;
+                }
+                int n = run < (uint32_t)(w - x) ? (int)run : w - x;
+                memset(&row[x], value, n);
+                x += n;
+                run -= n;
+            }
+        }
+    }
+}
+
+// First touch of chunk i: run-length chunks get a block of their own, uniform
+// chunks are answered from the index
+static void decode_stored_chunk(CaveFile* file, int i) {
+    if (file->index[i].encoding == CAVE_CHUNK_RUNS) {
+        const size_t size = CAVE_FILE_CHUNK_SIZE;
+        file->chunk_voxels[i] = (unsigned char*)malloc(size * size * size);
+        decode_chunk(file, i, file->chunk_voxels[i], size, size * size);
+    }
+    file->decoded[i] = 1;
+}
+
+// Chunks [begin, end) of a full decode
+static void decode_chunk_range(void* ctx, int begin, int end, int chunk) {
+    CaveFile* file = (CaveFile*)ctx;
+    (void)chunk;
+    
+    for (int i = begin; i < end; i++) {
+        if (!file->decoded[i]) {
+            decode_stored_chunk(file, i);
+        }
+    }
+}
+
+void cave_file_require_all(CaveFile* file) {
+    if (file->decoded_count == file->chunk_count) return;
+    parallel_for(file->chunk_count, decode_chunk_range, file);
+    file->decoded_count = file->chunk_count;
+}
+
+void cave_file_require(CaveFile* file, const int lo[3], const int hi[3]) {
+    const int dims[3] = { file->width, file->height, file->depth };
+    int c0[3], c1[3];
+    for (int a = 0; a < 3; a++) {
+        int l = lo[a] < 0 ? 0 : lo[a];
+        int h = hi[a] >= dims[a] ? dims[a] - 1 : hi[a];
+        if (l > h) return;
+        c0[a] = l / CAVE_FILE_CHUNK_SIZE;
+        c1[a] = h / CAVE_FILE_CHUNK_SIZE;
+    }
+    
+    for (int cz = c0[2]; cz <= c1[2]; cz++) {
+        for (int cy = c0[1]; cy <= c1[1]; cy++) {
+            for (int cx = c0[0]; cx <= c1[0]; cx++) {
+                int i = (cz * file->chunks[1] + cy) * file->chunks[0] + cx;
+                if (!file->decoded[i]) {
+                    decode_stored_chunk(file, i);
+                    file->decoded_count++;
+                }
+            }
+        }
+    }
+}
+
+int cave_file_get(CaveFile* file, int x, int y, int z) {
+    if (x < 0 || x >= file->width || y < 0 || y >= file->height || z < 0 || z >= file->depth) {
+        return VOXEL_WALL;
+    }
+    
+    int i = ((z / CAVE_FILE_CHUNK_SIZE) * file->chunks[1] + y / CAVE_FILE_CHUNK_SIZE) * file->chunks[0] +
+            x / CAVE_FILE_CHUNK_SIZE;
+    if (!file->decoded[i]) {
+        decode_stored_chunk(file, i);
+        file->decoded_count++;
+    }
+    const unsigned char* block = file->chunk_voxels[i];
+    if (!block) return file->index[i].value ? VOXEL_WALL : VOXEL_AIR;
+    return block[((z % CAVE_FILE_CHUNK_SIZE) * CAVE_FILE_CHUNK_SIZE + y % CAVE_FILE_CHUNK_SIZE) *
+                 CAVE_FILE_CHUNK_SIZE + x % CAVE_FILE_CHUNK_SIZE];
+}
+
+typedef struct {
+    const CaveFile* file;
+    Cave* cave;
+} CaveLoadJob;
+
+// Chunk layers [begin, end) of a whole load: each layer seals the halo of its
+// slices and decodes its chunks in place, so every voxel is written once
+static void load_chunk_layers(void* ctx, int begin, int end, int chunk) {
+    const CaveLoadJob* job = (const CaveLoadJob*)ctx;
+    const CaveFile* file = job->file;
+    Cave* cave = job->cave;
+    const int dims[3] = { file->width, file->height, file->depth };
+    const int layer = file->chunks[0] * file->chunks[1];
+    (void)chunk;
+    
+    for (int cz = begin; cz < end; cz++) {
+        int z0 = cz * CAVE_FILE_CHUNK_SIZE;
+        int z1 = z0 + CAVE_FILE_CHUNK_SIZE < file->depth ? z0 + CAVE_FILE_CHUNK_SIZE : file->depth;
+        cave_seal_slices(cave, z0, z1);
+        
+        for (int i = cz * layer; i < (cz + 1) * layer; i++) {
+            int lo[3], hi[3];
+            chunk_box(dims, file->chunks, i, lo, hi);
+            decode_chunk(file, i, &cave->voxels[cave_index(cave, lo[0], lo[1], lo[2])],
+                         cave->stride_y, cave->stride_z);
+        }
+    }
+}
+
+Cave* load_cave_file(const char* path, Crystal** crystals, int* crystal_count, Gem** gems, int* gem_count) {
+    CaveFile* file = open_cave_file(path);
+    if (!file) return NULL;
+    
+    Cave* cave = create_cave_unfilled(file->width, file->height, file->depth);
+    cave->seed = file->seed;
+    cave->respawn_count = file->respawn_count;
+    
+    size_t map_size = (size_t)file->width * file->height * sizeof(float);
+    memcpy(cave->height_map, file->height_map, map_size);
+    memcpy(cave->normal_map, file->normal_map, map_size * 3);
+    
+    CaveLoadJob job = { file, cave };
+    parallel_for(file->chunks[2], load_chunk_layers, &job);
+    
+    if (crystals) {
+        *crystals = (Crystal*)malloc((file->crystal_count > 0 ? file->crystal_count : 1) * sizeof(Crystal));
+        memcpy(*crystals, file->crystals, (size_t)file->crystal_count * sizeof(Crystal));
+        *crystal_count = file->crystal_count;
+    }
+    if (gems) {
+        *gems = (Gem*)malloc((file->gem_count > 0 ? file->gem_count : 1) * sizeof(Gem));
+        memcpy(*gems, file->gems, (size_t)file->gem_count * sizeof(Gem));
+        *gem_count = file->gem_count;
+    }
+    
+    close_cave_file(file);
+    return cave;
+}
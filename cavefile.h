@@ -0,0 +1,79 @@
+/*
+ * cavefile.h - Compressed Binary Cave Files
+ * A saved cave holds its voxels cut into CAVE_FILE_CHUNK_SIZE^3 chunks, each
+ * stored either as one palette value (all air or all wall) or as x-major
+ * run lengths, behind an index table of chunk offsets. The height map,
+ * normal map, crystals and gems follow as raw arrays. Opening a file maps
+ * it and nothing more: each chunk is decoded into a block of its own when
+ * first touched, and uniform chunks never need one.
+ */
+
+#ifndef CAVEFILE_H
+#define CAVEFILE_H
+
+#include "cave.h"
+
+// Bump whenever the layout changes; older files are then rejected
+#define CAVE_FILE_VERSION 1
+#define CAVE_FILE_CHUNK_SIZE 32     // Voxels per chunk edge
+
+// Chunk encodings
+typedef enum {
+    CAVE_CHUNK_UNIFORM,     // Every voxel is the entry's value; no payload
+    CAVE_CHUNK_RUNS         // Alternating run lengths (LEB128), the first run of the entry's value
+} CaveChunkEncoding;
+
+// Index table entry of one chunk
+typedef struct {
+    uint64_t offset;        // From the start of the file
+    uint32_t size;          // Payload bytes
+    uint8_t encoding;       // CaveChunkEncoding
+    uint8_t value;          // Palette value, or the value of the first run
+    uint16_t reserved;
+} CaveChunkEntry;
+
+typedef struct {
+    int width, height, depth;
+    uint64_t seed;
+    uint64_t respawn_count;
+    const float* height_map;    // Straight out of the mapping, like everything below; valid until close_cave_file
+    const float* normal_map;
+    const Crystal* crystals;
+    int crystal_count;
+    const Gem* gems;
+    int gem_count;
+    int chunks[3];          // Chunk grid, x fastest
+    int chunk_count;
+    int decoded_count;
+    unsigned char* decoded; // One flag per chunk
+    unsigned char** chunk_voxels;   // CAVE_FILE_CHUNK_SIZE^3 block per decoded run-length chunk, x fastest
+    const CaveChunkEntry* index;
+    const unsigned char* base;
+    size_t size;
+    int mapped;             // 1 if base is a file mapping, 0 if heap memory
+} CaveFile;
+
+// Streams cave and its entities to path chunk by chunk and publishes the file
+// atomically; returns 1 on success
+int save_cave_file(const char* path, const Cave* cave, const Crystal* crystals, int crystal_count,
+                   const Gem* gems, int gem_count);
+
+// Maps path and checks its header and index; NULL if it is not a cave file
+// of this version. No voxels are decoded and no voxel storage is allocated yet.
+CaveFile* open_cave_file(const char* path);
+// Unmaps the file and frees the decoded chunks
+void close_cave_file(CaveFile* file);
+
+// Decode the chunks overlapping [lo, hi] (inclusive) that are not decoded yet
+void cave_file_require(CaveFile* file, const int lo[3], const int hi[3]);
+// Decode every remaining chunk, spread across the worker pool
+void cave_file_require_all(CaveFile* file);
+// Voxel (x, y, z), decoding its chunk on first touch; outside the grid is wall
+int cave_file_get(CaveFile* file, int x, int y, int z);
+
+// Load a whole cave: open, decode every chunk straight into a dense cave
+// (which is never filled with air first), copy the entities out (when the
+// pointers are given) and close. NULL on failure.
+Cave* load_cave_file(const char* path, Crystal** crystals, int* crystal_count, Gem** gems, int* gem_count);
+
+#endif // CAVEFILE_H
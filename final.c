@@ -5,13 +5,28 @@
  * Controls:
  * - WASD: Move camera
  * - Mouse: Look around
+ * - Right click: Dig into the rock ahead
  * - Space/Shift: Move up/down
  * - R: Regenerate cave
  * - T: Toggle tessellation level
  * - L: Toggle lighting mode
  * - F: Toggle fog
  * - P: Toggle wireframe
+ * - B: Toggle bit-sliced smoothing engine
  * - ESC: Exit
+ *
+ * Options:
+ * - --bench: Run generation benchmarks and exit
+ * - --bitsliced: Smooth caves with the bit-sliced engine
+ * - --threads N: Worker threads for generation (default: one per CPU)
+ * - --seed N: Generate the cave from seed N (default: current time)
+ * - --no-texture-cache: Always synthesize textures, never read or write the cache
+ * - --infinite: Explore an endless cave streamed in chunks around the camera
+ * - --blocky: Draw cave walls as voxel cubes instead of a smooth surface
+ * - --load-cave FILE: Start in a saved cave instead of generating one
+ * - --save-cave FILE: Save the generated cave and its entities to FILE
+ * - --sparse-cave: Keep the interior in a sparse voxel tree; collision and wall
+ *   meshing read the tree
  */
 
 #include <stdio.h>
@@ -24,6 +39,14 @@
 #include "cave.h"
 #include "lighting.h"
 #include "ui.h"
+#include "bench.h"
+#include "texcache.h"
+#include "parallel.h"
+#include "world.h"
+#include "voxmesh.h"
+#include "frustum.h"
+#include "cavefile.h"
+#include "svo.h"
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -69,12 +92,35 @@ int shift_pressed = 0;
 // Scene objects
 Cave* cave = NULL;
 CaveMesh* cave_mesh = NULL;
+InteriorMesh* interior_mesh = NULL;
 Crystal* crystals = NULL;
-int crystal_count = 100;
+int crystal_count = 100;    // --crystals
+CrystalRenderer* crystal_renderer = NULL;
 Gem* gems = NULL;
-int gem_count = 200;
+int gem_count = 200;        // --gems
+GemRenderer* gem_renderer = NULL;
+GemGrid* gem_grid = NULL;
 LightingSystem* lighting = NULL;
 UISystem* ui = NULL;
+unsigned long long cave_seed = 0;
+World* world = NULL;        // Streaming world, only with --infinite
+int infinite_world = 0;
+const char* load_cave_path = NULL;  // --load-cave
+const char* save_cave_path = NULL;  // --save-cave
+VoxelTree* cave_tree = NULL;        // Interior voxels, only with --sparse-cave
+int sparse_cave = 0;
+
+// Player physics: a long frame is cut into steps of at most PHYSICS_STEP
+// seconds, and time past PHYSICS_MAX_STEPS of them is dropped, so a frame
+// never costs more than a fixed number of sweeps
+#define PHYSICS_STEP (1.0f / 60.0f)
+#define PHYSICS_MAX_STEPS 4
+#define PHYSICS_SLIDES 3    // Sweeps per step: the move, then slides along what it hit
+#define PLAYER_RADIUS 0.3f  // World units
+
+// Digging
+#define DIG_RADIUS 3        // Voxels
+#define DIG_REACH 3.0f      // World units
 
 // Render settings
 int wireframe = 0;
@@ -89,6 +135,7 @@ CaveViewMode view_mode = CAVE_INTERIOR;
 int frame_count = 0;
 float fps = 0.0f;
 int last_time = 0;
+CullStats cull_stats;  // What the last frame drew and skipped
 
 // Initialize OpenGL
 void init_opengl() {
@@ -125,21 +172,63 @@ void init_opengl() {
     init_shaders();
 }
 
+// Interior walls; with --sparse-cave the voxel tree is rebuilt from the cave
+// and the walls are meshed from it
+void build_interior() {
+    if (sparse_cave) {
+        free_voxel_tree(cave_tree);
+        cave_tree = voxel_tree_from_cave(cave);
+        printf("Voxel tree: %.2f MB, %.2f MB as a dense grid\n", voxel_tree_memory(cave_tree) / 1048576.0,
+               (double)cave->width * cave->height * cave->depth / 1048576.0);
+        interior_mesh = create_sparse_interior_mesh(cave_tree);
+    } else {
+        interior_mesh = create_interior_mesh(cave);
+    }
+}
+
 // Initialize scene
 void init_scene() {
-    // Create cave
-    printf("Generating cave...\n");
-    cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
-    generate_cave_3d(cave);
+    // Create cave, from a saved file when one was given
+    if (load_cave_path) {
+        printf("Loading cave from %s...\n", load_cave_path);
+        cave = load_cave_file(load_cave_path, &crystals, &crystal_count, &gems, &gem_count);
+        if (!cave) {
+            fprintf(stderr, "Could not load cave file %s\n", load_cave_path);
+            exit(1);
+        }
+        cave_seed = cave->seed;
+    } else {
+        printf("Generating cave...\n");
+        cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+        cave->seed = cave_seed;
+        generate_cave_3d(cave);
+    }
+    printf("Cave seed: %llu\n", cave_seed);
+    
+    // Built here rather than on the first collision query
+    cave_distance_field(cave);
     
     printf("Creating cave mesh...\n");
     cave_mesh = create_cave_mesh(cave);
+    build_interior();
+    printf("Interior mesh: %d triangles\n", interior_mesh->triangle_count);
     
-    printf("Generating crystals...\n");
-    crystals = generate_crystals(cave, crystal_count);
+    if (!load_cave_path) {
+        printf("Generating crystals...\n");
+        crystals = generate_crystals(cave, crystal_count);
+        
+        printf("Generating gems...\n");
+        gems = generate_gems(cave, gem_count);
+    }
     
-    printf("Generating gems...\n");
-    gems = generate_gems(cave, gem_count);
+    if (save_cave_path && save_cave_file(save_cave_path, cave, crystals, crystal_count, gems, gem_count)) {
+        printf("Saved cave to %s\n", save_cave_path);
+    }
+    crystal_renderer = create_crystal_renderer();
+    upload_crystal_instances(crystal_renderer, crystals, crystal_count);
+    gem_renderer = create_gem_renderer();
+    upload_gem_instances(gem_renderer, gems, gem_count);
+    gem_grid = create_gem_grid(gems, gem_count, GEM_GRID_CELL);
     
     // Initialize UI
     printf("Setting up UI...\n");
@@ -202,86 +291,113 @@ void init_scene() {
     add_light(lighting, &player_light);
     
     // Set spawn point inside cave
-    find_spawn_point(cave, &camera.position[0], &camera.position[1], &camera.position[2]);
+    if (infinite_world) {
+        printf("Streaming world...\n");
+        world = create_world(cave_seed, WORLD_VIEW_RADIUS);
+        world_find_spawn_point(world, &camera.position[0], &camera.position[1], &camera.position[2]);
+        update_world(world, camera.position[0], camera.position[1], camera.position[2]);
+        view_mode = CAVE_INTERIOR;
+    } else {
+        find_spawn_point(cave, PLAYER_RADIUS, &camera.position[0], &camera.position[1], &camera.position[2]);
+    }
     
     printf("Scene initialized!\n");
 }
 
-// Collision detection helper
+// Collision detection helper: one lookup in the cave's distance field
 int check_collision(Cave* cave, float x, float y, float z, float radius) {
-    // Convert world coordinates to cave coordinates
-    int cx = (int)((x + 5.0f) / 10.0f * cave->width);
-    int cy = (int)((y + 5.0f) / 10.0f * cave->height);
-    int cz = (int)((z + 5.0f) / 10.0f * cave->depth);
-    
-    // Check bounds
-    if (cx < 0 || cx >= cave->width ||
-        cy < 0 || cy >= cave->height ||
-        cz < 0 || cz >= cave->depth) {
-        return 1; // Collision with boundaries
-    }
-    
-    // Check a small area around the player position for walls
-    int check_radius = (int)(radius * cave->width / 10.0f) + 1;
-    
-    for (int dz = -check_radius; dz <= check_radius; dz++) {
-        for (int dy = -check_radius; dy <= check_radius; dy++) {
-            for (int dx = -check_radius; dx <= check_radius; dx++) {
-                int test_x = cx + dx;
-                int test_y = cy + dy;
-                int test_z = cz + dz;
-                
-                if (test_x >= 0 && test_x < cave->width &&
-                    test_y >= 0 && test_y < cave->height &&
-                    test_z >= 0 && test_z < cave->depth) {
-                    
-                    if (cave->map[test_z][test_y][test_x] == 1) {
-                        // Calculate distance to this wall block
-                        float wall_world_x = (float)test_x / cave->width * 10.0f - 5.0f;
-                        float wall_world_y = (float)test_y / cave->height * 10.0f - 5.0f;
-                        float wall_world_z = (float)test_z / cave->depth * 10.0f - 5.0f;
-                        
-                        float dist = sqrt(pow(x - wall_world_x, 2) +
-                                        pow(y - wall_world_y, 2) +
-                                        pow(z - wall_world_z, 2));
-                        
-                        if (dist < radius) {
-                            return 1; // Collision detected
-                        }
-                    }
-                }
+    return cave_distance(cave, x, y, z, NULL) < radius;
+}
+
+// Collision against a sparse cave: point queries on the voxels the sphere
+// can reach, each voxel a point at its centre
+int check_tree_collision(const VoxelTree* tree, float x, float y, float z, float radius) {
+    const float p[3] = { x, y, z };
+    const int dims[3] = { tree->width, tree->height, tree->depth };
+    int lo[3], hi[3];
+    for (int a = 0; a < 3; a++) {
+        float g = (p[a] + 5.0f) / 10.0f * dims[a], reach = radius / 10.0f * dims[a];
+        lo[a] = (int)ceilf(g - reach);
+        hi[a] = (int)floorf(g + reach);
+    }
+    
+    for (int vz = lo[2]; vz <= hi[2]; vz++) {
+        for (int vy = lo[1]; vy <= hi[1]; vy++) {
+            for (int vx = lo[0]; vx <= hi[0]; vx++) {
+                if (voxel_tree_get(tree, vx, vy, vz) != VOXEL_WALL) continue;
+                float dx = (float)vx / dims[0] * 10.0f - 5.0f - x;
+                float dy = (float)vy / dims[1] * 10.0f - 5.0f - y;
+                float dz = (float)vz / dims[2] * 10.0f - 5.0f - z;
+                if (dx * dx + dy * dy + dz * dz < radius * radius) return 1;
             }
         }
     }
-    
-    return 0; // No collision
+    return 0;
 }
 
-// Update camera
-void update_camera(float dt) {
-    // Calculate new position based on velocity
-    float new_pos[3] = {
-        camera.position[0] + camera.velocity[0] * dt,
-        camera.position[1] + camera.velocity[1] * dt,
-        camera.position[2] + camera.velocity[2] * dt
-    };
-    
-    // Check collision for new position
-    float collision_radius = 0.3f; // Player collision radius
-    
-    // Check X movement
-    if (!check_collision(cave, new_pos[0], camera.position[1], camera.position[2], collision_radius)) {
-        camera.position[0] = new_pos[0];
+// Collision against whichever cave the player is in
+int scene_collides(float x, float y, float z, float radius) {
+    if (world) {
+        return world_collides(world, x, y, z, radius);
     }
-    
-    // Check Y movement
-    if (!check_collision(cave, camera.position[0], new_pos[1], camera.position[2], collision_radius)) {
-        camera.position[1] = new_pos[1];
+    if (cave_tree) {
+        return check_tree_collision(cave_tree, x, y, z, radius);
+    }
+    return check_collision(cave, x, y, z, radius);
+}
+
+// Move the player through the cave by motion, sweeping so no wall can be
+// skipped; at a contact the rest of the move loses its part into the wall
+// and carries on along it
+static void move_player(float* position, const float* motion) {
+    float remaining[3] = { motion[0], motion[1], motion[2] };
+    for (int slide = 0; slide < PHYSICS_SLIDES; slide++) {
+        float target[3] = { position[0] + remaining[0], position[1] + remaining[1], position[2] + remaining[2] };
+        SweepHit hit;
+        if (!cave_sweep_sphere(cave, position, target, PLAYER_RADIUS, &hit)) {
+            memcpy(position, target, sizeof(target));
+            return;
+        }
+        
+        float left = 1.0f - hit.time;
+        float into = (remaining[0] * hit.normal[0] + remaining[1] * hit.normal[1] + remaining[2] * hit.normal[2]) * left;
+        for (int i = 0; i < 3; i++) {
+            position[i] += remaining[i] * hit.time;
+            remaining[i] = remaining[i] * left - hit.normal[i] * into;
+        }
     }
+}
+
+// Update camera
+void update_camera(float dt) {
+    int steps = (int)ceilf(dt / PHYSICS_STEP);
+    if (steps > PHYSICS_MAX_STEPS) steps = PHYSICS_MAX_STEPS;
+    float step_dt = steps > 0 ? dt / steps : 0.0f;
+    if (step_dt > PHYSICS_STEP) step_dt = PHYSICS_STEP;
     
-    // Check Z movement
-    if (!check_collision(cave, camera.position[0], camera.position[1], new_pos[2], collision_radius)) {
-        camera.position[2] = new_pos[2];
+    for (int step = 0; step < steps; step++) {
+        float motion[3] = { camera.velocity[0] * step_dt, camera.velocity[1] * step_dt, camera.velocity[2] * step_dt };
+        
+        if (world || cave_tree) {
+            // Streamed chunks and the voxel tree have no distance field; move
+            // one axis at a time
+            float new_pos[3] = {
+                camera.position[0] + motion[0],
+                camera.position[1] + motion[1],
+                camera.position[2] + motion[2]
+            };
+            if (!scene_collides(new_pos[0], camera.position[1], camera.position[2], PLAYER_RADIUS)) {
+                camera.position[0] = new_pos[0];
+            }
+            if (!scene_collides(camera.position[0], new_pos[1], camera.position[2], PLAYER_RADIUS)) {
+                camera.position[1] = new_pos[1];
+            }
+            if (!scene_collides(camera.position[0], camera.position[1], new_pos[2], PLAYER_RADIUS)) {
+                camera.position[2] = new_pos[2];
+            }
+        } else {
+            move_player(camera.position, motion);
+        }
     }
     
     // Update velocity based on input
@@ -336,10 +452,12 @@ void update_camera(float dt) {
 
 // Get view matrix
 void get_view_matrix(float* matrix) {
+    // Each helper applies its transform after the ones before it, so the
+    // translation goes first and pitch last
     matrix_identity(matrix);
-    matrix_rotate_x(matrix, -camera.rotation[1]);
-    matrix_rotate_y(matrix, -camera.rotation[0]);
     matrix_translate(matrix, -camera.position[0], -camera.position[1], -camera.position[2]);
+    matrix_rotate_y(matrix, -camera.rotation[0]);
+    matrix_rotate_x(matrix, -camera.rotation[1]);
 }
 
 // Get projection matrix
@@ -379,9 +497,12 @@ void render_shadow_pass() {
 // Main render function
 void render_scene() {
     float view[16], projection[16], model[16];
+    Frustum frustum;
     
     get_view_matrix(view);
     get_projection_matrix(projection);
+    frustum_from_matrices(&frustum, view, projection);
+    reset_cull_stats(&cull_stats);
     
     if (view_mode == CAVE_EXTERIOR) {
         // Render cave exterior with tessellation
@@ -406,33 +527,29 @@ void render_scene() {
         set_uniform_vec3(shader_programs[SHADER_TESSELLATION].program, "fogColor", 0.02f, 0.02f, 0.03f);
         set_uniform_float(shader_programs[SHADER_TESSELLATION].program, "fogDensity", fog_enabled ? 0.05f : 0.0f);
         
-        render_cave_with_tessellation(cave_mesh);
+        render_cave_with_tessellation(cave_mesh, &frustum, &cull_stats.patches);
     } else {
-        // Render cave interior
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        gluPerspective(60.0, aspect_ratio, 0.1, 100.0);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        
-        // Apply camera transformation
-        glRotatef(-camera.rotation[1] * 180.0f / M_PI, 1, 0, 0);
-        glRotatef(-camera.rotation[0] * 180.0f / M_PI, 0, 1, 0);
-        glTranslatef(-camera.position[0], -camera.position[1], -camera.position[2]);
+        // Render cave interior from the resident chunk meshes
+        begin_voxel_pass(view, projection, camera.position[0], camera.position[1], camera.position[2],
+                         fog_enabled ? 0.05f : 0.0f);
         
-        render_cave_interior(cave, camera.position[0], camera.position[1], camera.position[2]);
+        if (world) {
+            render_world_interior(world, &frustum, &cull_stats.chunks);
+        } else {
+            render_interior_mesh(interior_mesh, &frustum, &cull_stats.chunks);
+        }
     }
     
-    // Render gems
-    if (gems && gem_count > 0) {
-        use_shader(SHADER_CRYSTAL);
-        set_uniform_mat4(shader_programs[SHADER_CRYSTAL].program, "view", view);
-        set_uniform_mat4(shader_programs[SHADER_CRYSTAL].program, "projection", projection);
-        set_uniform_vec3(shader_programs[SHADER_CRYSTAL].program, "viewPos",
+    // Render gems (they belong to the fixed cave)
+    if (gems && gem_count > 0 && !world) {
+        use_shader(SHADER_GEM);
+        set_uniform_mat4(shader_programs[SHADER_GEM].program, "view", view);
+        set_uniform_mat4(shader_programs[SHADER_GEM].program, "projection", projection);
+        set_uniform_vec3(shader_programs[SHADER_GEM].program, "viewPos",
                          camera.position[0], camera.position[1], camera.position[2]);
-        set_uniform_float(shader_programs[SHADER_CRYSTAL].program, "time", time_value);
+        set_uniform_float(shader_programs[SHADER_GEM].program, "time", time_value);
         
-        render_gems(gems, gem_count, time_value);
+        render_gems(gem_renderer, &frustum, &cull_stats.gems);
     }
     
     // Render crystals
@@ -444,7 +561,7 @@ void render_scene() {
                          camera.position[0], camera.position[1], camera.position[2]);
         set_uniform_float(shader_programs[SHADER_CRYSTAL].program, "time", time_value);
         
-        render_crystals(crystals, crystal_count);
+        render_crystals(crystal_renderer, &frustum, &cull_stats.crystals);
     }
 }
 
@@ -466,10 +583,17 @@ void display() {
     // Update camera
     update_camera(dt);
     
+    // Stream chunks around the new position
+    if (world) {
+        update_world(world, camera.position[0], camera.position[1], camera.position[2]);
+    }
+    
     // Check for gem collection
-    if (keys['e'] || keys['E']) {
-        int gem_type = collect_gem(gems, gem_count, camera.position[0], camera.position[1], camera.position[2], 0.5f);
-        if (gem_type >= 0) {
+    if ((keys['e'] || keys['E']) && !world) {
+        int gem_index = collect_gem(gems, gem_grid, camera.position[0], camera.position[1], camera.position[2], 0.5f);
+        if (gem_index >= 0) {
+            int gem_type = gems[gem_index].type;
+            update_gem_instance(gem_renderer, gems, gem_index);
             ui->gem_counts[gem_type]++;
             ui->total_gems_collected++;
             update_hotbar(ui, gem_type, ui->gem_counts[gem_type]);
@@ -477,6 +601,20 @@ void display() {
         }
     }
     
+    // Point the compass at the nearest gem, relative to where the camera faces
+    int nearest = world ? -1 : find_nearest_gem(gem_grid, gems, camera.position[0], camera.position[1],
+                                                camera.position[2]);
+    if (nearest >= 0) {
+        float dx = gems[nearest].x - camera.position[0];
+        float dy = gems[nearest].y - camera.position[1];
+        float dz = gems[nearest].z - camera.position[2];
+        float ahead = sin(camera.rotation[0]) * dx - cos(camera.rotation[0]) * dz;
+        float right = cos(camera.rotation[0]) * dx + sin(camera.rotation[0]) * dz;
+        update_gem_compass(ui, 1, atan2f(right, ahead), sqrtf(dx * dx + dy * dy + dz * dz), gems[nearest].color);
+    } else {
+        update_gem_compass(ui, 0, 0.0f, 0.0f, NULL);
+    }
+    
     // Shadow pass
     if (view_mode == CAVE_EXTERIOR) {
         render_shadow_pass();
@@ -507,7 +645,16 @@ void display() {
         // Note: Text rendering in core profile requires more setup
         // For now, just print to console
         if (frame_count % 60 == 0) {
-            printf("FPS: %.1f\n", fps);
+            if (world) {
+                printf("FPS: %.1f (%d chunks loaded)\n", fps, world->live_count);
+            } else {
+                printf("FPS: %.1f\n", fps);
+            }
+            printf("  drawn/culled: patches %d/%d, chunks %d/%d, gems %d/%d, crystals %d/%d\n",
+                   cull_stats.patches.drawn, cull_stats.patches.culled,
+                   cull_stats.chunks.drawn, cull_stats.chunks.culled,
+                   cull_stats.gems.drawn, cull_stats.gems.culled,
+                   cull_stats.crystals.drawn, cull_stats.crystals.culled);
         }
     }
     
@@ -526,11 +673,18 @@ void keyboard(unsigned char key, int x, int y) {
         case 27:  // ESC
             cleanup_shaders();
             free_cave_mesh(cave_mesh);
+            free_interior_mesh(interior_mesh);
+            free_voxel_tree(cave_tree);
             free_cave(cave);
+            free_world(world);
             free(crystals);
             free(gems);
+            free_crystal_renderer(crystal_renderer);
+            free_gem_renderer(gem_renderer);
+            free_gem_grid(gem_grid);
             free_lighting_system(lighting);
             free_ui_system(ui);
+            parallel_shutdown();
             exit(0);
             break;
         case 'r':
@@ -538,14 +692,30 @@ void keyboard(unsigned char key, int x, int y) {
             // Regenerate cave
             free_cave(cave);
             free_cave_mesh(cave_mesh);
+            free_interior_mesh(interior_mesh);
             free(crystals);
             free(gems);
             cave = create_cave(CAVE_WIDTH, CAVE_HEIGHT, CAVE_DEPTH);
+            cave->seed = ++cave_seed;
             generate_cave_3d(cave);
+            printf("Cave seed: %llu\n", cave_seed);
+            cave_distance_field(cave);
             cave_mesh = create_cave_mesh(cave);
+            build_interior();
             crystals = generate_crystals(cave, crystal_count);
             gems = generate_gems(cave, gem_count);
-            find_spawn_point(cave, &camera.position[0], &camera.position[1], &camera.position[2]);
+            upload_crystal_instances(crystal_renderer, crystals, crystal_count);
+            upload_gem_instances(gem_renderer, gems, gem_count);
+            free_gem_grid(gem_grid);
+            gem_grid = create_gem_grid(gems, gem_count, GEM_GRID_CELL);
+            if (world) {
+                free_world(world);
+                world = create_world(cave_seed, WORLD_VIEW_RADIUS);
+                world_find_spawn_point(world, &camera.position[0], &camera.position[1], &camera.position[2]);
+                update_world(world, camera.position[0], camera.position[1], camera.position[2]);
+            } else {
+                find_spawn_point(cave, PLAYER_RADIUS, &camera.position[0], &camera.position[1], &camera.position[2]);
+            }
             break;
         case 't':
         case 'T':
@@ -568,8 +738,19 @@ void keyboard(unsigned char key, int x, int y) {
         case 'H':
             show_controls = !show_controls;
             break;
+        case 'b':
+        case 'B':
+            set_smooth_engine(get_smooth_engine() == SMOOTH_ENGINE_SCALAR ?
+                              SMOOTH_ENGINE_BITSLICED : SMOOTH_ENGINE_SCALAR);
+            printf("Smoothing engine: %s\n",
+                   get_smooth_engine() == SMOOTH_ENGINE_BITSLICED ? "Bit-sliced" : "Scalar");
+            break;
         case 'i':
         case 'I':
+            if (world) {
+                printf("The streamed world has no exterior view\n");
+                break;
+            }
             view_mode = (view_mode == CAVE_INTERIOR) ? CAVE_EXTERIOR : CAVE_INTERIOR;
             printf("View mode: %s\n", view_mode == CAVE_INTERIOR ? "Interior" : "Exterior");
             break;
@@ -599,8 +780,48 @@ void keyboard_up(unsigned char key, int x, int y) {
     shift_pressed = (modifiers & GLUT_ACTIVE_SHIFT) ? 1 : 0;
 }
 
+// Carve a ball where the view ray first meets rock in the fixed cave, then
+// rebuild only what the edit touched
+void dig_at_crosshair() {
+    float forward[3] = {
+        sin(camera.rotation[0]) * cos(camera.rotation[1]),
+        -sin(camera.rotation[1]),
+        -cos(camera.rotation[0]) * cos(camera.rotation[1])
+    };
+    
+    for (float t = 0.0f; t < DIG_REACH; t += 0.05f) {
+        int cx = (int)((camera.position[0] + forward[0] * t + 5.0f) / 10.0f * cave->width);
+        int cy = (int)((camera.position[1] + forward[1] * t + 5.0f) / 10.0f * cave->height);
+        int cz = (int)((camera.position[2] + forward[2] * t + 5.0f) / 10.0f * cave->depth);
+        if (!cave_in_bounds(cave, cx, cy, cz)) return;
+        
+        int voxel = cave_tree ? voxel_tree_get(cave_tree, cx, cy, cz) : cave_get(cave, cx, cy, cz);
+        if (voxel == VOXEL_WALL) {
+            // The dense grid still backs the height map and the distance
+            // field, so it is carved too; both carve the same ball
+            cave_carve_sphere(cave, cx, cy, cz, DIG_RADIUS);
+            if (cave_tree) voxel_tree_carve_sphere(cave_tree, cx, cy, cz, DIG_RADIUS);
+            if (cave->dirty) {
+                mark_interior_mesh_dirty(interior_mesh, cave->dirty_lo[0], cave->dirty_lo[1], cave->dirty_lo[2],
+                                         cave->dirty_hi[0], cave->dirty_hi[1], cave->dirty_hi[2]);
+            }
+            if (cave_tree) {
+                update_sparse_interior_mesh(interior_mesh, cave_tree);
+            } else {
+                update_interior_mesh(interior_mesh, cave);
+            }
+            update_cave_mesh(cave_mesh, cave);
+            return;
+        }
+    }
+}
+
 // Mouse callbacks
 void mouse(int button, int state, int x, int y) {
+    if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN && !world) {
+        dig_at_crosshair();
+    }
+    
     if (button == GLUT_LEFT_BUTTON) {
         if (state == GLUT_DOWN) {
             mouse_captured = 1;
@@ -657,6 +878,55 @@ void idle() {
 
 // Main function
 int main(int argc, char** argv) {
+    // Parse our own options; GLUT ignores anything it does not recognise
+    int run_bench = 0;
+    int thread_count = 0;
+    cave_seed = (unsigned long long)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            run_bench = 1;
+        } else if (strcmp(argv[i], "--bitsliced") == 0) {
+            set_smooth_engine(SMOOTH_ENGINE_BITSLICED);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            cave_seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--infinite") == 0) {
+            infinite_world = 1;
+        } else if (strcmp(argv[i], "--no-texture-cache") == 0) {
+            texture_cache_set_enabled(0);
+        } else if (strcmp(argv[i], "--blocky") == 0) {
+            set_voxel_surface(VOXEL_SURFACE_BLOCKY);
+        } else if (strcmp(argv[i], "--crystals") == 0 && i + 1 < argc) {
+            crystal_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--gems") == 0 && i + 1 < argc) {
+            gem_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--gem-spacing") == 0 && i + 1 < argc) {
+            set_placement_spacing(PLACEMENT_GEMS, (float)atof(argv[++i]));
+        } else if (strcmp(argv[i], "--crystal-spacing") == 0 && i + 1 < argc) {
+            set_placement_spacing(PLACEMENT_CRYSTALS, (float)atof(argv[++i]));
+        } else if (strcmp(argv[i], "--load-cave") == 0 && i + 1 < argc) {
+            load_cave_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-cave") == 0 && i + 1 < argc) {
+            save_cave_path = argv[++i];
+        } else if (strcmp(argv[i], "--sparse-cave") == 0) {
+            sparse_cave = 1;
+        }
+    }
+    
+    // Scene decoration (light placement) still uses rand()
+    srand((unsigned int)cave_seed);
+    
+    // Start generation workers
+    parallel_init(thread_count);
+    printf("Using %d generation thread(s), %s noise\n", parallel_thread_count(), noise_batch_isa());
+    
+    if (run_bench) {
+        int result = run_benchmarks();
+        parallel_shutdown();
+        return result;
+    }
+    
     // Initialize GLUT
     glutInit(&argc, argv);
     
@@ -691,12 +961,14 @@ int main(int argc, char** argv) {
     printf("- WASD: Move\n");
     printf("- Mouse: Look around\n");
     printf("- Space/Shift: Up/Down\n");
+    printf("- Right click: Dig\n");
     printf("- E: Collect gem\n");
     printf("- Q: Drop gem\n");
     printf("- 1-9,0: Select hotbar slot\n");
     printf("- H: Toggle help overlay\n");
     printf("- I: Toggle interior/exterior view\n");
     printf("- R: Regenerate cave\n");
+    printf("- B: Toggle bit-sliced smoothing\n");
     printf("- T: Cycle tessellation level\n");
     printf("- P: Toggle wireframe\n");
     printf("- F: Toggle fog\n");
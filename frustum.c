@@ -0,0 +1,86 @@
+/*
+ * frustum.c - View Frustum Culling Implementation
+ */
+
+#include "frustum.h"
+#include <string.h>
+#include <math.h>
+
+void frustum_from_matrices(Frustum* frustum, const float* view, const float* projection) {
+    // clip = projection * view, element [column * 4 + row] as GL reads it
+    float clip[16];
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                sum += projection[k * 4 + r] * view[c * 4 + k];
+            }
+            clip[c * 4 + r] = sum;
+        }
+    }
+    
+    // -w <= x, y, z <= w; each plane is the w row plus or minus another row
+    for (int i = 0; i < 6; i++) {
+        int row = i / 2;
+        float sign = (i & 1) ? -1.0f : 1.0f;
+        float* plane = frustum->planes[i];
+        for (int c = 0; c < 4; c++) {
+            plane[c] = clip[c * 4 + 3] + sign * clip[c * 4 + row];
+        }
+        
+        float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f) {
+            for (int c = 0; c < 4; c++) {
+                plane[c] /= length;
+            }
+        }
+    }
+}
+
+int frustum_test_aabb(const Frustum* frustum, const float min[3], const float max[3]) {
+    for (int i = 0; i < 6; i++) {
+        const float* plane = frustum->planes[i];
+        
+        // The corner furthest along the plane normal
+        float x = plane[0] >= 0.0f ? max[0] : min[0];
+        float y = plane[1] >= 0.0f ? max[1] : min[1];
+        float z = plane[2] >= 0.0f ? max[2] : min[2];
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int frustum_test_sphere(const Frustum* frustum, float x, float y, float z, float radius) {
+    for (int i = 0; i < 6; i++) {
+        const float* plane = frustum->planes[i];
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int tally(int visible, CullCounter* counter) {
+    if (counter) {
+        if (visible) {
+            counter->drawn++;
+        } else {
+            counter->culled++;
+        }
+    }
+    return visible;
+}
+
+int frustum_cull_aabb(const Frustum* frustum, const float min[3], const float max[3], CullCounter* counter) {
+    return tally(!frustum || frustum_test_aabb(frustum, min, max), counter);
+}
+
+int frustum_cull_sphere(const Frustum* frustum, float x, float y, float z, float radius, CullCounter* counter) {
+    return tally(!frustum || frustum_test_sphere(frustum, x, y, z, radius), counter);
+}
+
+void reset_cull_stats(CullStats* stats) {
+    memset(stats, 0, sizeof(CullStats));
+}
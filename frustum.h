@@ -0,0 +1,44 @@
+/*
+ * frustum.h - View Frustum Culling
+ */
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+// Six planes (left, right, bottom, top, near, far) as a, b, c, d with unit
+// normals pointing inwards: a point p is inside a plane when
+// a * p.x + b * p.y + c * p.z + d >= 0
+typedef struct {
+    float planes[6][4];
+} Frustum;
+
+// What one cull loop kept and skipped
+typedef struct {
+    int drawn;
+    int culled;
+} CullCounter;
+
+// Per-frame culling results, reset before each frame is drawn
+typedef struct {
+    CullCounter patches;    // Exterior height map patches
+    CullCounter chunks;     // Interior mesh chunks, fixed cave or streamed world
+    CullCounter gems;
+    CullCounter crystals;
+} CullStats;
+
+// Planes of the clip volume of projection * view, in world space; takes the
+// same column-major matrices the shaders receive
+void frustum_from_matrices(Frustum* frustum, const float* view, const float* projection);
+
+// 0 only when the volume is certainly outside; boxes straddling a corner of
+// the frustum may still pass
+int frustum_test_aabb(const Frustum* frustum, const float min[3], const float max[3]);
+int frustum_test_sphere(const Frustum* frustum, float x, float y, float z, float radius);
+
+// Test and tally; a NULL frustum keeps everything
+int frustum_cull_aabb(const Frustum* frustum, const float min[3], const float max[3], CullCounter* counter);
+int frustum_cull_sphere(const Frustum* frustum, float x, float y, float z, float radius, CullCounter* counter);
+
+void reset_cull_stats(CullStats* stats);
+
+#endif // FRUSTUM_H
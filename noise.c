@@ -0,0 +1,378 @@
+/*
+ * noise.c - Perlin and Fractal Noise Implementation
+ */
+
+#include "noise.h"
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NOISE_X86_SIMD 1
+#endif
+
+// Perlin noise implementation
+static const unsigned char permutation[256] = { 151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
+    190,6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,68,175,
+    74,165,71,134,139,48,27,166,77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,102,143,54,65,25,63,
+    161,1,216,80,73,209,76,132,187,208,89,18,169,200,196,135,130,116,188,159,86,164,100,109,198,173,186,3,64,52,217,226,250,124,
+    123,5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,223,183,170,213,119,248,152,2,44,154,163,70,
+    221,153,101,155,167,43,172,9,129,22,39,253,19,98,108,110,79,113,224,232,178,185,112,104,218,246,97,228,251,34,242,193,238,
+    210,144,12,191,179,162,241,81,51,145,235,249,14,239,107,49,192,214,31,181,199,106,157,184,84,204,176,115,121,50,45,127,4,
+    150,254,138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
+
+// The classic doubled table p[i] for i < 512 is permutation[i & 255], so no
+// initialisation is needed and every thread can sample noise at any time
+#define PERM(i) permutation[(i) & 255]
+
+static double fade(double t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static double lerp(double t, double a, double b) {
+    return a + t * (b - a);
+}
+
+static double grad(int hash, double x, double y, double z) {
+    int h = hash & 15;
+    double u = h < 8 ? x : y;
+    double v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+}
+
+float perlin_noise_3d(float x, float y, float z) {
+    int X = (int)floor(x) & 255;
+    int Y = (int)floor(y) & 255;
+    int Z = (int)floor(z) & 255;
+    
+    x -= floor(x);
+    y -= floor(y);
+    z -= floor(z);
+    
+    double u = fade(x);
+    double v = fade(y);
+    double w = fade(z);
+    
+    int A = PERM(X) + Y, AA = PERM(A) + Z, AB = PERM(A + 1) + Z;
+    int B = PERM(X + 1) + Y, BA = PERM(B) + Z, BB = PERM(B + 1) + Z;
+    
+    return lerp(w, lerp(v, lerp(u, grad(PERM(AA), x, y, z),
+                                   grad(PERM(BA), x - 1, y, z)),
+                           lerp(u, grad(PERM(AB), x, y - 1, z),
+                                   grad(PERM(BB), x - 1, y - 1, z))),
+                   lerp(v, lerp(u, grad(PERM(AA + 1), x, y, z - 1),
+                                   grad(PERM(BA + 1), x - 1, y, z - 1)),
+                           lerp(u, grad(PERM(AB + 1), x, y - 1, z - 1),
+                                   grad(PERM(BB + 1), x - 1, y - 1, z - 1))));
+}
+
+float fractal_noise_3d(float x, float y, float z, int octaves, float persistence) {
+    float total = 0;
+    float frequency = 1;
+    float amplitude = 1;
+    float maxValue = 0;
+    
+    for (int i = 0; i < octaves; i++) {
+        total += perlin_noise_3d(x * frequency, y * frequency, z * frequency) * amplitude;
+        maxValue += amplitude;
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+    
+    return total / maxValue;
+}
+
+// Batched noise: lattice hashing is done per lane with plain table reads (no
+// gathers), everything else runs in SIMD float registers.
+
+// Hash roots of the four cube edges along z for one cell; the eight corner
+// hashes are PERM(root) and PERM(root + 1). PERM wraps every lookup, so the
+// cell coordinates need no masking first.
+static inline void corner_roots(int X, int Y, int Z, int* aa, int* ba, int* ab, int* bb) {
+    int A = PERM(X) + Y, B = PERM(X + 1) + Y;
+    *aa = PERM(A) + Z;
+    *ab = PERM(A + 1) + Z;
+    *ba = PERM(B) + Z;
+    *bb = PERM(B + 1) + Z;
+}
+
+#ifdef NOISE_X86_SIMD
+
+__attribute__((target("avx2,fma")))
+static inline __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+    __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+    __m256 lt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+    __m256 lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    __m256 h12or14 = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+        _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+    __m256 u = _mm256_blendv_ps(y, x, lt8);
+    __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, h12or14), y, lt4);
+    __m256 u_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    __m256 v_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, u_sign), _mm256_xor_ps(v, v_sign));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 lerp8(__m256 t, __m256 a, __m256 b) {
+    return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 fade8(__m256 t) {
+    __m256 inner = _mm256_fmadd_ps(t, _mm256_set1_ps(6.0f), _mm256_set1_ps(-15.0f));
+    inner = _mm256_fmadd_ps(t, inner, _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+__attribute__((target("avx2,fma")))
+static __m256 perlin8(__m256 x, __m256 y, __m256 z) {
+    __m256 fx = _mm256_floor_ps(x);
+    __m256 fy = _mm256_floor_ps(y);
+    __m256 fz = _mm256_floor_ps(z);
+    
+    __m256i cx = _mm256_cvtps_epi32(fx);
+    __m256i cy = _mm256_cvtps_epi32(fy);
+    __m256i cz = _mm256_cvtps_epi32(fz);
+    __m256i h0, h1, h2, h3, h4, h5, h6, h7;
+    
+    // Coherent batches (a row of samples) usually touch one or two adjacent
+    // cells that share y and z: hash those once and blend per lane
+    int x0 = _mm256_extract_epi32(cx, 0);
+    __m256i upper = _mm256_cmpeq_epi32(cx, _mm256_set1_epi32(x0 + 1));
+    __m256i same = _mm256_and_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi32(cx, _mm256_set1_epi32(x0)), upper),
+        _mm256_and_si256(_mm256_cmpeq_epi32(cy, _mm256_set1_epi32(_mm256_extract_epi32(cy, 0))),
+                         _mm256_cmpeq_epi32(cz, _mm256_set1_epi32(_mm256_extract_epi32(cz, 0)))));
+    
+    if (_mm256_movemask_epi8(same) == -1) {
+        int r[2][4];
+        int y0 = _mm256_extract_epi32(cy, 0), z0 = _mm256_extract_epi32(cz, 0);
+        corner_roots(x0, y0, z0, &r[0][0], &r[0][1], &r[0][2], &r[0][3]);
+        corner_roots(x0 + 1, y0, z0, &r[1][0], &r[1][1], &r[1][2], &r[1][3]);
+        
+#define H8(i, d) _mm256_blendv_epi8(_mm256_set1_epi32(PERM(r[0][i] + d)), \
+                                    _mm256_set1_epi32(PERM(r[1][i] + d)), upper)
+        h0 = H8(0, 0); h1 = H8(1, 0); h2 = H8(2, 0); h3 = H8(3, 0);
+        h4 = H8(0, 1); h5 = H8(1, 1); h6 = H8(2, 1); h7 = H8(3, 1);
+#undef H8
+    } else {
+        int ix[8], iy[8], iz[8], aa[8], ba[8], ab[8], bb[8];
+        _mm256_storeu_si256((__m256i*)ix, cx);
+        _mm256_storeu_si256((__m256i*)iy, cy);
+        _mm256_storeu_si256((__m256i*)iz, cz);
+        for (int lane = 0; lane < 8; lane++) {
+            corner_roots(ix[lane], iy[lane], iz[lane], &aa[lane], &ba[lane], &ab[lane], &bb[lane]);
+        }
+        
+        // Assemble the hash vectors lane by lane rather than through memory,
+        // which would stall on store forwarding
+#define H8(r, d) _mm256_setr_epi32(PERM(r[0] + d), PERM(r[1] + d), PERM(r[2] + d), PERM(r[3] + d), \
+                                   PERM(r[4] + d), PERM(r[5] + d), PERM(r[6] + d), PERM(r[7] + d))
+        h0 = H8(aa, 0); h1 = H8(ba, 0); h2 = H8(ab, 0); h3 = H8(bb, 0);
+        h4 = H8(aa, 1); h5 = H8(ba, 1); h6 = H8(ab, 1); h7 = H8(bb, 1);
+#undef H8
+    }
+    
+    x = _mm256_sub_ps(x, fx);
+    y = _mm256_sub_ps(y, fy);
+    z = _mm256_sub_ps(z, fz);
+    __m256 u = fade8(x), v = fade8(y), w = fade8(z);
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 x1 = _mm256_sub_ps(x, one), y1 = _mm256_sub_ps(y, one), z1 = _mm256_sub_ps(z, one);
+    
+    return lerp8(w, lerp8(v, lerp8(u, grad8(h0, x, y, z),
+                                      grad8(h1, x1, y, z)),
+                             lerp8(u, grad8(h2, x, y1, z),
+                                      grad8(h3, x1, y1, z))),
+                    lerp8(v, lerp8(u, grad8(h4, x, y, z1),
+                                      grad8(h5, x1, y, z1)),
+                             lerp8(u, grad8(h6, x, y1, z1),
+                                      grad8(h7, x1, y1, z1))));
+}
+
+__attribute__((target("avx2,fma")))
+static int fractal_batch_avx2(const float* xs, const float* ys, const float* zs, float* out,
+                              int n, int octaves, float persistence) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(&xs[i]);
+        __m256 y = _mm256_loadu_ps(&ys[i]);
+        __m256 z = _mm256_loadu_ps(&zs[i]);
+        __m256 total = _mm256_setzero_ps();
+        float frequency = 1, amplitude = 1, max_value = 0;
+        
+        for (int o = 0; o < octaves; o++) {
+            __m256 f = _mm256_set1_ps(frequency);
+            __m256 noise = perlin8(_mm256_mul_ps(x, f), _mm256_mul_ps(y, f), _mm256_mul_ps(z, f));
+            total = _mm256_fmadd_ps(noise, _mm256_set1_ps(amplitude), total);
+            max_value += amplitude;
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+        
+        _mm256_storeu_ps(&out[i], _mm256_div_ps(total, _mm256_set1_ps(max_value)));
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z) {
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+    __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    __m128 h12or14 = _mm_castsi128_ps(_mm_or_si128(
+        _mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+        _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+    __m128 u = _mm_blendv_ps(y, x, lt8);
+    __m128 v = _mm_blendv_ps(_mm_blendv_ps(z, x, h12or14), y, lt4);
+    __m128 u_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128 v_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, u_sign), _mm_xor_ps(v, v_sign));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 lerp4(__m128 t, __m128 a, __m128 b) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fade4(__m128 t) {
+    __m128 inner = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+    inner = _mm_add_ps(_mm_mul_ps(t, inner), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+__attribute__((target("sse4.1")))
+static __m128 perlin4(__m128 x, __m128 y, __m128 z) {
+    __m128 fx = _mm_floor_ps(x);
+    __m128 fy = _mm_floor_ps(y);
+    __m128 fz = _mm_floor_ps(z);
+    
+    int ix[4], iy[4], iz[4], aa[4], ba[4], ab[4], bb[4];
+    _mm_storeu_si128((__m128i*)ix, _mm_cvtps_epi32(fx));
+    _mm_storeu_si128((__m128i*)iy, _mm_cvtps_epi32(fy));
+    _mm_storeu_si128((__m128i*)iz, _mm_cvtps_epi32(fz));
+    for (int lane = 0; lane < 4; lane++) {
+        corner_roots(ix[lane], iy[lane], iz[lane], &aa[lane], &ba[lane], &ab[lane], &bb[lane]);
+    }
+    
+#define H4(r, d) _mm_setr_epi32(PERM(r[0] + d), PERM(r[1] + d), PERM(r[2] + d), PERM(r[3] + d))
+    __m128i h0 = H4(aa, 0), h1 = H4(ba, 0), h2 = H4(ab, 0), h3 = H4(bb, 0);
+    __m128i h4 = H4(aa, 1), h5 = H4(ba, 1), h6 = H4(ab, 1), h7 = H4(bb, 1);
+#undef H4
+    
+    x = _mm_sub_ps(x, fx);
+    y = _mm_sub_ps(y, fy);
+    z = _mm_sub_ps(z, fz);
+    __m128 u = fade4(x), v = fade4(y), w = fade4(z);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 x1 = _mm_sub_ps(x, one), y1 = _mm_sub_ps(y, one), z1 = _mm_sub_ps(z, one);
+    
+    return lerp4(w, lerp4(v, lerp4(u, grad4(h0, x, y, z),
+                                      grad4(h1, x1, y, z)),
+                             lerp4(u, grad4(h2, x, y1, z),
+                                      grad4(h3, x1, y1, z))),
+                    lerp4(v, lerp4(u, grad4(h4, x, y, z1),
+                                      grad4(h5, x1, y, z1)),
+                             lerp4(u, grad4(h6, x, y1, z1),
+                                      grad4(h7, x1, y1, z1))));
+}
+
+__attribute__((target("sse4.1")))
+static int fractal_batch_sse41(const float* xs, const float* ys, const float* zs, float* out,
+                               int n, int octaves, float persistence) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&xs[i]);
+        __m128 y = _mm_loadu_ps(&ys[i]);
+        __m128 z = _mm_loadu_ps(&zs[i]);
+        __m128 total = _mm_setzero_ps();
+        float frequency = 1, amplitude = 1, max_value = 0;
+        
+        for (int o = 0; o < octaves; o++) {
+            __m128 f = _mm_set1_ps(frequency);
+            __m128 noise = perlin4(_mm_mul_ps(x, f), _mm_mul_ps(y, f), _mm_mul_ps(z, f));
+            total = _mm_add_ps(total, _mm_mul_ps(noise, _mm_set1_ps(amplitude)));
+            max_value += amplitude;
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+        
+        _mm_storeu_ps(&out[i], _mm_div_ps(total, _mm_set1_ps(max_value)));
+    }
+    return i;
+}
+
+#endif // NOISE_X86_SIMD
+
+typedef enum {
+    NOISE_ISA_SCALAR,
+    NOISE_ISA_SSE41,
+    NOISE_ISA_AVX2
+} NoiseIsa;
+
+static NoiseIsa detect_isa(void) {
+#ifdef NOISE_X86_SIMD
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return NOISE_ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return NOISE_ISA_SSE41;
+#endif
+    return NOISE_ISA_SCALAR;
+}
+
+const char* noise_batch_isa(void) {
+    switch (detect_isa()) {
+        case NOISE_ISA_AVX2: return "AVX2";
+        case NOISE_ISA_SSE41: return "SSE4.1";
+        default: return "scalar";
+    }
+}
+
+void fractal_noise_3d_batch(const float* xs, const float* ys, const float* zs, float* out,
+                            int n, int octaves, float persistence) {
+    int done = 0;
+    
+#ifdef NOISE_X86_SIMD
+    switch (detect_isa()) {
+        case NOISE_ISA_AVX2:
+            done = fractal_batch_avx2(xs, ys, zs, out, n, octaves, persistence);
+            break;
+        case NOISE_ISA_SSE41:
+            done = fractal_batch_sse41(xs, ys, zs, out, n, octaves, persistence);
+            break;
+        default:
+            break;
+    }
+#endif
+    
+    // Remainder (and everything on other CPUs)
+    for (int i = done; i < n; i++) {
+        out[i] = fractal_noise_3d(xs[i], ys[i], zs[i], octaves, persistence);
+    }
+}
+
+#define NOISE_ROW_BLOCK 256
+#define NOISE_ROW_LANES 8       // Widest batch step; blocks start on it
+
+void fractal_noise_row(float* out, int width, int x0, int x1, int y, float scale, float z,
+                       int octaves, float persistence) {
+    float xs[NOISE_ROW_BLOCK], ys[NOISE_ROW_BLOCK], zs[NOISE_ROW_BLOCK];
+    
+    // Widen to whole lane groups of the full row, so every x lands in the same
+    // SIMD group (or the same scalar tail) as it would in a [0, width) call
+    x0 -= x0 % NOISE_ROW_LANES;
+    x1 = x1 + NOISE_ROW_LANES - 1 - (x1 + NOISE_ROW_LANES - 1) % NOISE_ROW_LANES;
+    if (x1 > width - width % NOISE_ROW_LANES) x1 = width;
+    
+    for (int i = 0; i < NOISE_ROW_BLOCK; i++) {
+        ys[i] = y * scale;
+        zs[i] = z;
+    }
+    
+    for (int b = x0; b < x1; b += NOISE_ROW_BLOCK) {
+        int n = x1 - b < NOISE_ROW_BLOCK ? x1 - b : NOISE_ROW_BLOCK;
+        for (int i = 0; i < n; i++) {
+            xs[i] = (b + i) * scale;
+        }
+        fractal_noise_3d_batch(xs, ys, zs, out + b, n, octaves, persistence);
+    }
+}
@@ -0,0 +1,27 @@
+/*
+ * noise.h - Perlin and Fractal Noise
+ * Scalar functions plus a batched entry point that evaluates 8 (AVX2) or
+ * 4 (SSE4.1) points at once, picked at runtime with a scalar fallback.
+ */
+
+#ifndef NOISE_H
+#define NOISE_H
+
+float perlin_noise_3d(float x, float y, float z);
+float fractal_noise_3d(float x, float y, float z, int octaves, float persistence);
+
+// out[i] = fractal_noise_3d(xs[i], ys[i], zs[i], octaves, persistence), to float precision
+void fractal_noise_3d_batch(const float* xs, const float* ys, const float* zs, float* out,
+                            int n, int octaves, float persistence);
+
+// Span [x0, x1) of one row of a sampled plane, width wide:
+// out[x] = fractal_noise_3d(x * scale, y * scale, z, ...). Values match a
+// whole-row call bit for bit; a few neighbours of the span inside [0, width)
+// may be written too.
+void fractal_noise_row(float* out, int width, int x0, int x1, int y, float scale, float z,
+                       int octaves, float persistence);
+
+// Name of the instruction set fractal_noise_3d_batch uses on this CPU
+const char* noise_batch_isa(void);
+
+#endif // NOISE_H
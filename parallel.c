@@ -0,0 +1,171 @@
+/*
+ * parallel.c - Worker Thread Pool Implementation
+ */
+
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PARALLEL_MAX_THREADS 256
+
+static pthread_t* workers = NULL;
+static int thread_count = 1;  // Including the calling thread
+static int shutting_down = 0;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+// Current job, guarded by pool_mutex
+static ParallelFunc job_func = NULL;
+static void* job_ctx = NULL;
+static int job_count = 0;
+static int job_next_chunk = 0;
+static int job_chunks_left = 0;
+static unsigned int job_generation = 0;
+
+static _Thread_local int inside_job = 0;
+
+static int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// Claim and run chunks of the current job until none are left
+static void run_chunks(void) {
+    for (;;) {
+        pthread_mutex_lock(&pool_mutex);
+        if (job_next_chunk >= thread_count) {
+            pthread_mutex_unlock(&pool_mutex);
+            return;
+        }
+        int chunk = job_next_chunk++;
+        ParallelFunc func = job_func;
+        void* ctx = job_ctx;
+        int count = job_count;
+        pthread_mutex_unlock(&pool_mutex);
+        
+        int begin = (int)((long long)count * chunk / thread_count);
+        int end = (int)((long long)count * (chunk + 1) / thread_count);
+        if (begin < end) {
+            inside_job = 1;
+            func(ctx, begin, end, chunk);
+            inside_job = 0;
+        }
+        
+        pthread_mutex_lock(&pool_mutex);
+        if (--job_chunks_left == 0) {
+            pthread_cond_broadcast(&done_cond);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+}
+
+static void* worker_main(void* arg) {
+    unsigned int seen = 0;
+    (void)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&pool_mutex);
+        while (!shutting_down && job_generation == seen) {
+            pthread_cond_wait(&work_cond, &pool_mutex);
+        }
+        if (shutting_down) {
+            pthread_mutex_unlock(&pool_mutex);
+            return NULL;
+        }
+        seen = job_generation;
+        pthread_mutex_unlock(&pool_mutex);
+        
+        run_chunks();
+    }
+}
+
+void parallel_init(int count) {
+    parallel_shutdown();
+    
+    if (count <= 0) count = cpu_count();
+    if (count > PARALLEL_MAX_THREADS) count = PARALLEL_MAX_THREADS;
+    thread_count = count;
+    shutting_down = 0;
+    
+    if (thread_count > 1) {
+        workers = (pthread_t*)malloc((thread_count - 1) * sizeof(pthread_t));
+        for (int i = 0; i < thread_count - 1; i++) {
+            if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+                fprintf(stderr, "Failed to start worker thread %d\n", i);
+                exit(1);
+            }
+        }
+    }
+}
+
+void parallel_shutdown(void) {
+    if (workers) {
+        pthread_mutex_lock(&pool_mutex);
+        shutting_down = 1;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&pool_mutex);
+        
+        for (int i = 0; i < thread_count - 1; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+        workers = NULL;
+    }
+    thread_count = 1;
+}
+
+void parallel_detach_thread(void) {
+    inside_job = 1;
+}
+
+int parallel_thread_count(void) {
+    return thread_count;
+}
+
+void parallel_for(int count, ParallelFunc func, void* ctx) {
+    if (count <= 0) return;
+    
+    // Serial pool or nested call: run every chunk on this thread
+    if (!workers || inside_job) {
+        for (int chunk = 0; chunk < thread_count; chunk++) {
+            int begin = (int)((long long)count * chunk / thread_count);
+            int end = (int)((long long)count * (chunk + 1) / thread_count);
+            if (begin < end) func(ctx, begin, end, chunk);
+        }
+        return;
+    }
+    
+    pthread_mutex_lock(&pool_mutex);
+    job_func = func;
+    job_ctx = ctx;
+    job_count = count;
+    job_next_chunk = 0;
+    job_chunks_left = thread_count;
+    job_generation++;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    
+    // The calling thread works too
+    run_chunks();
+    
+    pthread_mutex_lock(&pool_mutex);
+    while (job_chunks_left > 0) {
+        pthread_cond_wait(&done_cond, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,28 @@
+/*
+ * parallel.h - Worker Thread Pool for Generation Passes
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Processes items [begin, end); chunk is in [0, parallel_thread_count())
+// and can be used to index per-thread scratch space
+typedef void (*ParallelFunc)(void* ctx, int begin, int end, int chunk);
+
+// Start the pool; thread_count <= 0 uses one thread per CPU
+void parallel_init(int thread_count);
+void parallel_shutdown(void);
+int parallel_thread_count(void);
+
+// Split [0, count) into one contiguous range per thread and run func on each.
+// Returns once every range is done, so consecutive calls act as a barrier.
+// Ranges depend only on count and the thread count, and calls made from
+// inside a job run inline.
+void parallel_for(int count, ParallelFunc func, void* ctx);
+
+// Make every later parallel_for on the calling thread run inline. For
+// background threads, which must never contend with the frame thread for
+// the pool.
+void parallel_detach_thread(void);
+
+#endif // PARALLEL_H
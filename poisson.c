@@ -0,0 +1,243 @@
+/*
+ * poisson.c - Poisson-Disk Sampling over Lattice Points
+ */
+
+#include "poisson.h"
+#include "rng.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define POISSON_MAX_CELLS (1 << 24)   // Background grid cells; coarser cells beyond this
+#define POISSON_CELLS_PER_POINT 8     // And no more than this many per domain point
+
+// Background grid: each cell at least spacing wide and holding a list of the
+// samples inside it, so a disc test only visits the 3x3x3 block around it
+typedef struct {
+    float cell;
+    int dims[3];
+    int* heads;             // First sample per cell, -1 when empty
+    int* next;              // Per sample
+    float* positions;       // Per sample, world xyz
+    int count;
+    int capacity;
+    float spacing2;
+} PoissonGrid;
+
+static float poisson_unit(Rng* rng) {
+    return (rng_next(rng) >> 40) * (1.0f / 16777216.0f);
+}
+
+static void point_position(const PoissonDomain* domain, uint32_t packed, float* p, int* lattice) {
+    lattice[0] = (int)(packed % (uint32_t)domain->dims[0]);
+    packed /= (uint32_t)domain->dims[0];
+    lattice[1] = (int)(packed % (uint32_t)domain->dims[1]);
+    lattice[2] = (int)(packed / (uint32_t)domain->dims[1]);
+    for (int a = 0; a < 3; a++) {
+        p[a] = lattice[a] * domain->scale[a];
+    }
+}
+
+static int grid_coord(const PoissonGrid* grid, const float* p, int a) {
+    int c = (int)(p[a] / grid->cell);
+    return c < 0 ? 0 : (c >= grid->dims[a] ? grid->dims[a] - 1 : c);
+}
+
+// 1 if no sample lies closer than the spacing to p
+static int grid_is_free(const PoissonGrid* grid, const float* p) {
+    int c[3] = { grid_coord(grid, p, 0), grid_coord(grid, p, 1), grid_coord(grid, p, 2) };
+    for (int z = c[2] > 0 ? c[2] - 1 : 0; z <= c[2] + 1 && z < grid->dims[2]; z++) {
+        for (int y = c[1] > 0 ? c[1] - 1 : 0; y <= c[1] + 1 && y < grid->dims[1]; y++) {
+            for (int x = c[0] > 0 ? c[0] - 1 : 0; x <= c[0] + 1 && x < grid->dims[0]; x++) {
+                size_t cell = ((size_t)z * grid->dims[1] + y) * grid->dims[0] + x;
+                for (int s = grid->heads[cell]; s >= 0; s = grid->next[s]) {
+                    const float* q = &grid->positions[s * 3];
+                    float dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+                    if (dx * dx + dy * dy + dz * dz < grid->spacing2) return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static void grid_add(PoissonGrid* grid, const float* p) {
+    if (grid->count == grid->capacity) {
+        grid->capacity = grid->capacity ? grid->capacity * 2 : 1024;
+        grid->next = (int*)realloc(grid->next, grid->capacity * sizeof(int));
+        grid->positions = (float*)realloc(grid->positions, grid->capacity * 3 * sizeof(float));
+    }
+    size_t cell = ((size_t)grid_coord(grid, p, 2) * grid->dims[1] + grid_coord(grid, p, 1)) * grid->dims[0] +
+                  grid_coord(grid, p, 0);
+    int s = grid->count++;
+    memcpy(&grid->positions[s * 3], p, 3 * sizeof(float));
+    grid->next[s] = grid->heads[cell];
+    grid->heads[cell] = s;
+}
+
+// Add a sample to the grid, the output and the active list
+static void accept_sample(PoissonGrid* grid, const float* p, uint32_t packed, uint32_t** out, int** active,
+                          int* active_count) {
+    int capacity = grid->capacity;
+    int s = grid->count;
+    grid_add(grid, p);
+    if (grid->capacity != capacity) {
+        *out = (uint32_t*)realloc(*out, grid->capacity * sizeof(uint32_t));
+        *active = (int*)realloc(*active, grid->capacity * sizeof(int));
+    }
+    (*out)[s] = packed;
+    (*active)[(*active_count)++] = s;
+}
+
+int poisson_sample(const PoissonDomain* domain, float spacing, uint64_t seed, uint32_t** samples) {
+    *samples = NULL;
+    if (domain->count == 0 || spacing <= 0.0f) return 0;
+    
+    // Lattice points are never closer than the shortest step, so below it
+    // every point is a sample
+    float step = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        if (domain->dims[a] > 1 && (step == 0.0f || domain->scale[a] < step)) step = domain->scale[a];
+    }
+    if (spacing <= step) {
+        *samples = (uint32_t*)malloc(domain->count * sizeof(uint32_t));
+        memcpy(*samples, domain->points, domain->count * sizeof(uint32_t));
+        return domain->count;
+    }
+    
+    // Which lattice points belong to the domain, one bit each
+    size_t lattice_size = (size_t)domain->dims[0] * domain->dims[1] * domain->dims[2];
+    uint64_t* member = (uint64_t*)calloc((lattice_size + 63) / 64, sizeof(uint64_t));
+    for (int i = 0; i < domain->count; i++) {
+        member[domain->points[i] >> 6] |= 1ULL << (domain->points[i] & 63);
+    }
+    
+    PoissonGrid grid;
+    memset(&grid, 0, sizeof(grid));
+    grid.spacing2 = spacing * spacing;
+    grid.cell = spacing;
+    size_t cells;
+    size_t max_cells = (size_t)domain->count * POISSON_CELLS_PER_POINT;
+    if (max_cells > POISSON_MAX_CELLS) max_cells = POISSON_MAX_CELLS;
+    for (;;) {
+        cells = 1;
+        for (int a = 0; a < 3; a++) {
+            grid.dims[a] = (int)(domain->dims[a] * domain->scale[a] / grid.cell) + 1;
+            cells *= grid.dims[a];
+        }
+        if (cells <= max_cells) break;
+        grid.cell *= 1.25f;
+    }
+    grid.heads = (int*)malloc(cells * sizeof(int));
+    memset(grid.heads, 0xff, cells * sizeof(int));
+    
+    uint32_t* out = NULL;
+    int* active = NULL;
+    int active_count = 0;
+    Rng rng = rng_stream(seed, RNG_STREAM_POISSON, 0);
+    
+    // Reseeds walk the domain once in order from a random start; the fronts
+    // grown from them place most samples, and the walk stays cache friendly
+    int start = rng_int(&rng, domain->count);
+    int cursor = 0;
+    
+    for (;;) {
+        if (active_count == 0) {
+            // Start a new front at the next point no sample covers
+            while (cursor < domain->count && active_count == 0) {
+                uint32_t packed = domain->points[(start + cursor) % domain->count];
+                cursor++;
+                float p[3];
+                int l[3];
+                point_position(domain, packed, p, l);
+                if (grid_is_free(&grid, p)) {
+                    accept_sample(&grid, p, packed, &out, &active, &active_count);
+                }
+            }
+            if (active_count == 0) break;
+        }
+        
+        int a = rng_int(&rng, active_count);
+        // Copied, as accepting a sample may move the positions
+        float origin[3];
+        memcpy(origin, &grid.positions[active[a] * 3], sizeof(origin));
+        
+        int found = 0;
+        for (int attempt = 0; attempt < POISSON_ATTEMPTS && !found; attempt++) {
+            // A point in the shell [spacing, 2 spacing), flat when the lattice is
+            float dir[3];
+            float phi = poisson_unit(&rng) * 2.0f * M_PI;
+            float cz = domain->dims[2] > 1 ? poisson_unit(&rng) * 2.0f - 1.0f : 0.0f;
+            float ring = sqrtf(1.0f - cz * cz);
+            dir[0] = ring * cosf(phi);
+            dir[1] = ring * sinf(phi);
+            dir[2] = cz;
+            float radius = spacing * (1.0f + poisson_unit(&rng));
+            
+            // Snap to a domain point in the 3x3x3 lattice block around it,
+            // the centre first; only that one point is tested
+            int l[3];
+            for (int axis = 0; axis < 3; axis++) {
+                float q = origin[axis] + dir[axis] * radius;
+                l[axis] = domain->scale[axis] > 0.0f ? (int)lroundf(q / domain->scale[axis]) : 0;
+            }
+            for (int n = 0; n < 27; n++) {
+                int k = (n + 13) % 27;
+                int x = l[0] + k % 3 - 1, y = l[1] + k / 3 % 3 - 1, z = l[2] + k / 9 - 1;
+                if (x < 0 || x >= domain->dims[0] || y < 0 || y >= domain->dims[1] ||
+                    z < 0 || z >= domain->dims[2]) {
+                    continue;
+                }
+                uint32_t packed = (uint32_t)x + (uint32_t)domain->dims[0] * ((uint32_t)y + (uint32_t)domain->dims[1] * z);
+                if (!(member[packed >> 6] & (1ULL << (packed & 63)))) continue;
+                
+                float p[3] = { x * domain->scale[0], y * domain->scale[1], z * domain->scale[2] };
+                if (grid_is_free(&grid, p)) {
+                    accept_sample(&grid, p, packed, &out, &active, &active_count);
+                    found = 1;
+                }
+                break;
+            }
+        }
+        
+        // A sample with no room left around it stops growing
+        if (!found) {
+            active[a] = active[--active_count];
+        }
+    }
+    
+    int count = grid.count;
+    free(member);
+    free(active);
+    free(grid.heads);
+    free(grid.next);
+    free(grid.positions);
+    *samples = out;
+    return count;
+}
+
+float poisson_spacing_for_count(const PoissonDomain* domain, int count) {
+    if (count <= 0 || domain->count == 0) return 0.0f;
+    
+    // Area of one point: the two longest steps, or the product of the two
+    // non-zero ones on a flat lattice
+    float s[3] = { domain->scale[0], domain->scale[1], domain->scale[2] };
+    for (int i = 0; i < 2; i++) {
+        for (int j = i + 1; j < 3; j++) {
+            if (s[j] > s[i]) {
+                float t = s[i];
+                s[i] = s[j];
+                s[j] = t;
+            }
+        }
+    }
+    float area = domain->count * s[0] * s[1];
+    
+    // A maximal disc set covers well under half the plane with discs of
+    // diameter spacing; stay on the dense side so count is reached
+    return sqrtf(0.35f * area / count);
+}
@@ -0,0 +1,38 @@
+/*
+ * poisson.h - Poisson-Disk Sampling over Lattice Points
+ * Bridson's algorithm restricted to a given set of lattice points (such as
+ * the air voxels against rock): new samples are tried in the shell between
+ * one and two spacings around an active sample and snapped to a nearby
+ * point of the set. A background grid of spacing-sized cells holds the
+ * samples so each test looks at 27 cells. Fronts that die out are reseeded
+ * from the next uncovered point of the set, so every disconnected patch is
+ * filled and the result is maximal.
+ */
+
+#ifndef POISSON_H
+#define POISSON_H
+
+#include <stdint.h>
+
+#define POISSON_ATTEMPTS 8      // Candidates tried around an active sample before retiring it
+
+// Points to sample from, packed x + dims[0] * (y + dims[1] * z), with the
+// world size of one lattice step along each axis
+typedef struct {
+    const uint32_t* points;
+    int count;
+    int dims[3];
+    float scale[3];
+} PoissonDomain;
+
+// A maximal set of domain points at least spacing (world units) apart, in
+// the order they were accepted. Returns the sample count and sets *samples
+// to a malloc'd array of packed points. The same seed gives the same set;
+// at or below the shortest lattice step it is every point, in domain order.
+int poisson_sample(const PoissonDomain* domain, float spacing, uint64_t seed, uint32_t** samples);
+
+// Spacing at which a maximal set over domain should hold at least about
+// count samples, treating the points as a surface of unit lattice squares
+float poisson_spacing_for_count(const PoissonDomain* domain, int count);
+
+#endif // POISSON_H
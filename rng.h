@@ -0,0 +1,73 @@
+/*
+ * rng.h - Counter-Based Random Numbers for Reproducible Generation
+ *
+ * Every value is a pure function of (seed, stream, index, counter), built on
+ * the SplitMix64 mixer, so any voxel or entity can be generated on any thread
+ * in any order and a given seed always produces the same cave.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+#define RNG_GOLDEN 0x9E3779B97F4A7C15ULL
+
+// Generation stages; each voxel or entity index gets its own stream within a stage
+typedef enum {
+    RNG_STREAM_FILL = 1,
+    RNG_STREAM_CARVE,
+    RNG_STREAM_TUNNEL,
+    RNG_STREAM_SPAWN,
+    RNG_STREAM_CRYSTAL,
+    RNG_STREAM_GEM,
+    RNG_STREAM_RESPAWN,
+    RNG_STREAM_WORLD_FILL,
+    RNG_STREAM_WORLD_NODE,
+    RNG_STREAM_WORLD_EDGE,
+    RNG_STREAM_CRYSTAL_MESH,
+    RNG_STREAM_POISSON
+} RngStream;
+
+// Sequential cursor over one stream
+typedef struct {
+    uint64_t key;
+    uint64_t counter;
+} Rng;
+
+// SplitMix64 finaliser
+static inline uint64_t rng_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Key of stream (stage, index) under a seed
+static inline uint64_t rng_key(uint64_t seed, RngStream stage, uint64_t index) {
+    return rng_mix(seed + RNG_GOLDEN * rng_mix(((uint64_t)stage << 56) ^ index));
+}
+
+// Value number counter of a stream
+static inline uint64_t rng_at(uint64_t key, uint64_t counter) {
+    return rng_mix(key + RNG_GOLDEN * (counter + 1));
+}
+
+static inline Rng rng_stream(uint64_t seed, RngStream stage, uint64_t index) {
+    Rng rng = { rng_key(seed, stage, index), 0 };
+    return rng;
+}
+
+static inline uint64_t rng_next(Rng* rng) {
+    return rng_at(rng->key, rng->counter++);
+}
+
+// Uniform integer in [0, n) from the top 32 bits (multiply-shift, no modulo bias worth noting)
+static inline int rng_range(uint64_t value, int n) {
+    return (int)(((value >> 32) * (uint64_t)n) >> 32);
+}
+
+static inline int rng_int(Rng* rng, int n) {
+    return rng_range(rng_next(rng), n);
+}
+
+#endif // RNG_H
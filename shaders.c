@@ -288,7 +288,7 @@ const char* tessellation_fragment_shader =
 "}\n"
 "\n"
 "void main() {\n"
-"    vec3 albedo = pow(texture(diffuseMap, teTexCoord).rgb, vec3(2.2));\n"
+"    vec3 albedo = texture(diffuseMap, teTexCoord).rgb;  // sRGB texture, decoded by the sampler\n"
 "    vec3 normal = getNormalFromMap();\n"
 "    float roughness = texture(roughnessMap, teTexCoord).r;\n"
 "    float ao = texture(aoMap, teTexCoord).r;\n"
@@ -366,22 +366,31 @@ const char* shadow_fragment_shader =
 "    // gl_FragDepth is automatically written\n"
 "}\n";
 
-// Crystal shader for glowing crystals
+// Crystal shader for glowing crystals: one instanced draw per cluster shape
 const char* crystal_vertex_shader =
 "#version 410 core\n"
 "layout(location = 0) in vec3 position;\n"
 "layout(location = 1) in vec3 normal;\n"
+"layout(location = 2) in vec4 instancePlacement;  // Base, size\n"
+"layout(location = 3) in vec2 instanceLook;       // Spin, glow intensity\n"
+"layout(location = 4) in vec3 instanceColor;\n"
 "\n"
 "out vec3 FragPos;\n"
 "out vec3 Normal;\n"
+"out vec3 Color;\n"
+"out float GlowIntensity;\n"
 "\n"
-"uniform mat4 model;\n"
 "uniform mat4 view;\n"
 "uniform mat4 projection;\n"
 "\n"
 "void main() {\n"
-"    FragPos = vec3(model * vec4(position, 1.0));\n"
-"    Normal = mat3(transpose(inverse(model))) * normal;\n"
+"    float c = cos(instanceLook.x);\n"
+"    float s = sin(instanceLook.x);\n"
+"    mat3 spin = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);\n"
+"    FragPos = instancePlacement.xyz + spin * (position * instancePlacement.w);\n"
+"    Normal = spin * normal;\n"
+"    Color = instanceColor;\n"
+"    GlowIntensity = instanceLook.y;\n"
 "    gl_Position = projection * view * vec4(FragPos, 1.0);\n"
 "}\n";
 
@@ -389,11 +398,12 @@ const char* crystal_fragment_shader =
 "#version 410 core\n"
 "in vec3 FragPos;\n"
 "in vec3 Normal;\n"
+"in vec3 Color;\n"
+"in float GlowIntensity;\n"
 "\n"
 "out vec4 FragColor;\n"
 "\n"
 "uniform vec3 viewPos;\n"
-"uniform vec3 crystalColor;\n"
 "uniform float time;\n"
 "\n"
 "void main() {\n"
@@ -401,17 +411,107 @@ const char* crystal_fragment_shader =
 "    vec3 viewDir = normalize(viewPos - FragPos);\n"
 "    \n"
 "    // Fresnel effect for rim lighting\n"
-"    float fresnel = pow(1.0 - dot(viewDir, norm), 2.0);\n"
+"    float fresnel = pow(1.0 - max(dot(viewDir, norm), 0.0), 2.0);\n"
 "    \n"
 "    // Animated glow\n"
 "    float glow = sin(time * 2.0) * 0.5 + 0.5;\n"
 "    \n"
-"    vec3 color = crystalColor * (0.3 + fresnel * 0.7);\n"
-"    color += crystalColor * glow * 0.5;\n"
+"    vec3 color = Color * (0.3 + fresnel * 0.7);\n"
+"    color += Color * glow * 0.5 * GlowIntensity;\n"
 "    \n"
 "    FragColor = vec4(color, 0.8);\n"
 "}\n";
 
+// Gem shader: one instanced draw, each gem bobbed and spun from time; shares
+// the crystal fragment shader
+const char* gem_vertex_shader =
+"#version 410 core\n"
+"layout(location = 0) in vec3 position;\n"
+"layout(location = 1) in vec3 normal;\n"
+"layout(location = 2) in vec4 instancePlacement;  // Centre, size\n"
+"layout(location = 3) in vec2 instanceMotion;     // Spin, bob phase\n"
+"layout(location = 4) in vec3 instanceColor;\n"
+"layout(location = 5) in float instanceCollected;\n"
+"\n"
+"out vec3 FragPos;\n"
+"out vec3 Normal;\n"
+"out vec3 Color;\n"
+"out float GlowIntensity;\n"
+"\n"
+"uniform mat4 view;\n"
+"uniform mat4 projection;\n"
+"uniform float time;\n"
+"\n"
+"void main() {\n"
+"    float angle = time + instanceMotion.x;\n"
+"    float c = cos(angle);\n"
+"    float s = sin(angle);\n"
+"    mat3 spin = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);\n"
+"    float bob = sin(time * 2.0 + instanceMotion.y) * 0.05;\n"
+"    \n"
+"    // Collected gems collapse to a point and produce no fragments\n"
+"    float size = instanceCollected > 0.5 ? 0.0 : instancePlacement.w;\n"
+"    FragPos = instancePlacement.xyz + vec3(0.0, bob, 0.0) + spin * (position * size);\n"
+"    Normal = spin * normal;\n"
+"    Color = instanceColor;\n"
+"    GlowIntensity = 1.0;\n"
+"    gl_Position = projection * view * vec4(FragPos, 1.0);\n"
+"}\n";
+
+// Voxel interior shader for the greedy-meshed cave walls
+const char* voxel_vertex_shader =
+"#version 410 core\n"
+"layout(location = 0) in vec3 position;\n"
+"layout(location = 1) in vec3 normal;\n"
+"\n"
+"out vec3 FragPos;\n"
+"out vec3 Normal;\n"
+"\n"
+"uniform mat4 view;\n"
+"uniform mat4 projection;\n"
+"\n"
+"void main() {\n"
+"    // Meshes are built in world space\n"
+"    FragPos = position;\n"
+"    Normal = normal;\n"
+"    gl_Position = projection * view * vec4(position, 1.0);\n"
+"}\n";
+
+const char* voxel_fragment_shader =
+"#version 410 core\n"
+"in vec3 FragPos;\n"
+"in vec3 Normal;\n"
+"\n"
+"out vec4 FragColor;\n"
+"\n"
+"uniform vec3 viewPos;\n"
+"uniform vec3 lightPos;\n"
+"uniform vec3 fogColor;\n"
+"uniform float fogDensity;\n"
+"\n"
+"void main() {\n"
+"    vec3 norm = normalize(Normal);\n"
+"    \n"
+"    // Upward faces brightest, downward darkest, as the walls were always\n"
+"    // shaded; blended so smooth walls have no seams between the tints\n"
+"    float sideX = abs(norm.x) / (abs(norm.x) + abs(norm.z) + 1e-4);\n"
+"    vec3 albedo = mix(vec3(0.55, 0.45, 0.35), vec3(0.6, 0.5, 0.4), sideX);\n"
+"    if (norm.y > 0.0) albedo = mix(albedo, vec3(0.7, 0.6, 0.5), norm.y);\n"
+"    else albedo = mix(albedo, vec3(0.5, 0.4, 0.3), -norm.y);\n"
+"    \n"
+"    // Lamp just above the camera\n"
+"    vec3 lightDir = normalize(lightPos - FragPos);\n"
+"    float diffuse = max(dot(norm, lightDir), 0.0);\n"
+"    vec3 color = albedo * (vec3(0.4, 0.4, 0.5) + vec3(0.8, 0.8, 0.9) * diffuse);\n"
+"    \n"
+"    // Fog\n"
+"    float dist = length(viewPos - FragPos);\n"
+"    float fogFactor = 1.0 - exp(-fogDensity * dist);\n"
+"    color = mix(color, fogColor, fogFactor);\n"
+"    \n"
+"    FragColor = vec4(color, 1.0);\n"
+"}\n";
+
 // Water shader
 const char* water_vertex_shader =
 "#version 410 core\n"
@@ -646,11 +746,21 @@ void init_shaders(void) {
         crystal_vertex_shader, crystal_fragment_shader
     );
     
+    // Initialize instanced gem shader
+    shader_programs[SHADER_GEM].program = create_shader_program(
+        gem_vertex_shader, crystal_fragment_shader
+    );
+    
     // Initialize water shader
     shader_programs[SHADER_WATER].program = create_shader_program(
         water_vertex_shader, water_fragment_shader
     );
     
+    // Initialize voxel interior shader
+    shader_programs[SHADER_VOXEL].program = create_shader_program(
+        voxel_vertex_shader, voxel_fragment_shader
+    );
+    
     // Get uniform locations for tessellation shader
     ShaderProgram* tess = &shader_programs[SHADER_TESSELLATION];
     tess->model_loc = glGetUniformLocation(tess->program, "model");
@@ -27,6 +27,8 @@ typedef enum {
     SHADER_CRYSTAL,
     SHADER_WATER,
     SHADER_POST_PROCESS,
+    SHADER_VOXEL,
+    SHADER_GEM,
     SHADER_COUNT
 } ShaderType;
 
@@ -80,7 +82,10 @@ extern const char* shadow_vertex_shader;
 extern const char* shadow_fragment_shader;
 extern const char* crystal_vertex_shader;
 extern const char* crystal_fragment_shader;
+extern const char* gem_vertex_shader;
 extern const char* water_vertex_shader;
 extern const char* water_fragment_shader;
+extern const char* voxel_vertex_shader;
+extern const char* voxel_fragment_shader;
 
 #endif // SHADERS_H
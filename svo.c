@@ -0,0 +1,365 @@
+/*
+ * svo.c - Sparse Voxel Tree Storage Implementation
+ */
+
+#include "svo.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ALL_WALL (~(uint64_t)0)
+
+// Brick bits on each face, for moving a brick by one voxel
+#define BRICK_X0 0x1111111111111111ULL
+#define BRICK_X3 0x8888888888888888ULL
+#define BRICK_Y0 0x000F000F000F000FULL
+#define BRICK_Y3 0xF000F000F000F000ULL
+
+static size_t block_bytes(int level) {
+    return 64 * (level == 0 ? sizeof(uint64_t) : sizeof(VoxelTreeNode));
+}
+
+static uint32_t alloc_block(VoxelTreePool* pool, int level) {
+    if (pool->free_count > 0) return (uint32_t)pool->free_list[--pool->free_count];
+    
+    if (pool->count == pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+        pool->blocks = realloc(pool->blocks, (size_t)pool->capacity * block_bytes(level));
+        pool->free_list = (int*)realloc(pool->free_list, pool->capacity * sizeof(int));
+        if (!pool->blocks || !pool->free_list) {
+            fprintf(stderr, "Failed to grow voxel tree to %d blocks\n", pool->capacity);
+            exit(1);
+        }
+    }
+    return (uint32_t)pool->count++;
+}
+
+static inline VoxelTreeNode* node_block(const VoxelTree* tree, int level, uint32_t block) {
+    return (VoxelTreeNode*)tree->pools[level].blocks + (size_t)block * 64;
+}
+
+static inline uint64_t* brick_block(const VoxelTree* tree, uint32_t block) {
+    return (uint64_t*)tree->pools[0].blocks + (size_t)block * 64;
+}
+
+// Child of a level node holding voxel (x, y, z); level 1 children are bricks
+static inline int child_slot(int x, int y, int z, int level) {
+    int shift = 2 * level;
+    return VOXEL_BRICK_BIT(x >> shift, y >> shift, z >> shift);
+}
+
+VoxelTree* create_voxel_tree(int width, int height, int depth) {
+    VoxelTree* tree = (VoxelTree*)calloc(1, sizeof(VoxelTree));
+    tree->width = width;
+    tree->height = height;
+    tree->depth = depth;
+    
+    int extent = width > height ? width : height;
+    if (depth > extent) extent = depth;
+    tree->size = 16;
+    tree->levels = 1;
+    while (tree->size < extent) {
+        tree->size *= 4;
+        tree->levels++;
+    }
+    if (tree->levels > VOXEL_TREE_MAX_LEVELS) {
+        fprintf(stderr, "Voxel tree of %dx%dx%d is too large\n", width, height, depth);
+        exit(1);
+    }
+    
+    tree->root.wall = ALL_WALL;
+    return tree;
+}
+
+void free_voxel_tree(VoxelTree* tree) {
+    if (tree) {
+        for (int level = 0; level < VOXEL_TREE_MAX_LEVELS; level++) {
+            free(tree->pools[level].blocks);
+            free(tree->pools[level].free_list);
+        }
+        free(tree);
+    }
+}
+
+// Mask of the brick at (x, y, z), a multiple of the brick size; anything
+// outside the root cube is wall, as is everything outside the cave inside it
+static uint64_t brick_mask(const VoxelTree* tree, int x, int y, int z) {
+    if (x < 0 || y < 0 || z < 0 || x >= tree->size || y >= tree->size || z >= tree->size) {
+        return ALL_WALL;
+    }
+    
+    const VoxelTreeNode* node = &tree->root;
+    for (int level = tree->levels; ; level--) {
+        int slot = child_slot(x, y, z, level);
+        uint64_t bit = (uint64_t)1 << slot;
+        if (!(node->mixed & bit)) return (node->wall & bit) ? ALL_WALL : 0;
+        if (level == 1) return brick_block(tree, node->block)[slot];
+        node = &node_block(tree, level - 1, node->block)[slot];
+    }
+}
+
+// Replace the brick holding (x, y, z) with (brick & keep) | set, splitting
+// uniform children on the way down and folding them back on the way up
+static void write_brick(VoxelTree* tree, int x, int y, int z, uint64_t keep, uint64_t set) {
+    VoxelTreeNode* path[VOXEL_TREE_MAX_LEVELS + 1];
+    int slots[VOXEL_TREE_MAX_LEVELS + 1];
+    VoxelTreeNode* node = &tree->root;
+    int slot = 0;
+    
+    for (int level = tree->levels; level >= 1; level--) {
+        slot = child_slot(x, y, z, level);
+        uint64_t bit = (uint64_t)1 << slot;
+        path[level] = node;
+        slots[level] = slot;
+        
+        if (!(node->mixed & bit)) {
+            // A uniform child the write leaves alone stays folded
+            uint64_t fill = (node->wall & bit) ? ALL_WALL : 0;
+            if (((fill & keep) | set) == fill) return;
+            
+            // Node blocks live in another pool, so node stays valid
+            if (node->mixed == 0) node->block = alloc_block(&tree->pools[level - 1], level - 1);
+            node->mixed |= bit;
+            if (level == 1) {
+                brick_block(tree, node->block)[slot] = fill;
+            } else {
+                VoxelTreeNode* child = &node_block(tree, level - 1, node->block)[slot];
+                child->mixed = 0;
+                child->wall = fill;
+                child->block = 0;
+            }
+        }
+        if (level > 1) node = &node_block(tree, level - 1, node->block)[slot];
+    }
+    
+    uint64_t* brick = &brick_block(tree, node->block)[slot];
+    *brick = (*brick & keep) | set;
+    
+    // Fold children that became uniform into their parents' bits
+    uint64_t value = *brick;
+    for (int level = 1; level <= tree->levels && (value == 0 || value == ALL_WALL); level++) {
+        VoxelTreeNode* parent = path[level];
+        uint64_t bit = (uint64_t)1 << slots[level];
+        parent->mixed &= ~bit;
+        parent->wall = value ? parent->wall | bit : parent->wall & ~bit;
+        if (parent->mixed != 0) break;
+        
+        VoxelTreePool* pool = &tree->pools[level - 1];
+        pool->free_list[pool->free_count++] = (int)parent->block;
+        parent->block = 0;
+        value = parent->wall;
+    }
+}
+
+VoxelTree* voxel_tree_from_cave(const Cave* cave) {
+    VoxelTree* tree = create_voxel_tree(cave->width, cave->height, cave->depth);
+    
+    for (int z = 0; z < cave->depth; z += VOXEL_BRICK_SIZE) {
+        for (int y = 0; y < cave->height; y += VOXEL_BRICK_SIZE) {
+            for (int x = 0; x < cave->width; x += VOXEL_BRICK_SIZE) {
+                uint64_t mask = 0;
+                for (int b = 0; b < 64; b++) {
+                    int vx = x + (b & 3), vy = y + ((b >> 2) & 3), vz = z + (b >> 4);
+                    if (!cave_in_bounds(cave, vx, vy, vz) || cave_get(cave, vx, vy, vz) == VOXEL_WALL) {
+                        mask |= (uint64_t)1 << b;
+                    }
+                }
+                if (mask != ALL_WALL) write_brick(tree, x, y, z, 0, mask);
+            }
+        }
+    }
+    return tree;
+}
+
+void voxel_tree_extract(const VoxelTree* tree, Cave* cave, int x0, int y0, int z0) {
+    // Window of tree voxels, halo included
+    const int lo[3] = { x0 - 1, y0 - 1, z0 - 1 };
+    const int hi[3] = { x0 + cave->width, y0 + cave->height, z0 + cave->depth };
+    
+    for (int bz = lo[2] & ~3; bz <= hi[2]; bz += VOXEL_BRICK_SIZE) {
+        for (int by = lo[1] & ~3; by <= hi[1]; by += VOXEL_BRICK_SIZE) {
+            for (int bx = lo[0] & ~3; bx <= hi[0]; bx += VOXEL_BRICK_SIZE) {
+                uint64_t mask = brick_mask(tree, bx, by, bz);
+                for (int z = bz < lo[2] ? lo[2] : bz; z <= bz + 3 && z <= hi[2]; z++) {
+                    for (int y = by < lo[1] ? lo[1] : by; y <= by + 3 && y <= hi[1]; y++) {
+                        unsigned char* row = &cave->voxels[cave_index(cave, 0, y - y0, z - z0)];
+                        for (int x = bx < lo[0] ? lo[0] : bx; x <= bx + 3 && x <= hi[0]; x++) {
+                            row[x - x0] = (mask >> VOXEL_BRICK_BIT(x, y, z)) & 1 ? VOXEL_WALL : VOXEL_AIR;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+Cave* voxel_tree_to_cave(const VoxelTree* tree) {
+    Cave* cave = create_cave(tree->width, tree->height, tree->depth);
+    voxel_tree_extract(tree, cave, 0, 0, 0);
+    return cave;
+}
+
+int voxel_tree_get(const VoxelTree* tree, int x, int y, int z) {
+    if (x < 0 || y < 0 || z < 0 || x >= tree->width || y >= tree->height || z >= tree->depth) {
+        return VOXEL_WALL;
+    }
+    uint64_t mask = brick_mask(tree, x & ~3, y & ~3, z & ~3);
+    return (mask >> VOXEL_BRICK_BIT(x, y, z)) & 1 ? VOXEL_WALL : VOXEL_AIR;
+}
+
+void voxel_tree_set(VoxelTree* tree, int x, int y, int z, int value) {
+    if (x < 0 || y < 0 || z < 0 || x >= tree->width || y >= tree->height || z >= tree->depth) return;
+    
+    uint64_t bit = (uint64_t)1 << VOXEL_BRICK_BIT(x, y, z);
+    if (value == VOXEL_WALL) {
+        write_brick(tree, x, y, z, ALL_WALL, bit);
+    } else {
+        write_brick(tree, x, y, z, ~bit, 0);
+    }
+}
+
+// Same ball as cave_carve_sphere, one brick at a time
+void voxel_tree_carve_sphere(VoxelTree* tree, int cx, int cy, int cz, int radius) {
+    const int c[3] = { cx, cy, cz };
+    const int dims[3] = { tree->width, tree->height, tree->depth };
+    int lo[3], hi[3];
+    for (int a = 0; a < 3; a++) {
+        lo[a] = c[a] - radius < 1 ? 1 : c[a] - radius;
+        hi[a] = c[a] + radius > dims[a] - 2 ? dims[a] - 2 : c[a] + radius;
+        if (lo[a] > hi[a]) return;
+    }
+    
+    for (int bz = lo[2] & ~3; bz <= hi[2]; bz += VOXEL_BRICK_SIZE) {
+        for (int by = lo[1] & ~3; by <= hi[1]; by += VOXEL_BRICK_SIZE) {
+            for (int bx = lo[0] & ~3; bx <= hi[0]; bx += VOXEL_BRICK_SIZE) {
+                uint64_t mask = 0;
+                for (int b = 0; b < 64; b++) {
+                    int x = bx + (b & 3), y = by + ((b >> 2) & 3), z = bz + (b >> 4);
+                    if (x < lo[0] || x > hi[0] || y < lo[1] || y > hi[1] || z < lo[2] || z > hi[2]) continue;
+                    int dx = x - cx, dy = y - cy, dz = z - cz;
+                    if (dx * dx + dy * dy + dz * dz <= radius * radius) mask |= (uint64_t)1 << b;
+                }
+                if (mask) write_brick(tree, bx, by, bz, ~mask, 0);
+            }
+        }
+    }
+}
+
+typedef struct {
+    const VoxelTree* tree;
+    int lo[3];
+    int hi[3];
+    VoxelSurfaceFunc func;
+    void* ctx;
+} SurfaceWalk;
+
+// Report the wall voxels of brick mask m at (x, y, z) that touch air, using
+// the six neighbouring bricks for the voxels on its faces
+static void brick_surface(const SurfaceWalk* walk, int x, int y, int z, uint64_t m) {
+    if (m == 0) return;
+    const VoxelTree* tree = walk->tree;
+    
+    // Wall neighbour along -x, +x, -y, +y, -z, +z of every bit
+    const uint64_t covered[6] = {
+        ((m << 1) & ~BRICK_X0) | ((brick_mask(tree, x - 4, y, z) >> 3) & BRICK_X0),
+        ((m >> 1) & ~BRICK_X3) | ((brick_mask(tree, x + 4, y, z) << 3) & BRICK_X3),
+        ((m << 4) & ~BRICK_Y0) | ((brick_mask(tree, x, y - 4, z) >> 12) & BRICK_Y0),
+        ((m >> 4) & ~BRICK_Y3) | ((brick_mask(tree, x, y + 4, z) << 12) & BRICK_Y3),
+        (m << 16) | (brick_mask(tree, x, y, z - 4) >> 48),
+        (m >> 16) | (brick_mask(tree, x, y, z + 4) << 48)
+    };
+    uint64_t exposed[6];
+    uint64_t surface = 0;
+    for (int d = 0; d < 6; d++) {
+        exposed[d] = m & ~covered[d];
+        surface |= exposed[d];
+    }
+    
+    while (surface) {
+        int b = __builtin_ctzll(surface);
+        surface &= surface - 1;
+        int vx = x + (b & 3), vy = y + ((b >> 2) & 3), vz = z + (b >> 4);
+        if (vx < walk->lo[0] || vx > walk->hi[0] || vy < walk->lo[1] || vy > walk->hi[1] ||
+            vz < walk->lo[2] || vz > walk->hi[2]) {
+            continue;
+        }
+        
+        int faces = 0;
+        for (int d = 0; d < 6; d++) {
+            faces |= (int)((exposed[d] >> b) & 1) << d;
+        }
+        walk->func(walk->ctx, vx, vy, vz, faces);
+    }
+}
+
+// Only the bricks on the shell of a solid cube can touch air
+static void solid_surface(const SurfaceWalk* walk, int x, int y, int z, int edge) {
+    const int last = edge - VOXEL_BRICK_SIZE;
+    const int start[3] = { x, y, z };
+    int lo[3], hi[3];
+    for (int a = 0; a < 3; a++) {
+        lo[a] = (walk->lo[a] & ~3) > start[a] ? walk->lo[a] & ~3 : start[a];
+        hi[a] = walk->hi[a] < start[a] + last ? walk->hi[a] : start[a] + last;
+    }
+    
+    for (int bz = lo[2]; bz <= hi[2]; bz += VOXEL_BRICK_SIZE) {
+        int z_face = bz == z || bz == z + last;
+        for (int by = lo[1]; by <= hi[1]; by += VOXEL_BRICK_SIZE) {
+            if (z_face || by == y || by == y + last) {
+                for (int bx = lo[0]; bx <= hi[0]; bx += VOXEL_BRICK_SIZE) {
+                    brick_surface(walk, bx, by, bz, ALL_WALL);
+                }
+            } else {
+                if (lo[0] <= x) brick_surface(walk, x, by, bz, ALL_WALL);
+                if (last > 0 && hi[0] >= x + last) brick_surface(walk, x + last, by, bz, ALL_WALL);
+            }
+        }
+    }
+}
+
+static void walk_surface(const SurfaceWalk* walk, const VoxelTreeNode* node, int level, int x, int y, int z) {
+    const int edge = 1 << (2 * level);  // Of each child
+    
+    for (int slot = 0; slot < 64; slot++) {
+        int cx = x + (slot & 3) * edge, cy = y + ((slot >> 2) & 3) * edge, cz = z + (slot >> 4) * edge;
+        if (cx > walk->hi[0] || cx + edge <= walk->lo[0] || cy > walk->hi[1] || cy + edge <= walk->lo[1] ||
+            cz > walk->hi[2] || cz + edge <= walk->lo[2]) {
+            continue;
+        }
+        
+        uint64_t bit = (uint64_t)1 << slot;
+        if (node->mixed & bit) {
+            if (level == 1) {
+                brick_surface(walk, cx, cy, cz, brick_block(walk->tree, node->block)[slot]);
+            } else {
+                walk_surface(walk, &node_block(walk->tree, level - 1, node->block)[slot], level - 1, cx, cy, cz);
+            }
+        } else if (node->wall & bit) {
+            solid_surface(walk, cx, cy, cz, edge);
+        }
+    }
+}
+
+void voxel_tree_for_each_surface(const VoxelTree* tree, const int lo[3], const int hi[3],
+                                 VoxelSurfaceFunc func, void* ctx) {
+    SurfaceWalk walk;
+    const int dims[3] = { tree->width, tree->height, tree->depth };
+    walk.tree = tree;
+    walk.func = func;
+    walk.ctx = ctx;
+    for (int a = 0; a < 3; a++) {
+        walk.lo[a] = lo[a] < 0 ? 0 : lo[a];
+        walk.hi[a] = hi[a] > dims[a] - 1 ? dims[a] - 1 : hi[a];
+        if (walk.lo[a] > walk.hi[a]) return;
+    }
+    
+    walk_surface(&walk, &tree->root, tree->levels, 0, 0, 0);
+}
+
+size_t voxel_tree_memory(const VoxelTree* tree) {
+    size_t bytes = sizeof(VoxelTree);
+    for (int level = 0; level < tree->levels; level++) {
+        const VoxelTreePool* pool = &tree->pools[level];
+        bytes += (size_t)(pool->count - pool->free_count) * block_bytes(level);
+    }
+    return bytes;
+}
@@ -0,0 +1,74 @@
+/*
+ * svo.h - Sparse Voxel Tree Storage
+ * A 64-tree: every node splits its cube into 4x4x4 children and the leaves
+ * are 4^3 bricks held as one 64-bit mask (bit set = wall). Children that are
+ * all wall or all air are two bits in their parent instead of a subtree, so
+ * memory follows the cave's surface rather than its volume. Cave stays the
+ * dense working format; trees convert to and from it and hand out dense
+ * windows for meshing.
+ */
+
+#ifndef SVO_H
+#define SVO_H
+
+#include "cave.h"
+
+#define VOXEL_BRICK_SIZE 4          // Voxels per brick edge; a brick is one uint64_t
+#define VOXEL_TREE_MAX_LEVELS 8     // Node levels above the bricks; 4^9 voxels per edge at most
+
+// Bit of voxel (x, y, z) within its brick, and of a child within its node
+#define VOXEL_BRICK_BIT(x, y, z) (((x) & 3) | (((y) & 3) << 2) | (((z) & 3) << 4))
+
+typedef struct {
+    uint64_t mixed;         // Children with a block of their own one level down
+    uint64_t wall;          // Of the other children, those that are solid wall
+    uint32_t block;         // The 64 children, when any is mixed
+} VoxelTreeNode;
+
+// Blocks of 64 children for one level, recycled through a free list
+typedef struct {
+    void* blocks;
+    int count;              // Blocks handed out, including freed ones
+    int capacity;
+    int* free_list;
+    int free_count;
+} VoxelTreePool;
+
+typedef struct {
+    int width;              // Voxels outside [0, width) x [0, height) x [0, depth) read as wall
+    int height;
+    int depth;
+    int size;               // Edge of the root cube, a power of 4
+    int levels;             // Node levels; the root covers 4^(levels + 1) voxels per edge
+    VoxelTreeNode root;
+    VoxelTreePool pools[VOXEL_TREE_MAX_LEVELS];  // pools[0] holds bricks, pools[k] nodes of level k
+} VoxelTree;
+
+// Called for each wall voxel next to air; faces has bit i set when the
+// neighbour along -x, +x, -y, +y, -z, +z (in that order) is air
+typedef void (*VoxelSurfaceFunc)(void* ctx, int x, int y, int z, int faces);
+
+// A tree of solid wall
+VoxelTree* create_voxel_tree(int width, int height, int depth);
+void free_voxel_tree(VoxelTree* tree);
+
+VoxelTree* voxel_tree_from_cave(const Cave* cave);
+Cave* voxel_tree_to_cave(const VoxelTree* tree);
+
+// Fill cave, halo included, with the tree's voxels starting at (x0, y0, z0),
+// so voxel (x, y, z) of cave is voxel (x0 + x, y0 + y, z0 + z) of the tree
+void voxel_tree_extract(const VoxelTree* tree, Cave* cave, int x0, int y0, int z0);
+
+int voxel_tree_get(const VoxelTree* tree, int x, int y, int z);
+void voxel_tree_set(VoxelTree* tree, int x, int y, int z, int value);
+void voxel_tree_carve_sphere(VoxelTree* tree, int cx, int cy, int cz, int radius);
+
+// Visit the surface voxels in [lo, hi] (inclusive), skipping solid and empty
+// subtrees without touching their voxels
+void voxel_tree_for_each_surface(const VoxelTree* tree, const int lo[3], const int hi[3],
+                                 VoxelSurfaceFunc func, void* ctx);
+
+// Bytes held by the node and brick blocks in use
+size_t voxel_tree_memory(const VoxelTree* tree);
+
+#endif // SVO_H
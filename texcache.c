@@ -0,0 +1,211 @@
+/*
+ * texcache.c - On-Disk Cache for Procedural Textures Implementation
+ */
+
+#include "texcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define cache_mkdir(path) _mkdir(path)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define cache_mkdir(path) mkdir(path, 0755)
+#endif
+
+#define TEXTURE_CACHE_PATH_MAX 1024
+
+// File header; texels follow directly, so they stay 16-byte aligned
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t reserved;
+    uint64_t key_hash;
+} TextureCacheHeader;
+
+static int cache_enabled = 1;
+
+void texture_cache_set_enabled(int enabled) {
+    cache_enabled = enabled;
+}
+
+int texture_cache_enabled(void) {
+    return cache_enabled;
+}
+
+// FNV-1a over everything that determines the texels
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t texture_key_hash(const TextureKey* key) {
+    uint32_t header[4] = { TEXTURE_CACHE_VERSION, (uint32_t)key->width,
+                           (uint32_t)key->height, (uint32_t)key->channels };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = hash_bytes(hash, key->name, strlen(key->name));
+    hash = hash_bytes(hash, header, sizeof(header));
+    return hash_bytes(hash, key->params, key->param_count * sizeof(float));
+}
+
+static size_t texture_data_size(const TextureKey* key) {
+    return (size_t)key->width * key->height * key->channels * sizeof(float);
+}
+
+// Cache directory, created on demand when create is set
+static int cache_directory(char* path, size_t size, int create) {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char root[TEXTURE_CACHE_PATH_MAX];
+    
+    if (xdg && xdg[0]) {
+        snprintf(root, sizeof(root), "%s", xdg);
+    } else if (home && home[0]) {
+        snprintf(root, sizeof(root), "%s/.cache", home);
+    } else {
+        snprintf(root, sizeof(root), ".cache");
+    }
+    
+    int n = snprintf(path, size, "%s/cave_dweller/textures-v%d", root, TEXTURE_CACHE_VERSION);
+    if (n < 0 || (size_t)n >= size) return 0;
+    
+    if (create) {
+        // mkdir -p, ignoring components that already exist
+        for (char* p = path + 1; *p; p++) {
+            if (*p == '/') {
+                *p = '\0';
+                cache_mkdir(path);
+                *p = '/';
+            }
+        }
+        cache_mkdir(path);
+    }
+    return 1;
+}
+
+static int cache_file_path(const TextureKey* key, char* path, size_t size, int create) {
+    char dir[TEXTURE_CACHE_PATH_MAX];
+    if (!cache_directory(dir, sizeof(dir), create)) return 0;
+    
+    int n = snprintf(path, size, "%s/%s-%dx%d-%016llx.tex", dir, key->name, key->width,
+                     key->height, (unsigned long long)texture_key_hash(key));
+    return n >= 0 && (size_t)n < size;
+}
+
+static int header_matches(const TextureCacheHeader* header, const TextureKey* key) {
+    return memcmp(header->magic, "CDTX", 4) == 0 &&
+           header->version == TEXTURE_CACHE_VERSION &&
+           header->width == (uint32_t)key->width &&
+           header->height == (uint32_t)key->height &&
+           header->channels == (uint32_t)key->channels &&
+           header->key_hash == texture_key_hash(key);
+}
+
+int texture_cache_open(const TextureKey* key, TextureCacheEntry* entry) {
+    char path[TEXTURE_CACHE_PATH_MAX];
+    size_t size = sizeof(TextureCacheHeader) + texture_data_size(key);
+    
+    memset(entry, 0, sizeof(*entry));
+    if (!cache_enabled || !cache_file_path(key, path, sizeof(path), 0)) return 0;
+    
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    
+    void* base = malloc(size);
+    int ok = base && fread(base, 1, size, file) == size && fgetc(file) == EOF;
+    fclose(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    
+    struct stat st;
+    void* base = NULL;
+    int ok = fstat(fd, &st) == 0 && (size_t)st.st_size == size;
+    if (ok) {
+        base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = base != MAP_FAILED;
+        if (!ok) base = NULL;
+    }
+    close(fd);
+    entry->mapped = 1;
+#endif
+    
+    entry->base = base;
+    entry->size = size;
+    if (!ok || !header_matches((const TextureCacheHeader*)base, key)) {
+        texture_cache_close(entry);
+        return 0;
+    }
+    
+    entry->data = (const float*)((const char*)base + sizeof(TextureCacheHeader));
+    return 1;
+}
+
+void texture_cache_close(TextureCacheEntry* entry) {
+    if (entry->base) {
+#ifdef _WIN32
+        free(entry->base);
+#else
+        munmap(entry->base, entry->size);
+#endif
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+int texture_cache_store(const TextureKey* key, const float* data) {
+    char path[TEXTURE_CACHE_PATH_MAX];
+    char temp_path[TEXTURE_CACHE_PATH_MAX + 8];
+    
+    if (!cache_enabled || !cache_file_path(key, path, sizeof(path), 1)) return 0;
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    
+    TextureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CDTX", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.width = key->width;
+    header.height = key->height;
+    header.channels = key->channels;
+    header.key_hash = texture_key_hash(key);
+    
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) return 0;
+    
+    size_t size = texture_data_size(key);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(data, 1, size, file) == size;
+    ok &= fclose(file) == 0;
+    
+    // Publish with a rename so readers never see a partial file
+    if (ok) {
+#ifdef _WIN32
+        remove(path);
+#endif
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+        fprintf(stderr, "Warning: could not write texture cache %s\n", path);
+    }
+    return ok;
+}
+
+void texture_cache_remove(const TextureKey* key) {
+    char path[TEXTURE_CACHE_PATH_MAX];
+    if (cache_file_path(key, path, sizeof(path), 0)) {
+        remove(path);
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * texcache.h - On-Disk Cache for Procedural Textures
+ * Deterministic textures are written once under
+ * $XDG_CACHE_HOME/cave_dweller/textures-v<N>/ (falling back to ~/.cache)
+ * and memory-mapped on later launches instead of being synthesized.
+ */
+
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include <stddef.h>
+
+// Bump when a generator changes in a way its parameters don't capture
+// (e.g. the noise function itself); old entries are then simply ignored
+#define TEXTURE_CACHE_VERSION 1
+
+typedef struct {
+    const char* name;       // Generator name, also used in the file name
+    const float* params;    // Every constant the generator reads
+    int param_count;
+    int width;
+    int height;
+    int channels;
+} TextureKey;
+
+typedef struct {
+    const float* data;      // width * height * channels texels, read-only
+    void* base;
+    size_t size;
+    int mapped;             // 1 if base is a file mapping, 0 if heap memory
+} TextureCacheEntry;
+
+void texture_cache_set_enabled(int enabled);
+int texture_cache_enabled(void);
+
+// Returns 1 and fills entry on a hit; release it with texture_cache_close
+int texture_cache_open(const TextureKey* key, TextureCacheEntry* entry);
+void texture_cache_close(TextureCacheEntry* entry);
+
+// Writes data for key atomically; returns 1 on success
+int texture_cache_store(const TextureKey* key, const float* data);
+
+// Deletes the entry for key, if any
+void texture_cache_remove(const TextureKey* key);
+
+#endif // TEXCACHE_H
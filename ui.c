@@ -4,6 +4,7 @@
 
 #include "ui.h"
 #include "shaders.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -173,6 +174,7 @@ void render_controls_overlay(int show) {
         "  Mouse - Look Around",
         "",
         "ACTIONS:",
+        "  Right Click - Dig",
         "  E - Collect Gem",
         "  Q - Drop Gem",
         "  1-9 - Select Hotbar Slot",
@@ -286,6 +288,27 @@ void render_ui(UISystem* ui, int window_width, int window_height) {
         glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
     }
     
+    // Gem compass: an arrow turned towards the nearest gem, and its distance
+    if (ui->compass_visible) {
+        float cx = window_width / 2, cy = 50;
+        float s = sinf(ui->compass_bearing), c = cosf(ui->compass_bearing);
+        glColor4f(ui->compass_color[0], ui->compass_color[1], ui->compass_color[2], 0.9f);
+        glBegin(GL_TRIANGLES);
+        // Up the screen is straight ahead
+        glVertex2f(cx + s * 18, cy - c * 18);
+        glVertex2f(cx - c * 8 - s * 8, cy - s * 8 + c * 8);
+        glVertex2f(cx + c * 8 - s * 8, cy + s * 8 + c * 8);
+        glEnd();
+        
+        char distance_text[32];
+        sprintf(distance_text, "%.1f", ui->compass_distance);
+        glColor3f(1.0f, 1.0f, 1.0f);
+        glRasterPos2f(cx - 10, cy + 28);
+        for (char* ch = distance_text; *ch; ch++) {
+            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *ch);
+        }
+    }
+    
     // FPS counter
     glColor3f(1.0f, 1.0f, 1.0f);
     glRasterPos2f(window_width - 100, 30);
@@ -318,3 +341,14 @@ void select_hotbar_slot(UISystem* ui, int slot) {
         ui->selected_slot = slot;
     }
 }
+
+void update_gem_compass(UISystem* ui, int visible, float bearing, float distance, const float* color) {
+    ui->compass_visible = visible;
+    if (!visible) return;
+    
+    ui->compass_bearing = bearing;
+    ui->compass_distance = distance;
+    for (int c = 0; c < 3; c++) {
+        ui->compass_color[c] = color[c];
+    }
+}
@@ -40,6 +40,12 @@ typedef struct {
     int selected_slot;
     int gem_counts[10];  // 10 hotbar slots
     int total_gems_collected;
+    
+    // Compass towards the nearest uncollected gem
+    int compass_visible;
+    float compass_bearing;      // Radians; 0 straight ahead, positive to the right
+    float compass_distance;
+    float compass_color[3];
 } UISystem;
 
 // Function prototypes
@@ -51,6 +57,8 @@ void render_text(const char* text, float x, float y, float scale);
 void render_controls_overlay(int show);
 void update_hotbar(UISystem* ui, int slot, int count);
 void select_hotbar_slot(UISystem* ui, int slot);
+// Point the compass at a gem, or hide it when visible is 0
+void update_gem_compass(UISystem* ui, int visible, float bearing, float distance, const float* color);
 
 // UI shader sources
 extern const char* ui_vertex_shader;
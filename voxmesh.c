@@ -0,0 +1,746 @@
+/*
+ * voxmesh.c - Voxel Interior Geometry Implementation
+ */
+
+#include "voxmesh.h"
+#include "shaders.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+static VoxelSurface voxel_surface = VOXEL_SURFACE_SMOOTH;
+
+void set_voxel_surface(VoxelSurface surface) {
+    voxel_surface = surface;
+}
+
+VoxelSurface get_voxel_surface(void) {
+    return voxel_surface;
+}
+
+static void reserve_mesh(VoxelMeshData* data, int vertices, int indices) {
+    if (data->vertex_count + vertices > data->vertex_capacity) {
+        int capacity = data->vertex_capacity ? data->vertex_capacity : 1024;
+        while (capacity < data->vertex_count + vertices) capacity *= 2;
+        data->vertices = (VoxelVertex*)realloc(data->vertices, capacity * sizeof(VoxelVertex));
+        data->vertex_capacity = capacity;
+    }
+    if (data->index_count + indices > data->index_capacity) {
+        int capacity = data->index_capacity ? data->index_capacity : 1536;
+        while (capacity < data->index_count + indices) capacity *= 2;
+        data->indices = (unsigned int*)realloc(data->indices, capacity * sizeof(unsigned int));
+        data->index_capacity = capacity;
+    }
+    if ((vertices && !data->vertices) || (indices && !data->indices)) {
+        fprintf(stderr, "Failed to allocate voxel mesh\n");
+        exit(1);
+    }
+}
+
+// Quad covering w x h faces starting at (i, j) on the u/v axes of a slice
+// facing axis * sign; corners go counter-clockwise seen from the air side
+static void emit_quad(VoxelMeshData* data, int axis, int sign, int k, int i, int j, int w, int h,
+                      const float origin[3], const float scale[3]) {
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float plane = origin[axis] + (k + 0.5f * sign) * scale[axis];
+    float u0 = origin[u] + (i - 0.5f) * scale[u];
+    float u1 = u0 + w * scale[u];
+    float v0 = origin[v] + (j - 0.5f) * scale[v];
+    float v1 = v0 + h * scale[v];
+    float corners[4][2] = { { u0, v0 }, { u1, v0 }, { u1, v1 }, { u0, v1 } };
+    
+    reserve_mesh(data, 4, 6);
+    VoxelVertex* out = &data->vertices[data->vertex_count];
+    for (int c = 0; c < 4; c++) {
+        // u x v points along +axis, so -axis faces walk the corners backwards
+        const float* corner = corners[sign > 0 ? c : (4 - c) & 3];
+        out[c].position[axis] = plane;
+        out[c].position[u] = corner[0];
+        out[c].position[v] = corner[1];
+        out[c].normal[axis] = (signed char)(sign * 127);
+        out[c].normal[u] = 0;
+        out[c].normal[v] = 0;
+        out[c].normal[3] = 0;
+    }
+    
+    unsigned int base = (unsigned int)data->vertex_count;
+    unsigned int* index = &data->indices[data->index_count];
+    index[0] = base;
+    index[1] = base + 1;
+    index[2] = base + 2;
+    index[3] = base;
+    index[4] = base + 2;
+    index[5] = base + 3;
+    
+    data->vertex_count += 4;
+    data->index_count += 6;
+    data->face_count += w * h;
+}
+
+void build_voxel_mesh(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                      const float origin[3], const float scale[3]) {
+    clear_voxel_mesh_data(data);
+    
+    int size[3] = { hi[0] - lo[0] + 1, hi[1] - lo[1] + 1, hi[2] - lo[2] + 1 };
+    if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0) return;
+    
+    const ptrdiff_t step[3] = { 1, cave->stride_y, cave->stride_z };
+    int max_area = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        int area = size[(axis + 1) % 3] * size[(axis + 2) % 3];
+        if (area > max_area) max_area = area;
+    }
+    unsigned char* mask = (unsigned char*)malloc(max_area);
+    
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        int su = size[u];
+        int sv = size[v];
+        
+        for (int sign = -1; sign <= 1; sign += 2) {
+            ptrdiff_t neighbour = sign * step[axis];
+            
+            for (int k = lo[axis]; k <= hi[axis]; k++) {
+                // Faces of this slice that separate wall from air
+                int p[3];
+                p[axis] = k;
+                p[u] = lo[u];
+                p[v] = lo[v];
+                const unsigned char* slice = &cave->voxels[cave_index(cave, p[0], p[1], p[2])];
+                int any = 0;
+                
+                for (int j = 0; j < sv; j++) {
+                    const unsigned char* voxel = slice + j * step[v];
+                    unsigned char* row = &mask[j * su];
+                    for (int i = 0; i < su; i++, voxel += step[u]) {
+                        row[i] = voxel[0] == VOXEL_WALL && voxel[neighbour] == VOXEL_AIR;
+                        any |= row[i];
+                    }
+                }
+                if (!any) continue;
+                
+                // Grow each face into the widest, then tallest, rectangle
+                for (int j = 0; j < sv; j++) {
+                    unsigned char* row = &mask[j * su];
+                    for (int i = 0; i < su; ) {
+                        if (!row[i]) {
+                            i++;
+                            continue;
+                        }
+                        
+                        int w = 1;
+                        while (i + w < su && row[i + w]) w++;
+                        
+                        int h = 1;
+                        for (; j + h < sv; h++) {
+                            const unsigned char* next = &mask[(j + h) * su + i];
+                            int full = 1;
+                            for (int x = 0; x < w && full; x++) full = next[x];
+                            if (!full) break;
+                        }
+                        
+                        for (int y = 0; y < h; y++) {
+                            memset(&mask[(j + y) * su + i], 0, w);
+                        }
+                        emit_quad(data, axis, sign, k, lo[u] + i, lo[v] + j, w, h, origin, scale);
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+    
+    free(mask);
+}
+
+// Smooth surface: marching cubes over a coarse density lattice. Each sample
+// averages the 2x2x2 voxels around a voxel corner, so a chunk's samples only
+// read its own voxels and its halo, and every cube is meshed on its own;
+// chunks that share a face see the same samples and meet without cracks.
+
+#define SMOOTH_ISO 0.5625f          // Just above 0.5 so flat walls never land on a sample
+#define SMOOTH_NOISE_FREQUENCY 4.0f // Relief noise cycles per world unit
+#define SMOOTH_MAX_TRIANGLES 12
+
+typedef struct {
+    int count;
+    unsigned char edges[SMOOTH_MAX_TRIANGLES * 3];
+} SmoothCase;
+
+static unsigned char cube_edges[12][2];     // Corner pairs, lower corner first
+static SmoothCase smooth_cases[256];
+static pthread_once_t smooth_cases_once = PTHREAD_ONCE_INIT;
+
+// Triangles for every corner mask (corner c sits at (c & 1, c >> 1 & 1, c >> 2 & 1)).
+// Each cube face is cut on its own, with diagonal inside corners always kept
+// apart, so neighbouring cubes agree on the face they share. The face cuts
+// chain into closed loops around the inside corners, which are fanned out.
+static void init_smooth_cases(void) {
+    int edge_between[8][8];
+    int faces[6][4];
+    int n = 0;
+    
+    for (int c = 0; c < 8; c++) {
+        for (int a = 0; a < 3; a++) {
+            if (!(c & (1 << a))) {
+                cube_edges[n][0] = (unsigned char)c;
+                cube_edges[n][1] = (unsigned char)(c | 1 << a);
+                edge_between[c][c | 1 << a] = edge_between[c | 1 << a][c] = n;
+                n++;
+            }
+        }
+    }
+    for (int a = 0; a < 3; a++) {
+        int u = 1 << (a + 1) % 3;
+        int v = 1 << (a + 2) % 3;
+        for (int side = 0; side < 2; side++) {
+            int base = side << a;
+            int* face = faces[2 * a + side];
+            face[0] = base;
+            face[1] = base | u;
+            face[2] = base | u | v;
+            face[3] = base | v;
+        }
+    }
+    
+    for (int mask = 0; mask < 256; mask++) {
+        int link[12][2];
+        int degree[12] = { 0 };
+        
+        // One cut per run of inside corners around each face
+        for (int f = 0; f < 6; f++) {
+            const int* face = faces[f];
+            for (int i = 0; i < 4; i++) {
+                int prev = face[(i + 3) & 3];
+                if (!(mask >> face[i] & 1) || (mask >> prev & 1)) continue;
+                
+                int j = i;
+                while (mask >> face[(j + 1) & 3] & 1) j = (j + 1) & 3;
+                int enter = edge_between[prev][face[i]];
+                int leave = edge_between[face[j]][face[(j + 1) & 3]];
+                link[enter][degree[enter]++] = leave;
+                link[leave][degree[leave]++] = enter;
+            }
+        }
+        
+        SmoothCase* out = &smooth_cases[mask];
+        int visited[12] = { 0 };
+        for (int e = 0; e < 12; e++) {
+            if (!degree[e] || visited[e]) continue;
+            
+            int loop[12];
+            int len = 0;
+            for (int cur = e, from = -1; len == 0 || cur != e; ) {
+                int next = link[cur][0] != from ? link[cur][0] : link[cur][1];
+                loop[len++] = cur;
+                visited[cur] = 1;
+                from = cur;
+                cur = next;
+            }
+            
+            // Wind the loop so its area vector follows the inside-to-outside
+            // direction of the edges it crosses
+            float area[3] = { 0.0f, 0.0f, 0.0f };
+            float across[3] = { 0.0f, 0.0f, 0.0f };
+            for (int i = 0; i < len; i++) {
+                float p[3], q[3];
+                const unsigned char* ep = cube_edges[loop[i]];
+                const unsigned char* eq = cube_edges[loop[(i + 1) % len]];
+                for (int a = 0; a < 3; a++) {
+                    p[a] = ((ep[0] >> a & 1) + (ep[1] >> a & 1)) * 0.5f;
+                    q[a] = ((eq[0] >> a & 1) + (eq[1] >> a & 1)) * 0.5f;
+                    float step = (float)((ep[1] >> a & 1) - (ep[0] >> a & 1));
+                    across[a] += (mask >> ep[0] & 1) ? step : -step;
+                }
+                area[0] += p[1] * q[2] - p[2] * q[1];
+                area[1] += p[2] * q[0] - p[0] * q[2];
+                area[2] += p[0] * q[1] - p[1] * q[0];
+            }
+            int reverse = area[0] * across[0] + area[1] * across[1] + area[2] * across[2] < 0.0f;
+            
+            for (int i = 1; i + 1 < len; i++) {
+                unsigned char* tri = &out->edges[3 * out->count++];
+                tri[0] = (unsigned char)loop[0];
+                tri[1] = (unsigned char)loop[reverse ? i + 1 : i];
+                tri[2] = (unsigned char)loop[reverse ? i : i + 1];
+            }
+        }
+    }
+}
+
+typedef struct {
+    int samples[3];         // Lattice points per axis
+    const float* coord[3];  // Per axis and point: position in voxel units
+    const float* density;
+    const float* gradient;  // Three per point, in voxel units
+    int* edge_vertex;       // Three per point: vertex on the edge leaving it along each axis
+} SmoothLattice;
+
+static inline int lattice_index(const SmoothLattice* lattice, int x, int y, int z) {
+    return (z * lattice->samples[1] + y) * lattice->samples[0] + x;
+}
+
+// Welded vertex where the surface crosses the lattice edge from p along axis
+static unsigned int smooth_edge_vertex(VoxelMeshData* data, const SmoothLattice* lattice,
+                                       const int p[3], int axis,
+                                       const float origin[3], const float scale[3]) {
+    int i0 = lattice_index(lattice, p[0], p[1], p[2]);
+    int* slot = &lattice->edge_vertex[3 * i0 + axis];
+    if (*slot >= 0) return (unsigned int)*slot;
+    
+    int q[3] = { p[0], p[1], p[2] };
+    q[axis]++;
+    int i1 = lattice_index(lattice, q[0], q[1], q[2]);
+    float d0 = lattice->density[i0];
+    float d1 = lattice->density[i1];
+    float t = (SMOOTH_ISO - d0) / (d1 - d0);
+    
+    reserve_mesh(data, 1, 0);
+    VoxelVertex* vertex = &data->vertices[data->vertex_count];
+    float normal[3];
+    float length = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        float c0 = lattice->coord[a][p[a]];
+        float c1 = lattice->coord[a][q[a]];
+        vertex->position[a] = origin[a] + (c0 + (c1 - c0) * t) * scale[a];
+        
+        // Density falls towards the air
+        float g0 = lattice->gradient[3 * i0 + a];
+        float g1 = lattice->gradient[3 * i1 + a];
+        normal[a] = -(g0 + (g1 - g0) * t) / scale[a];
+        length += normal[a] * normal[a];
+    }
+    if (length < 1e-8f) {
+        normal[0] = normal[1] = normal[2] = 0.0f;
+        normal[axis] = d0 > d1 ? 1.0f : -1.0f;
+        length = 1.0f;
+    }
+    length = 127.0f / sqrtf(length);
+    for (int a = 0; a < 3; a++) {
+        vertex->normal[a] = (signed char)lroundf(normal[a] * length);
+    }
+    vertex->normal[3] = 0;
+    
+    *slot = data->vertex_count++;
+    return (unsigned int)*slot;
+}
+
+void build_smooth_mesh(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                       const float origin[3], const float scale[3], int cell, float roughness) {
+    clear_voxel_mesh_data(data);
+    
+    int size[3] = { hi[0] - lo[0] + 1, hi[1] - lo[1] + 1, hi[2] - lo[2] + 1 };
+    if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0) return;
+    
+    pthread_once(&smooth_cases_once, init_smooth_cases);
+    
+    // Point k averages voxels lo + k * cell - 1 and the one after it on each
+    // axis, clamped to the halo past hi, so each voxel feeds one point per axis
+    SmoothLattice lattice;
+    int* voxel[3];
+    unsigned char* pair[3];
+    float* coord[3];
+    int count = 1;
+    for (int a = 0; a < 3; a++) {
+        int samples = (size[a] + cell - 1) / cell + 1;
+        voxel[a] = (int*)malloc(samples * sizeof(int));
+        pair[a] = (unsigned char*)malloc(samples);
+        coord[a] = (float*)malloc(samples * sizeof(float));
+        for (int k = 0; k < samples; k++) {
+            int v = lo[a] + k * cell - 1;
+            voxel[a][k] = v <= hi[a] ? v : hi[a] + 1;
+            pair[a][k] = v <= hi[a];
+            coord[a][k] = voxel[a][k] + 0.5f * pair[a][k];
+        }
+        lattice.samples[a] = samples;
+        lattice.coord[a] = coord[a];
+        count *= samples;
+    }
+    
+    float* density = (float*)malloc(count * sizeof(float));
+    float* gradient = (float*)malloc(count * 3 * sizeof(float));
+    int* edge_vertex = (int*)malloc(count * 3 * sizeof(int));
+    memset(edge_vertex, -1, count * 3 * sizeof(int));
+    lattice.density = density;
+    lattice.gradient = gradient;
+    lattice.edge_vertex = edge_vertex;
+    
+    const ptrdiff_t step[3] = { 1, cave->stride_y, cave->stride_z };
+    for (int z = 0; z < lattice.samples[2]; z++) {
+        for (int y = 0; y < lattice.samples[1]; y++) {
+            for (int x = 0; x < lattice.samples[0]; x++) {
+                const unsigned char* base = &cave->voxels[cave_index(cave, voxel[0][x], voxel[1][y], voxel[2][z])];
+                int i = lattice_index(&lattice, x, y, z);
+                int total = 0;
+                int upper[3] = { 0, 0, 0 };
+                
+                // Past hi the pair collapses onto the halo voxel
+                const ptrdiff_t next[3] = { pair[0][x] * step[0], pair[1][y] * step[1], pair[2][z] * step[2] };
+                for (int c = 0; c < 8; c++) {
+                    int wall = base[(c & 1) * next[0] + (c >> 1 & 1) * next[1] + (c >> 2 & 1) * next[2]];
+                    total += wall;
+                    for (int a = 0; a < 3; a++) {
+                        upper[a] += (c >> a & 1) ? wall : -wall;
+                    }
+                }
+                
+                density[i] = total * 0.125f;
+                for (int a = 0; a < 3; a++) {
+                    gradient[3 * i + a] = upper[a] * 0.25f;
+                }
+                
+            }
+        }
+    }
+    
+    // Relief noise in world space, so both sides of a chunk seam agree
+    if (roughness > 0.0f) {
+        float* xs = (float*)malloc(count * 4 * sizeof(float));
+        float* ys = xs + count;
+        float* zs = ys + count;
+        float* noise = zs + count;
+        for (int z = 0; z < lattice.samples[2]; z++) {
+            for (int y = 0; y < lattice.samples[1]; y++) {
+                for (int x = 0; x < lattice.samples[0]; x++) {
+                    int i = lattice_index(&lattice, x, y, z);
+                    xs[i] = (origin[0] + coord[0][x] * scale[0]) * SMOOTH_NOISE_FREQUENCY;
+                    ys[i] = (origin[1] + coord[1][y] * scale[1]) * SMOOTH_NOISE_FREQUENCY;
+                    zs[i] = (origin[2] + coord[2][z] * scale[2]) * SMOOTH_NOISE_FREQUENCY;
+                }
+            }
+        }
+        fractal_noise_3d_batch(xs, ys, zs, noise, count, 1, 1.0f);
+        for (int i = 0; i < count; i++) {
+            density[i] += roughness * noise[i];
+        }
+        free(xs);
+    }
+    
+    for (int z = 0; z + 1 < lattice.samples[2]; z++) {
+        for (int y = 0; y + 1 < lattice.samples[1]; y++) {
+            for (int x = 0; x + 1 < lattice.samples[0]; x++) {
+                int mask = 0;
+                for (int c = 0; c < 8; c++) {
+                    int i = lattice_index(&lattice, x + (c & 1), y + (c >> 1 & 1), z + (c >> 2 & 1));
+                    mask |= (density[i] > SMOOTH_ISO) << c;
+                }
+                
+                const SmoothCase* cube = &smooth_cases[mask];
+                if (cube->count == 0) continue;
+                
+                reserve_mesh(data, 0, cube->count * 3);
+                for (int e = 0; e < cube->count * 3; e++) {
+                    const unsigned char* edge = cube_edges[cube->edges[e]];
+                    int axis = (edge[0] ^ edge[1]) == 1 ? 0 : (edge[0] ^ edge[1]) == 2 ? 1 : 2;
+                    int p[3] = { x + (edge[0] & 1), y + (edge[0] >> 1 & 1), z + (edge[0] >> 2 & 1) };
+                    unsigned int index = smooth_edge_vertex(data, &lattice, p, axis, origin, scale);
+                    data->indices[data->index_count++] = index;
+                }
+            }
+        }
+    }
+    
+    for (int a = 0; a < 3; a++) {
+        free(voxel[a]);
+        free(pair[a]);
+        free(coord[a]);
+    }
+    free(density);
+    free(gradient);
+    free(edge_vertex);
+}
+
+void mesh_voxels(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                 const float origin[3], const float scale[3]) {
+    if (voxel_surface == VOXEL_SURFACE_SMOOTH) {
+        build_smooth_mesh(data, cave, lo, hi, origin, scale, SMOOTH_CELL_SIZE, SMOOTH_ROUGHNESS);
+    } else {
+        build_voxel_mesh(data, cave, lo, hi, origin, scale);
+    }
+}
+
+void voxel_mesh_bounds(const VoxelMeshData* data, float min[3], float max[3]) {
+    for (int a = 0; a < 3; a++) {
+        min[a] = INFINITY;
+        max[a] = -INFINITY;
+    }
+    for (int i = 0; i < data->vertex_count; i++) {
+        const float* p = data->vertices[i].position;
+        for (int a = 0; a < 3; a++) {
+            if (p[a] < min[a]) min[a] = p[a];
+            if (p[a] > max[a]) max[a] = p[a];
+        }
+    }
+}
+
+void clear_voxel_mesh_data(VoxelMeshData* data) {
+    data->vertex_count = 0;
+    data->index_count = 0;
+    data->face_count = 0;
+}
+
+void free_voxel_mesh_data(VoxelMeshData* data) {
+    free(data->vertices);
+    free(data->indices);
+    memset(data, 0, sizeof(*data));
+}
+
+// Write size bytes into the buffer bound to target, growing its store with
+// headroom only when they do not fit, so remeshes of a chunk reuse it
+static void update_buffer(GLenum target, size_t* capacity, size_t size, const void* data) {
+    if (size > *capacity) {
+        *capacity = size + size / 2;
+        glBufferData(target, *capacity, NULL, GL_DYNAMIC_DRAW);
+    }
+    if (size > 0) {
+        glBufferSubData(target, 0, size, data);
+    }
+}
+
+void upload_voxel_mesh(VoxelMesh* mesh, const VoxelMeshData* data) {
+    if (!mesh->vao) {
+        glGenVertexArrays(1, &mesh->vao);
+        glGenBuffers(1, &mesh->vbo);
+        glGenBuffers(1, &mesh->ebo);
+        
+        glBindVertexArray(mesh->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
+        
+        // Position
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VoxelVertex),
+                              (void*)offsetof(VoxelVertex, position));
+        glEnableVertexAttribArray(0);
+        
+        // Normal
+        glVertexAttribPointer(1, 3, GL_BYTE, GL_TRUE, sizeof(VoxelVertex),
+                              (void*)offsetof(VoxelVertex, normal));
+        glEnableVertexAttribArray(1);
+    } else {
+        glBindVertexArray(mesh->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    }
+    
+    update_buffer(GL_ARRAY_BUFFER, &mesh->vertex_bytes, data->vertex_count * sizeof(VoxelVertex), data->vertices);
+    update_buffer(GL_ELEMENT_ARRAY_BUFFER, &mesh->index_bytes, data->index_count * sizeof(unsigned int), data->indices);
+    glBindVertexArray(0);
+    
+    mesh->index_count = data->index_count;
+    voxel_mesh_bounds(data, mesh->bounds_min, mesh->bounds_max);
+}
+
+void release_voxel_mesh(VoxelMesh* mesh) {
+    if (mesh->vao) {
+        glDeleteVertexArrays(1, &mesh->vao);
+        glDeleteBuffers(1, &mesh->vbo);
+        glDeleteBuffers(1, &mesh->ebo);
+    }
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+void draw_voxel_mesh(const VoxelMesh* mesh) {
+    if (mesh->index_count == 0) return;
+    
+    glBindVertexArray(mesh->vao);
+    glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
+
+void cull_voxel_mesh(const VoxelMesh* mesh, const Frustum* frustum, CullCounter* counter) {
+    if (mesh->index_count == 0) return;
+    
+    if (frustum_cull_aabb(frustum, mesh->bounds_min, mesh->bounds_max, counter)) {
+        draw_voxel_mesh(mesh);
+    }
+}
+
+void begin_voxel_pass(const float* view, const float* projection,
+                      float cam_x, float cam_y, float cam_z, float fog_density) {
+    GLuint program = shader_programs[SHADER_VOXEL].program;
+    
+    use_shader(SHADER_VOXEL);
+    set_uniform_mat4(program, "view", view);
+    set_uniform_mat4(program, "projection", projection);
+    set_uniform_vec3(program, "viewPos", cam_x, cam_y, cam_z);
+    set_uniform_vec3(program, "lightPos", cam_x, cam_y + 1.0f, cam_z);
+    set_uniform_vec3(program, "fogColor", 0.02f, 0.02f, 0.03f);
+    set_uniform_float(program, "fogDensity", fog_density);
+}
+
+// Fixed-cave chunk meshing
+
+typedef struct {
+    InteriorMesh* mesh;
+    const Cave* cave;
+    const VoxelTree* tree;  // Mesh from windows of the tree instead of cave
+    const int* chunks;      // Indices of the chunks to rebuild
+} InteriorJob;
+
+// Voxels [lo, hi] of chunk (cx, cy, cz) in a grid of dims voxels
+static void interior_chunk_bounds(const int dims[3], int cx, int cy, int cz, int lo[3], int hi[3]) {
+    const int c[3] = { cx, cy, cz };
+    
+    for (int i = 0; i < 3; i++) {
+        lo[i] = c[i] * INTERIOR_CHUNK_SIZE;
+        hi[i] = lo[i] + INTERIOR_CHUNK_SIZE - 1 < dims[i] ? lo[i] + INTERIOR_CHUNK_SIZE - 1 : dims[i] - 1;
+    }
+}
+
+// The fixed cave spans [-5, 5] on every axis
+static void interior_placement(const int dims[3], float origin[3], float scale[3]) {
+    for (int i = 0; i < 3; i++) {
+        origin[i] = -5.0f;
+        scale[i] = 10.0f / dims[i];
+    }
+}
+
+void mesh_interior_chunk(VoxelMeshData* data, const Cave* cave, int cx, int cy, int cz) {
+    const int dims[3] = { cave->width, cave->height, cave->depth };
+    float origin[3], scale[3];
+    int lo[3], hi[3];
+    interior_placement(dims, origin, scale);
+    interior_chunk_bounds(dims, cx, cy, cz, lo, hi);
+    mesh_voxels(data, cave, lo, hi, origin, scale);
+}
+
+void mesh_sparse_interior_chunk(VoxelMeshData* data, const VoxelTree* tree, Cave* window, int cx, int cy, int cz) {
+    const int dims[3] = { tree->width, tree->height, tree->depth };
+    float origin[3], scale[3];
+    int lo[3], hi[3];
+    interior_placement(dims, origin, scale);
+    interior_chunk_bounds(dims, cx, cy, cz, lo, hi);
+    
+    // The window holds the chunk at its origin; voxels past the cave read as
+    // wall, as the dense grid's halo does
+    voxel_tree_extract(tree, window, lo[0], lo[1], lo[2]);
+    int window_hi[3];
+    for (int i = 0; i < 3; i++) {
+        origin[i] += lo[i] * scale[i];
+        window_hi[i] = hi[i] - lo[i];
+    }
+    const int window_lo[3] = { 0, 0, 0 };
+    mesh_voxels(data, window, window_lo, window_hi, origin, scale);
+}
+
+static void mesh_interior_chunks(void* ctx, int begin, int end, int chunk) {
+    InteriorJob* job = (InteriorJob*)ctx;
+    const int* counts = job->mesh->chunks;
+    Cave* window = job->tree ? create_cave(INTERIOR_CHUNK_SIZE, INTERIOR_CHUNK_SIZE, INTERIOR_CHUNK_SIZE) : NULL;
+    (void)chunk;
+    
+    for (int i = begin; i < end; i++) {
+        int index = job->chunks[i];
+        int cx = index % counts[0], cy = (index / counts[0]) % counts[1], cz = index / (counts[0] * counts[1]);
+        if (job->tree) {
+            mesh_sparse_interior_chunk(&job->mesh->data[index], job->tree, window, cx, cy, cz);
+        } else {
+            mesh_interior_chunk(&job->mesh->data[index], job->cave, cx, cy, cz);
+        }
+    }
+    free_cave(window);
+}
+
+static InteriorMesh* alloc_interior_mesh(int width, int height, int depth) {
+    InteriorMesh* mesh = (InteriorMesh*)calloc(1, sizeof(InteriorMesh));
+    mesh->chunks[0] = (width + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE;
+    mesh->chunks[1] = (height + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE;
+    mesh->chunks[2] = (depth + INTERIOR_CHUNK_SIZE - 1) / INTERIOR_CHUNK_SIZE;
+    
+    int count = mesh->chunks[0] * mesh->chunks[1] * mesh->chunks[2];
+    mesh->meshes = (VoxelMesh*)calloc(count, sizeof(VoxelMesh));
+    mesh->data = (VoxelMeshData*)calloc(count, sizeof(VoxelMeshData));
+    mesh->dirty = (unsigned char*)malloc(count);
+    memset(mesh->dirty, 1, count);
+    return mesh;
+}
+
+InteriorMesh* create_interior_mesh(const Cave* cave) {
+    InteriorMesh* mesh = alloc_interior_mesh(cave->width, cave->height, cave->depth);
+    update_interior_mesh(mesh, cave);
+    return mesh;
+}
+
+InteriorMesh* create_sparse_interior_mesh(const VoxelTree* tree) {
+    InteriorMesh* mesh = alloc_interior_mesh(tree->width, tree->height, tree->depth);
+    update_sparse_interior_mesh(mesh, tree);
+    return mesh;
+}
+
+void free_interior_mesh(InteriorMesh* mesh) {
+    if (!mesh) return;
+    
+    int count = mesh->chunks[0] * mesh->chunks[1] * mesh->chunks[2];
+    for (int i = 0; i < count; i++) {
+        release_voxel_mesh(&mesh->meshes[i]);
+        free_voxel_mesh_data(&mesh->data[i]);
+    }
+    free(mesh->meshes);
+    free(mesh->data);
+    free(mesh->dirty);
+    free(mesh);
+}
+
+// Voxels in [x0, x1] x [y0, y1] x [z0, z1] changed; faces of the voxels next
+// to the box change too, so chunks touching its one-voxel border are included
+void mark_interior_mesh_dirty(InteriorMesh* mesh, int x0, int y0, int z0, int x1, int y1, int z1) {
+    int lo[3] = { x0 - 1, y0 - 1, z0 - 1 };
+    int hi[3] = { x1 + 1, y1 + 1, z1 + 1 };
+    
+    for (int i = 0; i < 3; i++) {
+        lo[i] = lo[i] < 0 ? 0 : lo[i] / INTERIOR_CHUNK_SIZE;
+        hi[i] = hi[i] < 0 ? -1 : hi[i] / INTERIOR_CHUNK_SIZE;
+        if (hi[i] >= mesh->chunks[i]) hi[i] = mesh->chunks[i] - 1;
+    }
+    
+    for (int cz = lo[2]; cz <= hi[2]; cz++) {
+        for (int cy = lo[1]; cy <= hi[1]; cy++) {
+            for (int cx = lo[0]; cx <= hi[0]; cx++) {
+                mesh->dirty[(cz * mesh->chunks[1] + cy) * mesh->chunks[0] + cx] = 1;
+            }
+        }
+    }
+}
+
+static void update_interior_chunks(InteriorMesh* mesh, const Cave* cave, const VoxelTree* tree) {
+    int count = mesh->chunks[0] * mesh->chunks[1] * mesh->chunks[2];
+    int* dirty = (int*)malloc(count * sizeof(int));
+    int dirty_count = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (mesh->dirty[i]) dirty[dirty_count++] = i;
+    }
+    
+    if (dirty_count > 0) {
+        // Mesh on the pool, then upload from the GL thread
+        InteriorJob job = { mesh, cave, tree, dirty };
+        parallel_for(dirty_count, mesh_interior_chunks, &job);
+        
+        for (int i = 0; i < dirty_count; i++) {
+            int index = dirty[i];
+            mesh->triangle_count -= mesh->meshes[index].index_count / 3;
+            upload_voxel_mesh(&mesh->meshes[index], &mesh->data[index]);
+            mesh->triangle_count += mesh->meshes[index].index_count / 3;
+            mesh->dirty[index] = 0;
+        }
+    }
+    
+    free(dirty);
+}
+
+void update_interior_mesh(InteriorMesh* mesh, const Cave* cave) {
+    update_interior_chunks(mesh, cave, NULL);
+}
+
+void update_sparse_interior_mesh(InteriorMesh* mesh, const VoxelTree* tree) {
+    update_interior_chunks(mesh, NULL, tree);
+}
+
+void render_interior_mesh(const InteriorMesh* mesh, const Frustum* frustum, CullCounter* counter) {
+    int count = mesh->chunks[0] * mesh->chunks[1] * mesh->chunks[2];
+    for (int i = 0; i < count; i++) {
+        cull_voxel_mesh(&mesh->meshes[i], frustum, counter);
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * voxmesh.h - Voxel Interior Geometry
+ * Cave walls are meshed per chunk, either as voxel faces merged into maximal
+ * rectangles or as a smooth marching-cubes surface, and kept on the GPU in
+ * per-chunk buffers, so drawing the interior costs a few draw calls a frame
+ * and geometry is rebuilt only when voxels change.
+ */
+
+#ifndef VOXMESH_H
+#define VOXMESH_H
+
+#include "cave.h"
+#include "frustum.h"
+#include "svo.h"
+
+#define INTERIOR_CHUNK_SIZE 16  // Voxels per mesh chunk edge for the fixed cave; small so digging remeshes little
+#define SMOOTH_CELL_SIZE 2      // Voxels per marching cube edge for smooth walls
+#define SMOOTH_ROUGHNESS 0.15f  // Amplitude of the relief noise added to the density
+
+// How wall geometry is built
+typedef enum {
+    VOXEL_SURFACE_BLOCKY,   // Voxel faces, greedy-merged into rectangles
+    VOXEL_SURFACE_SMOOTH    // Marching cubes over a blurred density
+} VoxelSurface;
+
+// 16 bytes per vertex
+typedef struct {
+    float position[3];
+    signed char normal[4];  // Unit axis normal; w unused
+} VoxelVertex;
+
+// CPU-side mesh, built on any thread
+typedef struct {
+    VoxelVertex* vertices;
+    unsigned int* indices;
+    int vertex_count;
+    int vertex_capacity;
+    int index_count;
+    int index_capacity;
+    int face_count;         // Unmerged voxel faces the quads cover (blocky only)
+} VoxelMeshData;
+
+// GPU-side mesh, main thread only
+typedef struct {
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    int index_count;
+    size_t vertex_bytes;    // Sizes of the buffer stores, which only grow
+    size_t index_bytes;
+    float bounds_min[3];    // Box around the vertices, for culling
+    float bounds_max[3];
+} VoxelMesh;
+
+// Chunked interior geometry of a fixed-size cave
+typedef struct {
+    int chunks[3];          // Chunk counts along x, y, z
+    VoxelMesh* meshes;
+    VoxelMeshData* data;    // Staging for rebuilds
+    unsigned char* dirty;   // Chunks to remesh on the next update
+    int triangle_count;
+} InteriorMesh;
+
+// Mesh wall faces of voxels [lo, hi] (inclusive) whose neighbour is air;
+// voxel (x, y, z) fills the cell centred on origin + (x, y, z) * scale.
+// Neighbours are read through the halo, so lo - 1 and hi + 1 must be valid.
+void build_voxel_mesh(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                      const float origin[3], const float scale[3]);
+
+// Marching cubes over points cell voxels apart, each the wall fraction of the
+// 2x2x2 voxels around it plus roughness times 3D noise. Reads the same voxels
+// as build_voxel_mesh, so chunks mesh independently and still line up.
+void build_smooth_mesh(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                       const float origin[3], const float scale[3], int cell, float roughness);
+
+// Build with the current surface style
+void set_voxel_surface(VoxelSurface surface);
+VoxelSurface get_voxel_surface(void);
+void mesh_voxels(VoxelMeshData* data, const Cave* cave, const int lo[3], const int hi[3],
+                 const float origin[3], const float scale[3]);
+
+// Box around every vertex; empty meshes get an inverted box
+void voxel_mesh_bounds(const VoxelMeshData* data, float min[3], float max[3]);
+
+void clear_voxel_mesh_data(VoxelMeshData* data);
+void free_voxel_mesh_data(VoxelMeshData* data);
+
+void upload_voxel_mesh(VoxelMesh* mesh, const VoxelMeshData* data);
+void release_voxel_mesh(VoxelMesh* mesh);
+void draw_voxel_mesh(const VoxelMesh* mesh);
+
+// Draw if the mesh has triangles and its box meets the frustum (NULL draws
+// everything); empty meshes are not counted
+void cull_voxel_mesh(const VoxelMesh* mesh, const Frustum* frustum, CullCounter* counter);
+
+// Bind the voxel shader with the camera; call before draw_voxel_mesh
+void begin_voxel_pass(const float* view, const float* projection,
+                      float cam_x, float cam_y, float cam_z, float fog_density);
+
+// CPU side of interior chunk (cx, cy, cz), from the dense grid, or from the
+// tree through window, a scratch cave of INTERIOR_CHUNK_SIZE^3 voxels
+void mesh_interior_chunk(VoxelMeshData* data, const Cave* cave, int cx, int cy, int cz);
+void mesh_sparse_interior_chunk(VoxelMeshData* data, const VoxelTree* tree, Cave* window, int cx, int cy, int cz);
+
+InteriorMesh* create_interior_mesh(const Cave* cave);
+// Interior of a sparse cave; each worker meshes its chunks from one dense
+// window at a time
+InteriorMesh* create_sparse_interior_mesh(const VoxelTree* tree);
+void free_interior_mesh(InteriorMesh* mesh);
+void mark_interior_mesh_dirty(InteriorMesh* mesh, int x0, int y0, int z0, int x1, int y1, int z1);
+void update_interior_mesh(InteriorMesh* mesh, const Cave* cave);
+void update_sparse_interior_mesh(InteriorMesh* mesh, const VoxelTree* tree);
+void render_interior_mesh(const InteriorMesh* mesh, const Frustum* frustum, CullCounter* counter);
+
+#endif // VOXMESH_H
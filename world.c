@@ -0,0 +1,535 @@
+/*
+ * world.c - Infinite Streaming Cave World Implementation
+ */
+
+#include "world.h"
+#include "parallel.h"
+#include "rng.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+// The fixed cave's solid border keeps its walls alive; in open space the
+// smoothing rule (wall if more than 13 of the 26 neighbours are) erodes
+// 45% noise to nothing, so the world starts denser
+#define WORLD_WALL_PERCENTAGE 55
+#define WORLD_NODE_MARGIN 8         // Tunnel nodes sit this far inside their chunk
+#define WORLD_CHAMBER_CHANCE 30     // Percent of nodes that open into a chamber
+#define WORLD_LINK_UP_CHANCE 25     // Percent of nodes with a shaft to the node above
+#define WORLD_SPAWN_CHAMBER 10      // Chamber radius at the origin node
+#define WORLD_MESH_UPLOADS 8        // Chunk meshes sent to the GPU per frame
+
+static inline int floor_div(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline int floor_mod(int a, int b) {
+    int m = a % b;
+    return m < 0 ? m + b : m;
+}
+
+static inline int world_voxel_coord(float position) {
+    return (int)floorf(position / WORLD_VOXEL_SIZE + 0.5f);
+}
+
+// Stream index of a chunk; 21 bits per axis is over 200,000 world units each way
+static uint64_t chunk_key(int cx, int cy, int cz) {
+    return ((uint64_t)(cx & 0x1FFFFF) << 42) | ((uint64_t)(cy & 0x1FFFFF) << 21) | (uint64_t)(cz & 0x1FFFFF);
+}
+
+// Tunnel network: every chunk has one node, linked to the nodes of its +x and
+// +z neighbours and sometimes to the one above, so the caves always connect
+typedef struct {
+    int pos[3];     // World voxel coordinates
+    int chamber;    // Chamber radius, 0 for none
+    int link_up;
+} ChunkNode;
+
+static ChunkNode chunk_node(uint64_t seed, int cx, int cy, int cz) {
+    Rng rng = rng_stream(seed, RNG_STREAM_WORLD_NODE, chunk_key(cx, cy, cz));
+    int c[3] = { cx, cy, cz };
+    ChunkNode node;
+    
+    for (int i = 0; i < 3; i++) {
+        node.pos[i] = c[i] * CHUNK_SIZE + WORLD_NODE_MARGIN +
+                      rng_int(&rng, CHUNK_SIZE - 2 * WORLD_NODE_MARGIN);
+    }
+    node.chamber = rng_int(&rng, 100) < WORLD_CHAMBER_CHANCE ? 5 + rng_int(&rng, 5) : 0;
+    node.link_up = rng_int(&rng, 100) < WORLD_LINK_UP_CHANCE;
+    
+    if (cx == 0 && cy == 0 && cz == 0) {
+        node.chamber = WORLD_SPAWN_CHAMBER;
+    }
+    return node;
+}
+
+// Carving target: one chunk grid including its halo
+typedef struct {
+    Cave* chunk;
+    int base[3];    // World coordinates of local voxel (0, 0, 0)
+} ChunkCarver;
+
+static const int chunk_carve_lo[3] = { -1, -1, -1 };
+static const int chunk_carve_hi[3] = { CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+
+// Wobbly tunnel between two nodes that differ along axis, swept as capsules
+// between points a few voxels apart
+static void carve_world_edge(const ChunkCarver* carver, uint64_t seed, uint64_t key,
+                             const ChunkNode* from, const ChunkNode* to, int axis) {
+    Rng rng = rng_stream(seed, RNG_STREAM_WORLD_EDGE, key * 3 + axis);
+    int radius = 4 + rng_int(&rng, 2);
+    float amplitude[3], frequency[3];
+    
+    for (int i = 0; i < 3; i++) {
+        amplitude[i] = i == axis ? 0.0f : (float)(rng_int(&rng, 7) - 3);
+        frequency[i] = (float)(1 + rng_int(&rng, 2));
+    }
+    
+    // Skip tunnels that cannot reach this chunk
+    int reach = radius + 3;
+    for (int i = 0; i < 3; i++) {
+        int lo = (from->pos[i] < to->pos[i] ? from->pos[i] : to->pos[i]) - reach;
+        int hi = (from->pos[i] > to->pos[i] ? from->pos[i] : to->pos[i]) + reach;
+        if (hi < carver->base[i] - 1 || lo > carver->base[i] + CHUNK_SIZE) return;
+    }
+    
+    float delta[3], length = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        delta[i] = (float)(to->pos[i] - from->pos[i]);
+        length += delta[i] * delta[i];
+    }
+    int steps = (int)(sqrtf(length) / 4.0f) + 1;
+    
+    // Points are placed in world voxels and snapped to 1/256 of a voxel before
+    // the chunk's base comes off, so the chunk-relative floats are exact and
+    // every chunk carves the same tunnel to the bit
+    float prev[3];
+    for (int s = 0; s <= steps; s++) {
+        float t = (float)s / steps;
+        float p[3];
+        for (int i = 0; i < 3; i++) {
+            float offset = amplitude[i] * sinf((float)M_PI * t * frequency[i]);
+            double point = from->pos[i] + (double)(delta[i] * t) + offset;
+            p[i] = (float)(round(point * 256.0) / 256.0 - carver->base[i]);
+        }
+        carve_capsule(carver->chunk, s > 0 ? prev : p, p, (float)radius, chunk_carve_lo, chunk_carve_hi);
+        memcpy(prev, p, sizeof(p));
+    }
+}
+
+// Chambers and tunnels from every node close enough to reach the chunk
+static void carve_world_chunk(Cave* chunk, uint64_t seed, int cx, int cy, int cz) {
+    ChunkCarver carver = { chunk, { cx * CHUNK_SIZE, cy * CHUNK_SIZE, cz * CHUNK_SIZE } };
+    
+    for (int oz = -1; oz <= 1; oz++) {
+        for (int oy = -1; oy <= 1; oy++) {
+            for (int ox = -1; ox <= 1; ox++) {
+                int nx = cx + ox, ny = cy + oy, nz = cz + oz;
+                ChunkNode node = chunk_node(seed, nx, ny, nz);
+                uint64_t key = chunk_key(nx, ny, nz);
+                
+                if (node.chamber > 0) {
+                    carve_sphere(chunk, node.pos[0] - carver.base[0], node.pos[1] - carver.base[1],
+                                 node.pos[2] - carver.base[2], node.chamber, chunk_carve_lo, chunk_carve_hi);
+                }
+                
+                ChunkNode east = chunk_node(seed, nx + 1, ny, nz);
+                ChunkNode south = chunk_node(seed, nx, ny, nz + 1);
+                carve_world_edge(&carver, seed, key, &node, &east, 0);
+                carve_world_edge(&carver, seed, key, &node, &south, 2);
+                if (node.link_up) {
+                    ChunkNode up = chunk_node(seed, nx, ny + 1, nz);
+                    carve_world_edge(&carver, seed, key, &node, &up, 1);
+                }
+            }
+        }
+    }
+}
+
+void generate_world_chunk(Cave* chunk, Cave* scratch, uint64_t seed, int cx, int cy, int cz) {
+    // Every voxel draws from the stream of the chunk that owns it, so the
+    // apron holds exactly what the neighbours generate for themselves
+    uint64_t keys[27];
+    for (int oz = -1; oz <= 1; oz++) {
+        for (int oy = -1; oy <= 1; oy++) {
+            for (int ox = -1; ox <= 1; ox++) {
+                keys[((oz + 1) * 3 + oy + 1) * 3 + ox + 1] =
+                    rng_key(seed, RNG_STREAM_WORLD_FILL, chunk_key(cx + ox, cy + oy, cz + oz));
+            }
+        }
+    }
+    
+    // Owner (0..2 for -1..+1) and local coordinate along any axis of the scratch grid
+    int owner[CHUNK_SCRATCH_SIZE], local[CHUNK_SCRATCH_SIZE];
+    for (int i = 0; i < CHUNK_SCRATCH_SIZE; i++) {
+        int offset = floor_div(i - CHUNK_APRON, CHUNK_SIZE);
+        owner[i] = offset + 1;
+        local[i] = i - CHUNK_APRON - offset * CHUNK_SIZE;
+    }
+    
+    for (int z = 0; z < CHUNK_SCRATCH_SIZE; z++) {
+        for (int y = 0; y < CHUNK_SCRATCH_SIZE; y++) {
+            unsigned char* row = &scratch->voxels[cave_index(scratch, 0, y, z)];
+            const uint64_t* row_keys = &keys[(owner[z] * 3 + owner[y]) * 3];
+            uint64_t n = ((uint64_t)local[z] * CHUNK_SIZE + local[y]) * CHUNK_SIZE;
+            for (int x = 0; x < CHUNK_SCRATCH_SIZE; x++) {
+                uint64_t value = rng_at(row_keys[owner[x]], n + local[x]);
+                row[x] = rng_range(value, 100) < WORLD_WALL_PERCENTAGE ? VOXEL_WALL : VOXEL_AIR;
+            }
+        }
+    }
+    
+    // The scratch grid's outer layer is never smoothed, which corrupts one more
+    // layer per pass; the apron absorbs that, so the chunk and its halo come out exact
+    smooth_cave_iterations(scratch, SMOOTHING_ITERATIONS);
+    
+    for (int z = -1; z <= CHUNK_SIZE; z++) {
+        for (int y = -1; y <= CHUNK_SIZE; y++) {
+            memcpy(&chunk->voxels[cave_index(chunk, -1, y, z)],
+                   &scratch->voxels[cave_index(scratch, CHUNK_APRON - 1, y + CHUNK_APRON, z + CHUNK_APRON)],
+                   CHUNK_SIZE + 2);
+        }
+    }
+    
+    carve_world_chunk(chunk, seed, cx, cy, cz);
+}
+
+// Wall faces of a generated chunk in world units; the halo holds the
+// neighbours' voxels, so faces on the chunk border come out right
+static VoxelMeshData* mesh_world_chunk(const Cave* cave, int cx, int cy, int cz) {
+    VoxelMeshData* data = (VoxelMeshData*)calloc(1, sizeof(VoxelMeshData));
+    const int lo[3] = { 0, 0, 0 };
+    const int hi[3] = { CHUNK_SIZE - 1, CHUNK_SIZE - 1, CHUNK_SIZE - 1 };
+    const float origin[3] = {
+        cx * CHUNK_SIZE * WORLD_VOXEL_SIZE, cy * CHUNK_SIZE * WORLD_VOXEL_SIZE, cz * CHUNK_SIZE * WORLD_VOXEL_SIZE
+    };
+    const float scale[3] = { WORLD_VOXEL_SIZE, WORLD_VOXEL_SIZE, WORLD_VOXEL_SIZE };
+    
+    mesh_voxels(data, cave, lo, hi, origin, scale);
+    return data;
+}
+
+static void free_chunk_mesh_data(Chunk* chunk) {
+    if (chunk->mesh_data) {
+        free_voxel_mesh_data(chunk->mesh_data);
+        free(chunk->mesh_data);
+        chunk->mesh_data = NULL;
+    }
+}
+
+// Ring slot of a chunk
+static Chunk* chunk_slot(const World* world, int cx, int cy, int cz) {
+    int s = world->span;
+    return &world->chunks[((size_t)floor_mod(cz, s) * s + floor_mod(cy, s)) * s + floor_mod(cx, s)];
+}
+
+static int chunk_is(const Chunk* chunk, int cx, int cy, int cz) {
+    return chunk->cx == cx && chunk->cy == cy && chunk->cz == cz;
+}
+
+// Caller holds the world lock
+static void recycle_cave(World* world, Cave* cave) {
+    if (world->free_count < world->free_capacity) {
+        world->free_caves[world->free_count++] = cave;
+    } else {
+        free_cave(cave);
+    }
+}
+
+// Caller holds the world lock. A worker still generating the old chunk will
+// see the new ticket and throw its result away.
+static void evict_chunk(World* world, Chunk* chunk) {
+    if (chunk->state != CHUNK_EMPTY) {
+        world->evicted_count++;
+    }
+    if (chunk->live) {
+        world->live_count--;
+        chunk->live = NULL;
+    }
+    if (chunk->cave) {
+        recycle_cave(world, chunk->cave);
+        chunk->cave = NULL;
+    }
+    free_chunk_mesh_data(chunk);
+    chunk->mesh.index_count = 0;
+    chunk->mesh_uploaded = 0;
+    chunk->state = CHUNK_EMPTY;
+    chunk->ticket++;
+}
+
+// Queued chunk closest to the camera; caller holds the world lock
+static Chunk* next_queued_chunk(World* world) {
+    Chunk* best = NULL;
+    int best_distance = INT_MAX;
+    int count = world->span * world->span * world->span;
+    
+    for (int i = 0; i < count; i++) {
+        Chunk* chunk = &world->chunks[i];
+        if (chunk->state == CHUNK_QUEUED) {
+            int dx = chunk->cx - world->center[0];
+            int dy = chunk->cy - world->center[1];
+            int dz = chunk->cz - world->center[2];
+            int distance = dx * dx + dy * dy + dz * dz;
+            if (distance < best_distance) {
+                best = chunk;
+                best_distance = distance;
+            }
+        }
+    }
+    return best;
+}
+
+static void* stream_worker_main(void* arg) {
+    World* world = (World*)arg;
+    Cave* scratch = create_cave(CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE);
+    
+    // Chunks are small; smoothing them on this thread keeps the pool free
+    // for the frame thread
+    parallel_detach_thread();
+    
+    pthread_mutex_lock(&world->lock);
+    for (;;) {
+        Chunk* chunk = NULL;
+        while (!world->shutting_down && !(chunk = next_queued_chunk(world))) {
+            pthread_cond_wait(&world->work_cond, &world->lock);
+        }
+        if (world->shutting_down) break;
+        
+        chunk->state = CHUNK_GENERATING;
+        unsigned int ticket = chunk->ticket;
+        int cx = chunk->cx, cy = chunk->cy, cz = chunk->cz;
+        Cave* cave = world->free_count > 0 ? world->free_caves[--world->free_count] : NULL;
+        pthread_mutex_unlock(&world->lock);
+        
+        if (!cave) {
+            cave = create_cave(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+        }
+        generate_world_chunk(cave, scratch, world->seed, cx, cy, cz);
+        VoxelMeshData* mesh_data = mesh_world_chunk(cave, cx, cy, cz);
+        
+        pthread_mutex_lock(&world->lock);
+        if (chunk->ticket == ticket) {
+            chunk->cave = cave;
+            chunk->mesh_data = mesh_data;
+            chunk->state = CHUNK_READY;
+            world->generated_count++;
+        } else {
+            recycle_cave(world, cave);
+            free_voxel_mesh_data(mesh_data);
+            free(mesh_data);
+        }
+    }
+    pthread_mutex_unlock(&world->lock);
+    
+    free_cave(scratch);
+    return NULL;
+}
+
+World* create_world(uint64_t seed, int radius) {
+    World* world = (World*)calloc(1, sizeof(World));
+    world->seed = seed;
+    world->radius = radius;
+    world->span = 2 * radius + 1;
+    
+    int slot_count = world->span * world->span * world->span;
+    world->chunks = (Chunk*)calloc(slot_count, sizeof(Chunk));
+    
+    // Leave one CPU to the frame thread where there is one to spare
+    world->worker_count = parallel_thread_count() > 1 ? parallel_thread_count() - 1 : 1;
+    world->free_capacity = slot_count + world->worker_count;
+    world->free_caves = (Cave**)malloc(world->free_capacity * sizeof(Cave*));
+    
+    pthread_mutex_init(&world->lock, NULL);
+    pthread_cond_init(&world->work_cond, NULL);
+    
+    world->workers = (pthread_t*)malloc(world->worker_count * sizeof(pthread_t));
+    for (int i = 0; i < world->worker_count; i++) {
+        if (pthread_create(&world->workers[i], NULL, stream_worker_main, world) != 0) {
+            fprintf(stderr, "Failed to start chunk stream thread %d\n", i);
+            exit(1);
+        }
+    }
+    
+    return world;
+}
+
+void free_world(World* world) {
+    if (!world) return;
+    
+    pthread_mutex_lock(&world->lock);
+    world->shutting_down = 1;
+    pthread_cond_broadcast(&world->work_cond);
+    pthread_mutex_unlock(&world->lock);
+    
+    for (int i = 0; i < world->worker_count; i++) {
+        pthread_join(world->workers[i], NULL);
+    }
+    
+    int slot_count = world->span * world->span * world->span;
+    for (int i = 0; i < slot_count; i++) {
+        if (world->chunks[i].cave) free_cave(world->chunks[i].cave);
+        free_chunk_mesh_data(&world->chunks[i]);
+        release_voxel_mesh(&world->chunks[i].mesh);
+    }
+    for (int i = 0; i < world->free_count; i++) {
+        free_cave(world->free_caves[i]);
+    }
+    
+    pthread_mutex_destroy(&world->lock);
+    pthread_cond_destroy(&world->work_cond);
+    free(world->workers);
+    free(world->free_caves);
+    free(world->chunks);
+    free(world);
+}
+
+void update_world(World* world, float x, float y, float z) {
+    int center[3] = {
+        floor_div(world_voxel_coord(x), CHUNK_SIZE),
+        floor_div(world_voxel_coord(y), CHUNK_SIZE),
+        floor_div(world_voxel_coord(z), CHUNK_SIZE)
+    };
+    int span = world->span;
+    
+    pthread_mutex_lock(&world->lock);
+    
+    if (!world->centered || center[0] != world->center[0] ||
+        center[1] != world->center[1] || center[2] != world->center[2]) {
+        memcpy(world->center, center, sizeof(center));
+        world->centered = 1;
+        
+        // Each slot holds the one chunk of the window that maps onto it
+        int low[3] = { center[0] - world->radius, center[1] - world->radius, center[2] - world->radius };
+        int queued = 0;
+        for (int sz = 0; sz < span; sz++) {
+            int cz = low[2] + floor_mod(sz - low[2], span);
+            for (int sy = 0; sy < span; sy++) {
+                int cy = low[1] + floor_mod(sy - low[1], span);
+                for (int sx = 0; sx < span; sx++) {
+                    int cx = low[0] + floor_mod(sx - low[0], span);
+                    Chunk* chunk = &world->chunks[((size_t)sz * span + sy) * span + sx];
+                    
+                    if (chunk->state != CHUNK_EMPTY && chunk_is(chunk, cx, cy, cz)) continue;
+                    
+                    evict_chunk(world, chunk);
+                    chunk->cx = cx;
+                    chunk->cy = cy;
+                    chunk->cz = cz;
+                    chunk->state = CHUNK_QUEUED;
+                    queued++;
+                }
+            }
+        }
+        
+        if (queued > 0) {
+            pthread_cond_broadcast(&world->work_cond);
+        }
+    }
+    
+    // Publish finished chunks to the main thread
+    int slot_count = span * span * span;
+    for (int i = 0; i < slot_count; i++) {
+        Chunk* chunk = &world->chunks[i];
+        if (chunk->state == CHUNK_READY && !chunk->live) {
+            chunk->live = chunk->cave;
+            world->live_count++;
+        }
+    }
+    
+    pthread_mutex_unlock(&world->lock);
+}
+
+int world_get_voxel(const World* world, int x, int y, int z) {
+    int cx = floor_div(x, CHUNK_SIZE);
+    int cy = floor_div(y, CHUNK_SIZE);
+    int cz = floor_div(z, CHUNK_SIZE);
+    const Chunk* chunk = chunk_slot(world, cx, cy, cz);
+    
+    if (!chunk->live || !chunk_is(chunk, cx, cy, cz)) {
+        return VOXEL_WALL;
+    }
+    return cave_get(chunk->live, x - cx * CHUNK_SIZE, y - cy * CHUNK_SIZE, z - cz * CHUNK_SIZE);
+}
+
+int world_collides(const World* world, float x, float y, float z, float radius) {
+    int cx = world_voxel_coord(x);
+    int cy = world_voxel_coord(y);
+    int cz = world_voxel_coord(z);
+    int check_radius = (int)(radius / WORLD_VOXEL_SIZE) + 1;
+    
+    for (int dz = -check_radius; dz <= check_radius; dz++) {
+        for (int dy = -check_radius; dy <= check_radius; dy++) {
+            for (int dx = -check_radius; dx <= check_radius; dx++) {
+                if (world_get_voxel(world, cx + dx, cy + dy, cz + dz) == VOXEL_WALL) {
+                    float wx = (cx + dx) * WORLD_VOXEL_SIZE - x;
+                    float wy = (cy + dy) * WORLD_VOXEL_SIZE - y;
+                    float wz = (cz + dz) * WORLD_VOXEL_SIZE - z;
+                    if (wx * wx + wy * wy + wz * wz < radius * radius) {
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
+
+void world_find_spawn_point(World* world, float* x, float* y, float* z) {
+    ChunkNode node = chunk_node(world->seed, 0, 0, 0);
+    Chunk* chunk = chunk_slot(world, 0, 0, 0);
+    
+    // The spawn chunk is needed right away, so build it here and let the
+    // stream workers fill in the rest
+    pthread_mutex_lock(&world->lock);
+    int loaded = chunk->live && chunk_is(chunk, 0, 0, 0);
+    if (!loaded) {
+        evict_chunk(world, chunk);
+        chunk->cx = chunk->cy = chunk->cz = 0;
+        chunk->state = CHUNK_GENERATING;
+    }
+    pthread_mutex_unlock(&world->lock);
+    
+    if (!loaded) {
+        Cave* cave = create_cave(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+        Cave* scratch = create_cave(CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE, CHUNK_SCRATCH_SIZE);
+        generate_world_chunk(cave, scratch, world->seed, 0, 0, 0);
+        free_cave(scratch);
+        VoxelMeshData* mesh_data = mesh_world_chunk(cave, 0, 0, 0);
+        
+        pthread_mutex_lock(&world->lock);
+        chunk->cave = cave;
+        chunk->mesh_data = mesh_data;
+        chunk->live = cave;
+        chunk->state = CHUNK_READY;
+        world->live_count++;
+        world->generated_count++;
+        pthread_mutex_unlock(&world->lock);
+    }
+    
+    *x = node.pos[0] * WORLD_VOXEL_SIZE;
+    *y = node.pos[1] * WORLD_VOXEL_SIZE;
+    *z = node.pos[2] * WORLD_VOXEL_SIZE;
+}
+
+void render_world_interior(World* world, const Frustum* frustum, CullCounter* counter) {
+    int slot_count = world->span * world->span * world->span;
+    int uploads = 0;
+    
+    for (int i = 0; i < slot_count; i++) {
+        Chunk* chunk = &world->chunks[i];
+        if (!chunk->live) continue;
+        
+        // Spread uploads of newly streamed chunks over frames; the rest
+        // already sit in their buffers
+        if (!chunk->mesh_uploaded) {
+            if (uploads == WORLD_MESH_UPLOADS) continue;
+            upload_voxel_mesh(&chunk->mesh, chunk->mesh_data);
+            free_chunk_mesh_data(chunk);
+            chunk->mesh_uploaded = 1;
+            uploads++;
+        }
+        
+        cull_voxel_mesh(&chunk->mesh, frustum, counter);
+    }
+}
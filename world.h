@@ -0,0 +1,90 @@
+/*
+ * world.h - Infinite Streaming Cave World
+ * The world is cut into cubic chunks that stream in on background threads
+ * in a ring around the camera and are evicted once they fall outside it.
+ * Every voxel is a pure function of the seed and its world coordinates, so
+ * chunk borders line up exactly no matter which order chunks load in.
+ */
+
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "cave.h"
+#include "voxmesh.h"
+#include <pthread.h>
+
+#define CHUNK_SIZE 32               // Voxels per chunk edge
+#define WORLD_VOXEL_SIZE 0.1f       // World units per voxel
+#define WORLD_VIEW_RADIUS 3         // Chunks kept loaded on each side of the camera
+
+// Voxels of neighbouring chunks needed to smooth a chunk exactly: each CA pass
+// can pull in one more voxel, plus one for the chunk's halo
+#define CHUNK_APRON (SMOOTHING_ITERATIONS + 1)
+#define CHUNK_SCRATCH_SIZE (CHUNK_SIZE + 2 * CHUNK_APRON)
+
+typedef enum {
+    CHUNK_EMPTY,        // Slot holds nothing
+    CHUNK_QUEUED,       // Waiting for a stream worker
+    CHUNK_GENERATING,   // A stream worker is filling it
+    CHUNK_READY         // Generated; the main thread has to pick it up
+} ChunkState;
+
+// One slot of the ring. A chunk lives in the slot given by its coordinates
+// modulo the ring span, so the ring never grows as the camera moves.
+typedef struct {
+    int cx, cy, cz;         // Chunk coordinates the slot is assigned to
+    ChunkState state;       // Guarded by the world lock
+    unsigned int ticket;    // Bumped on every reassignment; stale results are dropped
+    Cave* cave;             // CHUNK_SIZE^3 voxels; the halo holds the neighbours' voxels
+    Cave* live;             // Main thread only: cave once it is safe to read
+    VoxelMeshData* mesh_data;   // Wall faces, built with the cave; the main thread owns it once live
+    VoxelMesh mesh;         // Main thread only: GPU copy of mesh_data, buffers reused across chunks
+    int mesh_uploaded;      // Main thread only
+} Chunk;
+
+typedef struct {
+    uint64_t seed;
+    int radius;             // View radius in chunks
+    int span;               // 2 * radius + 1
+    Chunk* chunks;          // span^3 slots
+    int center[3];          // Chunk the camera is in
+    int centered;           // 0 until the first update_world
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_t* workers;
+    int worker_count;
+    int shutting_down;
+    Cave** free_caves;      // Recycled chunk grids
+    int free_count;
+    int free_capacity;
+
+    int live_count;         // Chunks the main thread can read
+    uint64_t generated_count;
+    uint64_t evicted_count;
+} World;
+
+World* create_world(uint64_t seed, int radius);
+void free_world(World* world);
+
+// Recentre the ring on a world position: evicts chunks that left it, queues
+// the new ones nearest first and picks up finished ones. Never blocks on
+// generation.
+void update_world(World* world, float x, float y, float z);
+
+// Voxel at world voxel coordinates; anything not loaded yet reads as wall
+int world_get_voxel(const World* world, int x, int y, int z);
+int world_collides(const World* world, float x, float y, float z, float radius);
+
+// Centre of the spawn chamber; generates the chunk around it on the spot
+void world_find_spawn_point(World* world, float* x, float* y, float* z);
+
+// Draw the loaded chunks inside the frustum with the voxel pass already
+// bound, uploading a few freshly streamed meshes first
+void render_world_interior(World* world, const Frustum* frustum, CullCounter* counter);
+
+// Generate chunk (cx, cy, cz) into chunk (a CHUNK_SIZE^3 cave) using scratch
+// (a CHUNK_SCRATCH_SIZE^3 cave)
+void generate_world_chunk(Cave* chunk, Cave* scratch, uint64_t seed, int cx, int cy, int cz);
+
+#endif // WORLD_H